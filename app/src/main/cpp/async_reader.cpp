@@ -0,0 +1,391 @@
+#include "async_reader.h"
+#include "block_reader.h"
+#include "scan_stats.h"
+#include <android/log.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+// The same numbers on every architecture; older NDK headers lack them
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define LOG_TAG "AsyncReader"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const size_t kMaxPoolThreads = 8;
+
+// One request of a span; short reads are resubmitted for the rest
+struct Piece {
+    uint64_t offset;
+    uint8_t* data;
+    size_t length;
+    size_t done;
+    int error;
+    bool ended;   // End of file or failed; nothing after it counts
+    iovec iov;    // Kept alive for READV until the request completes
+};
+
+std::vector<Piece> cutSpan(uint8_t* buffer, size_t length, uint64_t offset, size_t requestBytes) {
+    std::vector<Piece> pieces;
+    for (size_t at = 0; at < length; at += requestBytes) {
+        pieces.push_back({offset + at, buffer + at, std::min(requestBytes, length - at), 0, 0, false, {}});
+    }
+    return pieces;
+}
+
+// Bytes read from the start of the span up to the first piece that came up short
+size_t contiguousBytes(const std::vector<Piece>& pieces) {
+    size_t total = 0;
+    errno = 0;
+    for (const auto& piece : pieces) {
+        total += piece.done;
+        if (piece.done < piece.length) {
+            errno = piece.error;
+            break;
+        }
+    }
+    return total;
+}
+
+#if HAVE_IO_URING
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int ringFd, unsigned opcode, const void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ringFd, opcode, arg, count));
+}
+#endif
+
+} // namespace
+
+#if HAVE_IO_URING
+
+// Submission and completion queues shared with the kernel
+struct AsyncReader::Ring {
+    int fd = -1;
+    void* sqMap = MAP_FAILED;
+    size_t sqMapSize = 0;
+    void* cqMap = MAP_FAILED;
+    size_t cqMapSize = 0;
+    void* sqeMap = MAP_FAILED;
+    size_t sqeMapSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned entries = 0;
+
+    std::vector<iovec> fixed; // Registered buffers, by buf_index
+
+    ~Ring() {
+        if (sqeMap != MAP_FAILED) munmap(sqeMap, sqeMapSize);
+        if (cqMap != MAP_FAILED) munmap(cqMap, cqMapSize);
+        if (sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+        if (fd >= 0) ::close(fd); // Also drops the registered buffers
+    }
+
+    bool setup(unsigned wanted) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = ioUringSetup(wanted, &params);
+        if (fd < 0) {
+            return false;
+        }
+
+        sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqeMapSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqeMap = mmap(nullptr, sqeMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqMap == MAP_FAILED || cqMap == MAP_FAILED || sqeMap == MAP_FAILED) {
+            return false;
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(sqMap);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+
+        uint8_t* cq = static_cast<uint8_t*>(cqMap);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        entries = params.sq_entries;
+        return true;
+    }
+
+    void registerBuffers(const std::vector<iovec>& buffers) {
+        if (buffers.empty()) return;
+        if (ioUringRegister(fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(buffers.size())) == 0) {
+            fixed = buffers;
+        } else {
+            // Usually RLIMIT_MEMLOCK; plain reads still work
+            LOGI("Cannot register %zu read buffers: %s", buffers.size(), strerror(errno));
+        }
+    }
+
+    int fixedIndex(const uint8_t* data, size_t length) const {
+        for (size_t i = 0; i < fixed.size(); ++i) {
+            const uint8_t* base = static_cast<const uint8_t*>(fixed[i].iov_base);
+            if (data >= base && data + length <= base + fixed[i].iov_len) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    // Queues a read of what is left of the piece; the caller keeps it in flight below entries
+    void queue(int sourceFd, Piece& piece, uint64_t tag) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+
+        uint8_t* data = piece.data + piece.done;
+        size_t length = piece.length - piece.done;
+        int bufferIndex = fixedIndex(data, length);
+        sqe.fd = sourceFd;
+        sqe.off = piece.offset + piece.done;
+        if (bufferIndex >= 0) {
+            sqe.opcode = IORING_OP_READ_FIXED;
+            sqe.addr = reinterpret_cast<uint64_t>(data);
+            sqe.len = static_cast<uint32_t>(length);
+            sqe.buf_index = static_cast<uint16_t>(bufferIndex);
+        } else {
+            // READV rather than READ, which needs 5.6
+            piece.iov.iov_base = data;
+            piece.iov.iov_len = length;
+            sqe.opcode = IORING_OP_READV;
+            sqe.addr = reinterpret_cast<uint64_t>(&piece.iov);
+            sqe.len = 1;
+        }
+        sqe.user_data = tag;
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Hands queued requests to the kernel and waits for at least one completion
+    bool submitAndWait(unsigned toSubmit) {
+        while (true) {
+            int submitted = ioUringEnter(fd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+            if (submitted >= 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    template <typename Visitor>
+    void reap(Visitor visitor) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            visitor(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+#else
+
+struct AsyncReader::Ring {
+};
+
+#endif
+
+AsyncReader::AsyncReader() : fd_(-1), backend_(Backend::Auto) {
+}
+
+AsyncReader::~AsyncReader() {
+    close();
+}
+
+bool AsyncReader::open(int fd, const Options& options, const std::vector<iovec>& fixedBuffers) {
+    close();
+    if (fd < 0) {
+        return false;
+    }
+
+    fd_ = fd;
+    options_ = options;
+    options_.queueDepth = std::max<size_t>(options_.queueDepth, 1);
+    options_.requestBytes = std::max<size_t>(options_.requestBytes, 4096);
+
+#if HAVE_IO_URING
+    if (options_.backend != Backend::PreadPool) {
+        std::unique_ptr<Ring> ring(new Ring());
+        if (ring->setup(static_cast<unsigned>(options_.queueDepth))) {
+            ring->registerBuffers(fixedBuffers);
+            options_.queueDepth = std::min<size_t>(options_.queueDepth, ring->entries);
+            ring_ = std::move(ring);
+            backend_ = Backend::IoUring;
+            return true;
+        }
+        if (options_.backend == Backend::IoUring) {
+            LOGE("io_uring unavailable: %s", strerror(errno));
+            fd_ = -1;
+            return false;
+        }
+    }
+#else
+    (void)fixedBuffers;
+    if (options_.backend == Backend::IoUring) {
+        fd_ = -1;
+        return false;
+    }
+#endif
+
+    pool_.reset(new ThreadPool(std::min(options_.queueDepth, kMaxPoolThreads)));
+    backend_ = Backend::PreadPool;
+    return true;
+}
+
+void AsyncReader::close() {
+    ring_.reset();
+    pool_.reset();
+    fd_ = -1;
+    backend_ = Backend::Auto;
+}
+
+size_t AsyncReader::read(uint8_t* buffer, size_t length, uint64_t offset) {
+    if (fd_ < 0 || !buffer) {
+        errno = EBADF;
+        return 0;
+    }
+    if (length <= options_.requestBytes || (!ring_ && !pool_)) {
+        // A single request gains nothing from the queue
+        errno = 0;
+        return BlockReader::readFully(fd_, buffer, length, offset);
+    }
+    return ring_ ? readRing(buffer, length, offset) : readPool(buffer, length, offset);
+}
+
+size_t AsyncReader::readRing(uint8_t* buffer, size_t length, uint64_t offset) {
+#if HAVE_IO_URING
+    std::vector<Piece> pieces = cutSpan(buffer, length, offset, options_.requestBytes);
+    std::vector<size_t> retry;
+    size_t next = 0;
+    size_t inFlight = 0;
+    // First piece that failed or hit the end of the source. Pieces after it
+    // no longer count, but earlier ones still finish their short reads.
+    size_t endedAt = pieces.size();
+
+    while (true) {
+        unsigned queued = 0;
+        while (inFlight < options_.queueDepth && (!retry.empty() || next < endedAt)) {
+            size_t index;
+            if (!retry.empty()) {
+                index = retry.back();
+                retry.pop_back();
+                if (index >= endedAt) continue;
+            } else {
+                index = next++;
+            }
+            ring_->queue(fd_, pieces[index], index);
+            queued++;
+            inFlight++;
+        }
+        if (inFlight == 0) break;
+
+        if (!ring_->submitAndWait(queued)) {
+            // The ring itself broke; finish this span with plain reads
+            LOGE("io_uring_enter failed: %s", strerror(errno));
+            ring_.reset();
+            pool_.reset(new ThreadPool(std::min(options_.queueDepth, kMaxPoolThreads)));
+            backend_ = Backend::PreadPool;
+            return readPool(buffer, length, offset);
+        }
+
+        ring_->reap([&](uint64_t tag, int result) {
+            Piece& piece = pieces[tag];
+            inFlight--;
+            if (result == -EINTR || result == -EAGAIN) {
+                retry.push_back(tag);
+            } else if (result < 0) {
+                piece.error = -result;
+                piece.ended = true;
+                endedAt = std::min<size_t>(endedAt, tag);
+            } else if (result == 0) {
+                piece.ended = true;
+                endedAt = std::min<size_t>(endedAt, tag);
+            } else {
+                piece.done += static_cast<size_t>(result);
+                ScanStats::add(kStatReadCalls, 1);
+                ScanStats::add(kStatBytesRead, static_cast<uint64_t>(result));
+                if (piece.done < piece.length) retry.push_back(tag);
+            }
+        });
+    }
+
+    return contiguousBytes(pieces);
+#else
+    return readPool(buffer, length, offset);
+#endif
+}
+
+size_t AsyncReader::readPool(uint8_t* buffer, size_t length, uint64_t offset) {
+    std::vector<Piece> pieces = cutSpan(buffer, length, offset, options_.requestBytes);
+    for (auto& piece : pieces) {
+        Piece* target = &piece;
+        pool_->submit([this, target] {
+            errno = 0;
+            target->done = BlockReader::readFully(fd_, target->data, target->length, target->offset);
+            target->error = target->done < target->length ? errno : 0;
+        });
+    }
+    pool_->wait();
+    return contiguousBytes(pieces);
+}
+
+const char* AsyncReader::backendName(Backend backend) {
+    switch (backend) {
+        case Backend::IoUring: return "io_uring";
+        case Backend::PreadPool: return "pread-pool";
+        default: return "auto";
+    }
+}
+
+bool AsyncReader::ioUringAvailable() {
+#if HAVE_IO_URING
+    // Kernels before 5.1 answer ENOSYS; seccomp or io_uring_disabled answer EPERM
+    static const bool available = [] {
+        Ring probe;
+        return probe.setup(1);
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,63 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include "thread_pool.h"
+#include <sys/uio.h>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Reads one span of a file as many requests in flight at once, which flash
+// storage needs to reach its bandwidth. Uses io_uring where the kernel and
+// seccomp policy allow it, with buffers registered up front read through
+// READ_FIXED; otherwise a pool of threads each issuing pread. One read()
+// at a time per reader.
+class AsyncReader {
+public:
+    enum class Backend {
+        Auto,      // io_uring if available, else the pread pool
+        IoUring,
+        PreadPool
+    };
+
+    struct Options {
+        Backend backend = Backend::Auto;
+        size_t queueDepth = 16;          // Requests in flight; pool threads for the fallback
+        size_t requestBytes = 256 * 1024; // Span cut into requests of this size; keep it 4 KiB aligned for O_DIRECT
+    };
+
+    AsyncReader();
+    ~AsyncReader();
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    // fd stays owned by the caller. Reads landing inside one of fixedBuffers
+    // skip the per-request page pinning io_uring otherwise does.
+    bool open(int fd, const Options& options, const std::vector<iovec>& fixedBuffers = {});
+    void close();
+
+    // Same contract as BlockReader::readFully: bytes read from offset on,
+    // short only at end of file or on error, in which case errno is set
+    size_t read(uint8_t* buffer, size_t length, uint64_t offset);
+
+    bool isOpen() const { return fd_ >= 0; }
+    Backend backend() const { return backend_; }
+    static const char* backendName(Backend backend);
+    static bool ioUringAvailable();
+
+private:
+    struct Ring; // io_uring queues, only in the .cpp
+
+    size_t readRing(uint8_t* buffer, size_t length, uint64_t offset);
+    size_t readPool(uint8_t* buffer, size_t length, uint64_t offset);
+
+    int fd_;
+    Options options_;
+    Backend backend_;
+    std::unique_ptr<Ring> ring_;
+    std::unique_ptr<ThreadPool> pool_;
+};
+
+#endif // ASYNC_READER_H
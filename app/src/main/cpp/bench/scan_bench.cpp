@@ -0,0 +1,499 @@
+// Host micro-benchmarks for the native scanning kernels.
+//
+// Every result is one JSON object per line on stdout, keyed by benchmark and
+// input, so runs from two commits can be joined and compared line by line:
+//
+//   scan_bench [--quick] [--filter SUBSTRING] [--threads N] [--queue-depth N] [--direct]
+//              [--memory-budget MIB] [--tmp DIR] [--image PATH]...
+//
+// readSource compares the read backends on the same file; --direct opens it
+// with O_DIRECT so a device or image on real storage is read past the page
+// cache (tmpfs refuses O_DIRECT, and the buffered numbers are kept then).
+// --memory-budget caps native buffers as on a low-RAM phone, spilling to the
+// work directory; every line reports the peak the workload held.
+//
+// Synthetic inputs plant a fixed number of complete JPEG and PDF files per
+// MiB over background bytes that cannot start any known signature, so the
+// hit density is exactly what the input name says. The trimmed inputs zero
+// most 4 KiB blocks that hold no planted file, as TRIM leaves a phone's flash.
+
+#include "file_recovery_engine.h"
+#include "file_scanner.h"
+#include "hit_arena.h"
+#include "async_reader.h"
+#include "block_reader.h"
+#include "block_classifier.h"
+#include "memory_budget.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t kMiB = 1024 * 1024;
+
+struct BenchConfig {
+    bool quick = false;
+    std::string filter;
+    size_t threads = 0;
+    size_t queueDepth = 16;
+    bool directIo = false;
+    size_t memoryBudget = 0; // Bytes, 0 for no limit
+    std::string tmpRoot = "/tmp";
+    std::vector<std::string> images;
+};
+
+// One timed measurement: `ops` calls covering `bytes` bytes per iteration
+struct Workload {
+    std::string benchmark;
+    std::string input;
+    uint64_t bytes;
+    uint64_t ops;
+    std::function<uint64_t()> run; // Returns the hit count, which is also reported
+};
+
+uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// xorshift64*: fast and reproducible, so every commit benchmarks the same bytes
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed ? seed : 1) {}
+
+    uint64_t next() {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545F4914F6CDD1DULL;
+    }
+
+private:
+    uint64_t state_;
+};
+
+// Control bytes 0x00-0x1F never begin a signature the engine knows. They
+// also hold no 0xFF (MP3 frame syncs, JPEG markers) and no digits, which a
+// PDF trailer would take for an incremental update.
+void fillBackground(uint8_t* data, size_t size, Random& random) {
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<uint8_t>(random.next() & 0x1F);
+    }
+}
+
+// Planted files carry their number so none is a duplicate of another
+std::vector<uint8_t> tinyJpeg(uint32_t id) {
+    std::vector<uint8_t> jpeg = {
+            0xFF, 0xD8,                                                      // SOI
+            0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+            0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x00, 0x10, 0x00, 0x10, 0x01, 0x01, 0x11, 0x00, // SOF0
+            0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00,     // SOS
+    };
+    for (int i = 0; i < 64; ++i) jpeg.push_back(static_cast<uint8_t>(0x10 + (i & 0x1F))); // Entropy data
+    for (int i = 0; i < 8; ++i) jpeg[jpeg.size() - 64 + i] = static_cast<uint8_t>(0x10 + ((id >> (4 * i)) & 0xF));
+    jpeg.push_back(0xFF);
+    jpeg.push_back(0xD9); // EOI
+    return jpeg;
+}
+
+std::vector<uint8_t> tinyPdf(uint32_t id) {
+    // The number is spelled in letters: digits would read as object numbers
+    std::string name;
+    for (int i = 0; i < 8; ++i) name += static_cast<char>('a' + ((id >> (4 * i)) & 0xF));
+    std::string pdf = "%PDF-1.4\n1 0 obj\n<</Id /" + name + ">>\nendobj\ntrailer\n<<>>\nstartxref\n9\n%%EOF\n";
+    return std::vector<uint8_t>(pdf.begin(), pdf.end());
+}
+
+// Background bytes with `perMiB` complete files spread evenly through each MiB
+std::vector<uint8_t> makeSyntheticImage(size_t size, size_t perMiB, uint64_t seed) {
+    std::vector<uint8_t> data(size);
+    Random random(seed);
+    fillBackground(data.data(), data.size(), random);
+    if (perMiB == 0) return data;
+
+    size_t spacing = kMiB / perMiB;
+    uint32_t planted = 0;
+    for (size_t offset = 0; offset + spacing <= size; offset += spacing, ++planted) {
+        std::vector<uint8_t> sample = planted % 2 == 0 ? tinyJpeg(planted) : tinyPdf(planted);
+        if (sample.size() > spacing) break;
+        // Sector-aligned start, as on a real disk
+        size_t at = offset + (random.next() % (spacing - sample.size() + 1)) / 512 * 512;
+        std::copy(sample.begin(), sample.end(), data.begin() + at);
+    }
+    return data;
+}
+
+// Zeroes seven in eight of the blocks holding only background; background
+// bytes are all below 0x20, so a block with any higher byte holds a planted file
+void trimImage(std::vector<uint8_t>& data, uint64_t seed) {
+    const size_t kBlock = BlockClassifier::kBlockSize;
+    Random random(seed);
+    for (size_t offset = 0; offset + kBlock <= data.size(); offset += kBlock) {
+        auto block = data.begin() + static_cast<std::ptrdiff_t>(offset);
+        bool planted = std::any_of(block, block + kBlock, [](uint8_t b) { return b >= 0x20; });
+        if (!planted && random.next() % 8 != 0) {
+            std::fill(block, block + kBlock, 0);
+        }
+    }
+}
+
+bool writeFile(const std::string& path, const uint8_t* data, size_t size) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t written = write(fd, data + done, size - done);
+        if (written <= 0) break;
+        done += static_cast<size_t>(written);
+    }
+    close(fd);
+    return done == size;
+}
+
+int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+void removeTree(const std::string& path) {
+    nftw(path.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+uint64_t fileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+}
+
+} // namespace
+
+// Friend of FileRecoveryEngine, so it can call the private scanning kernels
+class ScanBench {
+public:
+    ScanBench(const BenchConfig& config, const std::string& workDir) : config_(config), workDir_(workDir) {
+        ScanOptions options;
+        options.threads = config.threads;
+        options.queueDepth = config.queueDepth;
+        engine_.setScanOptions(options);
+    }
+
+    void addSignatureBenchmarks() {
+        const size_t densities[] = {0, 64, 1024};
+        for (size_t density : densities) {
+            auto data = std::make_shared<std::vector<uint8_t>>(makeSyntheticImage(kMiB, density, 1 + density));
+            std::string input = "synthetic-1MiB-" + std::to_string(density) + "perMiB";
+            uint64_t windows = data->size() - 15;
+
+            // Every byte offset is a candidate header, as in a naive carver
+            workloads_.push_back({"identifySignature", input, data->size(), windows, [data, windows]() {
+                uint64_t found = 0;
+                for (uint64_t i = 0; i < windows; ++i) {
+                    found += identifySignature(data->data() + i, 16) != UNKNOWN;
+                }
+                return found;
+            }});
+        }
+    }
+
+    // Per-block triage over data and over blank space; hits count the blank blocks
+    void addClassifierBenchmarks() {
+        const size_t kBlock = BlockClassifier::kBlockSize;
+        auto random = std::make_shared<std::vector<uint8_t>>(makeSyntheticImage(kMiB, 0, 3));
+        auto zero = std::make_shared<std::vector<uint8_t>>(kMiB, 0);
+        std::string kernel = BlockClassifier::implementation();
+        const std::pair<std::string, std::shared_ptr<std::vector<uint8_t>>> inputs[] = {
+                {"background-1MiB", random}, {"zero-1MiB", zero}};
+        for (const auto& input : inputs) {
+            auto data = input.second;
+            uint64_t blocks = data->size() / kBlock;
+            workloads_.push_back({"BlockClassifier::isUniform", input.first + "/" + kernel, data->size(), blocks,
+                                  [data, blocks]() {
+                uint64_t blank = 0;
+                for (uint64_t i = 0; i < blocks; ++i) {
+                    blank += BlockClassifier::isUniform(data->data() + i * kBlock, kBlock);
+                }
+                return blank;
+            }});
+            workloads_.push_back({"BlockClassifier::classify", input.first, data->size(), blocks, [data, blocks]() {
+                uint64_t blank = 0;
+                for (uint64_t i = 0; i < blocks; ++i) {
+                    blank += BlockClassifier::classify(data->data() + i * kBlock, kBlock).blank();
+                }
+                return blank;
+            }});
+        }
+    }
+
+    bool addCarveBenchmarks() {
+        const size_t densities[] = {0, 16, 256};
+        size_t imageSize = (config_.quick ? 8 : 64) * kMiB;
+        for (size_t density : densities) {
+            std::string path = workDir_ + "/image-" + std::to_string(density) + ".bin";
+            std::vector<uint8_t> data = makeSyntheticImage(imageSize, density, 100 + density);
+            if (!writeFile(path, data.data(), data.size())) {
+                fprintf(stderr, "Cannot write %s\n", path.c_str());
+                return false;
+            }
+            std::string input = "synthetic-" + std::to_string(imageSize / kMiB) + "MiB-" +
+                                std::to_string(density) + "perMiB";
+            addCarveBenchmark(input, path, data.size());
+            if (density == 0) {
+                addReadBenchmarks(input, path, data.size());
+            }
+            if (density == 16) {
+                trimImage(data, 200 + density);
+                path = workDir_ + "/trimmed-" + std::to_string(density) + ".bin";
+                if (!writeFile(path, data.data(), data.size())) {
+                    fprintf(stderr, "Cannot write %s\n", path.c_str());
+                    return false;
+                }
+                addCarveBenchmark("trimmed-" + input.substr(input.find('-') + 1), path, data.size());
+            }
+        }
+        for (const auto& image : config_.images) {
+            addCarveBenchmark(image, image, fileSize(image));
+            addReadBenchmarks(image, image, fileSize(image));
+        }
+        return true;
+    }
+
+    bool addFileBenchmarks() {
+        // A tree of small files fanned out like a camera roll: dirs of subdirs of files
+        size_t fileCount = config_.quick ? 2000 : 20000;
+        std::string tree = workDir_ + "/tree";
+        const size_t kFanout = 16;
+        const size_t kCorruptPerThousand = 100;
+        std::vector<std::string> files;
+        std::vector<uint8_t> content(4096);
+        Random random(7);
+        mkdir(tree.c_str(), 0755);
+        for (size_t i = 0; i < fileCount; ++i) {
+            std::string dir = tree + "/d" + std::to_string(i % kFanout);
+            std::string sub = dir + "/s" + std::to_string((i / kFanout) % kFanout);
+            mkdir(dir.c_str(), 0755);
+            mkdir(sub.c_str(), 0755);
+
+            fillBackground(content.data(), content.size(), random);
+            if (i % 1000 < kCorruptPerThousand) {
+                std::fill(content.begin(), content.begin() + 16, 0); // Zeroed header reads as corrupted
+            }
+            files.push_back(sub + "/f" + std::to_string(i) + ".bin");
+            if (!writeFile(files.back(), content.data(), content.size())) {
+                fprintf(stderr, "Cannot write %s\n", files.back().c_str());
+                return false;
+            }
+        }
+
+        std::string input = "tree-" + std::to_string(fileCount) + "files";
+        workloads_.push_back({"FileScanner::scanDirectory", input, 0, fileCount, [this, tree]() {
+            return static_cast<uint64_t>(fileScanner_.scanDirectory(tree, true).size());
+        }});
+
+        auto paths = std::make_shared<std::vector<std::string>>(std::move(files));
+        input = "files-" + std::to_string(fileCount) + "-" + std::to_string(kCorruptPerThousand) + "per1000corrupt";
+        workloads_.push_back({"isFileCorrupted", input, 0, fileCount, [this, paths]() {
+            uint64_t corrupted = 0;
+            for (const auto& path : *paths) {
+                corrupted += engine_.isFileCorrupted(path.c_str());
+            }
+            return corrupted;
+        }});
+        return true;
+    }
+
+    void runAll() {
+        for (const auto& workload : workloads_) {
+            std::string name = workload.benchmark + "/" + workload.input;
+            if (!config_.filter.empty() && name.find(config_.filter) == std::string::npos) continue;
+            measure(workload);
+        }
+    }
+
+private:
+    void addCarveBenchmark(const std::string& input, const std::string& path, uint64_t size) {
+        workloads_.push_back({"scanForFileSignatures", input, size, 1, [this, path]() {
+            HitArena arena;
+            HitSink sink = [](const HitArena&, size_t, size_t) { return true; };
+            HitBatcher hits(arena, sink, FileRecoveryEngine::kResultBatchSize);
+            engine_.scanForFileSignatures(path.c_str(), hits);
+            hits.flush();
+            return static_cast<uint64_t>(arena.size());
+        }});
+    }
+
+    // The whole source in 4 MiB blocks, as the sequential carver reads it: through
+    // std::ifstream as the old scanners did, one pread per block, and each block
+    // cut into queue-depth requests for the pread pool and for io_uring
+    void addReadBenchmarks(const std::string& input, const std::string& path, uint64_t size) {
+        const size_t kBlock = 4 * kMiB;
+        const uint64_t blocks = (size + kBlock - 1) / kBlock;
+        std::string depth = "-qd" + std::to_string(config_.queueDepth);
+
+        workloads_.push_back({"readSource", input + "/ifstream", size, blocks, [path]() {
+            std::ifstream file(path, std::ios::binary);
+            std::vector<char> buffer(kBlock);
+            uint64_t reads = 0;
+            while (file.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || file.gcount() > 0) {
+                reads++;
+            }
+            return reads;
+        }});
+        workloads_.push_back({"readSource", input + "/pread", size, blocks, [this, path, size]() {
+            return readSource(path, size, nullptr);
+        }});
+
+        AsyncReader::Backend backends[] = {AsyncReader::Backend::PreadPool, AsyncReader::Backend::IoUring};
+        for (AsyncReader::Backend backend : backends) {
+            if (backend == AsyncReader::Backend::IoUring && !AsyncReader::ioUringAvailable()) {
+                fprintf(stderr, "io_uring is unavailable here; skipping its readSource runs\n");
+                continue;
+            }
+            AsyncReader::Options options;
+            options.backend = backend;
+            options.queueDepth = config_.queueDepth;
+            options.requestBytes = std::max<size_t>(kBlock / config_.queueDepth, 64 * 1024) & ~size_t(4095);
+            workloads_.push_back({"readSource", input + "/" + AsyncReader::backendName(backend) + depth, size,
+                                  blocks, [this, path, size, options]() {
+                return readSource(path, size, &options);
+            }});
+        }
+    }
+
+    uint64_t readSource(const std::string& path, uint64_t size, const AsyncReader::Options* asyncOptions) {
+        const size_t kBlock = 4 * kMiB;
+        int fd = -1;
+        if (config_.directIo) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (fd < 0) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+
+        void* memory = nullptr;
+        if (posix_memalign(&memory, 4096, kBlock) != 0) {
+            close(fd);
+            return 0;
+        }
+        uint8_t* buffer = static_cast<uint8_t*>(memory);
+
+        AsyncReader reader;
+        if (asyncOptions) {
+            reader.open(fd, *asyncOptions, {{buffer, kBlock}});
+        }
+        uint64_t reads = 0;
+        for (uint64_t offset = 0; offset < size; offset += kBlock) {
+            // O_DIRECT needs whole sectors, so the tail block is read in full
+            size_t n = reader.isOpen() ? reader.read(buffer, kBlock, offset)
+                                       : BlockReader::readFully(fd, buffer, kBlock, offset);
+            if (n == 0) break;
+            reads++;
+        }
+        reader.close();
+        free(memory);
+        close(fd);
+        return reads;
+    }
+
+    // Calibrates an iteration count that fills the time slice, then reports the
+    // fastest of several repetitions; the median is there to judge the noise
+    void measure(const Workload& workload) {
+        const uint64_t sliceNs = config_.quick ? 20000000ULL : 200000000ULL;
+        const int repetitions = config_.quick ? 1 : 5;
+
+        uint64_t hits = 0;
+        uint64_t iterations = 1;
+        MemoryBudget::resetPeak();
+        uint64_t start = nowNs();
+        hits = workload.run(); // Warm-up, also fills the page cache
+        uint64_t once = std::max<uint64_t>(nowNs() - start, 1);
+        iterations = std::max<uint64_t>(1, sliceNs / once);
+
+        std::vector<double> perIteration;
+        for (int r = 0; r < repetitions; ++r) {
+            start = nowNs();
+            for (uint64_t i = 0; i < iterations; ++i) {
+                hits = workload.run();
+            }
+            perIteration.push_back(static_cast<double>(nowNs() - start) / static_cast<double>(iterations));
+        }
+        std::sort(perIteration.begin(), perIteration.end());
+        double best = perIteration.front();
+        double median = perIteration[perIteration.size() / 2];
+
+        printf("{\"benchmark\":\"%s\",\"input\":\"%s\",\"bytes\":%llu,\"ops\":%llu,\"hits\":%llu,"
+               "\"iterations\":%llu,\"repetitions\":%d,\"ns_per_op\":%.3f,\"ns_per_op_median\":%.3f",
+               workload.benchmark.c_str(), workload.input.c_str(),
+               static_cast<unsigned long long>(workload.bytes), static_cast<unsigned long long>(workload.ops),
+               static_cast<unsigned long long>(hits), static_cast<unsigned long long>(iterations),
+               repetitions, best / static_cast<double>(workload.ops), median / static_cast<double>(workload.ops));
+        printf(",\"peak_bytes\":%zu", MemoryBudget::peak());
+        if (workload.bytes > 0) {
+            printf(",\"mb_per_s\":%.2f", static_cast<double>(workload.bytes) / kMiB / (best / 1e9));
+        }
+        printf("}\n");
+        fflush(stdout);
+    }
+
+    const BenchConfig& config_;
+    std::string workDir_;
+    FileRecoveryEngine engine_;
+    FileScanner fileScanner_;
+    std::vector<Workload> workloads_;
+};
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--quick") {
+            config.quick = true;
+        } else if (arg == "--filter" && hasValue) {
+            config.filter = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            config.threads = static_cast<size_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--queue-depth" && hasValue) {
+            config.queueDepth = std::max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--direct") {
+            config.directIo = true;
+        } else if (arg == "--memory-budget" && hasValue) {
+            config.memoryBudget = static_cast<size_t>(strtoul(argv[++i], nullptr, 10)) * kMiB;
+        } else if (arg == "--tmp" && hasValue) {
+            config.tmpRoot = argv[++i];
+        } else if (arg == "--image" && hasValue) {
+            config.images.push_back(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--filter SUBSTRING] [--threads N] [--queue-depth N] [--direct] "
+                            "[--memory-budget MIB] [--tmp DIR] [--image PATH]...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::string pattern = config.tmpRoot + "/scan_bench.XXXXXX";
+    std::vector<char> workDir(pattern.begin(), pattern.end());
+    workDir.push_back('\0');
+    if (!mkdtemp(workDir.data())) {
+        fprintf(stderr, "Cannot create a work directory under %s\n", config.tmpRoot.c_str());
+        return 1;
+    }
+    MemoryBudget::configure(config.memoryBudget, workDir.data());
+
+    bool ok;
+    {
+        ScanBench bench(config, workDir.data());
+        bench.addSignatureBenchmarks();
+        bench.addClassifierBenchmarks();
+        ok = bench.addCarveBenchmarks() && bench.addFileBenchmarks();
+        if (ok) bench.runAll();
+    }
+    removeTree(workDir.data());
+    return ok ? 0 : 1;
+}
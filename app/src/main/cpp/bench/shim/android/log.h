@@ -0,0 +1,25 @@
+#ifndef BENCH_SHIM_ANDROID_LOG_H
+#define BENCH_SHIM_ANDROID_LOG_H
+
+// Host stand-in for the NDK logging header. Messages are dropped so the
+// benchmarks time the scanning code rather than terminal output; the format
+// attribute keeps printf checking of the LOGI/LOGE arguments.
+
+enum {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT
+};
+
+__attribute__((format(printf, 3, 4)))
+inline int __android_log_print(int, const char*, const char*, ...) {
+    return 0;
+}
+
+#endif // BENCH_SHIM_ANDROID_LOG_H
@@ -0,0 +1,191 @@
+#include "block_classifier.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLOCK_CLASSIFIER_AVX2 1
+#endif
+#endif
+
+namespace {
+
+const float kCompressedEntropy = 7.0f;
+
+// Bytes that never appear in text apart from tab, newline, form feed and carriage return
+bool isControl(unsigned value) {
+    return (value < 0x20 && value != '\t' && value != '\n' && value != '\f' && value != '\r') || value == 0x7F;
+}
+
+bool allEqual(const uint8_t* data, size_t size, uint8_t fill) {
+    uint64_t pattern;
+    memset(&pattern, fill, sizeof(pattern));
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word != pattern) return false;
+    }
+    for (; i < size; ++i) {
+        if (data[i] != fill) return false;
+    }
+    return true;
+}
+
+#if defined(__ARM_NEON)
+
+bool uniformNeon(const uint8_t* data, size_t size) {
+    const uint8x16_t fill = vdupq_n_u8(data[0]);
+    size_t i = 0;
+    while (i + 64 <= size) {
+        // Differences are ORed over 1 KiB at a time so the reduction stays off the inner loop
+        uint8x16_t diff = vdupq_n_u8(0);
+        size_t end = i + 1024 <= size ? i + 1024 : size - (size - i) % 64;
+        for (; i < end; i += 64) {
+            diff = vorrq_u8(diff, veorq_u8(vld1q_u8(data + i), fill));
+            diff = vorrq_u8(diff, veorq_u8(vld1q_u8(data + i + 16), fill));
+            diff = vorrq_u8(diff, veorq_u8(vld1q_u8(data + i + 32), fill));
+            diff = vorrq_u8(diff, veorq_u8(vld1q_u8(data + i + 48), fill));
+        }
+#if defined(__aarch64__)
+        if (vmaxvq_u8(diff) != 0) return false;
+#else
+        uint8x8_t folded = vorr_u8(vget_low_u8(diff), vget_high_u8(diff));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0) return false;
+#endif
+    }
+    return allEqual(data + i, size - i, data[0]);
+}
+
+#elif defined(__SSE2__)
+
+bool uniformSse2(const uint8_t* data, size_t size) {
+    const __m128i fill = _mm_set1_epi8(static_cast<char>(data[0]));
+    size_t i = 0;
+    while (i + 64 <= size) {
+        __m128i same = _mm_set1_epi8(-1);
+        size_t end = i + 1024 <= size ? i + 1024 : size - (size - i) % 64;
+        for (; i < end; i += 64) {
+            const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+            same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_loadu_si128(p), fill));
+            same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), fill));
+            same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_loadu_si128(p + 2), fill));
+            same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), fill));
+        }
+        if (_mm_movemask_epi8(same) != 0xFFFF) return false;
+    }
+    return allEqual(data + i, size - i, data[0]);
+}
+
+#if defined(BLOCK_CLASSIFIER_AVX2)
+
+__attribute__((target("avx2")))
+bool uniformAvx2(const uint8_t* data, size_t size) {
+    const __m256i fill = _mm256_set1_epi8(static_cast<char>(data[0]));
+    size_t i = 0;
+    while (i + 128 <= size) {
+        __m256i same = _mm256_set1_epi8(-1);
+        size_t end = i + 2048 <= size ? i + 2048 : size - (size - i) % 128;
+        for (; i < end; i += 128) {
+            const __m256i* p = reinterpret_cast<const __m256i*>(data + i);
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_loadu_si256(p), fill));
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), fill));
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 2), fill));
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 3), fill));
+        }
+        if (_mm256_movemask_epi8(same) != -1) return false;
+    }
+    return allEqual(data + i, size - i, data[0]);
+}
+
+#endif
+#endif
+
+using UniformKernel = bool (*)(const uint8_t*, size_t);
+
+struct Kernel {
+    UniformKernel run;
+    const char* name;
+};
+
+Kernel pickKernel() {
+#if defined(__ARM_NEON)
+    return {uniformNeon, "neon"};
+#elif defined(__SSE2__)
+#if defined(BLOCK_CLASSIFIER_AVX2)
+    if (__builtin_cpu_supports("avx2")) return {uniformAvx2, "avx2"};
+#endif
+    return {uniformSse2, "sse2"};
+#else
+    return {[](const uint8_t* data, size_t size) { return allEqual(data, size, data[0]); }, "scalar"};
+#endif
+}
+
+const Kernel& kernel() {
+    static const Kernel picked = pickKernel();
+    return picked;
+}
+
+} // namespace
+
+bool BlockClassifier::isUniform(const uint8_t* data, size_t size) {
+    if (size == 0) return false;
+    // Most data blocks differ within their first bytes
+    if (size >= 16 && (data[1] != data[0] || data[7] != data[0] || data[15] != data[0])) return false;
+    return kernel().run(data, size);
+}
+
+BlockClass BlockClassifier::classify(const uint8_t* data, size_t size) {
+    BlockClass result = {BlockKind::Binary, 0, 0.0f};
+    if (size == 0) return result;
+    if (isUniform(data, size)) {
+        result.fill = data[0];
+        result.kind = data[0] == 0x00 ? BlockKind::Zero : data[0] == 0xFF ? BlockKind::Ones : BlockKind::Uniform;
+        return result;
+    }
+
+    // Four interleaved histograms so consecutive equal bytes do not stall on one counter
+    uint32_t counts[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        counts[0][data[i]]++;
+        counts[1][data[i + 1]]++;
+        counts[2][data[i + 2]]++;
+        counts[3][data[i + 3]]++;
+    }
+    for (; i < size; ++i) counts[0][data[i]]++;
+
+    const double total = static_cast<double>(size);
+    double sum = 0.0;
+    bool control = false;
+    for (unsigned value = 0; value < 256; ++value) {
+        uint32_t count = counts[0][value] + counts[1][value] + counts[2][value] + counts[3][value];
+        if (count == 0) continue;
+        sum += count * std::log2(static_cast<double>(count));
+        control = control || isControl(value);
+    }
+    result.entropy = static_cast<float>(std::log2(total) - sum / total);
+
+    if (!control) {
+        result.kind = BlockKind::Text;
+    } else if (result.entropy >= kCompressedEntropy) {
+        result.kind = BlockKind::Compressed;
+    }
+    return result;
+}
+
+size_t BlockClassifier::blankPrefix(const uint8_t* data, size_t size) {
+    size_t blank = 0;
+    while (blank + kBlockSize <= size && isUniform(data + blank, kBlockSize)) {
+        blank += kBlockSize;
+    }
+    return blank;
+}
+
+const char* BlockClassifier::implementation() {
+    return kernel().name;
+}
@@ -0,0 +1,44 @@
+#ifndef BLOCK_CLASSIFIER_H
+#define BLOCK_CLASSIFIER_H
+
+#include <cstdint>
+#include <cstddef>
+
+enum class BlockKind {
+    Zero,       // Every byte 0x00: trimmed or never-written flash
+    Ones,       // Every byte 0xFF: erased NAND pages
+    Uniform,    // Every byte the same other value
+    Text,       // Printable ASCII or UTF-8 with no control bytes beyond whitespace
+    Binary,     // Structured data: headers, tables, uncompressed media
+    Compressed, // Close to 8 bits per byte: compressed or encrypted content
+};
+
+struct BlockClass {
+    BlockKind kind;
+    uint8_t fill;    // The repeated byte for Zero, Ones and Uniform blocks
+    float entropy;   // Shannon entropy in bits per byte, 0-8
+
+    bool blank() const { return kind == BlockKind::Zero || kind == BlockKind::Ones || kind == BlockKind::Uniform; }
+};
+
+// Cheap per-block triage so the scanners spend no time on empty space and
+// the validators can tell compressed payload from text or filler. The
+// uniform test is vectorised (NEON, SSE2 or AVX2, picked at run time on
+// x86) since it runs over every block of a device; the histogram behind
+// the entropy and text guesses is only built when a caller asks for it.
+class BlockClassifier {
+public:
+    static const size_t kBlockSize = 4096;
+
+    // True if every byte of data equals data[0]; false for an empty range
+    static bool isUniform(const uint8_t* data, size_t size);
+    static BlockClass classify(const uint8_t* data, size_t size);
+
+    // Bytes at the start of data covered by whole blank blocks
+    static size_t blankPrefix(const uint8_t* data, size_t size);
+
+    // Name of the isUniform kernel in use, for logs and the benchmarks
+    static const char* implementation();
+};
+
+#endif // BLOCK_CLASSIFIER_H
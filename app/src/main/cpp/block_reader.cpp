@@ -0,0 +1,409 @@
+#include "block_reader.h"
+#include "scan_stats.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#define LOG_TAG "BlockReader"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+uint64_t nowNanos() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+const size_t kDirectAlignment = 4096;
+// Smallest block the ring shrinks to under a memory budget
+const size_t kMinBudgetBlockSize = 256 * 1024;
+
+} // namespace
+
+BlockReader::BlockReader()
+        : fd_(-1), sourceSize_(0), alignment_(kDirectAlignment), produced_(0), consumed_(0),
+          holding_(false), producerDone_(false), stopping_(false), error_(0), ringBytes_(0), startNanos_(0) {
+}
+
+BlockReader::~BlockReader() {
+    close();
+}
+
+bool BlockReader::open(const char* path, const Options& options) {
+    return open(path, options, {});
+}
+
+bool BlockReader::open(const char* path, const Options& options, const std::vector<ByteRange>& ranges) {
+    close();
+
+    if (!path) {
+        LOGE("Null path provided");
+        return false;
+    }
+
+    options_ = options;
+    options_.blockSize = std::max<size_t>(options_.blockSize, kDirectAlignment);
+    options_.blockSize -= options_.blockSize % kDirectAlignment;
+    options_.ringDepth = std::max<size_t>(options_.ringDepth, 2);
+
+    int flags = O_RDONLY | O_CLOEXEC;
+    if (options_.directIo) {
+        fd_ = ::open(path, flags | O_DIRECT);
+        if (fd_ < 0) {
+            LOGI("O_DIRECT unavailable for %s, using buffered reads", path);
+            options_.directIo = false;
+        }
+    }
+    if (fd_ < 0) {
+        fd_ = ::open(path, flags);
+    }
+    if (fd_ < 0) {
+        LOGE("Cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    struct stat statbuf;
+    if (fstat(fd_, &statbuf) != 0 || S_ISDIR(statbuf.st_mode)) {
+        // Directories have no raw data to scan
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    if (!S_ISREG(statbuf.st_mode)) {
+        options_.useMmap = false;
+    }
+    if (!options_.directIo && !options_.useMmap) {
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    sourceSize_ = querySize(fd_);
+    ranges_.clear();
+    if (ranges.empty()) {
+        if (sourceSize_ == 0 && S_ISREG(statbuf.st_mode)) {
+            // Pseudo files (procfs) report no size; read until EOF instead
+            options_.useMmap = false;
+            ranges_.push_back({0, UINT64_MAX});
+        } else {
+            ranges_.push_back({0, sourceSize_});
+        }
+    } else {
+        for (const auto& range : ranges) {
+            if (range.offset >= sourceSize_) continue;
+            ranges_.push_back({range.offset, std::min(range.length, sourceSize_ - range.offset)});
+        }
+    }
+
+    ring_.assign(options_.ringDepth, Slot());
+    if (!options_.useMmap) {
+        reserveRing();
+        for (auto& slot : ring_) {
+            void* buffer = nullptr;
+            if (posix_memalign(&buffer, alignment_, options_.blockSize + 2 * alignment_) != 0) {
+                LOGE("Cannot allocate %zu byte read buffer", options_.blockSize);
+                close();
+                return false;
+            }
+            slot.buffer = static_cast<uint8_t*>(buffer);
+        }
+
+        if (options_.queueDepth > 1) {
+            // Each block goes out as queueDepth requests; the ring buffers are registered once
+            AsyncReader::Options asyncOptions;
+            asyncOptions.backend = options_.ioBackend;
+            asyncOptions.queueDepth = options_.queueDepth;
+            asyncOptions.requestBytes = std::max<size_t>(options_.blockSize / options_.queueDepth, 64 * 1024);
+            asyncOptions.requestBytes -= asyncOptions.requestBytes % kDirectAlignment;
+            std::vector<iovec> buffers;
+            for (const auto& slot : ring_) {
+                buffers.push_back({slot.buffer, options_.blockSize + 2 * alignment_});
+            }
+            if (async_.open(fd_, asyncOptions, buffers)) {
+                LOGI("Reading %s through %s, %zu requests in flight", path,
+                     AsyncReader::backendName(async_.backend()), options_.queueDepth);
+            }
+        }
+    }
+
+    produced_ = 0;
+    consumed_ = 0;
+    holding_ = false;
+    producerDone_ = false;
+    stopping_ = false;
+    error_ = 0;
+    stats_ = ReadThroughput();
+    startNanos_ = nowNanos();
+
+    ioThread_ = std::thread(&BlockReader::ioLoop, this);
+    return true;
+}
+
+// A ring that does not fit the memory budget drops to two slots, then to
+// smaller blocks; one that still does not fit is counted over the limit
+void BlockReader::reserveRing() {
+    size_t requested = options_.blockSize;
+    auto ringBytes = [this] { return options_.ringDepth * (options_.blockSize + 2 * alignment_); };
+    while (!MemoryBudget::tryReserve(ringBytes())) {
+        if (options_.ringDepth > 2) {
+            options_.ringDepth = 2;
+        } else if (options_.blockSize / 2 >= kMinBudgetBlockSize) {
+            options_.blockSize /= 2;
+            options_.blockSize -= options_.blockSize % kDirectAlignment;
+        } else {
+            MemoryBudget::reserve(ringBytes());
+            break;
+        }
+    }
+    ring_.resize(options_.ringDepth);
+    ringBytes_ = ringBytes();
+    if (options_.blockSize != requested) {
+        LOGI("Read blocks cut to %zu bytes to fit the memory budget", options_.blockSize);
+    }
+}
+
+bool BlockReader::next(ReadBlock& block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (holding_) {
+        unmapSlot(ring_[consumed_ % ring_.size()]);
+        consumed_++;
+        holding_ = false;
+        drained_.notify_one();
+    }
+
+    uint64_t waitStart = nowNanos();
+    filled_.wait(lock, [this] { return produced_ > consumed_ || producerDone_ || stopping_; });
+    uint64_t stall = nowNanos() - waitStart;
+    stats_.stallNanos += stall;
+    ScanStats::add(kStatIoWaitNanos, stall);
+
+    if (produced_ <= consumed_ || stopping_) {
+        return false;
+    }
+
+    const Slot& slot = ring_[consumed_ % ring_.size()];
+    block.data = slot.data;
+    block.size = slot.size;
+    block.offset = slot.offset;
+    holding_ = true;
+    return true;
+}
+
+void BlockReader::close() {
+    if (ioThread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        drained_.notify_all();
+        filled_.notify_all();
+        ioThread_.join();
+        stats_.elapsedNanos = nowNanos() - startNanos_;
+    }
+
+    // Unregisters the ring buffers before they are freed
+    async_.close();
+    for (auto& slot : ring_) {
+        unmapSlot(slot);
+        free(slot.buffer);
+    }
+    ring_.clear();
+    MemoryBudget::unreserve(ringBytes_);
+    ringBytes_ = 0;
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool BlockReader::failed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_ != 0;
+}
+
+ReadThroughput BlockReader::throughput() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReadThroughput result = stats_;
+    if (ioThread_.joinable()) {
+        result.elapsedNanos = nowNanos() - startNanos_;
+    }
+    return result;
+}
+
+void BlockReader::logThroughput(const char* phase) const {
+    ReadThroughput t = throughput();
+    double elapsed = t.elapsedNanos / 1e9;
+    LOGI("%s: %.1f MB in %.2f s (%.1f MB/s), %llu reads, device busy %.0f%%, consumer stalled %.0f%%",
+         phase, t.bytesRead / 1048576.0, elapsed, t.megabytesPerSecond(),
+         static_cast<unsigned long long>(t.readCalls),
+         t.elapsedNanos ? 100.0 * t.ioNanos / t.elapsedNanos : 0.0,
+         t.elapsedNanos ? 100.0 * t.stallNanos / t.elapsedNanos : 0.0);
+}
+
+void BlockReader::ioLoop() {
+    for (const auto& range : ranges_) {
+        uint64_t pos = range.offset;
+        uint64_t end = range.offset + range.length;
+
+        while (pos < end) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(options_.blockSize, end - pos));
+            Slot* slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                drained_.wait(lock, [this] { return stopping_ || produced_ - consumed_ < ring_.size(); });
+                if (stopping_) return;
+                slot = &ring_[produced_ % ring_.size()];
+            }
+
+            bool ok = options_.useMmap ? mapSlot(*slot, pos, length) : fillSlot(*slot, pos, length);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!ok) {
+                error_ = errno ? errno : EIO;
+                LOGE("Read failed at offset %llu: %s",
+                     static_cast<unsigned long long>(pos), strerror(error_));
+                producerDone_ = true;
+                filled_.notify_one();
+                return;
+            }
+            if (slot->size == 0) break; // Source ended early
+
+            stats_.bytesRead += slot->size;
+            produced_++;
+            filled_.notify_one();
+            pos += slot->size;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    producerDone_ = true;
+    filled_.notify_one();
+}
+
+bool BlockReader::fillSlot(Slot& slot, uint64_t offset, size_t length) {
+    uint64_t readStart = offset;
+    size_t readLength = length;
+    if (options_.directIo) {
+        readStart = offset & ~static_cast<uint64_t>(alignment_ - 1);
+        size_t head = static_cast<size_t>(offset - readStart);
+        readLength = (head + length + alignment_ - 1) & ~(alignment_ - 1);
+    }
+
+    uint64_t ioStart = nowNanos();
+    errno = 0;
+    size_t n = async_.isOpen() ? async_.read(slot.buffer, readLength, readStart)
+                               : readFully(fd_, slot.buffer, readLength, readStart);
+    if (n == 0 && errno == EINVAL && options_.directIo) {
+        // Some filesystems reject O_DIRECT at read time; fall back to buffered I/O
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+        options_.directIo = false;
+        readStart = offset;
+        readLength = length;
+        errno = 0;
+        n = async_.isOpen() ? async_.read(slot.buffer, readLength, readStart)
+                            : readFully(fd_, slot.buffer, readLength, readStart);
+    }
+    uint64_t ioNanos = nowNanos() - ioStart;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.ioNanos += ioNanos;
+        stats_.readCalls++;
+    }
+
+    if (n == 0 && errno != 0) {
+        return false;
+    }
+
+    size_t head = static_cast<size_t>(offset - readStart);
+    slot.data = slot.buffer + head;
+    slot.size = n > head ? std::min(length, n - head) : 0;
+    slot.offset = offset;
+    return true;
+}
+
+bool BlockReader::mapSlot(Slot& slot, uint64_t offset, size_t length) {
+    static const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t mapStart = offset & ~(pageSize - 1);
+    size_t head = static_cast<size_t>(offset - mapStart);
+
+    uint64_t ioStart = nowNanos();
+    void* mapping = mmap64(nullptr, head + length, PROT_READ, MAP_PRIVATE, fd_,
+                           static_cast<off64_t>(mapStart));
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapping, head + length, MADV_SEQUENTIAL);
+    madvise(mapping, head + length, MADV_WILLNEED);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.ioNanos += nowNanos() - ioStart;
+    stats_.readCalls++;
+    ScanStats::add(kStatReadCalls, 1);
+    ScanStats::add(kStatBytesRead, length);
+    slot.mapping = mapping;
+    slot.mappingLength = head + length;
+    slot.data = static_cast<const uint8_t*>(mapping) + head;
+    slot.size = length;
+    slot.offset = offset;
+    return true;
+}
+
+void BlockReader::unmapSlot(Slot& slot) {
+    if (slot.mapping) {
+        munmap(slot.mapping, slot.mappingLength);
+        slot.mapping = nullptr;
+        slot.mappingLength = 0;
+    }
+}
+
+size_t BlockReader::readFully(int fd, uint8_t* buffer, size_t length, uint64_t offset) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = pread64(fd, buffer + total, length - total, static_cast<off64_t>(offset + total));
+        ScanStats::add(kStatReadCalls, 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (n == 0) break;
+        total += static_cast<size_t>(n);
+    }
+    ScanStats::add(kStatBytesRead, total);
+    return total;
+}
+
+uint64_t BlockReader::querySize(int fd) {
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0) {
+        return 0;
+    }
+    if (S_ISBLK(statbuf.st_mode)) {
+        uint64_t size = 0;
+        if (ioctl(fd, BLKGETSIZE64, &size) == 0) {
+            return size;
+        }
+    }
+    return static_cast<uint64_t>(statbuf.st_size);
+}
+
+BlockReader::Options BlockReader::optionsFor(const char* path) {
+    Options options;
+    struct stat statbuf;
+    if (path && stat(path, &statbuf) == 0) {
+        options.directIo = S_ISBLK(statbuf.st_mode);
+        options.useMmap = S_ISREG(statbuf.st_mode);
+    }
+    return options;
+}
@@ -0,0 +1,115 @@
+#ifndef BLOCK_READER_H
+#define BLOCK_READER_H
+
+#include "async_reader.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+struct ByteRange {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Polled between batches by long filesystem sweeps; true makes them return early
+using StopCheck = std::function<bool()>;
+
+struct ReadBlock {
+    const uint8_t* data;
+    size_t size;
+    uint64_t offset; // Absolute offset of data[0] in the source
+};
+
+struct ReadThroughput {
+    uint64_t bytesRead = 0;
+    uint64_t readCalls = 0;
+    uint64_t ioNanos = 0;      // Time the I/O thread spent inside pread
+    uint64_t stallNanos = 0;   // Time the consumer spent waiting for a filled buffer
+    uint64_t elapsedNanos = 0;
+
+    double megabytesPerSecond() const {
+        return elapsedNanos ? (bytesRead / 1048576.0) / (elapsedNanos / 1e9) : 0.0;
+    }
+};
+
+// Sequential reader for block devices and image files. A dedicated I/O thread
+// issues large aligned preads into a ring of buffers while the caller consumes
+// the previously filled one, so device reads overlap with matching.
+class BlockReader {
+public:
+    struct Options {
+        size_t blockSize = 4 * 1024 * 1024;
+        size_t ringDepth = 3;
+        bool directIo = false;   // O_DIRECT, bypasses the page cache on block devices
+        bool useMmap = false;    // Map regular files window by window instead of reading
+        size_t queueDepth = 1;   // Reads in flight per block; above 1 the block is split over an AsyncReader
+        AsyncReader::Backend ioBackend = AsyncReader::Backend::Auto;
+    };
+
+    BlockReader();
+    ~BlockReader();
+
+    // Reads the whole source, or only the given ranges in order
+    bool open(const char* path, const Options& options);
+    bool open(const char* path, const Options& options, const std::vector<ByteRange>& ranges);
+
+    // Returns the next filled block; the previous block is recycled. False at end or on error.
+    bool next(ReadBlock& block);
+    void close();
+
+    uint64_t sourceSize() const { return sourceSize_; }
+    bool failed() const;
+    ReadThroughput throughput() const;
+    void logThroughput(const char* phase) const;
+
+    // Reads exactly length bytes at offset, retrying short reads. Returns bytes read.
+    static size_t readFully(int fd, uint8_t* buffer, size_t length, uint64_t offset);
+    static uint64_t querySize(int fd);
+    // Direct I/O for block devices, mapped windows for image files
+    static Options optionsFor(const char* path);
+
+private:
+    struct Slot {
+        uint8_t* buffer = nullptr;
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+        uint64_t offset = 0;
+        void* mapping = nullptr;
+        size_t mappingLength = 0;
+    };
+
+    void ioLoop();
+    bool fillSlot(Slot& slot, uint64_t offset, size_t length);
+    bool mapSlot(Slot& slot, uint64_t offset, size_t length);
+    void unmapSlot(Slot& slot);
+    void reserveRing();
+
+    Options options_;
+    int fd_;
+    uint64_t sourceSize_;
+    std::vector<ByteRange> ranges_;
+    std::vector<Slot> ring_;
+    size_t alignment_;
+    AsyncReader async_; // Open only when queueDepth > 1
+
+    std::thread ioThread_;
+    mutable std::mutex mutex_;
+    std::condition_variable filled_;
+    std::condition_variable drained_;
+    uint64_t produced_;
+    uint64_t consumed_;
+    bool holding_;
+    bool producerDone_;
+    bool stopping_;
+    int error_;
+    size_t ringBytes_; // Counted against the memory budget
+
+    ReadThroughput stats_;
+    uint64_t startNanos_;
+};
+
+#endif // BLOCK_READER_H
@@ -0,0 +1,211 @@
+#include "content_hash.h"
+#include "byte_order.h"
+#include "memory_budget.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t accumulate(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    return rotl(acc, 31) * kPrime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+    acc ^= accumulate(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+// Appends the pieces of extents that hold bytes [from, from + length) of their concatenation
+void appendSlice(const std::vector<ByteRange>& extents, uint64_t from, uint64_t length,
+                 std::vector<ByteRange>& slice) {
+    for (const auto& extent : extents) {
+        if (length == 0) break;
+        if (from >= extent.length) {
+            from -= extent.length;
+            continue;
+        }
+        uint64_t take = std::min(length, extent.length - from);
+        slice.push_back({extent.offset + from, take});
+        from = 0;
+        length -= take;
+    }
+}
+
+} // namespace
+
+Xxh64::Xxh64(uint64_t seed) : seed_(seed), totalLength_(0), pendingSize_(0) {
+    acc_[0] = seed + kPrime1 + kPrime2;
+    acc_[1] = seed + kPrime2;
+    acc_[2] = seed;
+    acc_[3] = seed - kPrime1;
+}
+
+void Xxh64::update(const uint8_t* data, size_t size) {
+    totalLength_ += size;
+
+    if (pendingSize_ + size < 32) {
+        memcpy(pending_ + pendingSize_, data, size);
+        pendingSize_ += size;
+        return;
+    }
+
+    if (pendingSize_ > 0) {
+        size_t fill = 32 - pendingSize_;
+        memcpy(pending_ + pendingSize_, data, fill);
+        for (int lane = 0; lane < 4; ++lane) {
+            acc_[lane] = accumulate(acc_[lane], readLe64(pending_ + lane * 8));
+        }
+        data += fill;
+        size -= fill;
+        pendingSize_ = 0;
+    }
+
+    const uint8_t* end = data + size;
+    for (; data + 32 <= end; data += 32) {
+        acc_[0] = accumulate(acc_[0], readLe64(data));
+        acc_[1] = accumulate(acc_[1], readLe64(data + 8));
+        acc_[2] = accumulate(acc_[2], readLe64(data + 16));
+        acc_[3] = accumulate(acc_[3], readLe64(data + 24));
+    }
+
+    pendingSize_ = static_cast<size_t>(end - data);
+    memcpy(pending_, data, pendingSize_);
+}
+
+uint64_t Xxh64::digest() const {
+    uint64_t hash;
+    if (totalLength_ >= 32) {
+        hash = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) + rotl(acc_[3], 18);
+        for (uint64_t acc : acc_) {
+            hash = mergeRound(hash, acc);
+        }
+    } else {
+        hash = seed_ + kPrime5;
+    }
+    hash += totalLength_;
+
+    const uint8_t* p = pending_;
+    const uint8_t* end = pending_ + pendingSize_;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= accumulate(0, readLe64(p));
+        hash = rotl(hash, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        hash ^= static_cast<uint64_t>(readLe32(p)) * kPrime1;
+        hash = rotl(hash, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash ^= *p * kPrime5;
+        hash = rotl(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+ContentHasher::ContentHasher() : fd_(-1) {
+}
+
+ContentHasher::~ContentHasher() {
+    close();
+    MemoryBudget::unreserve(buffer_.size());
+}
+
+bool ContentHasher::open(const char* path) {
+    close();
+    fd_ = path ? ::open(path, O_RDONLY | O_CLOEXEC) : -1;
+    return fd_ >= 0;
+}
+
+void ContentHasher::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+uint64_t ContentHasher::hash(const std::vector<ByteRange>& extents) {
+    return fd_ >= 0 ? hashFd(fd_, extents) : 0;
+}
+
+uint64_t ContentHasher::hashFile(const char* path) {
+    int fd = path ? ::open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) {
+        return 0;
+    }
+    uint64_t hash = hashFd(fd, {{0, BlockReader::querySize(fd)}});
+    ::close(fd);
+    return hash;
+}
+
+uint64_t ContentHasher::sample(const std::vector<ByteRange>& extents) {
+    return fd_ >= 0 ? sampleFd(fd_, extents) : 0;
+}
+
+uint64_t ContentHasher::sampleFile(const char* path) {
+    int fd = path ? ::open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) {
+        return 0;
+    }
+    uint64_t hash = sampleFd(fd, {{0, BlockReader::querySize(fd)}});
+    ::close(fd);
+    return hash;
+}
+
+uint64_t ContentHasher::sampleFd(int fd, const std::vector<ByteRange>& extents) {
+    uint64_t total = 0;
+    for (const auto& extent : extents) total += extent.length;
+    if (total <= 2 * kSampleBytes) {
+        return hashFd(fd, extents, total);
+    }
+
+    // Seeded with the length, so the length is part of the key
+    std::vector<ByteRange> sampled;
+    appendSlice(extents, 0, kSampleBytes, sampled);
+    appendSlice(extents, total - kSampleBytes, kSampleBytes, sampled);
+    return hashFd(fd, sampled, total);
+}
+
+uint64_t ContentHasher::hashFd(int fd, const std::vector<ByteRange>& extents, uint64_t seed) {
+    if (buffer_.empty()) {
+        size_t size = kChunkSize;
+        if (!MemoryBudget::tryReserve(size)) {
+            size = kMinChunkSize;
+            MemoryBudget::reserve(size);
+        }
+        buffer_.resize(size);
+    }
+
+    Xxh64 hasher(seed);
+    for (const auto& extent : extents) {
+        for (uint64_t done = 0; done < extent.length;) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(buffer_.size(), extent.length - done));
+            size_t n = BlockReader::readFully(fd, buffer_.data(), length, extent.offset + done);
+            if (n != length) {
+                return 0;
+            }
+            hasher.update(buffer_.data(), n);
+            done += n;
+        }
+    }
+    uint64_t hash = hasher.digest();
+    return hash ? hash : 1;
+}
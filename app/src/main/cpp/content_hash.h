@@ -0,0 +1,65 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include "block_reader.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// XXH64 (xxHash, 64-bit) fed in pieces of any size; the digest equals the
+// one-shot hash of everything passed to update
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void update(const uint8_t* data, size_t size);
+    uint64_t digest() const;
+
+private:
+    uint64_t acc_[4];
+    uint64_t seed_;
+    uint64_t totalLength_;
+    uint8_t pending_[32]; // Tail shorter than one 32-byte stripe
+    size_t pendingSize_;
+};
+
+// Content hashes of carved files and of whole files, used to recognise the
+// same file found twice. 0 means "not hashed"; a real digest of 0 is bumped.
+//
+// Scans key every hit on a sample: its length plus its first and last
+// kSampleBytes, so a hit costs at most two short reads however large it is.
+// Only hits whose keys match are hashed in full to confirm the match.
+class ContentHasher {
+public:
+    static const size_t kChunkSize = 1024 * 1024;
+    // Read size when a whole chunk does not fit the memory budget
+    static const size_t kMinChunkSize = 64 * 1024;
+    // Head and tail read for a sampled key; content up to twice this is keyed on all of it
+    static const size_t kSampleBytes = 64 * 1024;
+
+    ContentHasher();
+    ~ContentHasher();
+
+    ContentHasher(const ContentHasher&) = delete;
+    ContentHasher& operator=(const ContentHasher&) = delete;
+
+    bool open(const char* path);
+    void close();
+
+    // Hash of the extents read in order, 0 if any of them could not be read in full
+    uint64_t hash(const std::vector<ByteRange>& extents);
+    uint64_t hashFile(const char* path);
+
+    // Sampled keys of the same content, 0 on a read error
+    uint64_t sample(const std::vector<ByteRange>& extents);
+    uint64_t sampleFile(const char* path);
+
+private:
+    uint64_t hashFd(int fd, const std::vector<ByteRange>& extents, uint64_t seed = 0);
+    uint64_t sampleFd(int fd, const std::vector<ByteRange>& extents);
+
+    int fd_;
+    std::vector<uint8_t> buffer_; // Counted as long-lived in MemoryBudget
+};
+
+#endif // CONTENT_HASH_H
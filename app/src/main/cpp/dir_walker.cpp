@@ -0,0 +1,196 @@
+#include "dir_walker.h"
+#include "thread_pool.h"
+#include <android/log.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+
+#define LOG_TAG "DirWalker"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+// Layout returned by the getdents64 syscall
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+const size_t kDirentBufferSize = 64 * 1024;
+
+// Directory fds handed from a parent to queued children; past this the
+// children reopen by path so a wide tree cannot exhaust the fd table
+const int kMaxHeldDirFds = 256;
+
+const int kDirOpenFlags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+bool isDotEntry(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+} // namespace
+
+DirWalker::DirWalker(const WalkOptions& options)
+        : options_(options), pool_(nullptr), sink_(nullptr), heldDirFds_(0),
+          filesFound_(0), directoriesVisited_(0), stopped_(false) {
+    if (options_.batchSize == 0) {
+        options_.batchSize = 1;
+    }
+}
+
+std::vector<std::string> DirWalker::walk(const std::string& root) {
+    std::vector<std::string> files;
+    walk(root, [&files](const std::vector<std::string>& batch) {
+        files.insert(files.end(), batch.begin(), batch.end());
+        return true;
+    });
+    return files;
+}
+
+bool DirWalker::walk(const std::string& root, const PathSink& sink) {
+    filesFound_ = 0;
+    directoriesVisited_ = 0;
+    stopped_ = false;
+    heldDirFds_ = 1; // The root fd below
+    visited_.clear();
+    sink_ = &sink;
+
+    int fd = open(root.c_str(), kDirOpenFlags);
+    if (fd < 0) {
+        LOGE("Cannot open directory: %s", root.c_str());
+        sink_ = nullptr;
+        return false;
+    }
+
+    std::string rootPath = root;
+    while (rootPath.size() > 1 && rootPath.back() == '/') {
+        rootPath.pop_back();
+    }
+
+    size_t threads = options_.threads == 0 ? ThreadPool::defaultThreadCount() : options_.threads;
+    if (threads > 1 && options_.recursive) {
+        ThreadPool pool(threads);
+        pool_ = &pool;
+        schedule({rootPath, fd});
+        pool.wait();
+        pool_ = nullptr;
+    } else {
+        schedule({rootPath, fd});
+        while (!localQueue_.empty()) {
+            DirTask task = std::move(localQueue_.back());
+            localQueue_.pop_back();
+            walkDirectory(std::move(task));
+        }
+    }
+
+    sink_ = nullptr;
+    LOGI("Walked %llu directories, %llu files under %s",
+         static_cast<unsigned long long>(directoriesVisited_.load()),
+         static_cast<unsigned long long>(filesFound_.load()), rootPath.c_str());
+    return !stopped_;
+}
+
+void DirWalker::schedule(DirTask task) {
+    if (pool_) {
+        // std::function needs a copyable callable
+        pool_->submit([this, task]() mutable { walkDirectory(std::move(task)); });
+    } else {
+        localQueue_.push_back(std::move(task));
+    }
+}
+
+bool DirWalker::markVisited(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(visitedMutex_);
+    return visited_.insert({st.st_dev, st.st_ino}).second;
+}
+
+bool DirWalker::emit(std::vector<std::string>& batch) {
+    if (batch.empty()) return !stopped_;
+
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+    if (!stopped_ && !(*sink_)(batch)) {
+        stopped_ = true;
+    }
+    batch.clear();
+    return !stopped_;
+}
+
+void DirWalker::walkDirectory(DirTask task) {
+    int dirFd = task.fd;
+    if (dirFd >= 0) {
+        heldDirFds_--;
+    } else {
+        dirFd = open(task.path.c_str(), kDirOpenFlags);
+        if (dirFd < 0) return;
+    }
+
+    // Also catches bind mounts and symlinks leading back up the tree
+    if (stopped_ || !markVisited(dirFd)) {
+        close(dirFd);
+        return;
+    }
+    directoriesVisited_++;
+
+    static thread_local std::vector<char> buffer(kDirentBufferSize);
+    std::vector<std::string> batch;
+    batch.reserve(options_.batchSize);
+    std::string path = task.path;
+    if (path.back() != '/') path += '/';
+    const size_t prefixLength = path.size();
+
+    while (!stopped_) {
+        long bytes = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+
+        for (long pos = 0; pos < bytes;) {
+            const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(buffer.data() + pos);
+            pos += entry->d_reclen;
+            if (isDotEntry(entry->d_name)) continue;
+
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN || (type == DT_LNK && options_.followSymlinks)) {
+                struct stat st;
+                int statFlags = options_.followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+                if (fstatat(dirFd, entry->d_name, &st, statFlags) != 0) continue;
+                type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            path.resize(prefixLength);
+            path += entry->d_name;
+
+            if (type == DT_REG) {
+                batch.push_back(path);
+                filesFound_++;
+                if (batch.size() >= options_.batchSize && !emit(batch)) break;
+            } else if (type == DT_DIR && options_.recursive) {
+                int childFd = -1;
+                if (heldDirFds_.fetch_add(1) < kMaxHeldDirFds) {
+                    int openFlags = options_.followSymlinks ? kDirOpenFlags : kDirOpenFlags | O_NOFOLLOW;
+                    childFd = openat(dirFd, entry->d_name, openFlags);
+                    if (childFd < 0) {
+                        heldDirFds_--;
+                        continue; // Unreadable, no point queueing it
+                    }
+                } else {
+                    heldDirFds_--;
+                }
+                schedule({path, childFd});
+            }
+        }
+    }
+
+    close(dirFd);
+    emit(batch);
+}
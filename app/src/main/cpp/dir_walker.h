@@ -0,0 +1,69 @@
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+class ThreadPool;
+
+struct WalkOptions {
+    size_t threads = 0;          // 0 = one per online core, 1 = walk on the calling thread
+    bool recursive = true;
+    bool followSymlinks = true;  // Loops are caught by the (device, inode) check
+    size_t batchSize = 256;      // Paths handed to the sink per call
+};
+
+// Lists regular files below a root directory. Each directory is opened
+// relative to its parent's fd and read with getdents64 in large chunks;
+// d_type decides what an entry is, and fstatat is only issued when the
+// filesystem does not fill it in or a symlink has to be resolved. Subtrees
+// are walked in parallel and paths are streamed out in batches.
+class DirWalker {
+public:
+    // Calls are serialised, but may come from any worker thread; returning
+    // false stops the walk
+    using PathSink = std::function<bool(const std::vector<std::string>&)>;
+
+    explicit DirWalker(const WalkOptions& options = WalkOptions());
+
+    bool walk(const std::string& root, const PathSink& sink);
+    std::vector<std::string> walk(const std::string& root);
+
+    uint64_t filesFound() const { return filesFound_; }
+    uint64_t directoriesVisited() const { return directoriesVisited_; }
+    bool stopped() const { return stopped_; }
+
+private:
+    struct DirTask {
+        std::string path;
+        int fd;  // Already open, or -1 to be reopened by path
+    };
+
+    void walkDirectory(DirTask task);
+    void schedule(DirTask task);
+    bool markVisited(int fd);
+    bool emit(std::vector<std::string>& batch);
+
+    WalkOptions options_;
+    ThreadPool* pool_;
+    std::vector<DirTask> localQueue_;
+    const PathSink* sink_;
+
+    std::mutex visitedMutex_;
+    std::set<std::pair<dev_t, ino_t>> visited_;
+    std::mutex sinkMutex_;
+
+    std::atomic<int> heldDirFds_;
+    std::atomic<uint64_t> filesFound_;
+    std::atomic<uint64_t> directoriesVisited_;
+    std::atomic<bool> stopped_;
+};
+
+#endif // DIR_WALKER_H
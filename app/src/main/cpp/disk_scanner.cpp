@@ -1,14 +1,67 @@
 
 #include "disk_scanner.h"
+#include "block_reader.h"
+#include "async_reader.h"
+#include "ext4_reader.h"
+#include "fat_reader.h"
+#include "f2fs_reader.h"
 #include <android/log.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cstring>
+#include <algorithm>
 
 #define LOG_TAG "DiskScanner"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
+namespace {
+
+// Parts of the sorted, disjoint free runs that no claimed range covers
+std::vector<ByteRange> subtractRanges(const std::vector<ByteRange>& ranges, std::vector<ByteRange> claimed) {
+    std::sort(claimed.begin(), claimed.end(), [](const ByteRange& a, const ByteRange& b) {
+        return a.offset < b.offset;
+    });
+    std::vector<ByteRange> remaining;
+    size_t c = 0;
+    for (const auto& range : ranges) {
+        uint64_t pos = range.offset;
+        uint64_t end = range.offset + range.length;
+        while (c < claimed.size() && claimed[c].offset + claimed[c].length <= pos) ++c;
+        for (size_t k = c; k < claimed.size() && claimed[k].offset < end; ++k) {
+            if (claimed[k].offset > pos) remaining.push_back({pos, claimed[k].offset - pos});
+            pos = std::max(pos, claimed[k].offset + claimed[k].length);
+        }
+        if (pos < end) remaining.push_back({pos, end - pos});
+    }
+    return remaining;
+}
+
+FileCluster clusterOf(const ByteRange& extent, size_t sectorSize) {
+    FileCluster cluster;
+    cluster.startSector = extent.offset / sectorSize;
+    cluster.endSector = (extent.offset + extent.length + sectorSize - 1) / sectorSize - 1;
+    cluster.size = static_cast<size_t>(extent.length);
+    cluster.isDeleted = true;
+    return cluster;
+}
+
+// A deleted file its filesystem metadata still maps, as one cluster
+FileCluster fileCluster(std::string name, uint64_t size, const std::vector<ByteRange>& extents, size_t sectorSize) {
+    FileCluster cluster = clusterOf(extents.front(), sectorSize);
+    cluster.size = static_cast<size_t>(size);
+    cluster.name = std::move(name);
+    // Data kept inside an F2FS inode does not start on a sector
+    if (extents.size() > 1 || extents.front().offset % sectorSize != 0) {
+        cluster.extents = extents;
+    }
+    return cluster;
+}
+
+} // namespace
+
 DiskScanner::DiskScanner() {
     LOGI("DiskScanner initialized");
 }
@@ -27,8 +80,22 @@ bool DiskScanner::mountFileSystem(const std::string& device) {
         return false;
     }
     
-    // In a real implementation, this would attempt to mount the filesystem
-    // For now, we'll simulate success
+    // Nothing is mounted: the volume's metadata is read from the device directly.
+    // F2FS, FAT32 and exFAT are opened here; anything else falls back to ext4 or carving.
+    devicePath_ = device;
+    fat_.reset();
+    f2fs_.reset();
+    if (F2fsReader::probe(device)) {
+        std::unique_ptr<F2fsReader> f2fs(new F2fsReader());
+        if (f2fs->open(device)) {
+            f2fs_ = std::move(f2fs);
+        }
+    } else if (FatReader::probe(device)) {
+        std::unique_ptr<FatReader> fat(new FatReader());
+        if (fat->open(device)) {
+            fat_ = std::move(fat);
+        }
+    }
     LOGI("Filesystem mounted successfully: %s", device.c_str());
     return true;
 }
@@ -37,18 +104,50 @@ std::vector<FileCluster> DiskScanner::scanDeletedClusters() {
     std::vector<FileCluster> clusters;
     
     LOGI("Scanning for deleted file clusters");
-    
-    // Simulate finding deleted clusters
-    // In real implementation, this would scan the filesystem's free space
-    for (int i = 0; i < 10; i++) {
-        FileCluster cluster;
-        cluster.startSector = i * 100;
-        cluster.endSector = (i + 1) * 100 - 1;
-        cluster.size = 100 * 512; // Assume 512 byte sectors
-        cluster.isDeleted = true;
-        clusters.push_back(cluster);
+
+    if (devicePath_.empty()) {
+        LOGE("No device mounted");
+        return clusters;
     }
-    
+
+    if (fat_ || f2fs_) {
+        // Deleted files come back whole from their directory entries or F2FS
+        // inodes, named and sized; the free space none of them claims is left for carving
+        std::vector<ByteRange> claimed;
+        auto addFile = [&](std::string name, uint64_t size, const std::vector<ByteRange>& extents) {
+            claimed.insert(claimed.end(), extents.begin(), extents.end());
+            clusters.push_back(fileCluster(std::move(name), size, extents, kSectorSize));
+        };
+        if (fat_) {
+            for (auto& file : fat_->deletedFiles()) addFile(std::move(file.path), file.size, file.extents);
+        } else {
+            for (auto& file : f2fs_->deletedFiles()) addFile(std::move(file.name), file.size, file.extents);
+        }
+        size_t named = clusters.size();
+        for (const auto& extent : subtractRanges(fat_ ? fat_->freeExtents() : f2fs_->freeExtents(), claimed)) {
+            clusters.push_back(clusterOf(extent, kSectorSize));
+        }
+        LOGI("Found %zu deleted files and %zu free runs", named, clusters.size() - named);
+        return clusters;
+    }
+
+    // Only unallocated blocks can hold deleted data
+    Ext4Reader ext4;
+    if (!ext4.open(devicePath_)) {
+        LOGE("Unsupported filesystem on %s", devicePath_.c_str());
+        return clusters;
+    }
+
+    // Files whose inode still maps them come back whole, though unnamed
+    std::vector<ByteRange> claimed;
+    for (const auto& file : ext4.deletedInodes()) {
+        claimed.insert(claimed.end(), file.extents.begin(), file.extents.end());
+        clusters.push_back(fileCluster(std::string(), file.size, file.extents, kSectorSize));
+    }
+    for (const auto& extent : subtractRanges(ext4.freeExtents(), claimed)) {
+        clusters.push_back(clusterOf(extent, kSectorSize));
+    }
+
     LOGI("Found %zu deleted clusters", clusters.size());
     return clusters;
 }
@@ -56,43 +155,63 @@ std::vector<FileCluster> DiskScanner::scanDeletedClusters() {
 FileData DiskScanner::reconstructFile(const FileCluster& cluster) {
     FileData fileData;
     
-    LOGI("Reconstructing file from cluster: %u-%u", cluster.startSector, cluster.endSector);
+    LOGI("Reconstructing file from cluster: %llu-%llu",
+         static_cast<unsigned long long>(cluster.startSector),
+         static_cast<unsigned long long>(cluster.endSector));
     
-    // Simulate file reconstruction
-    fileData.size = cluster.size;
-    fileData.data = new uint8_t[fileData.size];
-    
-    // Fill with dummy data - in real implementation, this would read from disk
-    for (size_t i = 0; i < fileData.size; i++) {
-        fileData.data[i] = static_cast<uint8_t>(i % 256);
+    if (devicePath_.empty() || cluster.endSector < cluster.startSector) {
+        LOGE("No device mounted or invalid cluster range");
+        return fileData;
     }
-    
-    fileData.isValid = true;
-    return fileData;
-}
 
-FileType DiskScanner::identifyBySignature(const uint8_t* data, size_t size) {
-    if (size < 4) return FileType::UNKNOWN;
-    
-    // JPEG
-    if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
-        return FileType::JPEG;
+    int fd = open(devicePath_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Cannot open device: %s", devicePath_.c_str());
+        return fileData;
     }
-    
-    // PNG
-    if (data[0] == 0x89 && data[1] == 0x50 && data[2] == 0x4E && data[3] == 0x47) {
-        return FileType::PNG;
+
+    // Each run as one span, cut into requests that are in flight together
+    std::vector<ByteRange> extents = cluster.extents;
+    if (extents.empty()) {
+        uint64_t offset = cluster.startSector * kSectorSize;
+        uint64_t runLength = (cluster.endSector - cluster.startSector + 1) * kSectorSize;
+        if (cluster.size > 0 && cluster.size < runLength) {
+            runLength = cluster.size;
+        }
+        extents.push_back({offset, runLength});
     }
-    
-    // MP4
-    if (size >= 8 && memcmp(data + 4, "ftyp", 4) == 0) {
-        return FileType::MP4;
+    size_t length = 0;
+    for (const auto& extent : extents) {
+        length += static_cast<size_t>(extent.length);
     }
-    
-    // PDF
-    if (memcmp(data, "%PDF", 4) == 0) {
-        return FileType::PDF;
+
+    if (!fileData.buffer.allocate(length)) {
+        LOGE("Cannot allocate %zu bytes for cluster", length);
+        close(fd);
+        return fileData;
     }
-    
-    return FileType::UNKNOWN;
+    fileData.data = fileData.buffer.data();
+    AsyncReader reader;
+    bool async = reader.open(fd, AsyncReader::Options());
+    for (const auto& extent : extents) {
+        size_t runLength = static_cast<size_t>(extent.length);
+        uint8_t* out = fileData.data + fileData.size;
+        size_t n = async ? reader.read(out, runLength, extent.offset)
+                         : BlockReader::readFully(fd, out, runLength, extent.offset);
+        fileData.size += n;
+        if (n < runLength) break;
+    }
+    reader.close();
+    close(fd);
+
+    fileData.isValid = fileData.size == length;
+    if (!fileData.isValid) {
+        LOGE("Short read reconstructing cluster: %zu of %zu bytes", fileData.size, length);
+    }
+    return fileData;
+}
+
+FileType DiskScanner::identifyBySignature(const uint8_t* data, size_t size) {
+    if (size < 4) return FileType::UNKNOWN;
+    return identifySignature(data, size);
 }
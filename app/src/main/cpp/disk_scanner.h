@@ -2,39 +2,34 @@
 #ifndef DISK_SCANNER_H
 #define DISK_SCANNER_H
 
+#include "file_types.h"
+#include "block_reader.h"
+#include "memory_budget.h"
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
-enum class FileType {
-    UNKNOWN,
-    JPEG,
-    PNG,
-    GIF,
-    MP4,
-    MP3,
-    PDF,
-    ZIP,
-    DOC,
-    DOCX
-};
+class FatReader;
+class F2fsReader;
 
 struct FileCluster {
-    uint32_t startSector;
-    uint32_t endSector;
+    uint64_t startSector;
+    uint64_t endSector;
     size_t size;
     bool isDeleted;
+    std::string name;               // Path on the volume when a directory entry named the file; on F2FS
+                                    // the bare name the inode kept
+    std::vector<ByteRange> extents; // Runs in file order for a fragmented file; empty for one run
 };
 
 struct FileData {
     uint8_t* data;
     size_t size;
     bool isValid;
+    BudgetBuffer buffer; // Owns data; spilled to disk when it does not fit the memory budget
     
     FileData() : data(nullptr), size(0), isValid(false) {}
-    ~FileData() {
-        delete[] data;
-    }
 };
 
 class DiskScanner {
@@ -46,6 +41,13 @@ public:
     std::vector<FileCluster> scanDeletedClusters();
     FileData reconstructFile(const FileCluster& cluster);
     FileType identifyBySignature(const uint8_t* data, size_t size);
+
+private:
+    static const size_t kSectorSize = 512;
+
+    std::string devicePath_;
+    std::unique_ptr<FatReader> fat_;   // Set when the device holds a FAT32 or exFAT volume
+    std::unique_ptr<F2fsReader> f2fs_; // Set when it holds F2FS
 };
 
 #endif // DISK_SCANNER_H
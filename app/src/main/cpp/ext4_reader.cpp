@@ -0,0 +1,524 @@
+#include "ext4_reader.h"
+#include "byte_order.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define LOG_TAG "Ext4Reader"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const uint64_t kSuperblockOffset = 1024;
+const size_t kSuperblockSize = 1024;
+const uint16_t kExt4Magic = 0xEF53;
+
+const uint32_t kIncompat64Bit = 0x80;
+const uint32_t kIncompatMetaBg = 0x10;
+// Group descriptor checksums, which keep itable_unused and the uninit flags trustworthy
+const uint32_t kRoCompatGdtCsum = 0x10;
+const uint32_t kRoCompatMetadataCsum = 0x400;
+
+// Bitmap blocks fetched per read when consecutive groups keep them side by side (flex_bg)
+const uint32_t kBitmapBatch = 64;
+
+const uint16_t kExtentMagic = 0xF30A;
+const int kMaxExtentDepth = 5;
+const uint32_t kUnwrittenLength = 32768; // ee_len above this marks an unwritten extent
+
+const uint32_t kDirectBlocks = 12;
+// Inode table bytes fetched per read by the deleted-inode sweep
+const size_t kInodeTableBatch = 1024 * 1024;
+
+// Adds one mapped block, extending the last extent when it continues it
+void appendBlock(std::vector<Ext4Extent>& extents, uint64_t logical, uint64_t physical) {
+    if (!extents.empty()) {
+        Ext4Extent& last = extents.back();
+        if (last.logical + last.length == logical && last.physical + last.length == physical &&
+            last.length < UINT32_MAX) {
+            last.length++;
+            return;
+        }
+    }
+    extents.push_back({logical, physical, 1, false});
+}
+
+} // namespace
+
+Ext4Reader::Ext4Reader()
+        : fd_(-1), blockSize_(0), blockCount_(0), firstDataBlock_(0), blocksPerGroup_(0),
+          inodesPerGroup_(0), inodeSize_(0), descSize_(0), featureIncompat_(0), featureRoCompat_(0),
+          journalInode_(0) {
+}
+
+Ext4Reader::~Ext4Reader() {
+    close();
+}
+
+bool Ext4Reader::probe(const std::string& devicePath) {
+    int fd = ::open(devicePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint8_t magic[2];
+    bool isExt4 = BlockReader::readFully(fd, magic, sizeof(magic), kSuperblockOffset + 0x38) == sizeof(magic) &&
+                  readLe16(magic) == kExt4Magic;
+    ::close(fd);
+    return isExt4;
+}
+
+bool Ext4Reader::open(const std::string& devicePath) {
+    close();
+
+    fd_ = ::open(devicePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        LOGE("Cannot open device: %s", devicePath.c_str());
+        return false;
+    }
+
+    if (!readSuperblock() || !readGroupDescriptors()) {
+        close();
+        return false;
+    }
+
+    LOGI("ext4 on %s: %llu blocks of %u bytes, %zu groups", devicePath.c_str(),
+         static_cast<unsigned long long>(blockCount_), blockSize_, groups_.size());
+    return true;
+}
+
+void Ext4Reader::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    groups_.clear();
+}
+
+bool Ext4Reader::readSuperblock() {
+    uint8_t sb[kSuperblockSize];
+    if (BlockReader::readFully(fd_, sb, sizeof(sb), kSuperblockOffset) != sizeof(sb)) {
+        LOGE("Cannot read superblock");
+        return false;
+    }
+
+    if (readLe16(sb + 0x38) != kExt4Magic) {
+        LOGE("Not an ext2/3/4 filesystem");
+        return false;
+    }
+
+    uint32_t logBlockSize = readLe32(sb + 0x18);
+    if (logBlockSize > 6) {
+        LOGE("Unsupported block size exponent: %u", logBlockSize);
+        return false;
+    }
+
+    blockSize_ = 1024u << logBlockSize;
+    firstDataBlock_ = readLe32(sb + 0x14);
+    blocksPerGroup_ = readLe32(sb + 0x20);
+    inodesPerGroup_ = readLe32(sb + 0x28);
+    featureIncompat_ = readLe32(sb + 0x60);
+    featureRoCompat_ = readLe32(sb + 0x64);
+    inodeSize_ = readLe32(sb + 0x4C) >= 1 ? readLe16(sb + 0x58) : 128;
+    journalInode_ = readLe32(sb + 0xE0);
+
+    blockCount_ = readLe32(sb + 0x04);
+    descSize_ = 32;
+    if (featureIncompat_ & kIncompat64Bit) {
+        blockCount_ |= static_cast<uint64_t>(readLe32(sb + 0x150)) << 32;
+        descSize_ = std::max<uint32_t>(readLe16(sb + 0xFE), 32);
+    }
+
+    if (blocksPerGroup_ == 0 || inodesPerGroup_ == 0 || blockCount_ <= firstDataBlock_) {
+        LOGE("Corrupt superblock geometry");
+        return false;
+    }
+    if (featureIncompat_ & kIncompatMetaBg) {
+        LOGE("meta_bg group descriptor layout is not supported");
+        return false;
+    }
+    return true;
+}
+
+bool Ext4Reader::readGroupDescriptors() {
+    uint64_t groupCount = (blockCount_ - firstDataBlock_ + blocksPerGroup_ - 1) / blocksPerGroup_;
+    size_t tableBytes = static_cast<size_t>(groupCount * descSize_);
+    uint32_t tableBlocks = static_cast<uint32_t>((tableBytes + blockSize_ - 1) / blockSize_);
+
+    std::vector<uint8_t> table(static_cast<size_t>(tableBlocks) * blockSize_);
+    if (!readBlocks(firstDataBlock_ + 1, tableBlocks, table.data())) {
+        LOGE("Cannot read group descriptor table");
+        return false;
+    }
+
+    groups_.resize(static_cast<size_t>(groupCount));
+    for (size_t g = 0; g < groups_.size(); ++g) {
+        const uint8_t* d = table.data() + g * descSize_;
+        Ext4GroupDesc& desc = groups_[g];
+        desc.blockBitmap = readLe32(d + 0x00);
+        desc.inodeBitmap = readLe32(d + 0x04);
+        desc.inodeTable = readLe32(d + 0x08);
+        desc.freeBlocks = readLe16(d + 0x0C);
+        desc.freeInodes = readLe16(d + 0x0E);
+        desc.flags = readLe16(d + 0x12);
+        desc.itableUnused = readLe16(d + 0x1C);
+        if (descSize_ >= 64) {
+            desc.blockBitmap |= static_cast<uint64_t>(readLe32(d + 0x20)) << 32;
+            desc.inodeBitmap |= static_cast<uint64_t>(readLe32(d + 0x24)) << 32;
+            desc.inodeTable |= static_cast<uint64_t>(readLe32(d + 0x28)) << 32;
+            desc.freeBlocks |= static_cast<uint32_t>(readLe16(d + 0x2C)) << 16;
+            desc.freeInodes |= static_cast<uint32_t>(readLe16(d + 0x2E)) << 16;
+            desc.itableUnused |= static_cast<uint32_t>(readLe16(d + 0x32)) << 16;
+        }
+    }
+    return true;
+}
+
+uint32_t Ext4Reader::blocksInGroup(uint32_t group) const {
+    uint64_t groupStart = firstDataBlock_ + static_cast<uint64_t>(group) * blocksPerGroup_;
+    return static_cast<uint32_t>(std::min<uint64_t>(blocksPerGroup_, blockCount_ - groupStart));
+}
+
+bool Ext4Reader::readBlocks(uint64_t block, uint32_t count, uint8_t* buffer) const {
+    size_t length = static_cast<size_t>(count) * blockSize_;
+    return BlockReader::readFully(fd_, buffer, length, block * blockSize_) == length;
+}
+
+bool Ext4Reader::readInode(uint32_t inode, uint8_t* buffer) const {
+    if (inode == 0 || (inode - 1) / inodesPerGroup_ >= groups_.size()) {
+        return false;
+    }
+    uint32_t group = (inode - 1) / inodesPerGroup_;
+    uint64_t offset = groups_[group].inodeTable * blockSize_ +
+                      static_cast<uint64_t>((inode - 1) % inodesPerGroup_) * inodeSize_;
+    return BlockReader::readFully(fd_, buffer, inodeSize_, offset) == inodeSize_;
+}
+
+Ext4Inode Ext4Inode::parse(const uint8_t* raw) {
+    Ext4Inode inode;
+    inode.mode = readLe16(raw + 0x00);
+    inode.size = readLe32(raw + 0x04) | (static_cast<uint64_t>(readLe32(raw + 0x6C)) << 32);
+    inode.dtime = readLe32(raw + 0x14);
+    inode.links = readLe16(raw + 0x1A);
+    inode.flags = readLe32(raw + 0x20);
+    inode.blockMap = raw + 0x28;
+    return inode;
+}
+
+bool Ext4Reader::mapExtents(const Ext4Inode& inode, const BlockSource& source,
+                            std::vector<Ext4Extent>& extents) const {
+    extents.clear();
+    if (!(inode.flags & Ext4Inode::kFlagExtents)) {
+        return false;
+    }
+    if (!mapExtentNode(inode.blockMap, 60, -1, source, extents)) {
+        return false;
+    }
+    std::sort(extents.begin(), extents.end(), [](const Ext4Extent& a, const Ext4Extent& b) {
+        return a.logical < b.logical;
+    });
+    return true;
+}
+
+bool Ext4Reader::mapExtentNode(const uint8_t* node, size_t nodeSize, int depth, const BlockSource& source,
+                               std::vector<Ext4Extent>& extents) const {
+    // 12-byte header, then 12-byte entries: leaves below depth 0, indexes above
+    if (nodeSize < 12 || readLe16(node) != kExtentMagic) {
+        return false;
+    }
+    uint16_t entries = readLe16(node + 2);
+    uint16_t nodeDepth = readLe16(node + 6);
+    if ((depth >= 0 && nodeDepth != depth) || nodeDepth > kMaxExtentDepth || 12 + entries * 12u > nodeSize) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < entries; ++i) {
+        const uint8_t* entry = node + 12 + i * 12;
+        if (nodeDepth == 0) {
+            uint32_t length = readLe16(entry + 4);
+            Ext4Extent extent;
+            extent.logical = readLe32(entry);
+            extent.physical = readLe32(entry + 8) | (static_cast<uint64_t>(readLe16(entry + 6)) << 32);
+            extent.unwritten = length > kUnwrittenLength;
+            extent.length = extent.unwritten ? length - kUnwrittenLength : length;
+            if (extent.length == 0 || extent.physical + extent.length > blockCount_) {
+                return false;
+            }
+            extents.push_back(extent);
+            continue;
+        }
+
+        uint64_t child = readLe32(entry + 4) | (static_cast<uint64_t>(readLe16(entry + 8)) << 32);
+        std::vector<uint8_t> block(blockSize_);
+        if (child >= blockCount_ || !source(child, block.data()) ||
+            !mapExtentNode(block.data(), block.size(), nodeDepth - 1, source, extents)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Ext4Reader::mapBlocks(const Ext4Inode& inode, const BlockSource& source,
+                           std::vector<Ext4Extent>& extents) const {
+    extents.clear();
+    if (inode.flags & (Ext4Inode::kFlagExtents | Ext4Inode::kFlagInlineData)) {
+        return false;
+    }
+
+    const uint64_t end = (inode.size + blockSize_ - 1) / blockSize_;
+    uint64_t logical = 0;
+    for (uint32_t i = 0; i < kDirectBlocks && logical < end; ++i, ++logical) {
+        uint32_t physical = readLe32(inode.blockMap + i * 4);
+        if (physical >= blockCount_) return false;
+        if (physical != 0) appendBlock(extents, logical, physical);
+    }
+    for (int depth = 1; depth <= 3 && logical < end; ++depth) {
+        uint32_t block = readLe32(inode.blockMap + (kDirectBlocks + depth - 1) * 4);
+        if (!mapIndirect(block, depth, source, logical, end, extents)) return false;
+    }
+    return true;
+}
+
+bool Ext4Reader::mapIndirect(uint64_t block, int depth, const BlockSource& source, uint64_t& logical,
+                             uint64_t end, std::vector<Ext4Extent>& extents) const {
+    const uint32_t pointers = blockSize_ / 4;
+    uint64_t span = 1; // File blocks under one pointer of this block
+    for (int d = 1; d < depth; ++d) span *= pointers;
+
+    if (block == 0) {
+        logical = std::min(end, logical + span * pointers);
+        return true;
+    }
+    std::vector<uint8_t> data(blockSize_);
+    if (block >= blockCount_ || !source(block, data.data())) {
+        return false;
+    }
+    for (uint32_t i = 0; i < pointers && logical < end; ++i) {
+        uint32_t child = readLe32(data.data() + i * 4);
+        if (depth > 1) {
+            if (!mapIndirect(child, depth - 1, source, logical, end, extents)) return false;
+            continue;
+        }
+        if (child >= blockCount_) return false;
+        if (child != 0) appendBlock(extents, logical, child);
+        ++logical;
+    }
+    return true;
+}
+
+bool Ext4Reader::fileRanges(const std::vector<Ext4Extent>& extents, uint64_t size,
+                            std::vector<ByteRange>& ranges) const {
+    ranges.clear();
+    uint64_t covered = 0;
+    for (const auto& extent : extents) {
+        if (covered >= size) break;
+        if (extent.logical * blockSize_ != covered || extent.unwritten) break;
+        uint64_t offset = extent.physical * blockSize_;
+        uint64_t length = std::min<uint64_t>(static_cast<uint64_t>(extent.length) * blockSize_, size - covered);
+        if (!ranges.empty() && ranges.back().offset + ranges.back().length == offset) {
+            ranges.back().length += length;
+        } else {
+            ranges.push_back({offset, length});
+        }
+        covered += length;
+    }
+    return covered == size;
+}
+
+std::vector<Ext4DeletedFile> Ext4Reader::deletedInodes(const StopCheck& stop) const {
+    std::vector<Ext4DeletedFile> files;
+    if (!isOpen()) return files;
+
+    const bool tracked = (featureRoCompat_ & (kRoCompatGdtCsum | kRoCompatMetadataCsum)) != 0;
+    const uint32_t batchBlocks = std::max<uint32_t>(1, static_cast<uint32_t>(kInodeTableBatch / blockSize_));
+    BudgetLease lease(static_cast<size_t>(batchBlocks) * blockSize_);
+    std::vector<uint8_t> table(static_cast<size_t>(batchBlocks) * blockSize_);
+    auto fromDevice = [this](uint64_t block, uint8_t* buffer) { return readBlocks(block, 1, buffer); };
+    std::vector<Ext4Extent> extents;
+    uint64_t swept = 0;
+
+    bool stopped = false;
+    for (uint32_t g = 0; g < groups_.size() && !stopped; ++g) {
+        // Inodes past the high-water mark were never handed out, so never deleted either
+        uint32_t used = inodesPerGroup_;
+        if (tracked) {
+            if (groups_[g].flags & kGroupInodeUninit) continue;
+            used -= std::min(groups_[g].itableUnused, inodesPerGroup_);
+        }
+        if (used == 0) continue;
+
+        uint32_t tableBlocks = static_cast<uint32_t>((static_cast<uint64_t>(used) * inodeSize_ + blockSize_ - 1) /
+                                                     blockSize_);
+        for (uint32_t first = 0; first < tableBlocks; first += batchBlocks) {
+            if (stop && stop()) {
+                stopped = true;
+                break;
+            }
+            uint32_t count = std::min(batchBlocks, tableBlocks - first);
+            if (!readBlocks(groups_[g].inodeTable + first, count, table.data())) {
+                LOGE("Cannot read inode table of group %u", g);
+                break;
+            }
+            uint32_t firstIndex = static_cast<uint32_t>(static_cast<uint64_t>(first) * blockSize_ / inodeSize_);
+            uint32_t inodes = std::min<uint32_t>(count * (blockSize_ / inodeSize_), used - firstIndex);
+            swept += inodes;
+            for (uint32_t i = 0; i < inodes; ++i) {
+                Ext4Inode inode = Ext4Inode::parse(table.data() + static_cast<size_t>(i) * inodeSize_);
+                if (inode.dtime == 0 || inode.links != 0 || !inode.isRegular() || inode.size == 0) continue;
+
+                bool mapped = (inode.flags & Ext4Inode::kFlagExtents) ? mapExtents(inode, fromDevice, extents)
+                                                                      : mapBlocks(inode, fromDevice, extents);
+                Ext4DeletedFile file = {g * inodesPerGroup_ + firstIndex + i + 1, inode.dtime, inode.size, {}};
+                if (mapped && fileRanges(extents, inode.size, file.extents)) {
+                    files.push_back(std::move(file));
+                }
+            }
+        }
+    }
+
+    // Blocks allocated to another file since would give back its data instead
+    if (!files.empty()) {
+        std::vector<ByteRange> unallocated = freeExtents();
+        auto isFree = [&unallocated](const ByteRange& extent) {
+            auto next = std::upper_bound(unallocated.begin(), unallocated.end(), extent.offset,
+                                         [](uint64_t offset, const ByteRange& range) { return offset < range.offset; });
+            return next != unallocated.begin() &&
+                   extent.offset + extent.length <= (next - 1)->offset + (next - 1)->length;
+        };
+        files.erase(std::remove_if(files.begin(), files.end(), [&](const Ext4DeletedFile& file) {
+            return !std::all_of(file.extents.begin(), file.extents.end(), isFree);
+        }), files.end());
+    }
+
+    LOGI("Inode sweep: %llu inodes read, %zu deleted files still mapped%s", static_cast<unsigned long long>(swept),
+         files.size(), stopped ? " (stopped)" : "");
+    return files;
+}
+
+std::vector<ByteRange> Ext4Reader::freeExtents() const {
+    std::vector<ByteRange> extents;
+    forEachFreeExtent([&extents](const ByteRange& extent) {
+        extents.push_back(extent);
+        return true;
+    });
+    return extents;
+}
+
+ByteRange Ext4Reader::groupRange(uint32_t group) const {
+    uint64_t groupStart = firstDataBlock_ + static_cast<uint64_t>(group) * blocksPerGroup_;
+    return {groupStart * blockSize_, static_cast<uint64_t>(blocksInGroup(group)) * blockSize_};
+}
+
+bool Ext4Reader::forEachBitmap(const std::function<bool(uint32_t, const uint8_t*)>& visitor) const {
+    if (!isOpen()) return false;
+
+    BudgetLease lease(static_cast<size_t>(kBitmapBatch) * blockSize_);
+    std::vector<uint8_t> bitmaps(static_cast<size_t>(kBitmapBatch) * blockSize_);
+    uint32_t groupCount = static_cast<uint32_t>(groups_.size());
+    uint32_t g = 0;
+    while (g < groupCount) {
+        if (groups_[g].flags & kGroupBlockUninit) {
+            ++g;
+            continue;
+        }
+
+        // Batch groups whose bitmaps sit in consecutive blocks
+        uint32_t batch = 1;
+        while (g + batch < groupCount && batch < kBitmapBatch &&
+               !(groups_[g + batch].flags & kGroupBlockUninit) &&
+               groups_[g + batch].blockBitmap == groups_[g].blockBitmap + batch) {
+            ++batch;
+        }
+
+        if (!readBlocks(groups_[g].blockBitmap, batch, bitmaps.data())) {
+            LOGE("Cannot read block bitmap of group %u", g);
+            g += batch;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < batch; ++i) {
+            if (!visitor(g + i, bitmaps.data() + static_cast<size_t>(i) * blockSize_)) {
+                return false;
+            }
+        }
+        g += batch;
+    }
+    return true;
+}
+
+std::vector<uint64_t> Ext4Reader::bitmapChecksums() const {
+    std::vector<uint64_t> checksums(groups_.size(), 0);
+    forEachBitmap([this, &checksums](uint32_t group, const uint8_t* bitmap) {
+        // FNV-1a over the bits that map real blocks; padding bits past the end are ignored
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        size_t bytes = (blocksInGroup(group) + 7) / 8;
+        for (size_t i = 0; i < bytes; ++i) {
+            hash = (hash ^ bitmap[i]) * 0x100000001b3ULL;
+        }
+        checksums[group] = hash | 1; // Never 0, which marks uninitialised groups
+        return true;
+    });
+    return checksums;
+}
+
+bool Ext4Reader::forEachFreeExtent(const std::function<bool(const ByteRange&)>& visitor) const {
+    if (!isOpen()) return false;
+
+    uint64_t freeBlocks = 0;
+    uint64_t extentCount = 0;
+    uint64_t runStart = 0;
+    uint64_t runLength = 0;
+    bool stopped = false;
+
+    auto emitRun = [&]() {
+        if (runLength > 0 && !stopped) {
+            stopped = !visitor({runStart * blockSize_, runLength * blockSize_});
+            freeBlocks += runLength;
+            extentCount++;
+        }
+        runLength = 0;
+    };
+    auto addFree = [&](uint64_t block, uint64_t count) {
+        if (runLength > 0 && runStart + runLength == block) {
+            runLength += count;
+        } else {
+            emitRun();
+            runStart = block;
+            runLength = count;
+        }
+    };
+
+    forEachBitmap([&](uint32_t group, const uint8_t* bitmap) {
+        uint64_t groupStart = firstDataBlock_ + static_cast<uint64_t>(group) * blocksPerGroup_;
+        uint32_t blocks = blocksInGroup(group);
+
+        uint32_t bit = 0;
+        while (bit < blocks) {
+            // Whole 64-block words first, single bits at the edges
+            if ((bit & 63) == 0 && bit + 64 <= blocks) {
+                uint64_t word = readLe64(bitmap + bit / 8);
+                if (word == 0) {
+                    addFree(groupStart + bit, 64);
+                    bit += 64;
+                    continue;
+                }
+                if (word == ~0ULL) {
+                    bit += 64;
+                    continue;
+                }
+            }
+            if (!(bitmap[bit / 8] & (1u << (bit & 7)))) {
+                addFree(groupStart + bit, 1);
+            }
+            ++bit;
+        }
+        return !stopped;
+    });
+    emitRun();
+
+    LOGI("Free space: %llu of %llu blocks in %llu extents",
+         static_cast<unsigned long long>(freeBlocks), static_cast<unsigned long long>(blockCount_),
+         static_cast<unsigned long long>(extentCount));
+    return !stopped;
+}
@@ -0,0 +1,142 @@
+#ifndef EXT4_READER_H
+#define EXT4_READER_H
+
+#include "block_reader.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+struct Ext4GroupDesc {
+    uint64_t blockBitmap;
+    uint64_t inodeBitmap;
+    uint64_t inodeTable;
+    uint32_t freeBlocks;
+    uint32_t freeInodes;
+    uint32_t itableUnused;
+    uint16_t flags;
+};
+
+// One run of a file's blocks from its extent tree
+struct Ext4Extent {
+    uint64_t logical;  // First file block
+    uint64_t physical; // First filesystem block
+    uint32_t length;   // Blocks
+    bool unwritten;    // Allocated but never written; reads as zeros
+};
+
+// The inode fields recovery needs, decoded from a raw on-disk inode
+struct Ext4Inode {
+    static const uint16_t kTypeMask = 0xF000;
+    static const uint16_t kTypeRegular = 0x8000;
+    static const uint16_t kTypeDirectory = 0x4000;
+    static const uint32_t kFlagExtents = 0x80000;
+    static const uint32_t kFlagInlineData = 0x10000000;
+
+    uint16_t mode;
+    uint16_t links;
+    uint32_t dtime;  // Set when the inode was freed
+    uint32_t flags;
+    uint64_t size;
+    const uint8_t* blockMap; // i_block inside the raw inode, 60 bytes: extent tree root or block map
+
+    static Ext4Inode parse(const uint8_t* raw);
+    bool isRegular() const { return (mode & kTypeMask) == kTypeRegular; }
+    bool isDirectory() const { return (mode & kTypeMask) == kTypeDirectory; }
+    bool isDeleted() const { return mode == 0 || links == 0 || dtime != 0; }
+};
+
+// A deleted file whose own inode table entry still maps its data
+struct Ext4DeletedFile {
+    uint32_t inode;
+    uint32_t dtime;
+    uint64_t size;
+    std::vector<ByteRange> extents; // Byte ranges on the device in file order, clipped to size
+};
+
+// Read-only view of an ext4 filesystem on a block device or image file
+class Ext4Reader {
+public:
+    static const uint16_t kGroupInodeUninit = 0x1;
+    static const uint16_t kGroupBlockUninit = 0x2;
+
+    Ext4Reader();
+    ~Ext4Reader();
+
+    bool open(const std::string& devicePath);
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+
+    uint32_t blockSize() const { return blockSize_; }
+    uint64_t blockCount() const { return blockCount_; }
+    uint32_t blocksPerGroup() const { return blocksPerGroup_; }
+    uint32_t inodesPerGroup() const { return inodesPerGroup_; }
+    uint32_t inodeSize() const { return inodeSize_; }
+    uint32_t journalInode() const { return journalInode_; }
+    // Blocks one group's inode table takes
+    uint32_t inodeTableBlocks() const { return (inodesPerGroup_ * inodeSize_ + blockSize_ - 1) / blockSize_; }
+    const std::vector<Ext4GroupDesc>& groups() const { return groups_; }
+
+    // Byte ranges of every unallocated block run. Groups whose bitmap was
+    // never initialised have never held data and are left out.
+    std::vector<ByteRange> freeExtents() const;
+    // Same walk without materialising the list; the visitor returns false to stop
+    bool forEachFreeExtent(const std::function<bool(const ByteRange&)>& visitor) const;
+    // One checksum per group over its block bitmap, 0 for never-initialised
+    // groups. Equal checksums mean the group's free space is unchanged.
+    std::vector<uint64_t> bitmapChecksums() const;
+    // Bytes covered by a block group
+    ByteRange groupRange(uint32_t group) const;
+
+    bool readBlocks(uint64_t block, uint32_t count, uint8_t* buffer) const;
+    // Raw on-disk inode, inodeSize() bytes
+    bool readInode(uint32_t inode, uint8_t* buffer) const;
+
+    // Reads one block of an extent tree, possibly from somewhere other than the device
+    using BlockSource = std::function<bool(uint64_t block, uint8_t* buffer)>;
+    // Extents of an inode using an extent tree, in logical order; index
+    // blocks below the root come from source. False if the tree is damaged.
+    bool mapExtents(const Ext4Inode& inode, const BlockSource& source, std::vector<Ext4Extent>& extents) const;
+    // Blocks of an inode using the ext2/ext3 block map, in logical order:
+    // twelve direct pointers, then single, double and triple indirect blocks
+    // from source. Holes are left out. False if a pointer is out of range.
+    bool mapBlocks(const Ext4Inode& inode, const BlockSource& source, std::vector<Ext4Extent>& extents) const;
+    // Byte ranges holding the first size bytes of a file, from its extents in
+    // logical order; false if a hole or an unwritten extent comes first
+    bool fileRanges(const std::vector<Ext4Extent>& extents, uint64_t size, std::vector<ByteRange>& ranges) const;
+
+    // Regular files freed with dtime set whose extent tree or block map still
+    // covers their whole size, on blocks that are all still free. Inode tables
+    // are read in large batches, and groups the descriptors mark as never
+    // holding inodes are skipped. A stop ends the sweep with what it found so far.
+    std::vector<Ext4DeletedFile> deletedInodes(const StopCheck& stop = nullptr) const;
+
+    static bool probe(const std::string& devicePath);
+
+private:
+    bool readSuperblock();
+    bool readGroupDescriptors();
+    uint32_t blocksInGroup(uint32_t group) const;
+    bool mapExtentNode(const uint8_t* node, size_t nodeSize, int depth, const BlockSource& source,
+                       std::vector<Ext4Extent>& extents) const;
+    // Maps the pointers below an indirect block of the given depth, advancing logical up to end
+    bool mapIndirect(uint64_t block, int depth, const BlockSource& source, uint64_t& logical, uint64_t end,
+                     std::vector<Ext4Extent>& extents) const;
+    // Visits the block bitmap of every initialised group in order
+    bool forEachBitmap(const std::function<bool(uint32_t, const uint8_t*)>& visitor) const;
+
+    int fd_;
+    uint32_t blockSize_;
+    uint64_t blockCount_;
+    uint32_t firstDataBlock_;
+    uint32_t blocksPerGroup_;
+    uint32_t inodesPerGroup_;
+    uint32_t inodeSize_;
+    uint32_t descSize_;
+    uint32_t featureIncompat_;
+    uint32_t featureRoCompat_;
+    uint32_t journalInode_;
+    std::vector<Ext4GroupDesc> groups_;
+};
+
+#endif // EXT4_READER_H
@@ -0,0 +1,112 @@
+#include "extent_copier.h"
+#include <android/log.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#define LOG_TAG "ExtentCopier"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+uint64_t ExtentCopier::copy(int inFd, uint64_t inOffset, uint64_t length, int outFd) {
+    uint64_t remaining = length;
+    uint64_t copied = 0;
+
+    if (inFd < 0 || outFd < 0 || length == 0) {
+        return 0;
+    }
+
+    // Each stage copies what it can and leaves the rest to the next fallback
+    if (!tryCopyFileRange(inFd, inOffset, remaining, outFd, copied) && remaining > 0) {
+        if (!trySendfile(inFd, inOffset, remaining, outFd, copied) && remaining > 0) {
+            copyBuffered(inFd, inOffset, remaining, outFd, copied);
+        }
+    }
+
+    if (remaining > 0) {
+        LOGE("Copied %llu of %llu bytes", static_cast<unsigned long long>(copied),
+             static_cast<unsigned long long>(length));
+    }
+    return copied;
+}
+
+bool ExtentCopier::tryCopyFileRange(int inFd, uint64_t& inOffset, uint64_t& remaining, int outFd,
+                                    uint64_t& copied) {
+#ifdef __NR_copy_file_range
+    while (remaining > 0) {
+        loff_t offIn = static_cast<loff_t>(inOffset);
+        size_t chunk = static_cast<size_t>(std::min(remaining, kChunkSize));
+        // Called through syscall(): bionic only exposes the wrapper from API 34
+        long n = syscall(__NR_copy_file_range, inFd, &offIn, outFd, nullptr, chunk, 0u);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Not supported for this pair (block device source, cross-fs, old kernel)
+            return false;
+        }
+        if (n == 0) return copied > 0;
+        inOffset += static_cast<uint64_t>(n);
+        remaining -= static_cast<uint64_t>(n);
+        copied += static_cast<uint64_t>(n);
+    }
+    return true;
+#else
+    (void) inFd; (void) inOffset; (void) remaining; (void) outFd; (void) copied;
+    return false;
+#endif
+}
+
+bool ExtentCopier::trySendfile(int inFd, uint64_t& inOffset, uint64_t& remaining, int outFd,
+                               uint64_t& copied) {
+    while (remaining > 0) {
+        off64_t offIn = static_cast<off64_t>(inOffset);
+        size_t chunk = static_cast<size_t>(std::min(remaining, kChunkSize));
+        ssize_t n = sendfile64(outFd, inFd, &offIn, chunk);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return true; // Source ended
+        inOffset += static_cast<uint64_t>(n);
+        remaining -= static_cast<uint64_t>(n);
+        copied += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+void ExtentCopier::copyBuffered(int inFd, uint64_t& inOffset, uint64_t& remaining, int outFd,
+                                uint64_t& copied) {
+    std::vector<uint8_t> buffer(static_cast<size_t>(std::min<uint64_t>(remaining, kBufferSize)));
+
+    while (remaining > 0) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+        ssize_t n = pread64(inFd, buffer.data(), chunk, static_cast<off64_t>(inOffset));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+
+        if (!writeAll(outFd, buffer.data(), static_cast<size_t>(n))) {
+            return;
+        }
+
+        inOffset += static_cast<uint64_t>(n);
+        remaining -= static_cast<uint64_t>(n);
+        copied += static_cast<uint64_t>(n);
+    }
+}
+
+bool ExtentCopier::writeAll(int outFd, const uint8_t* data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t w = write(outFd, data + written, length - written);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            LOGE("Write failed: %s", strerror(errno));
+            return false;
+        }
+        written += static_cast<size_t>(w);
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef EXTENT_COPIER_H
+#define EXTENT_COPIER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Kernel-side copies from a source file or block device into an output fd.
+// copy_file_range is tried first, then sendfile, then a fixed-size buffer,
+// so memory use does not depend on the size of what is being recovered.
+class ExtentCopier {
+public:
+    // Copies length bytes starting at inOffset to the current position of
+    // outFd. Returns the number of bytes copied.
+    static uint64_t copy(int inFd, uint64_t inOffset, uint64_t length, int outFd);
+    static bool writeAll(int outFd, const uint8_t* data, size_t length);
+
+private:
+    static constexpr uint64_t kChunkSize = 16 * 1024 * 1024;
+    static constexpr size_t kBufferSize = 1024 * 1024;
+
+    static bool tryCopyFileRange(int inFd, uint64_t& inOffset, uint64_t& remaining, int outFd, uint64_t& copied);
+    static bool trySendfile(int inFd, uint64_t& inOffset, uint64_t& remaining, int outFd, uint64_t& copied);
+    static void copyBuffered(int inFd, uint64_t& inOffset, uint64_t& remaining, int outFd, uint64_t& copied);
+};
+
+#endif // EXTENT_COPIER_H
@@ -0,0 +1,592 @@
+#include "f2fs_reader.h"
+#include "byte_order.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+#define LOG_TAG "F2fsReader"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const uint64_t kSuperblockOffset = 1024;
+const size_t kSuperblockSize = 3072;
+const uint32_t kF2fsMagic = 0xF2F52010;
+const uint32_t kLogBlockSize = 12;
+const uint32_t kLogBlocksPerSegment = 9;
+
+const uint32_t kFeatureFlexibleInlineXattr = 0x40;
+
+// Checkpoint pack head and tail
+const size_t kCheckpointBitmapOffset = 192;
+const size_t kCheckpointMaxChecksumOffset = 4092;
+const uint32_t kCheckpointCompactSummary = 0x4;
+const uint32_t kCheckpointLargeNatBitmap = 0x400;
+
+// Segment summary blocks: 512 seven-byte entries, the journal, a five-byte footer
+const size_t kSummaryJournalOffset = 512 * 7;
+const size_t kSummaryJournalSize = 507;
+
+const size_t kNatEntrySize = 9;
+const uint32_t kNatEntriesPerBlock = 4096 / kNatEntrySize;
+const size_t kNatJournalEntrySize = 4 + kNatEntrySize;
+const size_t kNatJournalEntries = (kSummaryJournalSize - 2) / kNatJournalEntrySize;
+
+const size_t kSitEntrySize = 74;
+const uint32_t kSitEntriesPerBlock = 4096 / kSitEntrySize;
+const size_t kSitJournalEntrySize = 4 + kSitEntrySize;
+const size_t kSitJournalEntries = (kSummaryJournalSize - 2) / kSitJournalEntrySize;
+const size_t kSegmentBitmapSize = 64;
+// SIT segment types 3 to 5 are the hot, warm and cold node logs
+const uint32_t kFirstNodeType = 3;
+const uint32_t kLastNodeType = 5;
+
+const size_t kNodeFooterOffset = 4096 - 24;
+const uint32_t kRootIno = 3;
+
+// Inode layout
+const size_t kInodeAddrOffset = 360;
+const size_t kInodeNidOffset = 4052;
+const uint32_t kAddrsPerInode = 923;
+const uint32_t kAddrsPerBlock = 1018;
+const uint32_t kNidsPerBlock = 1018;
+const uint32_t kDefaultInlineXattrAddrs = 50;
+const uint8_t kInlineXattr = 0x01;
+const uint8_t kInlineData = 0x02;
+const uint8_t kExtraAttr = 0x20;
+const uint8_t kAdviseEncrypted = 0x04;
+const uint32_t kCompressedFlag = 0x04;
+const uint16_t kTypeMask = 0xF000;
+const uint16_t kTypeRegular = 0x8000;
+const size_t kMaxNameLength = 255;
+
+// i_nid slots: two direct nodes, two indirect, one double indirect, with
+// their positions in the node tree
+const uint32_t kNodeOffsets[5] = {1, 2, 3, 4 + kNidsPerBlock, 5 + 2 * kNidsPerBlock};
+const int kNodeDepths[5] = {0, 0, 1, 1, 2};
+
+// Checkpoint checksum: CRC-32 seeded with the magic and not inverted
+uint32_t f2fsChecksum(const uint8_t* data, size_t length) {
+    uint32_t crc = kF2fsMagic;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+        }
+    }
+    return crc;
+}
+
+bool checkpointValid(const uint8_t* block) {
+    uint32_t checksumOffset = readLe32(block + 164);
+    return checksumOffset >= kCheckpointBitmapOffset && checksumOffset <= kCheckpointMaxChecksumOffset &&
+           f2fsChecksum(block, checksumOffset) == readLe32(block + checksumOffset);
+}
+
+// F2FS bitmaps number bits from the most significant end of each byte
+bool testBit(const uint8_t* bitmap, size_t bit) {
+    return (bitmap[bit / 8] & (0x80 >> (bit & 7))) != 0;
+}
+
+} // namespace
+
+F2fsReader::F2fsReader()
+        : fd_(-1), blockCount_(0), features_(0), checkpointBlock_(0), checkpointPayload_(0), sitBlock_(0),
+          sitSegments_(0), natBlock_(0), natSegments_(0), mainBlock_(0), mainSegments_(0), checkpointVersion_(0) {
+}
+
+F2fsReader::~F2fsReader() {
+    close();
+}
+
+// Either of the two superblock copies, in blocks 0 and 1
+bool F2fsReader::readSuperblock(int fd, uint8_t* superblock) {
+    for (uint64_t copy = 0; copy < 2; ++copy) {
+        if (BlockReader::readFully(fd, superblock, kSuperblockSize, copy * kBlockSize + kSuperblockOffset) !=
+            kSuperblockSize) {
+            return false;
+        }
+        if (readLe32(superblock) == kF2fsMagic && readLe32(superblock + 16) == kLogBlockSize &&
+            readLe32(superblock + 20) == kLogBlocksPerSegment) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool F2fsReader::probe(const std::string& devicePath) {
+    int fd = ::open(devicePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint8_t superblock[kSuperblockSize];
+    bool isF2fs = readSuperblock(fd, superblock);
+    ::close(fd);
+    return isF2fs;
+}
+
+bool F2fsReader::open(const std::string& devicePath) {
+    close();
+
+    fd_ = ::open(devicePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        LOGE("Cannot open device: %s", devicePath.c_str());
+        return false;
+    }
+
+    uint8_t superblock[kSuperblockSize];
+    if (!readSuperblock(fd_, superblock)) {
+        LOGE("No F2FS superblock on %s", devicePath.c_str());
+        close();
+        return false;
+    }
+    if (!parseSuperblock(superblock) || !readCheckpoint()) {
+        close();
+        return false;
+    }
+
+    LOGI("F2FS on %s: %llu blocks, %u main segments, checkpoint %llu", devicePath.c_str(),
+         static_cast<unsigned long long>(blockCount_), mainSegments_,
+         static_cast<unsigned long long>(checkpointVersion_));
+    return true;
+}
+
+void F2fsReader::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    valid_.clear();
+    nodeSegments_.clear();
+    natBitmap_.clear();
+    natJournal_.clear();
+}
+
+bool F2fsReader::parseSuperblock(const uint8_t* sb) {
+    blockCount_ = readLe64(sb + 36);
+    sitSegments_ = readLe32(sb + 56);
+    natSegments_ = readLe32(sb + 60);
+    mainSegments_ = readLe32(sb + 68);
+    checkpointBlock_ = readLe32(sb + 76);
+    sitBlock_ = readLe32(sb + 80);
+    natBlock_ = readLe32(sb + 84);
+    mainBlock_ = readLe32(sb + 92);
+    checkpointPayload_ = readLe32(sb + 1664);
+    features_ = readLe32(sb + 2180);
+
+    // Checkpoint, SIT, NAT and SSA areas in order, each SIT and NAT block kept twice
+    bool ordered = checkpointBlock_ < sitBlock_ && sitBlock_ < natBlock_ && natBlock_ < mainBlock_;
+    bool paired = sitSegments_ >= 2 && sitSegments_ % 2 == 0 && natSegments_ >= 2 && natSegments_ % 2 == 0;
+    if (!ordered || !paired || mainSegments_ == 0 || checkpointPayload_ >= kBlocksPerSegment ||
+        mainBlock_ + static_cast<uint64_t>(mainSegments_) * kBlocksPerSegment > blockCount_) {
+        LOGE("Corrupt F2FS superblock geometry");
+        return false;
+    }
+    return true;
+}
+
+// The newer of the two checkpoint packs whose head and tail agree
+bool F2fsReader::readCheckpoint() {
+    const size_t headBlocks = 1 + checkpointPayload_;
+    std::vector<uint8_t> head;
+    std::vector<uint8_t> candidate(headBlocks * kBlockSize);
+    std::vector<uint8_t> tail(kBlockSize);
+    uint32_t packStart = 0;
+    for (uint32_t pack = 0; pack < 2; ++pack) {
+        uint32_t start = checkpointBlock_ + pack * kBlocksPerSegment;
+        if (!readBlocks(start, static_cast<uint32_t>(headBlocks), candidate.data()) ||
+            !checkpointValid(candidate.data())) {
+            continue;
+        }
+        uint32_t packBlocks = readLe32(candidate.data() + 136);
+        uint64_t version = readLe64(candidate.data());
+        if (packBlocks < headBlocks + 1 || packBlocks > kBlocksPerSegment ||
+            !readBlocks(start + packBlocks - 1, 1, tail.data()) || !checkpointValid(tail.data()) ||
+            readLe64(tail.data()) != version) {
+            continue;
+        }
+        if (head.empty() || version > checkpointVersion_) {
+            head = candidate;
+            checkpointVersion_ = version;
+            packStart = start;
+        }
+    }
+    if (head.empty()) {
+        LOGE("No valid F2FS checkpoint");
+        return false;
+    }
+
+    // Which copy of each SIT and NAT block is current
+    const uint8_t* cp = head.data();
+    uint32_t flags = readLe32(cp + 132);
+    size_t sitBitmapSize = readLe32(cp + 156);
+    size_t natBitmapSize = readLe32(cp + 160);
+    size_t sitBitmap;
+    size_t natBitmap;
+    if (flags & kCheckpointLargeNatBitmap) {
+        natBitmap = kCheckpointBitmapOffset + 4;
+        sitBitmap = natBitmap + natBitmapSize;
+    } else if (checkpointPayload_ > 0) {
+        natBitmap = kCheckpointBitmapOffset;
+        sitBitmap = kBlockSize;
+    } else {
+        sitBitmap = kCheckpointBitmapOffset;
+        natBitmap = sitBitmap + sitBitmapSize;
+    }
+    if (sitBitmap + sitBitmapSize > head.size() || natBitmap + natBitmapSize > head.size()) {
+        LOGE("Corrupt F2FS checkpoint bitmaps");
+        return false;
+    }
+    natBitmap_.assign(cp + natBitmap, cp + natBitmap + natBitmapSize);
+
+    // SIT and NAT changes since they were last written out sit in the journals
+    // of the hot and cold data summaries
+    bool compact = (flags & kCheckpointCompactSummary) != 0;
+    std::vector<uint8_t> summaries((compact ? 1 : 3) * kBlockSize);
+    if (!readBlocks(packStart + readLe32(cp + 140), compact ? 1 : 3, summaries.data())) {
+        LOGE("Cannot read F2FS checkpoint summaries");
+        return false;
+    }
+    const uint8_t* natJournal = compact ? summaries.data() : summaries.data() + kSummaryJournalOffset;
+    const uint8_t* sitJournal = compact ? summaries.data() + kSummaryJournalSize
+                                        : summaries.data() + 2 * kBlockSize + kSummaryJournalOffset;
+    loadNatJournal(natJournal);
+    return loadSit(std::vector<uint8_t>(cp + sitBitmap, cp + sitBitmap + sitBitmapSize), sitJournal);
+}
+
+bool F2fsReader::loadSit(const std::vector<uint8_t>& sitBitmap, const uint8_t* sitJournal) {
+    valid_.assign(static_cast<size_t>(mainSegments_) * kSegmentBitmapSize, 0);
+    nodeSegments_.assign(mainSegments_, 0);
+    auto applyEntry = [this](uint32_t segment, const uint8_t* entry) {
+        uint32_t type = readLe16(entry) >> 10;
+        memcpy(valid_.data() + static_cast<size_t>(segment) * kSegmentBitmapSize, entry + 2, kSegmentBitmapSize);
+        nodeSegments_[segment] = type >= kFirstNodeType && type <= kLastNodeType;
+    };
+
+    const uint32_t sitBlocks = (mainSegments_ + kSitEntriesPerBlock - 1) / kSitEntriesPerBlock;
+    const uint32_t copyBlocks = sitSegments_ / 2 * kBlocksPerSegment;
+    if (sitBlocks > copyBlocks || sitBlocks > sitBitmap.size() * 8) {
+        LOGE("Corrupt F2FS SIT geometry");
+        return false;
+    }
+    // Blocks taken from the same copy are read together
+    const uint32_t kRun = 256;
+    BudgetLease lease(kRun * kBlockSize);
+    std::vector<uint8_t> buffer(kRun * kBlockSize);
+    for (uint32_t first = 0; first < sitBlocks;) {
+        bool second = testBit(sitBitmap.data(), first);
+        uint32_t count = 1;
+        while (count < kRun && first + count < sitBlocks && testBit(sitBitmap.data(), first + count) == second) {
+            ++count;
+        }
+        if (!readBlocks(sitBlock_ + first + (second ? copyBlocks : 0), count, buffer.data())) {
+            LOGE("Cannot read the F2FS SIT");
+            return false;
+        }
+        for (uint32_t b = 0; b < count; ++b) {
+            uint32_t segment = (first + b) * kSitEntriesPerBlock;
+            for (uint32_t e = 0; e < kSitEntriesPerBlock && segment + e < mainSegments_; ++e) {
+                applyEntry(segment + e, buffer.data() + b * kBlockSize + e * kSitEntrySize);
+            }
+        }
+        first += count;
+    }
+
+    size_t journaled = std::min<size_t>(readLe16(sitJournal), kSitJournalEntries);
+    for (size_t i = 0; i < journaled; ++i) {
+        const uint8_t* entry = sitJournal + 2 + i * kSitJournalEntrySize;
+        uint32_t segment = readLe32(entry);
+        if (segment < mainSegments_) applyEntry(segment, entry + 4);
+    }
+    return true;
+}
+
+void F2fsReader::loadNatJournal(const uint8_t* natJournal) {
+    size_t journaled = std::min<size_t>(readLe16(natJournal), kNatJournalEntries);
+    for (size_t i = 0; i < journaled; ++i) {
+        const uint8_t* entry = natJournal + 2 + i * kNatJournalEntrySize;
+        natJournal_.push_back({readLe32(entry), readLe32(entry + 9)});
+    }
+}
+
+uint32_t F2fsReader::nodeAddress(uint32_t nid, std::vector<uint8_t>& natBlock, uint32_t& natBlockAddress) const {
+    for (const auto& entry : natJournal_) {
+        if (entry.first == nid) return entry.second;
+    }
+
+    // NAT blocks come in pairs of segments, one copy in each
+    uint32_t blockOffset = nid / kNatEntriesPerBlock;
+    uint32_t segment = blockOffset / kBlocksPerSegment;
+    if (segment >= natSegments_ / 2) return 0;
+    uint32_t address = natBlock_ + segment * 2 * kBlocksPerSegment + blockOffset % kBlocksPerSegment;
+    if (blockOffset < natBitmap_.size() * 8 && testBit(natBitmap_.data(), blockOffset)) {
+        address += kBlocksPerSegment;
+    }
+    if (natBlock.size() != kBlockSize || natBlockAddress != address) {
+        natBlock.resize(kBlockSize);
+        if (!readBlocks(address, 1, natBlock.data())) {
+            natBlock.clear();
+            return 0;
+        }
+        natBlockAddress = address;
+    }
+    return readLe32(natBlock.data() + (nid % kNatEntriesPerBlock) * kNatEntrySize + 5);
+}
+
+bool F2fsReader::isBlockValid(uint32_t block) const {
+    if (!inMainArea(block)) return true;
+    return testBit(valid_.data(), block - mainBlock_);
+}
+
+bool F2fsReader::readBlocks(uint32_t block, uint32_t count, uint8_t* buffer) const {
+    size_t length = static_cast<size_t>(count) * kBlockSize;
+    return isOpen() && BlockReader::readFully(fd_, buffer, length, static_cast<uint64_t>(block) * kBlockSize) == length;
+}
+
+bool F2fsReader::readBytes(uint64_t offset, size_t length, uint8_t* buffer) const {
+    return isOpen() && BlockReader::readFully(fd_, buffer, length, offset) == length;
+}
+
+std::vector<ByteRange> F2fsReader::freeExtents() const {
+    std::vector<ByteRange> extents;
+    if (!isOpen()) return extents;
+
+    const uint64_t mainBlocks = static_cast<uint64_t>(mainSegments_) * kBlocksPerSegment;
+    uint64_t freeBlocks = 0;
+    uint64_t runStart = 0;
+    uint64_t runLength = 0;
+    auto emitRun = [&]() {
+        if (runLength > 0) {
+            extents.push_back({(mainBlock_ + runStart) * kBlockSize, runLength * kBlockSize});
+            freeBlocks += runLength;
+        }
+        runLength = 0;
+    };
+
+    for (uint64_t bit = 0; bit < mainBlocks;) {
+        // Whole bytes of invalid or valid blocks first, single bits otherwise
+        uint8_t byte = valid_[bit / 8];
+        if ((bit & 7) == 0 && (byte == 0 || byte == 0xFF)) {
+            if (byte == 0) {
+                if (runLength == 0) runStart = bit;
+                runLength += 8;
+            } else {
+                emitRun();
+            }
+            bit += 8;
+            continue;
+        }
+        if (!testBit(valid_.data(), bit)) {
+            if (runLength == 0) runStart = bit;
+            runLength++;
+        } else {
+            emitRun();
+        }
+        ++bit;
+    }
+    emitRun();
+
+    LOGI("Free space: %llu of %llu main blocks in %zu extents", static_cast<unsigned long long>(freeBlocks),
+         static_cast<unsigned long long>(mainBlocks), extents.size());
+    return extents;
+}
+
+// Invalid blocks of node segments that still carry a plausible node footer
+std::vector<F2fsReader::NodeBlock> F2fsReader::orphanedNodes(const StopCheck& stop) const {
+    std::vector<NodeBlock> nodes;
+    const uint64_t maxNid = static_cast<uint64_t>(natSegments_ / 2) * kBlocksPerSegment * kNatEntriesPerBlock;
+    const uint32_t currentVersion = static_cast<uint32_t>(checkpointVersion_);
+    BudgetLease lease(kBlocksPerSegment * kBlockSize);
+    std::vector<uint8_t> buffer(kBlocksPerSegment * kBlockSize);
+
+    for (uint32_t segment = 0; segment < mainSegments_; ++segment) {
+        if (!nodeSegments_[segment]) continue;
+        if (stop && stop()) break;
+        const uint8_t* bits = valid_.data() + static_cast<size_t>(segment) * kSegmentBitmapSize;
+        for (uint32_t first = 0; first < kBlocksPerSegment;) {
+            if (testBit(bits, first)) {
+                ++first;
+                continue;
+            }
+            uint32_t count = 1;
+            while (first + count < kBlocksPerSegment && !testBit(bits, first + count)) ++count;
+            uint32_t block = mainBlock_ + segment * kBlocksPerSegment + first;
+            if (!readBlocks(block, count, buffer.data())) {
+                LOGE("Cannot read node segment %u", segment);
+                break;
+            }
+            for (uint32_t b = 0; b < count; ++b) {
+                const uint8_t* footer = buffer.data() + b * kBlockSize + kNodeFooterOffset;
+                NodeBlock node = {block + b, readLe32(footer), readLe32(footer + 4), readLe32(footer + 8) >> 3,
+                                  static_cast<uint32_t>(readLe64(footer + 12))};
+                // The upper half of the footer version holds a checkpoint CRC on newer kernels
+                bool plausible = node.nid >= kRootIno && node.nid < maxNid && node.ino >= kRootIno &&
+                                 node.ino < maxNid && node.version != 0 && node.version <= currentVersion &&
+                                 (node.nid == node.ino) == (node.offset == 0);
+                if (plausible) nodes.push_back(node);
+            }
+            first += count;
+        }
+    }
+    return nodes;
+}
+
+bool F2fsReader::mapNode(uint32_t nid, uint32_t ino, uint32_t offset, int depth, uint64_t blocksLeft,
+                         uint32_t version, const std::vector<NodeBlock>& nodes,
+                         std::vector<uint32_t>& addresses) const {
+    if (nid == 0) return false;
+    // Nodes are sorted by id, newest first
+    auto match = std::lower_bound(nodes.begin(), nodes.end(), nid,
+                                  [](const NodeBlock& node, uint32_t value) { return node.nid < value; });
+    for (; match != nodes.end() && match->nid == nid; ++match) {
+        if (match->ino == ino && match->offset == offset && match->version <= version) break;
+    }
+    if (match == nodes.end() || match->nid != nid) return false;
+
+    std::vector<uint8_t> block(kBlockSize);
+    if (!readBlocks(match->block, 1, block.data())) return false;
+    if (depth == 0) {
+        uint64_t count = std::min<uint64_t>(kAddrsPerBlock, blocksLeft);
+        for (uint64_t i = 0; i < count; ++i) {
+            addresses.push_back(readLe32(block.data() + i * 4));
+        }
+        return true;
+    }
+
+    // Each child of an indirect node is a direct node; each child of the
+    // double indirect node is an indirect node followed by its direct nodes
+    const uint64_t span = depth == 1 ? kAddrsPerBlock : static_cast<uint64_t>(kAddrsPerBlock) * kNidsPerBlock;
+    const uint32_t stride = depth == 1 ? 1 : kNidsPerBlock + 1;
+    for (uint32_t i = 0; i < kNidsPerBlock && blocksLeft > 0; ++i) {
+        uint64_t childBlocks = std::min(span, blocksLeft);
+        if (!mapNode(readLe32(block.data() + i * 4), ino, offset + 1 + i * stride, depth - 1, childBlocks, version,
+                     nodes, addresses)) {
+            return false;
+        }
+        blocksLeft -= childBlocks;
+    }
+    return true;
+}
+
+bool F2fsReader::mapInode(const uint8_t* inode, const NodeBlock& node, const std::vector<NodeBlock>& nodes,
+                          F2fsFile& file) const {
+    // File-based encryption leaves nothing readable to recover
+    if ((readLe16(inode) & kTypeMask) != kTypeRegular || (inode[2] & kAdviseEncrypted) ||
+        (readLe32(inode + 80) & kCompressedFlag)) {
+        return false;
+    }
+    file.ino = node.ino;
+    file.size = readLe64(inode + 16);
+    if (file.size == 0) return false;
+
+    size_t nameLength = std::min<size_t>(readLe32(inode + 88), kMaxNameLength);
+    file.name.assign(reinterpret_cast<const char*>(inode + 92), nameLength);
+    std::replace(file.name.begin(), file.name.end(), '/', '_');
+
+    // Extra attributes and inline xattrs take the front and back of i_addr
+    uint8_t inlineFlags = inode[3];
+    uint32_t extraSize = (inlineFlags & kExtraAttr) ? readLe16(inode + kInodeAddrOffset) : 0;
+    uint32_t xattrAddrs = 0;
+    if (inlineFlags & kInlineXattr) {
+        xattrAddrs = (features_ & kFeatureFlexibleInlineXattr) && extraSize > 0
+                     ? readLe16(inode + kInodeAddrOffset + 2)
+                     : kDefaultInlineXattrAddrs;
+    }
+    if (extraSize % 4 != 0 || extraSize / 4 + xattrAddrs + 1 >= kAddrsPerInode) return false;
+    const uint32_t addrsPerInode = kAddrsPerInode - extraSize / 4 - xattrAddrs;
+    const uint8_t* addrs = inode + kInodeAddrOffset + extraSize;
+
+    // Small files keep their data inside the inode block, after one reserved slot
+    if (inlineFlags & kInlineData) {
+        if (file.size > (addrsPerInode - 1) * 4) return false;
+        file.extents = {{static_cast<uint64_t>(node.block) * kBlockSize + kInodeAddrOffset + extraSize + 4, file.size}};
+        return true;
+    }
+
+    const uint64_t blocks = (file.size + kBlockSize - 1) / kBlockSize;
+    std::vector<uint32_t> addresses;
+    for (uint32_t i = 0; i < addrsPerInode && addresses.size() < blocks; ++i) {
+        addresses.push_back(readLe32(addrs + i * 4));
+    }
+    for (int i = 0; i < 5 && addresses.size() < blocks; ++i) {
+        if (!mapNode(readLe32(inode + kInodeNidOffset + i * 4), node.ino, kNodeOffsets[i], kNodeDepths[i],
+                     blocks - addresses.size(), node.version, nodes, addresses)) {
+            return false;
+        }
+    }
+    if (addresses.size() < blocks) return false;
+
+    // Holes, blocks reserved but never written and blocks reused since all
+    // mean the data is not all there
+    file.extents.clear();
+    uint64_t remaining = file.size;
+    for (uint32_t address : addresses) {
+        if (!inMainArea(address) || isBlockValid(address)) return false;
+        uint64_t length = std::min<uint64_t>(kBlockSize, remaining);
+        uint64_t offset = static_cast<uint64_t>(address) * kBlockSize;
+        if (!file.extents.empty() && file.extents.back().offset + file.extents.back().length == offset) {
+            file.extents.back().length += length;
+        } else {
+            file.extents.push_back({offset, length});
+        }
+        remaining -= length;
+    }
+    return true;
+}
+
+std::vector<F2fsFile> F2fsReader::deletedFiles(const StopCheck& stop) const {
+    std::vector<F2fsFile> files;
+    if (!isOpen()) return files;
+
+    std::vector<NodeBlock> nodes = orphanedNodes(stop);
+    // Within one checkpoint a later block in the log is the later write
+    std::sort(nodes.begin(), nodes.end(), [](const NodeBlock& a, const NodeBlock& b) {
+        if (a.nid != b.nid) return a.nid < b.nid;
+        if (a.version != b.version) return a.version > b.version;
+        return a.block > b.block;
+    });
+
+    std::vector<uint8_t> natBlock;
+    uint32_t natBlockAddress = 0;
+    std::vector<uint8_t> inode(kBlockSize);
+    std::vector<uint32_t> generations;
+    size_t inodeVersions = 0;
+    for (size_t i = 0; i < nodes.size() && !(stop && stop());) {
+        const uint32_t ino = nodes[i].nid;
+        size_t end = i;
+        bool inodes = false;
+        while (end < nodes.size() && nodes[end].nid == ino) {
+            inodes = inodes || nodes[end].ino == ino;
+            ++end;
+        }
+
+        // Old versions of a file that still exists are not deleted files
+        if (!inodes || nodeAddress(ino, natBlock, natBlockAddress) != 0) {
+            i = end;
+            continue;
+        }
+        // The inode number may have been reused and freed again; each
+        // generation is a different file, recovered from its newest version
+        // that still maps completely
+        generations.clear();
+        for (; i < end; ++i) {
+            if (nodes[i].ino != ino) continue;
+            ++inodeVersions;
+            if (!readBlocks(nodes[i].block, 1, inode.data())) continue;
+            uint32_t generation = readLe32(inode.data() + 68);
+            if (std::find(generations.begin(), generations.end(), generation) != generations.end()) continue;
+
+            F2fsFile file;
+            if (mapInode(inode.data(), nodes[i], nodes, file)) {
+                generations.push_back(generation);
+                files.push_back(std::move(file));
+            }
+        }
+    }
+    LOGI("%zu orphaned node blocks, %zu inode versions of deleted files map %zu files", nodes.size(),
+         inodeVersions, files.size());
+    return files;
+}
@@ -0,0 +1,100 @@
+#ifndef F2FS_READER_H
+#define F2FS_READER_H
+
+#include "block_reader.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// A deleted file rebuilt from an inode block F2FS left behind
+struct F2fsFile {
+    uint32_t ino;
+    std::string name;               // Name the inode recorded when it was last linked
+    uint64_t size;
+    std::vector<ByteRange> extents; // Byte ranges on the device in file order, clipped to size
+};
+
+// Read-only view of an F2FS volume, the usual format of /data on Android.
+// F2FS never overwrites a block in place: every update writes a new copy of
+// the inode or node block and marks the old one invalid in the SIT. Deleting
+// a file only drops its NAT entry and invalidates its blocks, so the last
+// inode version and its direct nodes stay on disk until their segment is
+// cleaned or reused, block map included.
+class F2fsReader {
+public:
+    static const uint32_t kBlockSize = 4096;
+
+    F2fsReader();
+    ~F2fsReader();
+
+    bool open(const std::string& devicePath);
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+
+    uint64_t blockCount() const { return blockCount_; }
+    uint64_t checkpointVersion() const { return checkpointVersion_; }
+
+    // False for main-area blocks the SIT marks invalid or free; metadata
+    // blocks always count as valid
+    bool isBlockValid(uint32_t block) const;
+    bool readBlocks(uint32_t block, uint32_t count, uint8_t* buffer) const;
+    bool readBytes(uint64_t offset, size_t length, uint8_t* buffer) const;
+    // Byte ranges of every invalid or free main-area block run
+    std::vector<ByteRange> freeExtents() const;
+    // Deleted regular files whose last inode version survives in an invalid
+    // node block, mapped through their surviving direct and indirect nodes,
+    // with every data block still invalid. A stop ends the sweep with what it found so far.
+    std::vector<F2fsFile> deletedFiles(const StopCheck& stop = nullptr) const;
+
+    static bool probe(const std::string& devicePath);
+
+private:
+    // Footer of a node block that is no longer live
+    struct NodeBlock {
+        uint32_t block;
+        uint32_t nid;
+        uint32_t ino;
+        uint32_t offset; // Position in the file's node tree, 0 for the inode
+        uint32_t version; // Checkpoint the block was written under
+    };
+
+    static bool readSuperblock(int fd, uint8_t* superblock);
+    bool parseSuperblock(const uint8_t* superblock);
+    bool readCheckpoint();
+    bool loadSit(const std::vector<uint8_t>& sitBitmap, const uint8_t* sitJournal);
+    void loadNatJournal(const uint8_t* natJournal);
+
+    // Block the NAT maps a node id to, or 0 if it is free
+    uint32_t nodeAddress(uint32_t nid, std::vector<uint8_t>& natBlock, uint32_t& natBlockAddress) const;
+    bool inMainArea(uint32_t block) const {
+        return block >= mainBlock_ && block - mainBlock_ < static_cast<uint64_t>(mainSegments_) * kBlocksPerSegment;
+    }
+    std::vector<NodeBlock> orphanedNodes(const StopCheck& stop) const;
+    // Data block addresses of a node subtree, appended in file order, from
+    // the newest node versions written no later than version
+    bool mapNode(uint32_t nid, uint32_t ino, uint32_t offset, int depth, uint64_t blocksLeft, uint32_t version,
+                 const std::vector<NodeBlock>& nodes, std::vector<uint32_t>& addresses) const;
+    bool mapInode(const uint8_t* inode, const NodeBlock& node, const std::vector<NodeBlock>& nodes,
+                  F2fsFile& file) const;
+
+    static const uint32_t kBlocksPerSegment = 512;
+
+    int fd_;
+    uint64_t blockCount_;
+    uint32_t features_;
+    uint32_t checkpointBlock_;
+    uint32_t checkpointPayload_; // Extra checkpoint blocks holding a large SIT bitmap
+    uint32_t sitBlock_;
+    uint32_t sitSegments_;
+    uint32_t natBlock_;
+    uint32_t natSegments_;
+    uint32_t mainBlock_;
+    uint32_t mainSegments_;
+    uint64_t checkpointVersion_;
+    std::vector<uint8_t> valid_;        // Main-area valid bits, most significant bit first as in the SIT
+    std::vector<uint8_t> nodeSegments_; // Main segments the SIT last assigned to node logs
+    std::vector<uint8_t> natBitmap_;    // Which copy of each NAT block is current
+    std::vector<std::pair<uint32_t, uint32_t>> natJournal_; // Node id and address, newer than the NAT blocks
+};
+
+#endif // F2FS_READER_H
@@ -0,0 +1,626 @@
+#include "fat_reader.h"
+#include "byte_order.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+
+#define LOG_TAG "FatReader"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const size_t kBootSectorSize = 512;
+const size_t kEntrySize = 32;
+
+// MBR partition types that hold FAT32 (0x0B, 0x0C) or exFAT (0x07, shared with NTFS)
+const uint8_t kPartitionTypes[] = {0x0B, 0x0C, 0x07};
+
+const uint32_t kFat32Mask = 0x0FFFFFFF;
+const uint32_t kExFatBad = 0xFFFFFFF7;
+
+const uint8_t kFat32Deleted = 0xE5;
+const uint8_t kFat32AttrLongName = 0x0F;
+const uint8_t kFat32AttrVolume = 0x08;
+const uint8_t kFat32AttrDirectory = 0x10;
+
+const uint8_t kExFatInUse = 0x80;
+const uint8_t kExFatFile = 0x05;
+const uint8_t kExFatStream = 0x40;
+const uint8_t kExFatName = 0x41;
+const uint8_t kExFatBitmap = 0x81;
+const uint8_t kExFatNoFatChain = 0x02;
+const uint16_t kExFatAttrDirectory = 0x10;
+
+const size_t kFatWindowSize = 64 * 1024;
+const size_t kMaxDirectoryBytes = 32 * 1024 * 1024;
+const int kMaxDepth = 32;
+
+void appendUtf8(std::string& out, uint32_t codePoint) {
+    if (codePoint < 0x80) {
+        out += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+// Names are UTF-16 on disk; unpaired surrogates become U+FFFD and a '/' would split the path
+std::string utf16ToUtf8(const std::vector<uint16_t>& units) {
+    std::string out;
+    for (size_t i = 0; i < units.size(); ++i) {
+        uint32_t unit = units[i];
+        if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < units.size() && units[i + 1] >= 0xDC00 &&
+            units[i + 1] <= 0xDFFF) {
+            appendUtf8(out, 0x10000 + ((unit - 0xD800) << 10) + (units[++i] - 0xDC00));
+        } else if (unit >= 0xD800 && unit <= 0xDFFF) {
+            appendUtf8(out, 0xFFFD);
+        } else {
+            appendUtf8(out, unit == '/' ? '_' : unit);
+        }
+    }
+    return out;
+}
+
+// Checksum of an 8.3 name that its long-name entries carry
+uint8_t shortNameChecksum(const uint8_t* name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; ++i) {
+        sum = static_cast<uint8_t>(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    }
+    return sum;
+}
+
+// 8.3 name with the lower-case flags Windows NT keeps in byte 12
+std::string shortName(const uint8_t* entry) {
+    std::string base(reinterpret_cast<const char*>(entry), 8);
+    std::string extension(reinterpret_cast<const char*>(entry + 8), 3);
+    base.erase(base.find_last_not_of(' ') + 1);
+    extension.erase(extension.find_last_not_of(' ') + 1);
+    if (entry[12] & 0x08) std::transform(base.begin(), base.end(), base.begin(), ::tolower);
+    if (entry[12] & 0x10) std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    std::string name = extension.empty() ? base : base + "." + extension;
+    std::replace(name.begin(), name.end(), '/', '_');
+    return name;
+}
+
+// The 13 UTF-16 units of one long-name entry, up to the terminator
+void appendLongNamePart(const uint8_t* entry, std::vector<uint16_t>& units) {
+    static const int kOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    for (int offset : kOffsets) {
+        uint16_t unit = readLe16(entry + offset);
+        if (unit == 0x0000 || unit == 0xFFFF) return;
+        units.push_back(unit);
+    }
+}
+
+// Checksum over a whole exFAT entry set, taken with every entry marked in use
+// as it was when written; the primary entry's own checksum bytes are skipped
+uint16_t entrySetChecksum(const uint8_t* entries, size_t count) {
+    uint16_t sum = 0;
+    for (size_t i = 0; i < count * kEntrySize; ++i) {
+        if (i == 2 || i == 3) continue;
+        uint8_t value = i % kEntrySize == 0 ? static_cast<uint8_t>(entries[i] | kExFatInUse) : entries[i];
+        sum = static_cast<uint16_t>(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + value);
+    }
+    return sum;
+}
+
+bool isFat32Boot(const uint8_t* boot) {
+    return boot[510] == 0x55 && boot[511] == 0xAA && readLe16(boot + 0x16) == 0 && readLe32(boot + 0x24) != 0 &&
+           readLe16(boot + 0x0B) >= 512 && boot[0x0D] != 0 && boot[0x10] != 0;
+}
+
+bool isExFatBoot(const uint8_t* boot) {
+    return memcmp(boot + 3, "EXFAT   ", 8) == 0;
+}
+
+} // namespace
+
+FatReader::FatReader()
+        : fd_(-1), kind_(Kind::Fat32), volumeOffset_(0), bytesPerSector_(0), clusterSize_(0), clusterCount_(0),
+          fatOffset_(0), heapOffset_(0), rootCluster_(0), fatWindowStart_(0) {
+}
+
+FatReader::~FatReader() {
+    close();
+}
+
+bool FatReader::findVolume(int fd, uint64_t& offset, uint8_t* bootSector) {
+    offset = 0;
+    if (BlockReader::readFully(fd, bootSector, kBootSectorSize, 0) != kBootSectorSize) {
+        return false;
+    }
+    if (isExFatBoot(bootSector) || isFat32Boot(bootSector)) {
+        return true;
+    }
+    if (bootSector[510] != 0x55 || bootSector[511] != 0xAA) {
+        return false;
+    }
+
+    // A whole card: the first MBR partition of a FAT type
+    for (int i = 0; i < 4; ++i) {
+        const uint8_t* partition = bootSector + 446 + i * 16;
+        if (std::find(std::begin(kPartitionTypes), std::end(kPartitionTypes), partition[4]) ==
+            std::end(kPartitionTypes)) {
+            continue;
+        }
+        uint64_t start = static_cast<uint64_t>(readLe32(partition + 8)) * kBootSectorSize;
+        uint8_t candidate[kBootSectorSize];
+        if (start == 0 || BlockReader::readFully(fd, candidate, sizeof(candidate), start) != sizeof(candidate)) {
+            continue;
+        }
+        if (isExFatBoot(candidate) || isFat32Boot(candidate)) {
+            offset = start;
+            memcpy(bootSector, candidate, kBootSectorSize);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FatReader::probe(const std::string& devicePath) {
+    int fd = ::open(devicePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint64_t offset;
+    uint8_t boot[kBootSectorSize];
+    bool isFat = findVolume(fd, offset, boot);
+    ::close(fd);
+    return isFat;
+}
+
+bool FatReader::open(const std::string& devicePath) {
+    close();
+
+    fd_ = ::open(devicePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        LOGE("Cannot open device: %s", devicePath.c_str());
+        return false;
+    }
+
+    uint8_t boot[kBootSectorSize];
+    if (!findVolume(fd_, volumeOffset_, boot)) {
+        LOGE("No FAT32 or exFAT volume on %s", devicePath.c_str());
+        close();
+        return false;
+    }
+
+    bool exFat = isExFatBoot(boot);
+    bool loaded = exFat ? parseExFat(boot) && loadExFatAllocation() : parseFat32(boot) && loadFat32Allocation();
+    if (!loaded) {
+        close();
+        return false;
+    }
+
+    LOGI("%s on %s: %u clusters of %u bytes", exFat ? "exFAT" : "FAT32", devicePath.c_str(), clusterCount_,
+         clusterSize_);
+    return true;
+}
+
+void FatReader::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    used_.clear();
+    fatWindow_.clear();
+}
+
+bool FatReader::parseFat32(const uint8_t* boot) {
+    kind_ = Kind::Fat32;
+    bytesPerSector_ = readLe16(boot + 0x0B);
+    uint32_t sectorsPerCluster = boot[0x0D];
+    uint32_t reservedSectors = readLe16(boot + 0x0E);
+    uint32_t fatCount = boot[0x10];
+    uint64_t totalSectors = readLe16(boot + 0x13) ? readLe16(boot + 0x13) : readLe32(boot + 0x20);
+    uint64_t fatSectors = readLe32(boot + 0x24);
+    rootCluster_ = readLe32(boot + 0x2C);
+
+    uint64_t dataStart = reservedSectors + fatCount * fatSectors;
+    if ((sectorsPerCluster & (sectorsPerCluster - 1)) != 0 || totalSectors <= dataStart) {
+        LOGE("Corrupt FAT32 boot sector geometry");
+        return false;
+    }
+    clusterSize_ = bytesPerSector_ * sectorsPerCluster;
+    // The FAT must also have room for every cluster
+    uint64_t clusters = std::min<uint64_t>((totalSectors - dataStart) / sectorsPerCluster,
+                                           fatSectors * bytesPerSector_ / 4 - 2);
+    if (clusters < 65525 || clusters > kFat32Mask - 10) {
+        LOGE("Cluster count %llu is not FAT32; FAT12 and FAT16 are not supported",
+             static_cast<unsigned long long>(clusters));
+        return false;
+    }
+    clusterCount_ = static_cast<uint32_t>(clusters);
+    fatOffset_ = volumeOffset_ + static_cast<uint64_t>(reservedSectors) * bytesPerSector_;
+    heapOffset_ = volumeOffset_ + dataStart * bytesPerSector_;
+    return validCluster(rootCluster_);
+}
+
+bool FatReader::parseExFat(const uint8_t* boot) {
+    kind_ = Kind::ExFat;
+    uint8_t sectorShift = boot[108];
+    uint8_t clusterShift = boot[109];
+    if (sectorShift < 9 || sectorShift > 12 || sectorShift + clusterShift > 25) {
+        LOGE("Corrupt exFAT boot sector geometry");
+        return false;
+    }
+    bytesPerSector_ = 1u << sectorShift;
+    clusterSize_ = bytesPerSector_ << clusterShift;
+    fatOffset_ = volumeOffset_ + static_cast<uint64_t>(readLe32(boot + 80)) * bytesPerSector_;
+    heapOffset_ = volumeOffset_ + static_cast<uint64_t>(readLe32(boot + 88)) * bytesPerSector_;
+    clusterCount_ = readLe32(boot + 92);
+    rootCluster_ = readLe32(boot + 96);
+    if (clusterCount_ == 0 || clusterCount_ > kExFatBad - 2) {
+        LOGE("Corrupt exFAT cluster count");
+        return false;
+    }
+    return validCluster(rootCluster_);
+}
+
+// FAT32 has no bitmap: a cluster is free when its FAT entry is 0
+bool FatReader::loadFat32Allocation() {
+    used_.assign((static_cast<size_t>(clusterCount_) + 7) / 8, 0);
+    BudgetLease lease(1024 * 1024);
+    std::vector<uint8_t> chunk(1024 * 1024);
+    uint64_t entries = static_cast<uint64_t>(clusterCount_) + 2;
+    for (uint64_t first = 0; first < entries;) {
+        size_t count = static_cast<size_t>(std::min<uint64_t>(entries - first, chunk.size() / 4));
+        if (BlockReader::readFully(fd_, chunk.data(), count * 4, fatOffset_ + first * 4) != count * 4) {
+            LOGE("Cannot read the FAT");
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t cluster = first + i;
+            if (cluster >= 2 && (readLe32(chunk.data() + i * 4) & kFat32Mask) != 0) {
+                used_[(cluster - 2) / 8] |= static_cast<uint8_t>(1u << ((cluster - 2) & 7));
+            }
+        }
+        first += count;
+    }
+    return true;
+}
+
+// exFAT keeps an allocation bitmap file, listed in the root directory
+bool FatReader::loadExFatAllocation() {
+    std::vector<uint32_t> rootClusters;
+    std::vector<uint8_t> root;
+    if (!followChain(rootCluster_, kMaxDirectoryBytes / clusterSize_, rootClusters) ||
+        !readClusters(rootClusters, root)) {
+        LOGE("Cannot read the exFAT root directory");
+        return false;
+    }
+
+    for (size_t i = 0; i + kEntrySize <= root.size() && root[i] != 0; i += kEntrySize) {
+        if (root[i] != kExFatBitmap) continue;
+        uint32_t first = readLe32(root.data() + i + 20);
+        uint64_t length = readLe64(root.data() + i + 24);
+        if (!validCluster(first) || length < (clusterCount_ + 7) / 8) break;
+
+        size_t clusters = static_cast<size_t>((length + clusterSize_ - 1) / clusterSize_);
+        std::vector<uint32_t> chain;
+        if (!followChain(first, clusters, chain) || chain.size() != clusters) {
+            // Written contiguously when the volume was formatted
+            chain.clear();
+            for (size_t c = 0; c < clusters && validCluster(first + static_cast<uint32_t>(c)); ++c) {
+                chain.push_back(first + static_cast<uint32_t>(c));
+            }
+        }
+        if (!readClusters(chain, used_) || used_.size() < (clusterCount_ + 7) / 8) break;
+        used_.resize((clusterCount_ + 7) / 8);
+        return true;
+    }
+    LOGE("exFAT allocation bitmap not found");
+    return false;
+}
+
+uint64_t FatReader::clusterOffset(uint32_t cluster) const {
+    return heapOffset_ + static_cast<uint64_t>(cluster - 2) * clusterSize_;
+}
+
+bool FatReader::isClusterFree(uint32_t cluster) const {
+    if (!validCluster(cluster)) return false;
+    uint32_t bit = cluster - 2;
+    return !(used_[bit / 8] & (1u << (bit & 7)));
+}
+
+bool FatReader::readBytes(uint64_t offset, size_t length, uint8_t* buffer) const {
+    return isOpen() && BlockReader::readFully(fd_, buffer, length, offset) == length;
+}
+
+uint32_t FatReader::nextCluster(uint32_t cluster) const {
+    uint64_t offset = fatOffset_ + static_cast<uint64_t>(cluster) * 4;
+    if (fatWindow_.empty() || offset < fatWindowStart_ || offset + 4 > fatWindowStart_ + fatWindow_.size()) {
+        fatWindowStart_ = offset - offset % kFatWindowSize;
+        fatWindow_.resize(kFatWindowSize);
+        fatWindow_.resize(BlockReader::readFully(fd_, fatWindow_.data(), kFatWindowSize, fatWindowStart_));
+        if (offset + 4 > fatWindowStart_ + fatWindow_.size()) {
+            fatWindow_.clear();
+            return 0;
+        }
+    }
+    uint32_t next = readLe32(fatWindow_.data() + (offset - fatWindowStart_));
+    if (kind_ == Kind::Fat32) next &= kFat32Mask;
+    return validCluster(next) ? next : 0;
+}
+
+bool FatReader::followChain(uint32_t first, size_t maxClusters, std::vector<uint32_t>& clusters) const {
+    clusters.clear();
+    for (uint32_t cluster = first; cluster != 0 && clusters.size() < maxClusters; cluster = nextCluster(cluster)) {
+        if (!validCluster(cluster)) return false;
+        // A chain that comes back on itself is damaged
+        if (!clusters.empty() && cluster == first) return false;
+        clusters.push_back(cluster);
+    }
+    return !clusters.empty();
+}
+
+bool FatReader::clustersOf(const Entry& entry, std::vector<uint32_t>& clusters) const {
+    clusters.clear();
+    if (!validCluster(entry.firstCluster)) return false;
+
+    // Directories on FAT32 record no size; one cluster holds 1024 entries of 32 bytes at 32 KiB
+    size_t count = entry.size > 0 ? static_cast<size_t>((entry.size + clusterSize_ - 1) / clusterSize_) : 1;
+    if (!entry.deleted && entry.size == 0) {
+        return followChain(entry.firstCluster, kMaxDirectoryBytes / clusterSize_, clusters);
+    }
+    if (!entry.contiguous && (kind_ == Kind::ExFat || !entry.deleted)) {
+        // exFAT leaves the chain of a deleted file in the FAT; FAT32 zeroes it
+        if (followChain(entry.firstCluster, count, clusters) && clusters.size() == count) return true;
+        if (!entry.deleted) return false;
+    }
+
+    // FAT32 drivers allocate forward from the first free cluster, so a
+    // deleted file most often sat in one run
+    clusters.clear();
+    if (count > clusterCount_ || entry.firstCluster - 2 > clusterCount_ - count) return false;
+    for (size_t i = 0; i < count; ++i) {
+        clusters.push_back(entry.firstCluster + static_cast<uint32_t>(i));
+    }
+    return true;
+}
+
+bool FatReader::readClusters(const std::vector<uint32_t>& clusters, std::vector<uint8_t>& out) const {
+    out.resize(clusters.size() * clusterSize_);
+    size_t i = 0;
+    while (i < clusters.size()) {
+        // Consecutive clusters in one read
+        size_t run = 1;
+        while (i + run < clusters.size() && clusters[i + run] == clusters[i] + run) ++run;
+        size_t length = run * clusterSize_;
+        if (BlockReader::readFully(fd_, out.data() + i * clusterSize_, length, clusterOffset(clusters[i])) != length) {
+            return false;
+        }
+        i += run;
+    }
+    return true;
+}
+
+std::vector<ByteRange> FatReader::extentsOf(const std::vector<uint32_t>& clusters, uint64_t size) const {
+    std::vector<ByteRange> extents;
+    uint64_t remaining = size;
+    for (uint32_t cluster : clusters) {
+        if (remaining == 0) break;
+        uint64_t length = std::min<uint64_t>(clusterSize_, remaining);
+        uint64_t offset = clusterOffset(cluster);
+        if (!extents.empty() && extents.back().offset + extents.back().length == offset) {
+            extents.back().length += length;
+        } else {
+            extents.push_back({offset, length});
+        }
+        remaining -= length;
+    }
+    return extents;
+}
+
+std::vector<ByteRange> FatReader::freeExtents() const {
+    std::vector<ByteRange> extents;
+    if (!isOpen()) return extents;
+
+    uint64_t freeClusters = 0;
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    auto emitRun = [&]() {
+        if (runLength > 0) {
+            extents.push_back({clusterOffset(runStart), static_cast<uint64_t>(runLength) * clusterSize_});
+            freeClusters += runLength;
+        }
+        runLength = 0;
+    };
+
+    for (uint32_t bit = 0; bit < clusterCount_;) {
+        // Whole bytes of free or used clusters first, single bits at the edges
+        if ((bit & 7) == 0 && bit + 8 <= clusterCount_ && (used_[bit / 8] == 0 || used_[bit / 8] == 0xFF)) {
+            if (used_[bit / 8] == 0) {
+                if (runLength == 0) runStart = bit + 2;
+                runLength += 8;
+            } else {
+                emitRun();
+            }
+            bit += 8;
+            continue;
+        }
+        if (!(used_[bit / 8] & (1u << (bit & 7)))) {
+            if (runLength == 0) runStart = bit + 2;
+            runLength++;
+        } else {
+            emitRun();
+        }
+        ++bit;
+    }
+    emitRun();
+
+    LOGI("Free space: %llu of %u clusters in %zu extents", static_cast<unsigned long long>(freeClusters),
+         clusterCount_, extents.size());
+    return extents;
+}
+
+std::vector<FatReader::Entry> FatReader::parseFat32Directory(const std::vector<uint8_t>& data) const {
+    std::vector<Entry> entries;
+    // Long-name entries precede their 8.3 entry, last part first
+    std::vector<const uint8_t*> longName;
+
+    for (size_t i = 0; i + kEntrySize <= data.size(); i += kEntrySize) {
+        const uint8_t* e = data.data() + i;
+        if (e[0] == 0x00) break;
+
+        uint8_t attributes = e[11];
+        if ((attributes & 0x3F) == kFat32AttrLongName) {
+            // A live part flagged last starts a new name; deleted parts have lost their ordinals
+            bool starts = e[0] != kFat32Deleted && (e[0] & 0x40);
+            if (starts || (!longName.empty() && longName.back()[13] != e[13])) longName.clear();
+            longName.push_back(e);
+            continue;
+        }
+        if (attributes & kFat32AttrVolume) {
+            longName.clear();
+            continue;
+        }
+
+        Entry entry;
+        entry.deleted = e[0] == kFat32Deleted;
+        entry.directory = (attributes & kFat32AttrDirectory) != 0;
+        entry.contiguous = false;
+        entry.firstCluster = (static_cast<uint32_t>(readLe16(e + 20)) << 16) | readLe16(e + 26);
+        entry.size = entry.directory ? 0 : readLe32(e + 28);
+
+        uint8_t raw[11];
+        memcpy(raw, e, sizeof(raw));
+        if (raw[0] == 0x05) raw[0] = kFat32Deleted; // A live name really starting with 0xE5
+        if (!longName.empty()) {
+            // The deleted marker overwrote the first character the checksum covers
+            bool matches = shortNameChecksum(raw) == longName.front()[13];
+            for (int first = 0x20; entry.deleted && !matches && first < 0x100; ++first) {
+                raw[0] = static_cast<uint8_t>(first);
+                matches = shortNameChecksum(raw) == longName.front()[13];
+            }
+            if (matches) {
+                std::vector<uint16_t> units;
+                for (auto part = longName.rbegin(); part != longName.rend(); ++part) {
+                    appendLongNamePart(*part, units);
+                }
+                entry.name = utf16ToUtf8(units);
+            }
+        }
+        longName.clear();
+        if (entry.name.empty()) {
+            entry.name = shortName(e);
+            if (entry.deleted && !entry.name.empty()) entry.name[0] = '_';
+        }
+        if (entry.name.empty() || entry.name == "." || entry.name == "..") continue;
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+std::vector<FatReader::Entry> FatReader::parseExFatDirectory(const std::vector<uint8_t>& data) const {
+    std::vector<Entry> entries;
+    size_t count = data.size() / kEntrySize;
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* e = data.data() + i * kEntrySize;
+        if (e[0] == 0x00) break;
+        if ((e[0] & ~kExFatInUse) != kExFatFile) continue;
+
+        // File entry, stream extension, then the name in 15-character entries
+        size_t secondaries = e[1];
+        if (secondaries < 2 || secondaries > 18 || i + secondaries >= count) continue;
+        const bool inUse = (e[0] & kExFatInUse) != 0;
+        const uint8_t* stream = e + kEntrySize;
+        bool consistent = (stream[0] & ~kExFatInUse) == kExFatStream;
+        for (size_t s = 1; consistent && s <= secondaries; ++s) {
+            // A reused slot in a deleted set belongs to a newer file
+            consistent = ((e[s * kEntrySize] & kExFatInUse) != 0) == inUse;
+        }
+        if (!consistent || entrySetChecksum(e, secondaries + 1) != readLe16(e + 2)) continue;
+
+        Entry entry;
+        entry.deleted = !inUse;
+        entry.directory = (readLe16(e + 4) & kExFatAttrDirectory) != 0;
+        entry.contiguous = (stream[1] & kExFatNoFatChain) != 0;
+        entry.firstCluster = readLe32(stream + 20);
+        entry.size = readLe64(stream + 24);
+
+        size_t nameLength = stream[3];
+        std::vector<uint16_t> units;
+        for (size_t s = 2; s <= secondaries && units.size() < nameLength; ++s) {
+            const uint8_t* part = e + s * kEntrySize;
+            if ((part[0] & ~kExFatInUse) != kExFatName) break;
+            for (size_t c = 0; c < 15 && units.size() < nameLength; ++c) {
+                units.push_back(readLe16(part + 2 + c * 2));
+            }
+        }
+        entry.name = utf16ToUtf8(units);
+        i += secondaries;
+        if (entry.name.empty()) continue;
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+void FatReader::walkDirectory(const std::string& path, const std::vector<uint32_t>& clusters, int depth,
+                              std::unordered_set<uint32_t>& visited, std::vector<FatFile>& files,
+                              const StopCheck& stop) const {
+    if (stop && stop()) return;
+    std::vector<uint8_t> data;
+    if (!readClusters(clusters, data)) {
+        LOGE("Cannot read directory %s", path.c_str());
+        return;
+    }
+
+    std::vector<Entry> entries = kind_ == Kind::ExFat ? parseExFatDirectory(data) : parseFat32Directory(data);
+    std::vector<uint32_t> entryClusters;
+    for (const auto& entry : entries) {
+        std::string entryPath = path + "/" + entry.name;
+        if (entry.directory) {
+            if (depth >= kMaxDepth || !visited.insert(entry.firstCluster).second ||
+                !clustersOf(entry, entryClusters)) {
+                continue;
+            }
+            // A deleted directory is only read while nothing else owns its clusters
+            if (entry.deleted && !std::all_of(entryClusters.begin(), entryClusters.end(),
+                                              [this](uint32_t c) { return isClusterFree(c); })) {
+                continue;
+            }
+            walkDirectory(entryPath, entryClusters, depth + 1, visited, files, stop);
+            continue;
+        }
+
+        if (!entry.deleted || entry.size == 0 || !clustersOf(entry, entryClusters)) continue;
+        // Clusters handed to another file since would give back its data instead
+        if (!std::all_of(entryClusters.begin(), entryClusters.end(),
+                         [this](uint32_t c) { return isClusterFree(c); })) {
+            continue;
+        }
+        files.push_back({entryPath, entry.size, extentsOf(entryClusters, entry.size)});
+    }
+}
+
+std::vector<FatFile> FatReader::deletedFiles(const StopCheck& stop) const {
+    std::vector<FatFile> files;
+    if (!isOpen()) return files;
+
+    std::vector<uint32_t> root;
+    if (!followChain(rootCluster_, kMaxDirectoryBytes / clusterSize_, root)) {
+        LOGE("Cannot follow the root directory chain");
+        return files;
+    }
+    std::unordered_set<uint32_t> visited = {rootCluster_};
+    walkDirectory("", root, 0, visited, files, stop);
+    LOGI("Directory entries map %zu deleted files", files.size());
+    return files;
+}
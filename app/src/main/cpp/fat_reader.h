@@ -0,0 +1,98 @@
+#ifndef FAT_READER_H
+#define FAT_READER_H
+
+#include "block_reader.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <cstdint>
+
+// A deleted file rebuilt from its FAT32 or exFAT directory entry
+struct FatFile {
+    std::string path;               // From the volume root; the long name wherever its entries survive
+    uint64_t size;
+    std::vector<ByteRange> extents; // Byte ranges on the device in file order, clipped to size
+};
+
+// Read-only view of a FAT32 or exFAT volume, as on SD cards and USB OTG
+// drives. A whole-card image with an MBR is opened at its first FAT partition.
+// Deleting a file only marks its directory entries (0xE5 on FAT32, the
+// in-use bit on exFAT) and frees its clusters, so the name, size and first
+// cluster survive until the entry or the clusters are reused.
+class FatReader {
+public:
+    enum class Kind { Fat32, ExFat };
+
+    FatReader();
+    ~FatReader();
+
+    bool open(const std::string& devicePath);
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+
+    Kind kind() const { return kind_; }
+    uint32_t clusterSize() const { return clusterSize_; }
+    uint32_t clusterCount() const { return clusterCount_; }
+    // Byte offset of the volume on the device
+    uint64_t volumeOffset() const { return volumeOffset_; }
+
+    bool isClusterFree(uint32_t cluster) const;
+    // Bytes at a device offset, such as one inside a FatFile extent
+    bool readBytes(uint64_t offset, size_t length, uint8_t* buffer) const;
+    // Byte ranges of every free cluster run
+    std::vector<ByteRange> freeExtents() const;
+    // Deleted files from every directory reachable from the root, deleted
+    // directories included, whose clusters are all still free. A stop ends
+    // the walk with what it found so far.
+    std::vector<FatFile> deletedFiles(const StopCheck& stop = nullptr) const;
+
+    static bool probe(const std::string& devicePath);
+
+private:
+    struct Entry {
+        std::string name;
+        uint32_t firstCluster;
+        uint64_t size;
+        bool directory;
+        bool deleted;
+        bool contiguous; // exFAT NoFatChain: the clusters follow each other and the FAT is not kept
+    };
+
+    static bool findVolume(int fd, uint64_t& offset, uint8_t* bootSector);
+    bool parseFat32(const uint8_t* boot);
+    bool parseExFat(const uint8_t* boot);
+    bool loadFat32Allocation();
+    bool loadExFatAllocation();
+
+    uint64_t clusterOffset(uint32_t cluster) const;
+    bool validCluster(uint32_t cluster) const { return cluster >= 2 && cluster - 2 < clusterCount_; }
+    // Next cluster in a FAT chain, 0 at its end or if the entry is not a valid link
+    uint32_t nextCluster(uint32_t cluster) const;
+    bool followChain(uint32_t first, size_t maxClusters, std::vector<uint32_t>& clusters) const;
+    // Clusters a directory entry points at, or false if they cannot be told
+    bool clustersOf(const Entry& entry, std::vector<uint32_t>& clusters) const;
+    bool readClusters(const std::vector<uint32_t>& clusters, std::vector<uint8_t>& out) const;
+    std::vector<ByteRange> extentsOf(const std::vector<uint32_t>& clusters, uint64_t size) const;
+
+    std::vector<Entry> parseFat32Directory(const std::vector<uint8_t>& data) const;
+    std::vector<Entry> parseExFatDirectory(const std::vector<uint8_t>& data) const;
+    void walkDirectory(const std::string& path, const std::vector<uint32_t>& clusters, int depth,
+                       std::unordered_set<uint32_t>& visited, std::vector<FatFile>& files,
+                       const StopCheck& stop) const;
+
+    int fd_;
+    Kind kind_;
+    uint64_t volumeOffset_;
+    uint32_t bytesPerSector_;
+    uint32_t clusterSize_;
+    uint32_t clusterCount_;
+    uint64_t fatOffset_;  // From the start of the device
+    uint64_t heapOffset_; // Cluster 2, from the start of the device
+    uint32_t rootCluster_;
+    std::vector<uint8_t> used_; // Bit n set when cluster n + 2 is allocated
+    // FAT entries around the last one looked up; chains mostly stay close
+    mutable std::vector<uint8_t> fatWindow_;
+    mutable uint64_t fatWindowStart_;
+};
+
+#endif // FAT_READER_H
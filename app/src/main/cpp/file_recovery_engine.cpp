@@ -1,6 +1,26 @@
 #include "file_recovery_engine.h"
+#include "signature_matcher.h"
+#include "block_reader.h"
+#include "parallel_carver.h"
+#include "ext4_reader.h"
+#include "extent_copier.h"
+#include "scan_index.h"
+#include "format_walker.h"
+#include "fragment_reassembler.h"
+#include "scan_stats.h"
+#include "content_hash.h"
+#include "preview_extractor.h"
+#include "jbd2_journal.h"
+#include "block_classifier.h"
+#include "fat_reader.h"
+#include "f2fs_reader.h"
+#include "memory_budget.h"
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <android/log.h>
 #include <fstream>
@@ -9,11 +29,113 @@
 #include <dirent.h>
 #include <memory>
 #include <vector>
+#include <unordered_set>
 
 #define LOG_TAG "FileRecoveryEngine"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
+namespace {
+
+int64_t toNanos(const struct timespec& time) {
+    return static_cast<int64_t>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+}
+
+// The carved bytes of a hit in file order
+std::vector<ByteRange> hitExtents(const IndexedHit& hit) {
+    return hit.fragments.empty() ? std::vector<ByteRange>{{hit.offset, hit.length}} : hit.fragments;
+}
+
+// Full hash of a hit whose sampled key matched an earlier one's (see HitBatcher::setFullHash)
+uint64_t fullContentHash(const HitArena& arena, const CarveHit& hit, const std::string& path,
+                         const std::vector<ByteRange>& fragments) {
+    ScopedStatTimer timer(kStatHashNanos);
+    ContentHasher hasher;
+    if (hit.flags & kHitDirectoryEntry) {
+        return hasher.hashFile(path.c_str());
+    }
+    if (!hasher.open(arena.sourceName(hit.source).c_str())) {
+        return 0;
+    }
+    return hasher.hash(fragments.empty() ? std::vector<ByteRange>{{hit.offset, hit.length}} : fragments);
+}
+
+// "<source>@<offset>+<length>[,<offset>+<length>...]", as parseExtentLocation reads it
+std::string extentLocation(const char* source, const std::vector<ByteRange>& extents) {
+    std::string location = source;
+    for (size_t i = 0; i < extents.size(); ++i) {
+        location += (i == 0 ? "@" : ",") + std::to_string(extents[i].offset) + "+" +
+                    std::to_string(extents[i].length);
+    }
+    return location;
+}
+
+// Whether extent lies entirely inside one of ranges, which are sorted and disjoint
+bool insideRanges(const std::vector<ByteRange>& ranges, const ByteRange& extent) {
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), extent.offset,
+                                 [](uint64_t offset, const ByteRange& range) { return offset < range.offset; });
+    return next != ranges.begin() && extent.offset + extent.length <= (next - 1)->offset + (next - 1)->length;
+}
+
+// Block device of the ext4 mount holding path, empty if it is on something else
+std::string ext4DeviceFor(const char* path) {
+    std::ifstream mounts("/proc/self/mounts");
+    std::string line;
+    std::string device;
+    size_t longest = 0;
+    while (std::getline(mounts, line)) {
+        std::istringstream fields(line);
+        std::string source, mountPoint, type;
+        if (!(fields >> source >> mountPoint >> type) || type != "ext4" || source.compare(0, 5, "/dev/") != 0) {
+            continue;
+        }
+        size_t length = mountPoint == "/" ? 0 : mountPoint.size();
+        bool contains = strncmp(path, mountPoint.c_str(), length) == 0 && (path[length] == '/' || path[length] == '\0');
+        if (contains && (device.empty() || length > longest)) {
+            device = source;
+            longest = length;
+        }
+    }
+    return device;
+}
+
+// Overlap of two offset-ordered range lists
+std::vector<ByteRange> intersectRanges(const std::vector<ByteRange>& a, const std::vector<ByteRange>& b) {
+    std::vector<ByteRange> overlap;
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        uint64_t aEnd = a[i].offset + a[i].length;
+        uint64_t bEnd = b[j].offset + b[j].length;
+        uint64_t start = std::max(a[i].offset, b[j].offset);
+        uint64_t end = std::min(aEnd, bEnd);
+        if (start < end) overlap.push_back({start, end - start});
+        if (aEnd < bEnd) ++i; else ++j;
+    }
+    return overlap;
+}
+
+// Type of a file from its first block, for queries that name types
+FileType identifyFile(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return UNKNOWN;
+    std::vector<uint8_t> head(BlockClassifier::kBlockSize);
+    size_t length = BlockReader::readFully(fd, head.data(), head.size(), 0);
+    close(fd);
+    return length >= 4 ? identifySignature(head.data(), length) : UNKNOWN;
+}
+
+// Whole files staged for a Java array cannot spill; past the memory budget
+// they have to go through recoverToFd
+bool fitsMemoryBudget(uint64_t bytes, const char* what) {
+    size_t limit = MemoryBudget::limit();
+    if (limit == 0 || bytes <= limit) return true;
+    LOGE("%s needs %llu bytes, over the %zu byte memory budget; recover it to a file instead", what,
+         static_cast<unsigned long long>(bytes), limit);
+    return false;
+}
+
+} // namespace
+
 FileRecoveryEngine::FileRecoveryEngine() {
     LOGI("Enhanced FileRecoveryEngine initialized");
 }
@@ -25,48 +147,194 @@ FileRecoveryEngine::~FileRecoveryEngine() {
 std::vector<int> FileRecoveryEngine::performEnhancedScan(const char* path, bool isRooted) {
     std::vector<int> results;
 
+    HitArena arena;
+    performEnhancedScan(path, isRooted, arena, [&results](const HitArena&, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            results.push_back(static_cast<int>(i));
+        }
+        return true;
+    });
+
+    return results;
+}
+
+bool FileRecoveryEngine::performEnhancedScan(const char* path, bool isRooted, HitArena& arena, const HitSink& sink) {
     if (!path) {
         LOGE("Null path provided");
-        return results;
+        return false;
     }
 
     LOGI("Performing enhanced scan on: %s", path);
 
-    // Scan for actual file remnants and deleted entries
-    results = scanForDeletedEntries(path, isRooted);
+    // A narrowed query leaves hits out, so what it finds cannot stand for the scan in the index
+    if (!scanOptions_.indexPath.empty() && !query_.narrowed()) {
+        index_.reset(new ScanIndex(scanOptions_.indexPath));
+        index_->load();
+    }
+
+    bool completed = false;
+    try {
+        HitBatcher hits(arena, sink, kResultBatchSize);
+        beginQuery(hits);
+        // Stopping because the query is satisfied still completes the scan
+        completed = (runEnhancedScan(path, isRooted, hits) || queryMet(hits)) && hits.flush();
+    } catch (const std::exception& e) {
+        LOGE("Error in enhanced scan: %s", e.what());
+    }
+
+    // Whatever finished is worth keeping, even if the scan was stopped
+    if (index_) {
+        index_->save();
+        index_.reset();
+    }
+    return completed;
+}
 
-    // Scan for file signatures in unallocated space
-    auto signatureResults = scanForFileSignatures(path);
-    results.insert(results.end(), signatureResults.begin(), signatureResults.end());
+bool FileRecoveryEngine::carveSignatures(const char* path, HitArena& arena, const HitSink& sink,
+                                         const CarveProgressSink& progress, uint64_t resumeOffset,
+                                         const std::vector<IndexedHit>& resumeHits, std::vector<IndexedHit>* found) {
+    if (!path) {
+        LOGE("Null path provided");
+        return false;
+    }
 
-    LOGI("Found %zu potential recoverable items", results.size());
+    LOGI("Carving %s from offset %llu", path, static_cast<unsigned long long>(resumeOffset));
 
-    return results;
+    carveProgress_ = progress ? &progress : nullptr;
+    resumeOffset_ = resumeOffset;
+    resumeHits_ = &resumeHits;
+    carveFound_ = found;
+    carveShort_ = false;
+
+    bool completed = false;
+    try {
+        HitBatcher hits(arena, sink, kResultBatchSize);
+        beginQuery(hits);
+        completed = (scanForFileSignatures(path, hits) || queryMet(hits)) && !carveShort_ && hits.flush();
+    } catch (const std::exception& e) {
+        LOGE("Error carving signatures: %s", e.what());
+    }
+
+    carveProgress_ = nullptr;
+    resumeOffset_ = 0;
+    resumeHits_ = nullptr;
+    carveFound_ = nullptr;
+    return completed;
 }
 
-std::vector<int> FileRecoveryEngine::scanForDeletedEntries(const char* path, bool isRooted) {
-    std::vector<int> results;
+void FileRecoveryEngine::setScanQuery(const ScanQuery& query) {
+    query_ = query;
+    queryMatcher_.reset();
+    if (query_.fileTypes.empty()) {
+        return;
+    }
+
+    // Fewer patterns make a smaller automaton, and headers of other types
+    // are never handed to the format walkers. Word and Excel files are only
+    // carved as ZIP and told apart afterwards.
+    std::vector<SignaturePattern> patterns;
+    for (const auto& signature : kSignatures) {
+        bool wanted = query_.wantsType(signature.type) || (signature.type == ZIP && query_.wantsOffice());
+        if (!signature.carve || !wanted) continue;
+        patterns.push_back({std::vector<uint8_t>(signature.bytes, signature.bytes + signature.length),
+                            signature.type, signature.offset});
+    }
+    queryMatcher_.reset(new SignatureMatcher(patterns));
+}
+
+const SignatureMatcher& FileRecoveryEngine::carveMatcher() const {
+    return queryMatcher_ ? *queryMatcher_ : signatureMatcher();
+}
+
+void FileRecoveryEngine::beginQuery(HitBatcher& hits) {
+    const HitArena& arena = hits.arena();
+    hits.setFullHash([&arena](const CarveHit& hit, const std::string& path, const std::vector<ByteRange>& fragments) {
+        return fullContentHash(arena, hit, path, fragments);
+    }, 2 * ContentHasher::kSampleBytes);
+    hits.setLimit(query_.maxResults);
+    timedOut_ = false;
+    deadlineNanos_ = query_.timeBudgetNanos > 0 ? ScanStats::nowNanos() + query_.timeBudgetNanos : 0;
+}
 
+bool FileRecoveryEngine::outOfTime() {
+    if (deadlineNanos_ != 0 && !timedOut_ && ScanStats::nowNanos() >= deadlineNanos_) {
+        LOGI("Scan query time budget spent");
+        timedOut_ = true;
+    }
+    return timedOut_;
+}
+
+bool FileRecoveryEngine::runEnhancedScan(const char* path, bool isRooted, HitBatcher& hits) {
+    // Scan for actual file remnants and deleted entries, then for file
+    // signatures in unallocated space
+    return scanForDeletedEntries(path, isRooted, hits) && scanForFileSignatures(path, hits);
+}
+
+bool FileRecoveryEngine::scanForDeletedEntries(const char* path, bool isRooted, HitBatcher& hits) {
     if (!path) {
         LOGE("Null path provided");
-        return results;
+        return true;
+    }
+
+    // A query that names directories replaces the scan path and the system areas
+    if (!query_.directories.empty()) {
+        for (const auto& directory : query_.directories) {
+            if (!scanDirectoryEntries(directory.c_str(), 0, hits)) return false;
+        }
+        return true;
+    }
+
+    if (!scanDirectoryEntries(path, 0, hits)) {
+        return false;
+    }
+
+    // Enhanced scan for hidden/system files if rooted
+    return !isRooted || scanSystemAreas(path, hits);
+}
+
+bool FileRecoveryEngine::scanDirectoryEntries(const char* path, uint8_t flags, HitBatcher& hits) {
+    uint32_t source = hits.arena().addSource(path);
+    const CarveHit entryHit = {0, 0, source, UNKNOWN, 50, static_cast<uint8_t>(kHitDirectoryEntry | flags)};
+
+    // An unchanged directory keeps the entries it had last time
+    struct stat dirStat;
+    bool indexing = index_ && stat(path, &dirStat) == 0;
+    if (indexing) {
+        const IndexedDirectory* cached = index_->findDirectory(path, toNanos(dirStat.st_mtim),
+                                                               toNanos(dirStat.st_ctim));
+        if (cached) {
+            for (const auto& entry : cached->entries) {
+                CarveHit hit = entryHit;
+                hit.length = entry.length;
+                hit.fileType = static_cast<uint16_t>(entry.fileType);
+                ScanStats::addHit(hit.fileType);
+                if (!hits.add(hit, entry.contentHash, std::string(path) + "/" + entry.name)) return false;
+            }
+            return true;
+        }
     }
 
     DIR* dir = nullptr;
+    bool keepGoing = true;
     try {
         dir = opendir(path);
         if (!dir) {
             LOGE("Cannot open directory: %s", path);
-            return results;
+            return true;
         }
 
         struct dirent* entry;
-        int fileId = 1;
+        std::vector<IndexedEntry> found;
+        ContentHasher hasher;
 
-        while ((entry = readdir(dir)) != nullptr) {
-            if (!entry->d_name || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        while (keepGoing && (entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
                 continue;
             }
+            if (outOfTime()) {
+                keepGoing = false;
+                break;
+            }
 
             std::string fullPath = std::string(path) + "/" + entry->d_name;
             struct stat statbuf;
@@ -74,15 +342,29 @@ std::vector<int> FileRecoveryEngine::scanForDeletedEntries(const char* path, boo
             if (stat(fullPath.c_str(), &statbuf) == 0) {
                 // Check if file appears deleted or corrupted
                 if (isFileDeleted(fullPath.c_str()) || isFileCorrupted(fullPath.c_str())) {
-                    results.push_back(fileId++);
+                    CarveHit hit = entryHit;
+                    hit.length = static_cast<uint64_t>(statbuf.st_size);
+                    if (!query_.fileTypes.empty() && S_ISREG(statbuf.st_mode)) {
+                        hit.fileType = static_cast<uint16_t>(identifyFile(fullPath.c_str()));
+                    }
+                    if (!query_.wantsType(hit.fileType) || !query_.wantsSize(hit.length)) {
+                        continue;
+                    }
+                    ScanStats::addHit(hit.fileType);
+                    // Hashed like carved hits, so a carved copy of the same file merges with it
+                    uint64_t contentHash = 0;
+                    if (S_ISREG(statbuf.st_mode)) {
+                        ScopedStatTimer timer(kStatHashNanos);
+                        contentHash = hasher.sampleFile(fullPath.c_str());
+                    }
+                    keepGoing = hits.add(hit, contentHash, fullPath);
+                    found.push_back({entry->d_name, hit.length, hit.fileType, contentHash});
                 }
             }
         }
 
-        // Enhanced scan for hidden/system files if rooted
-        if (isRooted) {
-            auto systemResults = scanSystemAreas(path);
-            results.insert(results.end(), systemResults.begin(), systemResults.end());
+        if (indexing && keepGoing) {
+            index_->storeDirectory(path, {toNanos(dirStat.st_mtim), toNanos(dirStat.st_ctim), std::move(found)});
         }
 
     } catch (const std::exception& e) {
@@ -93,68 +375,433 @@ std::vector<int> FileRecoveryEngine::scanForDeletedEntries(const char* path, boo
         closedir(dir);
     }
 
-    return results;
+    return keepGoing;
 }
 
-std::vector<int> FileRecoveryEngine::scanForFileSignatures(const char* path) {
-    std::vector<int> results;
+const SignatureMatcher& FileRecoveryEngine::signatureMatcher() {
+    static const SignatureMatcher matcher([] {
+        std::vector<SignaturePattern> patterns;
+        for (const auto& signature : kSignatures) {
+            if (!signature.carve) continue;
+            patterns.push_back({std::vector<uint8_t>(signature.bytes, signature.bytes + signature.length),
+                                signature.type, signature.offset});
+        }
+        return patterns;
+    }());
+    return matcher;
+}
 
+bool FileRecoveryEngine::scanForFileSignatures(const char* path, HitBatcher& hits) {
     if (!path) {
         LOGE("Null path provided");
-        return results;
+        return false;
     }
 
     try {
-        std::ifstream file(path, std::ios::binary);
-        if (!file.is_open()) {
-            return results;
-        }
-
-        // Common file signatures
-        static const std::vector<std::vector<uint8_t>> signatures = {
-                {0xFF, 0xD8, 0xFF}, // JPEG
-                {0x89, 0x50, 0x4E, 0x47}, // PNG
-                {0x47, 0x49, 0x46, 0x38}, // GIF
-                {0x25, 0x50, 0x44, 0x46}, // PDF
-                {0x50, 0x4B, 0x03, 0x04}, // ZIP
-                {0xFF, 0xFB}, // MP3
-                {0x66, 0x74, 0x79, 0x70} // MP4
+        CarveOptions carveOptions;
+        carveOptions.threads = scanOptions_.threads;
+        carveOptions.stripeBytes = scanOptions_.stripeBytes;
+        carveOptions.queueDepth = scanOptions_.queueDepth;
+
+        // On ext4 only the unallocated blocks can hold deleted data, on F2FS
+        // the blocks the SIT marks invalid, and on FAT32 and exFAT the free clusters
+        std::vector<ByteRange> ranges;
+        Ext4Reader ext4;
+        F2fsReader f2fs;
+        FatReader fat;
+        bool isExt4 = Ext4Reader::probe(path) && ext4.open(path);
+        bool isF2fs = !isExt4 && F2fsReader::probe(path) && f2fs.open(path);
+        bool isFat = !isExt4 && !isF2fs && FatReader::probe(path) && fat.open(path);
+        const bool mapped = isExt4 || isF2fs || isFat;
+        if (mapped) {
+            ranges = isExt4 ? ext4.freeExtents() : isF2fs ? f2fs.freeExtents() : fat.freeExtents();
+            if (ranges.empty()) {
+                return true;
+            }
+        }
+        // Where a fragmented file may continue, even outside the segments re-carved below
+        const std::vector<ByteRange> unallocated = ranges;
+        if (!query_.ranges.empty()) {
+            ranges = mapped ? intersectRanges(ranges, query_.ranges) : query_.ranges;
+        }
+
+        const uint32_t source = hits.arena().addSource(path);
+        // Every hit is keyed on a sample of its content so the same file
+        // carved twice, or also found as a directory entry, crosses JNI once
+        ContentHasher hasher;
+        hasher.open(path);
+        auto hashHit = [&hasher](const IndexedHit& hit) {
+            ScopedStatTimer timer(kStatHashNanos);
+            return hit.length > 0 ? hasher.sample(hitExtents(hit)) : 0;
+        };
+        auto emitHit = [&](const IndexedHit& hit) {
+            if (!query_.wantsType(hit.fileType) || !query_.wantsSize(hit.length)) {
+                return !outOfTime();
+            }
+            if (outOfTime()) {
+                return false;
+            }
+#ifndef NDEBUG
+            LOGI("Found file signature (type %d) at offset: %llu, length: %llu%s",
+                 hit.fileType, static_cast<unsigned long long>(hit.offset),
+                 static_cast<unsigned long long>(hit.length), hit.complete ? "" : " (truncated)");
+#endif
+            ScanStats::addHit(hit.fileType);
+            if (!hit.complete) ScanStats::add(kStatTruncated, 1);
+            CarveHit record = {hit.offset, hit.length, source, static_cast<uint16_t>(hit.fileType),
+                               static_cast<uint8_t>(hit.complete ? 90 : 60),
+                               static_cast<uint8_t>(hit.complete ? kHitComplete : 0)};
+            // Replays from an older index or a checkpoint may not carry a hash yet
+            uint64_t contentHash = hit.contentHash ? hit.contentHash : hashHit(hit);
+            if (carveFound_) {
+                carveFound_->push_back(hit);
+                carveFound_->back().contentHash = contentHash;
+            }
+            std::string location = extentLocation(path, hitExtents(hit));
+            if (hit.fragments.empty()) {
+                return hits.add(record, contentHash, location);
+            }
+            ScanStats::add(kStatFragmented, 1);
+            record.confidence -= 10;
+            record.flags |= kHitFragmented;
+            return hits.add(record, contentHash, location, hit.fragments);
         };
 
-        const size_t bufferSize = 8192;
-        std::vector<uint8_t> buffer(bufferSize);
-        int fileId = 1000; // Start from 1000 for signature-based results
+        // Headers inside an already carved file (thumbnails, archive members,
+        // later MP3 frames) are part of that file, not files of their own
+        std::vector<ByteRange> carved;
+        auto insideCarved = [&carved](uint64_t offset) {
+            auto next = std::upper_bound(carved.begin(), carved.end(), offset,
+                                         [](uint64_t value, const ByteRange& range) {
+                                             return value < range.offset;
+                                         });
+            return next != carved.begin() && offset < (next - 1)->offset + (next - 1)->length;
+        };
+
+        // Deleted files whose inode survives, in the ext4 journal, the inode
+        // table or an old F2FS node block, or whose FAT directory entry
+        // survives, come out exact; their blocks are claimed so carving does
+        // not find them again
+        std::vector<uint8_t> head(BlockClassifier::kBlockSize);
+        // Sweeps of a large volume can outlast a query's time budget on their own
+        const StopCheck stopSweep = [this] { return outOfTime(); };
+        auto emitMapped = [&](const std::vector<ByteRange>& extents, uint64_t size, uint8_t flags,
+                              const std::function<bool(uint64_t, size_t, uint8_t*)>& read) {
+            carved.insert(carved.end(), extents.begin(), extents.end());
+            // Below the resume point it came back with the checkpoint's hits
+            if (extents.front().offset < resumeOffset_) return true;
+            if (outOfTime()) return false;
+            if (!query_.wantsOffset(extents.front().offset) || !query_.wantsSize(size)) return true;
+
+            uint16_t fileType = UNKNOWN;
+            size_t headLength = static_cast<size_t>(std::min<uint64_t>(head.size(), extents.front().length));
+            if (read(extents.front().offset, headLength, head.data())) {
+                fileType = static_cast<uint16_t>(identifySignature(head.data(), headLength));
+            }
+            if (!query_.wantsType(fileType)) return true;
+            ScanStats::addHit(fileType);
+            CarveHit record = {extents.front().offset, size, source, fileType, 95,
+                               static_cast<uint8_t>(kHitComplete | flags)};
+            uint64_t contentHash;
+            {
+                ScopedStatTimer timer(kStatHashNanos);
+                contentHash = hasher.sample(extents);
+            }
+            if (carveFound_) {
+                carveFound_->push_back({record.offset, size, fileType, true,
+                                        extents.size() > 1 ? extents : std::vector<ByteRange>(), contentHash});
+            }
+            if (extents.size() > 1) record.flags |= kHitFragmented;
+            return hits.add(record, contentHash, extentLocation(path, extents),
+                            extents.size() > 1 ? extents : std::vector<ByteRange>());
+        };
+        if (isExt4) {
+            auto readExt4 = [&ext4](uint64_t offset, size_t length, uint8_t* buffer) {
+                std::vector<uint8_t> block(ext4.blockSize());
+                if (!ext4.readBlocks(offset / ext4.blockSize(), 1, block.data())) return false;
+                memcpy(buffer, block.data(), std::min<size_t>(length, block.size()));
+                return true;
+            };
+            std::unordered_set<uint32_t> journaled;
+            for (const auto& file : journalFiles(ext4, unallocated, stopSweep)) {
+                journaled.insert(file.inode);
+                if (!emitMapped(file.extents, file.size, kHitJournal, readExt4)) return false;
+            }
+            for (const auto& file : ext4.deletedInodes(stopSweep)) {
+                if (journaled.count(file.inode)) continue;
+                if (!emitMapped(file.extents, file.size, kHitInode, readExt4)) return false;
+            }
+        }
+        if (isF2fs) {
+            auto readF2fs = [&f2fs](uint64_t offset, size_t length, uint8_t* buffer) {
+                return f2fs.readBytes(offset, length, buffer);
+            };
+            for (const auto& file : f2fs.deletedFiles(stopSweep)) {
+                if (!emitMapped(file.extents, file.size, kHitInode, readF2fs)) return false;
+            }
+        }
+        if (isFat) {
+            auto readFat = [&fat](uint64_t offset, size_t length, uint8_t* buffer) {
+                return fat.readBytes(offset, length, buffer);
+            };
+            for (const auto& file : fat.deletedFiles(stopSweep)) {
+                if (!emitMapped(file.extents, file.size, kHitFatEntry, readFat)) return false;
+            }
+        }
+        if (outOfTime()) {
+            return false;
+        }
+        // With an index, unchanged segments replay their recorded hits and
+        // only the stale ones are carved again
+        uint64_t sourceSize = 0;
+        std::vector<IndexedSegment> stale;
+        bool indexing = false;
+        if (index_) {
+            std::vector<IndexedSegment> segments = indexSegments(path, isExt4 ? &ext4 : nullptr, sourceSize);
+            indexing = !segments.empty();
+            for (auto& segment : segments) {
+                const IndexedSegment* cached = index_->findSegment(path, sourceSize, segment.start,
+                                                                   segment.end, segment.generation);
+                if (!cached) {
+                    stale.push_back(std::move(segment));
+                    continue;
+                }
+                for (const auto& hit : cached->hits) {
+                    if (!hit.fragments.empty()) {
+                        carved.insert(carved.end(), hit.fragments.begin(), hit.fragments.end());
+                    } else if (hit.length > 0) {
+                        carved.push_back({hit.offset, hit.length});
+                    }
+                    if (!emitHit(hit)) return false;
+                }
+            }
+            if (indexing) {
+                LOGI("Scan index: %zu of %zu segments changed", stale.size(), segments.size());
+                if (mapped) {
+                    ranges = restrictToSegments(ranges, stale, carveMatcher().maxHeaderReach());
+                }
+            }
+        }
+        // A resumed carve replays what the interrupted one found and only
+        // carves past the point where it stopped
+        if (resumeHits_) {
+            for (const auto& hit : *resumeHits_) {
+                if (!hit.fragments.empty()) {
+                    carved.insert(carved.end(), hit.fragments.begin(), hit.fragments.end());
+                } else if (hit.length > 0) {
+                    carved.push_back({hit.offset, hit.length});
+                }
+                if (!emitHit(hit)) return false;
+            }
+        }
+        const bool resumed = resumeOffset_ > 0;
+        if (resumed) {
+            if (ranges.empty()) {
+                int fd = open(path, O_RDONLY | O_CLOEXEC);
+                uint64_t size = fd >= 0 ? BlockReader::querySize(fd) : 0;
+                if (fd >= 0) close(fd);
+                if (resumeOffset_ < size) {
+                    ranges.push_back({resumeOffset_, size - resumeOffset_});
+                }
+            } else {
+                std::vector<ByteRange> remaining;
+                for (const auto& range : ranges) {
+                    uint64_t end = range.offset + range.length;
+                    if (end <= resumeOffset_) continue;
+                    uint64_t start = std::max(range.offset, resumeOffset_);
+                    remaining.push_back({start, end - start});
+                }
+                ranges = std::move(remaining);
+            }
+        }
+        // Fragments of a replayed hit can lie past later segments
+        std::sort(carved.begin(), carved.end(), [](const ByteRange& a, const ByteRange& b) {
+            return a.offset < b.offset;
+        });
+
+        FormatWalker walker(path);
+        ReassemblyOptions reassemblyOptions;
+        if (isExt4) {
+            reassemblyOptions.blockSize = ext4.blockSize();
+        } else if (isF2fs) {
+            reassemblyOptions.blockSize = F2fsReader::kBlockSize;
+        } else if (isFat) {
+            reassemblyOptions.blockSize = fat.clusterSize();
+        }
+        FragmentReassembler reassembler(path, reassemblyOptions);
+        const SignatureMatcher& matcher = carveMatcher();
+        ParallelCarver carver(matcher, carveOptions);
+        // Empty ranges would mean the whole device, not "nothing left to carve"
+        bool nothingToCarve = (indexing && stale.empty()) ||
+                              (((indexing && mapped) || resumed || !query_.ranges.empty()) && ranges.empty()) ||
+                              matcher.patternCount() == 0;
+        if (carveProgress_ || deadlineNanos_ != 0) {
+            carver.setProgressSink([&](const CarveProgress& progress) {
+                if (outOfTime()) return false;
+                // Hits below the reported offset must reach the sink before a checkpoint is taken
+                return !carveProgress_ || (hits.flush() && (*carveProgress_)(progress));
+            });
+        }
+        bool carvedAll = true;
+        if (!nothingToCarve) {
+            uint64_t carvedEnd = 0;
+            carvedAll = carver.carve(path, ranges, [&](const std::vector<SignatureMatch>& matches) {
+                for (const auto& match : matches) {
+                    if (match.offset < carvedEnd || (!carved.empty() && insideCarved(match.offset))) {
+                        continue;
+                    }
+
+                    IndexedSegment* owner = nullptr;
+                    if (indexing) {
+                        // Ranges reach a few bytes past a segment; those hits belong to a neighbour
+                        auto next = std::upper_bound(stale.begin(), stale.end(), match.offset,
+                                                     [](uint64_t offset, const IndexedSegment& segment) {
+                                                         return offset < segment.start;
+                                                     });
+                        if (next == stale.begin() || match.offset >= (next - 1)->end) continue;
+                        owner = &*(next - 1);
+                    }
 
-        while (file.read(reinterpret_cast<char*>(buffer.data()), bufferSize)) {
-            size_t bytesRead = static_cast<size_t>(file.gcount());
-            if (bytesRead == 0) break;
+                    // Follow the format to its end; headers that lead nowhere are dropped here
+                    CarvedExtent extent;
+                    {
+                        ScopedStatTimer timer(kStatValidateNanos);
+                        extent = walker.walk(match.offset, match.fileType);
+                    }
+                    if (extent.status == CarveStatus::Invalid) {
+                        ScanStats::add(kStatRejects, 1);
+                        continue;
+                    }
 
-            for (const auto& signature : signatures) {
-                if (signature.size() > bytesRead) continue;
+                    // A photo or video that stops making sense partway may
+                    // continue in blocks further on. MP4 boxes only give
+                    // sizes, so a fragmented one can still look complete.
+                    std::vector<ByteRange> fragments;
+                    if ((extent.status == CarveStatus::Truncated && match.fileType == JPEG) || match.fileType == MP4) {
+                        ScopedStatTimer timer(kStatValidateNanos);
+                        ReassembledFile file = reassembler.reassemble(match.offset, match.fileType, unallocated, carved);
+                        if (file.fragments.size() > 1) {
+                            extent.status = file.status;
+                            extent.end = file.fragments.front().offset + file.fragments.front().length;
+                            fragments = std::move(file.fragments);
+                        }
+                    }
 
-                for (size_t i = 0; i <= bytesRead - signature.size(); ++i) {
-                    if (std::equal(signature.begin(), signature.end(), buffer.begin() + i)) {
-                        results.push_back(fileId++);
-                        LOGI("Found file signature at offset: %zu",
-                             static_cast<size_t>(file.tellg()) - bytesRead + i);
+                    // Typed like a directory entry of the same file would be
+                    int fileType = match.fileType == ZIP && query_.wantsOffice() ? walker.identify(match.offset)
+                                                                                 : match.fileType;
+                    IndexedHit hit = {match.offset, extent.end - extent.start, fileType,
+                                      extent.status == CarveStatus::Complete, fragments};
+                    carvedEnd = std::max(carvedEnd, extent.end);
+                    if (!fragments.empty()) {
+                        // Later fragments are claimed so their blocks are not carved again
+                        hit.length = 0;
+                        for (const auto& fragment : fragments) {
+                            hit.length += fragment.length;
+                            if (fragment.offset < carvedEnd) continue;
+                            carved.insert(std::upper_bound(carved.begin(), carved.end(), fragment.offset,
+                                                           [](uint64_t offset, const ByteRange& range) {
+                                                               return offset < range.offset;
+                                                           }),
+                                          fragment);
+                        }
                     }
+
+                    // Its blocks stay claimed, so what it holds is not reported either
+                    if (!query_.wantsSize(hit.length)) continue;
+                    hit.contentHash = hashHit(hit);
+                    if (owner) owner->hits.push_back(hit);
+                    if (!emitHit(hit)) return false;
                 }
+                return true;
+            });
+        }
+
+        if (carver.stopped()) {
+            return false;
+        }
+        if (!carvedAll) {
+            // Segments with unread blocks must be carved again next time
+            LOGE("Carve of %s did not read all of its ranges", path);
+            carveShort_ = true;
+        } else if (indexing) {
+            for (auto& segment : stale) {
+                index_->storeSegment(path, sourceSize, std::move(segment));
             }
         }
 
     } catch (const std::exception& e) {
+        // Out of memory, a full arena or a walker error: what was found so far is not the whole scan
         LOGE("Error scanning for file signatures: %s", e.what());
+        return false;
     }
 
-    return results;
+    return true;
 }
 
-std::vector<int> FileRecoveryEngine::scanSystemAreas(const char* basePath) {
-    std::vector<int> results;
+std::vector<IndexedSegment> FileRecoveryEngine::indexSegments(const char* path, const Ext4Reader* ext4,
+                                                              uint64_t& sourceSize) {
+    std::vector<IndexedSegment> segments;
+
+    if (ext4) {
+        // One segment per block group, versioned by its bitmap
+        sourceSize = ext4->blockCount() * ext4->blockSize();
+        std::vector<uint64_t> checksums = ext4->bitmapChecksums();
+        for (uint32_t group = 0; group < checksums.size(); ++group) {
+            ByteRange range = ext4->groupRange(group);
+            segments.push_back({range.offset, range.offset + range.length, checksums[group], {}});
+        }
+        return segments;
+    }
+
+    // Image files are one segment, versioned by size and timestamps. Other
+    // block devices have no cheap change marker and are always rescanned.
+    struct stat statbuf;
+    if (stat(path, &statbuf) != 0 || !S_ISREG(statbuf.st_mode) || statbuf.st_size <= 0) {
+        return segments;
+    }
+
+    sourceSize = static_cast<uint64_t>(statbuf.st_size);
+    const uint64_t markers[] = {
+            sourceSize,
+            static_cast<uint64_t>(toNanos(statbuf.st_mtim)),
+            static_cast<uint64_t>(toNanos(statbuf.st_ctim)),
+            static_cast<uint64_t>(statbuf.st_ino)
+    };
+    uint64_t generation = 0xcbf29ce484222325ULL;
+    for (uint64_t marker : markers) {
+        generation = (generation ^ marker) * 0x100000001b3ULL;
+    }
+    segments.push_back({0, sourceSize, generation, {}});
+    return segments;
+}
+
+std::vector<ByteRange> FileRecoveryEngine::restrictToSegments(const std::vector<ByteRange>& freeExtents,
+                                                              const std::vector<IndexedSegment>& segments,
+                                                              uint64_t headerReach) {
+    // Both lists are in offset order. Each piece runs a header's length past
+    // its segment, within the same free extent, so boundary headers are seen.
+    std::vector<ByteRange> ranges;
+    uint64_t tail = headerReach > 0 ? headerReach - 1 : 0;
+    size_t e = 0;
+    for (const auto& segment : segments) {
+        while (e < freeExtents.size() && freeExtents[e].offset + freeExtents[e].length <= segment.start) {
+            ++e;
+        }
+        for (size_t i = e; i < freeExtents.size() && freeExtents[i].offset < segment.end; ++i) {
+            uint64_t extentEnd = freeExtents[i].offset + freeExtents[i].length;
+            uint64_t start = std::max(freeExtents[i].offset, segment.start);
+            uint64_t end = std::min(extentEnd, segment.end + tail);
+            ranges.push_back({start, end - start});
+        }
+    }
+    return ranges;
+}
 
+bool FileRecoveryEngine::scanSystemAreas(const char* basePath, HitBatcher& hits) {
     if (!basePath) {
         LOGE("Null basePath provided");
-        return results;
+        return true;
     }
 
     static const std::vector<std::string> systemPaths = {
@@ -165,16 +812,13 @@ std::vector<int> FileRecoveryEngine::scanSystemAreas(const char* basePath) {
             "/data/media/0/.Trash-1000"
     };
 
-    int fileId = 2000; // Start from 2000 for system scan results
-
     for (const auto& sysPath : systemPaths) {
-        if (access(sysPath.c_str(), R_OK) == 0) {
-            auto pathResults = scanForDeletedEntries(sysPath.c_str(), true);
-            results.insert(results.end(), pathResults.begin(), pathResults.end());
+        if (access(sysPath.c_str(), R_OK) == 0 && !scanDirectoryEntries(sysPath.c_str(), kHitSystemArea, hits)) {
+            return false;
         }
     }
 
-    return results;
+    return true;
 }
 
 std::vector<uint8_t> FileRecoveryEngine::recoverDeletedFile(const char* filePath) {
@@ -188,70 +832,254 @@ std::vector<uint8_t> FileRecoveryEngine::recoverDeletedFile(const char* filePath
     LOGI("Attempting to recover file: %s", filePath);
 
     try {
-        // First try direct file access
-        std::ifstream file(filePath, std::ios::binary);
-        if (file.is_open()) {
+        // Direct file access first, then backup locations
+        for (const auto& candidate : recoveryCandidates(filePath)) {
+            std::ifstream file(candidate, std::ios::binary);
+            if (!file.is_open()) continue;
+
             file.seekg(0, std::ios::end);
             std::streampos fileSize = file.tellg();
-            if (fileSize <= 0) {
-                LOGI("File is empty");
+            if (fileSize <= 0) continue;
+
+            if (!fitsMemoryBudget(static_cast<uint64_t>(fileSize), candidate.c_str())) {
                 return recoveredData;
             }
-
+            BudgetLease lease(static_cast<size_t>(fileSize));
             file.seekg(0, std::ios::beg);
             recoveredData.resize(static_cast<size_t>(fileSize));
 
-            if (!file.read(reinterpret_cast<char*>(recoveredData.data()), fileSize)) {
-                LOGE("Failed to read file contents");
-                recoveredData.clear();
-            } else {
-                LOGI("Successfully recovered %zu bytes from direct access",
-                     static_cast<size_t>(fileSize));
+            if (file.read(reinterpret_cast<char*>(recoveredData.data()), fileSize)) {
+                LOGI("Successfully recovered %zu bytes from: %s",
+                     static_cast<size_t>(fileSize), candidate.c_str());
+                return recoveredData;
             }
-            return recoveredData;
+            LOGE("Failed to read file contents: %s", candidate.c_str());
+            recoveredData.clear();
+        }
+
+        // Try journal/log file recovery
+        recoveredData = recoverFromJournal(filePath);
+        if (!recoveredData.empty()) {
+            LOGI("Successfully recovered %zu bytes from journal", recoveredData.size());
         }
 
-        // Try recovery from backup locations
-        const char* fileName = strrchr(filePath, '/');
-        fileName = fileName ? fileName + 1 : filePath;
+    } catch (const std::exception& e) {
+        LOGE("Error during file recovery: %s", e.what());
+    }
 
-        static const std::vector<std::string> backupPaths = {
-                std::string(filePath) + ".bak",
-                std::string(filePath) + "~",
-                "/data/media/0/.trash/" + std::string(fileName),
-                "/cache/" + std::string(fileName)
-        };
+    return recoveredData;
+}
 
-        for (const auto& backupPath : backupPaths) {
-            std::ifstream backupFile(backupPath, std::ios::binary);
-            if (backupFile.is_open()) {
-                backupFile.seekg(0, std::ios::end);
-                std::streampos fileSize = backupFile.tellg();
-                if (fileSize <= 0) continue;
+bool FileRecoveryEngine::recoverToFd(const char* location, int outFd) {
+    if (!location || outFd < 0) {
+        LOGE("Invalid recovery location or output descriptor");
+        return false;
+    }
 
-                backupFile.seekg(0, std::ios::beg);
-                recoveredData.resize(static_cast<size_t>(fileSize));
+    LOGI("Recovering to fd %d from: %s", outFd, location);
 
-                if (backupFile.read(reinterpret_cast<char*>(recoveredData.data()), fileSize)) {
-                    LOGI("Successfully recovered %zu bytes from backup: %s",
-                         static_cast<size_t>(fileSize), backupPath.c_str());
-                    return recoveredData;
-                }
-                recoveredData.clear();
+    try {
+        std::string sourcePath;
+        std::vector<ByteRange> extents;
+        // Without a length an extent cannot be copied; the location may
+        // then be a file name that happens to end in @<digits>
+        if (parseExtentLocation(location, sourcePath, extents) &&
+            std::none_of(extents.begin(), extents.end(), [](const ByteRange& extent) { return extent.length == 0; })) {
+            uint64_t length = 0;
+            for (const auto& extent : extents) {
+                length += extent.length;
+            }
+
+            int fd = open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                LOGE("Cannot open source: %s", sourcePath.c_str());
+                return false;
+            }
+            // Fragments are written back to back in file order
+            uint64_t copied = 0;
+            for (const auto& extent : extents) {
+                uint64_t written = ExtentCopier::copy(fd, extent.offset, extent.length, outFd);
+                copied += written;
+                if (written != extent.length) break;
             }
+            close(fd);
+            LOGI("Recovered %llu bytes from %zu extent(s)", static_cast<unsigned long long>(copied), extents.size());
+            return copied == length;
         }
 
-        // Try journal/log file recovery
-        recoveredData = recoverFromJournal(filePath);
-        if (!recoveredData.empty()) {
-            LOGI("Successfully recovered %zu bytes from journal", recoveredData.size());
+        // Direct file access first, then backup locations
+        for (const auto& candidate : recoveryCandidates(location)) {
+            int fd = open(candidate.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+
+            uint64_t size = BlockReader::querySize(fd);
+            if (size == 0) {
+                close(fd);
+                continue;
+            }
+
+            uint64_t copied = ExtentCopier::copy(fd, 0, size, outFd);
+            close(fd);
+            LOGI("Recovered %llu bytes from: %s", static_cast<unsigned long long>(copied), candidate.c_str());
+            return copied == size;
+        }
+
+        // A deleted file the ext4 journal still maps is copied like a carved one
+        std::string device;
+        if (locateInJournal(location, device, extents)) {
+            return recoverToFd(extentLocation(device.c_str(), extents).c_str(), outFd);
         }
 
     } catch (const std::exception& e) {
-        LOGE("Error during file recovery: %s", e.what());
+        LOGE("Error during recovery to fd: %s", e.what());
     }
 
-    return recoveredData;
+    return false;
+}
+
+bool FileRecoveryEngine::openPreviewSource(const char* location, PreviewExtractor& extractor) {
+    if (!location) {
+        return false;
+    }
+
+    std::string sourcePath;
+    std::vector<ByteRange> extents;
+    if (parseExtentLocation(location, sourcePath, extents)) {
+        return extractor.open(sourcePath.c_str(), extents);
+    }
+
+    for (const auto& candidate : recoveryCandidates(location)) {
+        if (extractor.open(candidate.c_str(), {{0, 0}})) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<uint8_t> FileRecoveryEngine::extractPreview(const char* location) {
+    std::vector<uint8_t> preview;
+    if (!location) {
+        return preview;
+    }
+
+    PreviewCache& cache = PreviewCache::shared();
+    if (cache.get(location, preview)) {
+        return preview;
+    }
+
+    try {
+        PreviewExtractor extractor;
+        if (!openPreviewSource(location, extractor)) {
+            LOGE("Cannot open preview source: %s", location);
+            return preview;
+        }
+        preview = extractor.extractEmbedded();
+        cache.put(location, preview);
+    } catch (const std::exception& e) {
+        LOGE("Error extracting preview: %s", e.what());
+    }
+
+    return preview;
+}
+
+std::vector<std::string> FileRecoveryEngine::recoveryCandidates(const char* filePath) {
+    const char* fileName = strrchr(filePath, '/');
+    fileName = fileName ? fileName + 1 : filePath;
+
+    return {
+            std::string(filePath),
+            std::string(filePath) + ".bak",
+            std::string(filePath) + "~",
+            "/data/media/0/.trash/" + std::string(fileName),
+            "/cache/" + std::string(fileName)
+    };
+}
+
+bool FileRecoveryEngine::parseExtentLocation(const char* location, std::string& sourcePath,
+                                             std::vector<ByteRange>& extents) {
+    const char* at = strrchr(location, '@');
+    if (!at || at == location) {
+        return false;
+    }
+    // A real file such as /sdcard/Download/report@20240517 is not an extent
+    struct stat statbuf;
+    if (stat(location, &statbuf) == 0) {
+        return false;
+    }
+
+    extents.clear();
+    const char* next = at + 1;
+    while (true) {
+        if (!isdigit(static_cast<unsigned char>(*next))) return false;
+        char* end = nullptr;
+        uint64_t offset = strtoull(next, &end, 10);
+        uint64_t length = 0;
+        if (*end == '+') {
+            const char* lengthStart = end + 1;
+            if (!isdigit(static_cast<unsigned char>(*lengthStart))) return false;
+            length = strtoull(lengthStart, &end, 10);
+        }
+        extents.push_back({offset, length});
+        if (*end == '\0') break;
+        if (*end != ',') return false;
+        next = end + 1;
+    }
+
+    sourcePath.assign(location, at);
+    return true;
+}
+
+std::vector<JournalFile> FileRecoveryEngine::journalFiles(const Ext4Reader& ext4,
+                                                         const std::vector<ByteRange>& unallocated,
+                                                         const StopCheck& stop) {
+    std::vector<JournalFile> files;
+    Jbd2Journal journal(ext4);
+    if (!journal.load(stop)) {
+        return files;
+    }
+
+    for (auto& file : journal.deletedFiles(stop)) {
+        // Blocks handed to another file since would give back its data instead
+        bool intact = std::all_of(file.extents.begin(), file.extents.end(), [&](const ByteRange& extent) {
+            return insideRanges(unallocated, extent);
+        });
+        if (intact) {
+            files.push_back(std::move(file));
+        }
+    }
+    LOGI("Journal maps %zu deleted files", files.size());
+    return files;
+}
+
+bool FileRecoveryEngine::locateInJournal(const char* filePath, std::string& device,
+                                         std::vector<ByteRange>& extents) {
+    device = ext4DeviceFor(filePath);
+    if (device.empty()) {
+        return false;
+    }
+
+    Ext4Reader ext4;
+    if (!ext4.open(device)) {
+        return false;
+    }
+
+    // Directory blocks give names, not full paths, so the last component is matched
+    const char* name = strrchr(filePath, '/');
+    name = name ? name + 1 : filePath;
+    const JournalFile* newest = nullptr;
+    std::vector<JournalFile> files = journalFiles(ext4, ext4.freeExtents());
+    for (const auto& file : files) {
+        if (file.name == name && (!newest || static_cast<int32_t>(file.sequence - newest->sequence) > 0)) {
+            newest = &file;
+        }
+    }
+    if (!newest) {
+        return false;
+    }
+
+    LOGI("Journal has inode %u for %s in %zu extent(s)", newest->inode, filePath, newest->extents.size());
+    extents = newest->extents;
+    return true;
 }
 
 std::vector<uint8_t> FileRecoveryEngine::recoverFromJournal(const char* filePath) {
@@ -263,27 +1091,37 @@ std::vector<uint8_t> FileRecoveryEngine::recoverFromJournal(const char* filePath
     }
 
     try {
-        // Check ext4 journal
-        const char* journalPath = "/proc/fs/ext4/journal";
-        std::ifstream journal(journalPath, std::ios::binary);
-
-        if (journal.is_open()) {
-            const size_t bufferSize = 4096;
-            std::vector<uint8_t> buffer(bufferSize);
-            std::string targetPath(filePath);
-
-            while (journal.read(reinterpret_cast<char*>(buffer.data()), bufferSize)) {
-                size_t bytesRead = static_cast<size_t>(journal.gcount());
-                if (bytesRead == 0) break;
-
-                // Look for file path references in journal
-                std::string bufferStr(reinterpret_cast<char*>(buffer.data()), bytesRead);
-                if (bufferStr.find(targetPath) != std::string::npos) {
-                    recoveredData.insert(recoveredData.end(), buffer.begin(), buffer.begin() + bytesRead);
-                    break;
-                }
+        std::string device;
+        std::vector<ByteRange> extents;
+        if (!locateInJournal(filePath, device, extents)) {
+            return recoveredData;
+        }
+
+        uint64_t length = 0;
+        for (const auto& extent : extents) {
+            length += extent.length;
+        }
+        if (!fitsMemoryBudget(length, filePath)) {
+            return recoveredData;
+        }
+
+        int fd = open(device.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOGE("Cannot open device: %s", device.c_str());
+            return recoveredData;
+        }
+        BudgetLease lease(static_cast<size_t>(length));
+        recoveredData.reserve(static_cast<size_t>(length));
+        for (const auto& extent : extents) {
+            size_t start = recoveredData.size();
+            recoveredData.resize(start + static_cast<size_t>(extent.length));
+            if (BlockReader::readFully(fd, recoveredData.data() + start, extent.length, extent.offset) != extent.length) {
+                LOGE("Short read from journaled extent at %llu", static_cast<unsigned long long>(extent.offset));
+                recoveredData.clear();
+                break;
             }
         }
+        close(fd);
     } catch (const std::exception& e) {
         LOGE("Error recovering from journal: %s", e.what());
     }
@@ -294,23 +1132,44 @@ std::vector<uint8_t> FileRecoveryEngine::recoverFromJournal(const char* filePath
 std::vector<std::string> FileRecoveryEngine::scanFreeClusters(const char* devicePath) {
     std::vector<std::string> clusters;
 
+    // One entry per unallocated extent: "<device>@<byte offset>+<byte length>"
+    HitArena arena;
+    scanFreeClusters(devicePath, arena, [&](const HitArena& hits, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            clusters.emplace_back(std::string(devicePath) + "@" + std::to_string(hits[i].offset) +
+                                  "+" + std::to_string(hits[i].length));
+        }
+        return true;
+    });
+
+    return clusters;
+}
+
+bool FileRecoveryEngine::scanFreeClusters(const char* devicePath, HitArena& arena, const HitSink& sink) {
     if (!devicePath) {
         LOGE("Null devicePath provided");
-        return clusters;
+        return false;
     }
 
     LOGI("Scanning free clusters on device: %s", devicePath);
 
     try {
-        // Simulate cluster scanning - real implementation would use low-level disk access
-        for (int i = 0; i < 50; i++) {
-            clusters.emplace_back(std::string(devicePath) + "/cluster_" + std::to_string(i));
+        Ext4Reader ext4;
+        if (!ext4.open(devicePath)) {
+            return false;
         }
+
+        HitBatcher hits(arena, sink, kResultBatchSize);
+        const uint32_t source = arena.addSource(devicePath);
+        bool completed = ext4.forEachFreeExtent([&](const ByteRange& extent) {
+            return hits.add({extent.offset, extent.length, source, UNKNOWN, 60, kHitFreeExtent});
+        });
+
+        return completed && hits.flush();
     } catch (const std::exception& e) {
         LOGE("Error scanning free clusters: %s", e.what());
+        return false;
     }
-
-    return clusters;
 }
 
 bool FileRecoveryEngine::isFileDeleted(const char* filePath) {
@@ -319,13 +1178,14 @@ bool FileRecoveryEngine::isFileDeleted(const char* filePath) {
         return false;
     }
 
+    // Empty and special files are not deleted ones; deleted ext4 inodes are
+    // found by the inode table sweep instead (Ext4Reader::deletedInodes)
     struct stat statbuf;
     if (stat(filePath, &statbuf) != 0) {
-        return true; // File doesn't exist
+        return errno == ENOENT; // Removed since it was listed
     }
-
-    // Check if file size is 0 or if it's a broken symlink
-    return statbuf.st_size == 0 || !S_ISREG(statbuf.st_mode);
+    // Unlinked while still open, e.g. reached through /proc/<pid>/fd
+    return S_ISREG(statbuf.st_mode) && statbuf.st_nlink == 0;
 }
 
 bool FileRecoveryEngine::isFileCorrupted(const char* filePath) {
@@ -339,17 +1199,16 @@ bool FileRecoveryEngine::isFileCorrupted(const char* filePath) {
         return true;
     }
 
-    // Read first few bytes to check for corruption
-    std::vector<uint8_t> header(16);
-    if (!file.read(reinterpret_cast<char*>(header.data()), 16)) {
+    // The first block: a wiped header or a block of filler where the data should be
+    std::vector<uint8_t> head(BlockClassifier::kBlockSize);
+    file.read(reinterpret_cast<char*>(head.data()), static_cast<std::streamsize>(head.size()));
+    size_t length = static_cast<size_t>(file.gcount());
+    if (length < 16) {
         return true;
     }
 
-    // Simple corruption check - all zeros or all 0xFF
-    bool allZeros = std::all_of(header.begin(), header.end(), [](uint8_t b) { return b == 0; });
-    bool allFF = std::all_of(header.begin(), header.end(), [](uint8_t b) { return b == 0xFF; });
-
-    return allZeros || allFF;
+    bool wipedHeader = BlockClassifier::isUniform(head.data(), 16) && (head[0] == 0x00 || head[0] == 0xFF);
+    return wipedHeader || BlockClassifier::isUniform(head.data(), length);
 }
 
 bool FileRecoveryEngine::detectRootAccess() {
@@ -423,58 +1282,5 @@ bool FileRecoveryEngine::checkSystemPartition() {
 int FileRecoveryEngine::identifyFileType(const uint8_t* signature, size_t length) {
     if (!signature || length < 4) return UNKNOWN;
 
-    return detectFileTypeBySignature(signature, length);
+    return identifySignature(signature, length);
 }
-
-int FileRecoveryEngine::detectFileTypeBySignature(const uint8_t* data, size_t size) {
-    if (!data || size < 4) return UNKNOWN;
-
-    // JPEG
-    if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
-        return JPEG;
-    }
-
-    // PNG
-    if (data[0] == 0x89 && data[1] == 0x50 && data[2] == 0x4E && data[3] == 0x47) {
-        return PNG;
-    }
-
-    // GIF
-    if (size >= 4 && memcmp(data, "GIF8", 4) == 0) {
-        return GIF;
-    }
-
-    // PDF
-    if (size >= 4 && memcmp(data, "%PDF", 4) == 0) {
-        return PDF;
-    }
-
-    // ZIP
-    if (data[0] == 0x50 && data[1] == 0x4B && (data[2] == 0x03 || data[2] == 0x05)) {
-        return ZIP;
-    }
-
-    // MP3
-    if ((size >= 2 && data[0] == 0xFF && (data[1] & 0xE0) == 0xE0) ||
-        (size >= 3 && memcmp(data, "ID3", 3) == 0)) {
-        return MP3;
-    }
-
-    // MP4
-    if (size >= 8 && memcmp(data + 4, "ftyp", 4) == 0) {
-        return MP4;
-    }
-
-    // Additional signatures for better detection
-    // DOCX, XLSX, PPTX (ZIP-based)
-    if (size >= 30 && data[0] == 0x50 && data[1] == 0x4B) {
-        if (size >= 31 && memcmp(data + 26, "word/", 5) == 0) {
-            return DOC;
-        }
-        if (size >= 29 && memcmp(data + 26, "xl/", 3) == 0) {
-            return XLS;
-        }
-    }
-
-    return UNKNOWN;
-}
\ No newline at end of file
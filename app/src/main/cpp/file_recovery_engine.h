@@ -2,29 +2,75 @@
 #ifndef FILE_RECOVERY_ENGINE_H
 #define FILE_RECOVERY_ENGINE_H
 
+#include "block_reader.h"
+#include "hit_arena.h"
+#include "file_types.h"
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include <cstdint>
 
-// File type constants
-enum FileType {
-    UNKNOWN = 0,
-    JPEG = 1,
-    PNG = 2,
-    GIF = 3,
-    PDF = 4,
-    ZIP = 5,
-    MP3 = 6,
-    MP4 = 7,
-    DOC = 8,
-    XLS = 9
+class SignatureMatcher;
+class ScanIndex;
+class Ext4Reader;
+struct IndexedSegment;
+struct IndexedHit;
+struct CarveProgress;
+class PreviewExtractor;
+struct JournalFile;
+
+// Tuning for raw device and image scans
+struct ScanOptions {
+    size_t threads = 0;                      // Carving threads, 0 = one per online core
+    uint64_t stripeBytes = 64 * 1024 * 1024; // Bytes carved per task in parallel mode
+    size_t queueDepth = 16;                  // Device reads in flight, 1 = one pread at a time
+    std::string indexPath;                   // Scan index file; empty disables incremental scans
+};
+
+// Narrows a scan to what the caller is after. Each field left at its default
+// leaves that dimension open, so the default query finds everything.
+struct ScanQuery {
+    std::vector<int> fileTypes;           // FileType ids to report; the carver only looks for these
+    std::vector<ByteRange> ranges;        // Source windows to carve, in offset order
+    std::vector<std::string> directories; // Checked for deleted entries instead of the scan path
+    uint64_t minSize = 0;
+    uint64_t maxSize = 0;                 // 0 for no upper bound
+    size_t maxResults = 0;                // The scan ends once this many hits are reported
+    uint64_t timeBudgetNanos = 0;         // The scan ends after this long
+
+    bool wantsType(int fileType) const {
+        return fileTypes.empty() || std::find(fileTypes.begin(), fileTypes.end(), fileType) != fileTypes.end();
+    }
+    // Word or Excel files, which carve as ZIP
+    bool wantsOffice() const { return !fileTypes.empty() && (wantsType(DOC) || wantsType(XLS)); }
+    // Unknown lengths (0) only pass without a minimum
+    bool wantsSize(uint64_t length) const { return length >= minSize && (maxSize == 0 || length <= maxSize); }
+    bool wantsOffset(uint64_t offset) const {
+        return ranges.empty() || std::any_of(ranges.begin(), ranges.end(), [offset](const ByteRange& range) {
+            return offset >= range.offset && offset - range.offset < range.length;
+        });
+    }
+    // Some hits are left out, so the scan cannot stand in for a full one in the scan index
+    bool narrowed() const {
+        return !fileTypes.empty() || !ranges.empty() || !directories.empty() || minSize > 0 || maxSize > 0;
+    }
 };
 
 class FileRecoveryEngine {
 public:
+    static const size_t kResultBatchSize = 512;
+
     FileRecoveryEngine();
     ~FileRecoveryEngine();
 
+    void setScanOptions(const ScanOptions& options) { scanOptions_ = options; }
+    const ScanOptions& scanOptions() const { return scanOptions_; }
+    // Applies to every later scan; types outside the query are not carved at all
+    void setScanQuery(const ScanQuery& query);
+    const ScanQuery& scanQuery() const { return query_; }
+
     // Legacy methods
     std::vector<int> performDeepScan(const char* path, bool isRooted);
     bool detectRootAccess();
@@ -33,16 +79,63 @@ public:
     // Enhanced methods
     std::vector<int> performEnhancedScan(const char* path, bool isRooted);
     std::vector<uint8_t> recoverDeletedFile(const char* filePath);
+    // Streams the recovered data into outFd without staging it in memory.
+    // location is a file path or "<source>@<offset>+<length>" extent.
+    bool recoverToFd(const char* location, int outFd);
     std::vector<std::string> scanFreeClusters(const char* devicePath);
 
+    // Opens location, as recoverToFd takes it, for reading in place
+    bool openPreviewSource(const char* location, PreviewExtractor& extractor);
+    // Embedded preview of the file at location, empty if it has none; see PreviewCache
+    std::vector<uint8_t> extractPreview(const char* location);
+
+    // Streaming variants: hits are appended to the arena and handed to the
+    // sink every kResultBatchSize hits
+    bool performEnhancedScan(const char* path, bool isRooted, HitArena& arena, const HitSink& sink);
+    bool scanFreeClusters(const char* devicePath, HitArena& arena, const HitSink& sink);
+
+    // Returning false stops the carve; see ParallelCarver::ProgressSink
+    using CarveProgressSink = std::function<bool(const CarveProgress&)>;
+
+    // Carves one device or image for file signatures only, with progress
+    // reports in between. Headers below resumeOffset are not carved again;
+    // resumeHits, what an earlier run found there, are replayed instead.
+    // Every hit reported, replays included, is also appended to found with
+    // its content key, ready for a checkpoint.
+    // True only if every block of the source was read, or the query was met.
+    bool carveSignatures(const char* path, HitArena& arena, const HitSink& sink, const CarveProgressSink& progress,
+                         uint64_t resumeOffset, const std::vector<IndexedHit>& resumeHits,
+                         std::vector<IndexedHit>* found = nullptr);
+
 private:
+    // The host benchmarks time the scanning kernels below directly
+    friend class ScanBench;
+
     // Enhanced scanning methods
-    std::vector<int> scanForDeletedEntries(const char* path, bool isRooted);
-    std::vector<int> scanForFileSignatures(const char* path);
-    std::vector<int> scanSystemAreas(const char* basePath);
+    bool runEnhancedScan(const char* path, bool isRooted, HitBatcher& hits);
+    bool scanForDeletedEntries(const char* path, bool isRooted, HitBatcher& hits);
+    bool scanDirectoryEntries(const char* path, uint8_t flags, HitBatcher& hits);
+    bool scanForFileSignatures(const char* path, HitBatcher& hits);
+    std::vector<IndexedSegment> indexSegments(const char* path, const Ext4Reader* ext4, uint64_t& sourceSize);
+    static std::vector<ByteRange> restrictToSegments(const std::vector<ByteRange>& freeExtents,
+                                                     const std::vector<IndexedSegment>& segments,
+                                                     uint64_t headerReach);
+    bool scanSystemAreas(const char* basePath, HitBatcher& hits);
+
+    // Deleted files the ext4 journal still maps, kept only where every
+    // extent lies in unallocated space and so still holds the file's data
+    std::vector<JournalFile> journalFiles(const Ext4Reader& ext4, const std::vector<ByteRange>& unallocated,
+                                          const StopCheck& stop = nullptr);
 
     // Recovery methods
     std::vector<uint8_t> recoverFromJournal(const char* filePath);
+    // Device and extents of the newest journaled file named like filePath's last component
+    bool locateInJournal(const char* filePath, std::string& device, std::vector<ByteRange>& extents);
+    std::vector<std::string> recoveryCandidates(const char* filePath);
+    // "<source>@<offset>[+<length>]", with further ",<offset>+<length>" for fragmented files.
+    // False for a location that exists as a file of its own.
+    static bool parseExtentLocation(const char* location, std::string& sourcePath,
+                                    std::vector<ByteRange>& extents);
     bool isFileDeleted(const char* filePath);
     bool isFileCorrupted(const char* filePath);
 
@@ -51,8 +144,30 @@ private:
     bool checkRootFiles();
     bool checkSystemPartition();
 
-    // File type detection
-    int detectFileTypeBySignature(const uint8_t* data, size_t size);
+    // Carving automaton over the kSignatures entries marked for carving
+    static const SignatureMatcher& signatureMatcher();
+    // The one above, or one over just the query's types
+    const SignatureMatcher& carveMatcher() const;
+
+    // Starts the query's clock and hit quota for a scan into hits
+    void beginQuery(HitBatcher& hits);
+    // True once the query's time budget is spent
+    bool outOfTime();
+    // Whether a scan that stopped early did so because its query was satisfied
+    bool queryMet(const HitBatcher& hits) const { return timedOut_ || hits.limitReached(); }
+
+    ScanOptions scanOptions_;
+    ScanQuery query_;
+    std::unique_ptr<SignatureMatcher> queryMatcher_; // Set when the query names file types
+    uint64_t deadlineNanos_ = 0;
+    bool timedOut_ = false;
+    // Set only while carveSignatures runs
+    const CarveProgressSink* carveProgress_ = nullptr;
+    uint64_t resumeOffset_ = 0;
+    const std::vector<IndexedHit>* resumeHits_ = nullptr;
+    std::vector<IndexedHit>* carveFound_ = nullptr;
+    bool carveShort_ = false; // A carve left blocks of its ranges unread
+    std::unique_ptr<ScanIndex> index_; // Only set while a scan is running
 };
 
 #endif // FILE_RECOVERY_ENGINE_H
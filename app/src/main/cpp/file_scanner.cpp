@@ -1,8 +1,6 @@
 #include "file_scanner.h"
-#include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <cstring>
 #include <android/log.h>
 
 #ifndef R_OK
@@ -24,39 +22,24 @@ FileScanner::~FileScanner() {
 std::vector<std::string> FileScanner::scanDirectory(const std::string& path, bool recursive) {
     std::vector<std::string> files;
 
-    LOGI("Scanning directory: %s", path.c_str());
-
-    DIR* dir = opendir(path.c_str());
-    if (!dir) {
-        LOGE("Cannot open directory: %s", path.c_str());
-        return files;
-    }
-
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-
-        std::string fullPath = path + "/" + entry->d_name;
-        struct stat statbuf;
-
-        if (stat(fullPath.c_str(), &statbuf) == 0) {
-            if (S_ISREG(statbuf.st_mode)) {
-                files.push_back(fullPath);
-            } else if (S_ISDIR(statbuf.st_mode) && recursive) {
-                auto subFiles = scanDirectory(fullPath, recursive);
-                files.insert(files.end(), subFiles.begin(), subFiles.end());
-            }
-        }
-    }
+    scanDirectory(path, recursive, [&files](const std::vector<std::string>& batch) {
+        files.insert(files.end(), batch.begin(), batch.end());
+        return true;
+    });
 
-    closedir(dir);
     LOGI("Found %zu files in directory: %s", files.size(), path.c_str());
-
     return files;
 }
 
+bool FileScanner::scanDirectory(const std::string& path, bool recursive, const DirWalker::PathSink& sink) {
+    LOGI("Scanning directory: %s", path.c_str());
+
+    WalkOptions options;
+    options.recursive = recursive;
+    DirWalker walker(options);
+    return walker.walk(path, sink);
+}
+
 std::vector<std::string> FileScanner::findDeletedFiles(const std::string& path) {
     std::vector<std::string> deletedFiles;
 
@@ -2,6 +2,7 @@
 #ifndef FILE_SCANNER_H
 #define FILE_SCANNER_H
 
+#include "dir_walker.h"
 #include <string>
 #include <vector>
 
@@ -11,6 +12,8 @@ public:
     ~FileScanner();
     
     std::vector<std::string> scanDirectory(const std::string& path, bool recursive = true);
+    // Streams regular file paths in batches instead of collecting them all
+    bool scanDirectory(const std::string& path, bool recursive, const DirWalker::PathSink& sink);
     std::vector<std::string> findDeletedFiles(const std::string& path);
     bool isFileRecoverable(const std::string& filePath);
     size_t getFileSize(const std::string& filePath);
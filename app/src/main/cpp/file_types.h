@@ -0,0 +1,152 @@
+#ifndef FILE_TYPES_H
+#define FILE_TYPES_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "byte_order.h"
+
+// File type ids shared by every scanner and with Kotlin (nativeTypeToFileType)
+enum FileType {
+    UNKNOWN = 0,
+    JPEG = 1,
+    PNG = 2,
+    GIF = 3,
+    PDF = 4,
+    ZIP = 5,
+    MP3 = 6,
+    MP4 = 7,
+    DOC = 8,
+    XLS = 9
+};
+
+// Extra check on the bytes at the start of a file, run after the magic matched
+using SignatureValidator = bool (*)(const uint8_t* data, size_t size);
+
+struct Signature {
+    uint8_t bytes[8];
+    uint8_t mask[8];          // Bits of each byte that must match
+    uint8_t length;
+    uint8_t offset;           // Distance from the start of the file to the magic
+    FileType type;
+    SignatureValidator validate;
+    bool carve;               // Searched for by raw scans; exact bytes only
+};
+
+namespace signatures {
+
+// Office files start with [Content_Types].xml and _rels/ ahead of their own
+// folder, so walk the local headers in the data for a member under it
+inline bool officeArchive(const uint8_t* data, size_t size, const char* member) {
+    size_t length = strlen(member);
+    size_t pos = 0;
+    while (pos + 30 <= size && memcmp(data + pos, "PK\x03\x04", 4) == 0) {
+        uint16_t nameLength = readLe16(data + pos + 26);
+        if (nameLength >= length && pos + 30 + length <= size && memcmp(data + pos + 30, member, length) == 0) {
+            return true;
+        }
+        // Sizes that follow the data in a descriptor leave nowhere to go on to
+        if (readLe16(data + pos + 6) & 0x8) break;
+        pos += 30 + nameLength + readLe16(data + pos + 28) + readLe32(data + pos + 18);
+    }
+    return false;
+}
+
+inline bool wordArchive(const uint8_t* data, size_t size) { return officeArchive(data, size, "word/"); }
+inline bool sheetArchive(const uint8_t* data, size_t size) { return officeArchive(data, size, "xl/"); }
+
+template <size_t N>
+constexpr Signature exact(const char (&magic)[N], FileType type, uint8_t offset = 0, bool carve = true,
+                          SignatureValidator validate = nullptr) {
+    static_assert(N - 1 <= 8, "Signatures are at most 8 bytes");
+    Signature signature = {{}, {}, static_cast<uint8_t>(N - 1), offset, type, validate, carve};
+    for (size_t i = 0; i + 1 < N; ++i) {
+        signature.bytes[i] = static_cast<uint8_t>(magic[i]);
+        signature.mask[i] = 0xFF;
+    }
+    return signature;
+}
+
+constexpr Signature masked(Signature signature, size_t index, uint8_t mask) {
+    signature.mask[index] = mask;
+    signature.bytes[index] &= mask;
+    return signature;
+}
+
+} // namespace signatures
+
+// Every known format, in the order identification tries them: a more
+// specific entry must come before one that would also match its bytes.
+// Adding a format is one line here plus, if needed, a FormatWalker case.
+constexpr Signature kSignatures[] = {
+        signatures::exact("\xFF\xD8\xFF", JPEG),
+        signatures::exact("\x89PNG", PNG),
+        signatures::exact("GIF8", GIF),
+        signatures::exact("%PDF", PDF),
+        signatures::exact("PK\x03\x04", DOC, 0, false, signatures::wordArchive),
+        signatures::exact("PK\x03\x04", XLS, 0, false, signatures::sheetArchive),
+        signatures::exact("PK\x03\x04", ZIP),
+        signatures::exact("PK\x05", ZIP, 0, false),
+        signatures::exact("\xFF\xFB", MP3),
+        signatures::masked(signatures::exact("\xFF\xE0", MP3, 0, false), 1, 0xE0),
+        signatures::exact("ID3", MP3, 0, false),
+        signatures::exact("ftyp", MP4, 4),
+};
+
+constexpr size_t kSignatureCount = sizeof(kSignatures) / sizeof(kSignatures[0]);
+static_assert(kSignatureCount <= 32, "Dispatch masks hold 32 signatures");
+
+namespace signatures {
+
+constexpr bool carvedAreExact() {
+    for (const auto& signature : kSignatures) {
+        for (size_t i = 0; signature.carve && i < signature.length; ++i) {
+            if (signature.mask[i] != 0xFF) return false;
+        }
+    }
+    return true;
+}
+static_assert(carvedAreExact(), "The carving automaton only matches exact bytes");
+
+// Bit i of kDispatch[b] is set when kSignatures[i] can match a file whose
+// first byte is b; signatures placed past the start are in every entry
+constexpr std::array<uint32_t, 256> buildDispatch() {
+    std::array<uint32_t, 256> table = {};
+    for (size_t i = 0; i < kSignatureCount; ++i) {
+        const Signature& signature = kSignatures[i];
+        for (size_t b = 0; b < 256; ++b) {
+            if (signature.offset > 0 || (b & signature.mask[0]) == signature.bytes[0]) {
+                table[b] |= 1u << i;
+            }
+        }
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> kDispatch = buildDispatch();
+
+} // namespace signatures
+
+// Type of the file starting at data, or UNKNOWN. One table lookup picks the
+// few signatures that can apply; only those are compared.
+inline FileType identifySignature(const uint8_t* data, size_t size) {
+    if (!data || size == 0) return UNKNOWN;
+
+    for (uint32_t candidates = signatures::kDispatch[data[0]]; candidates; candidates &= candidates - 1) {
+        const Signature& signature = kSignatures[__builtin_ctz(candidates)];
+        if (size < static_cast<size_t>(signature.offset) + signature.length) continue;
+
+        const uint8_t* magic = data + signature.offset;
+        bool matches = true;
+        for (size_t i = 0; i < signature.length && matches; ++i) {
+            matches = (magic[i] & signature.mask[i]) == signature.bytes[i];
+        }
+        if (matches && (!signature.validate || signature.validate(data, size))) {
+            return signature.type;
+        }
+    }
+    return UNKNOWN;
+}
+
+#endif // FILE_TYPES_H
@@ -0,0 +1,572 @@
+#include "format_walker.h"
+#include "file_types.h"
+#include "block_reader.h"
+#include "byte_order.h"
+#include "block_classifier.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+#define LOG_TAG "FormatWalker"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const size_t kWindowSize = 256 * 1024;
+
+// Upper bounds on how far a walk may run before the file is called truncated
+const uint64_t kMaxImageBytes = 64ULL * 1024 * 1024;
+const uint64_t kMaxDocumentBytes = 256ULL * 1024 * 1024;
+const uint64_t kMaxMediaBytes = 4ULL * 1024 * 1024 * 1024;
+
+// A lone FF FB pair is common in random data; a real stream has many frames
+const int kMinMp3Frames = 8;
+const int kMaxMp4Boxes = 4096;
+
+const uint8_t kPngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+    static uint32_t table[256];
+    static const bool initialised = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void) initialised;
+
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+CarvedExtent result(uint64_t start, uint64_t end, CarveStatus status) {
+    return {start, status == CarveStatus::Invalid ? start : end, status};
+}
+
+// Frame length of an MPEG audio Layer III header, 0 if the header is not valid
+uint32_t mp3FrameLength(const uint8_t* h) {
+    static const uint16_t kBitratesV1[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+    static const uint16_t kBitratesV2[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+    static const uint32_t kSampleRates[3] = {44100, 48000, 32000};
+
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return 0;
+    int version = (h[1] >> 3) & 3;       // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+    int layer = (h[1] >> 1) & 3;         // 1 = Layer III
+    int bitrateIndex = (h[2] >> 4) & 15;
+    int rateIndex = (h[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || rateIndex == 3) return 0;
+
+    uint32_t bitrate = (version == 3 ? kBitratesV1 : kBitratesV2)[bitrateIndex] * 1000u;
+    if (bitrate == 0) return 0;
+    uint32_t sampleRate = kSampleRates[rateIndex] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    uint32_t padding = (h[2] >> 1) & 1;
+    return (version == 3 ? 144 : 72) * bitrate / sampleRate + padding;
+}
+
+bool isMp4TopLevelBox(const uint8_t* type) {
+    static const char* const kTypes[] = {
+            "ftyp", "moov", "mdat", "free", "skip", "wide", "uuid", "meta",
+            "moof", "mfra", "pdin", "styp", "sidx", "udta", "pnot"
+    };
+    for (const char* known : kTypes) {
+        if (memcmp(type, known, 4) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+FormatWalker::FormatWalker(const char* path)
+        : fd_(-1), sourceSize_(0), window_(kWindowSize), windowOffset_(0), windowLength_(0), zipSearchedFrom_(0),
+          zipSearchedTo_(0) {
+    fd_ = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        LOGE("Cannot open source: %s", path);
+        return;
+    }
+    sourceSize_ = BlockReader::querySize(fd_);
+}
+
+FormatWalker::~FormatWalker() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+int FormatWalker::identify(uint64_t start) {
+    if (start >= sourceSize_) return UNKNOWN;
+    size_t length = static_cast<size_t>(std::min<uint64_t>(BlockClassifier::kBlockSize, sourceSize_ - start));
+    const uint8_t* data = at(start, length);
+    return data ? identifySignature(data, length) : UNKNOWN;
+}
+
+const uint8_t* FormatWalker::at(uint64_t offset, size_t length) {
+    if (length > window_.size() || offset + length > sourceSize_) {
+        return nullptr;
+    }
+    if (offset >= windowOffset_ && offset + length <= windowOffset_ + windowLength_) {
+        return window_.data() + (offset - windowOffset_);
+    }
+
+    // Align reloads so neighbouring small reads share one pread
+    windowOffset_ = offset & ~static_cast<uint64_t>(4095);
+    if (offset + length > windowOffset_ + window_.size()) {
+        windowOffset_ = offset;
+    }
+    size_t wanted = static_cast<size_t>(std::min<uint64_t>(window_.size(), sourceSize_ - windowOffset_));
+    windowLength_ = BlockReader::readFully(fd_, window_.data(), wanted, windowOffset_);
+    if (offset + length > windowOffset_ + windowLength_) {
+        windowLength_ = 0;
+        return nullptr;
+    }
+    return window_.data() + (offset - windowOffset_);
+}
+
+bool FormatWalker::findByte(uint8_t value, uint64_t from, uint64_t limit, uint64_t& found) {
+    limit = std::min(limit, sourceSize_);
+    while (from < limit) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(limit - from, window_.size() / 2));
+        const uint8_t* data = at(from, chunk);
+        if (!data) return false;
+        const void* hit = memchr(data, value, chunk);
+        if (hit) {
+            found = from + static_cast<uint64_t>(static_cast<const uint8_t*>(hit) - data);
+            return true;
+        }
+        from += chunk;
+    }
+    return false;
+}
+
+bool FormatWalker::findByteInData(uint8_t value, uint64_t from, uint64_t limit, uint64_t& found) {
+    const uint64_t kBlock = BlockClassifier::kBlockSize;
+    limit = std::min(limit, sourceSize_);
+    while (from < limit) {
+        uint64_t end = std::min(limit, from + window_.size() / 2);
+        // Chunks end on a block boundary so no block is split between two of them
+        if (end < limit && end / kBlock * kBlock > from) end = end / kBlock * kBlock;
+        size_t chunk = static_cast<size_t>(end - from);
+        const uint8_t* data = at(from, chunk);
+        if (!data) break;
+
+        size_t searched = chunk;
+        for (uint64_t block = (from + kBlock - 1) / kBlock * kBlock; block + kBlock <= end; block += kBlock) {
+            if (BlockClassifier::isUniform(data + (block - from), kBlock)) {
+                searched = static_cast<size_t>(block - from);
+                break;
+            }
+        }
+        const void* hit = memchr(data, value, searched);
+        if (hit) {
+            found = from + static_cast<uint64_t>(static_cast<const uint8_t*>(hit) - data);
+            return true;
+        }
+        from += searched;
+        if (searched < chunk) break;
+    }
+    found = from;
+    return false;
+}
+
+bool FormatWalker::find(const char* pattern, size_t length, uint64_t from, uint64_t limit, uint64_t& found) {
+    limit = std::min(limit, sourceSize_);
+    while (from + length <= limit) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(limit - from, window_.size() / 2));
+        const uint8_t* data = at(from, chunk);
+        if (!data || chunk < length) return false;
+        const void* hit = memmem(data, chunk, pattern, length);
+        if (hit) {
+            found = from + static_cast<uint64_t>(static_cast<const uint8_t*>(hit) - data);
+            return true;
+        }
+        // Keep the tail so a pattern split across chunks is still seen
+        from += chunk - length + 1;
+    }
+    return false;
+}
+
+CarvedExtent FormatWalker::walk(uint64_t start, int fileType) {
+    if (!isOpen() || start >= sourceSize_) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    switch (fileType) {
+        case JPEG: return walkJpeg(start, start + kMaxImageBytes);
+        case PNG:  return walkPng(start, start + kMaxImageBytes);
+        case GIF:  return walkGif(start, start + kMaxImageBytes);
+        case ZIP:  return walkZip(start, start + kMaxDocumentBytes);
+        case PDF:  return walkPdf(start, start + kMaxDocumentBytes);
+        case MP3:  return walkMp3(start, start + kMaxMediaBytes);
+        case MP4:  return walkMp4(start, start + kMaxMediaBytes);
+        default:   return result(start, start, CarveStatus::Truncated);
+    }
+}
+
+CarvedExtent FormatWalker::walkJpeg(uint64_t start, uint64_t limit) {
+    const uint8_t* soi = at(start, 3);
+    if (!soi || soi[0] != 0xFF || soi[1] != 0xD8 || soi[2] != 0xFF) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    uint64_t pos = start + 2;
+    bool sawFrame = false;
+    bool sawScan = false;
+    while (pos < limit) {
+        const uint8_t* m = at(pos, 2);
+        if (!m) break;
+        if (m[0] != 0xFF) {
+            return result(start, pos, sawScan ? CarveStatus::Truncated : CarveStatus::Invalid);
+        }
+
+        uint8_t marker = m[1];
+        if (marker == 0xFF) { // Fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0xD9) { // EOI
+            return result(start, pos + 2, sawFrame && sawScan ? CarveStatus::Complete : CarveStatus::Invalid);
+        }
+        if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) { // Standalone markers
+            pos += 2;
+            continue;
+        }
+        if (marker == 0x00 || marker == 0xD8) {
+            return result(start, pos, sawScan ? CarveStatus::Truncated : CarveStatus::Invalid);
+        }
+
+        const uint8_t* lengthBytes = at(pos + 2, 2);
+        if (!lengthBytes) break;
+        uint16_t length = readBe16(lengthBytes);
+        if (length < 2) {
+            return result(start, pos, sawScan ? CarveStatus::Truncated : CarveStatus::Invalid);
+        }
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            sawFrame = true;
+        }
+        pos += 2 + length;
+
+        if (marker == 0xDA) { // SOS: entropy-coded data runs until a marker other than RSTn or a stuffed 00
+            sawScan = true;
+            while (true) {
+                uint64_t ff;
+                if (!findByteInData(0xFF, pos, limit, ff)) {
+                    // Erased or trimmed space past the end of what survived
+                    pos = ff;
+                    break;
+                }
+                const uint8_t* next = at(ff + 1, 1);
+                if (!next) {
+                    pos = ff;
+                    break;
+                }
+                if (next[0] == 0x00 || (next[0] >= 0xD0 && next[0] <= 0xD7) || next[0] == 0xFF) {
+                    pos = ff + (next[0] == 0xFF ? 1 : 2);
+                    continue;
+                }
+                pos = ff;
+                break;
+            }
+        }
+    }
+
+    return result(start, std::min(pos, sourceSize_), sawFrame ? CarveStatus::Truncated : CarveStatus::Invalid);
+}
+
+CarvedExtent FormatWalker::walkPng(uint64_t start, uint64_t limit) {
+    const uint8_t* signature = at(start, sizeof(kPngSignature));
+    if (!signature || memcmp(signature, kPngSignature, sizeof(kPngSignature)) != 0) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    uint64_t pos = start + sizeof(kPngSignature);
+    bool first = true;
+    while (pos < limit) {
+        const uint8_t* header = at(pos, 8);
+        if (!header) break;
+
+        uint32_t length = readBe32(header);
+        uint8_t type[4];
+        memcpy(type, header + 4, 4);
+        bool typeValid = length <= 0x7FFFFFFFu;
+        for (uint8_t c : type) {
+            typeValid = typeValid && ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
+        }
+        if (!typeValid || (first && memcmp(type, "IHDR", 4) != 0)) {
+            return result(start, pos, first ? CarveStatus::Invalid : CarveStatus::Truncated);
+        }
+
+        // CRC covers the chunk type and data
+        uint32_t crc = crc32Update(0xFFFFFFFFu, type, 4);
+        uint64_t dataPos = pos + 8;
+        uint64_t dataEnd = dataPos + length;
+        if (dataEnd > limit) {
+            // A corrupt length would otherwise be checksummed in full, far past any real image
+            return result(start, pos, CarveStatus::Truncated);
+        }
+        while (dataPos < dataEnd) {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(dataEnd - dataPos, window_.size() / 2));
+            const uint8_t* data = at(dataPos, chunk);
+            if (!data) {
+                return result(start, std::min(dataPos, sourceSize_), CarveStatus::Truncated);
+            }
+            crc = crc32Update(crc, data, chunk);
+            dataPos += chunk;
+        }
+        const uint8_t* storedCrc = at(dataEnd, 4);
+        if (!storedCrc) {
+            return result(start, dataEnd, CarveStatus::Truncated);
+        }
+        if (readBe32(storedCrc) != (crc ^ 0xFFFFFFFFu)) {
+            return result(start, pos, first ? CarveStatus::Invalid : CarveStatus::Truncated);
+        }
+
+        pos = dataEnd + 4;
+        first = false;
+        if (memcmp(type, "IEND", 4) == 0) {
+            return result(start, pos, CarveStatus::Complete);
+        }
+    }
+
+    return result(start, std::min(pos, sourceSize_), CarveStatus::Truncated);
+}
+
+CarvedExtent FormatWalker::walkZip(uint64_t start, uint64_t limit) {
+    const uint8_t* local = at(start, 30);
+    if (!local || readLe32(local) != 0x04034B50) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+    uint16_t nameLength = readLe16(local + 26);
+    uint16_t extraLength = readLe16(local + 28);
+    uint32_t compressedSize = readLe32(local + 18);
+    if (nameLength == 0 || readLe16(local + 4) > 63) { // Version needed to extract
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    // The end record is the one whose central directory sits right before it,
+    // measured from this archive's start; EOCDs of other archives do not line up
+    uint64_t pos = start + 30;
+    if (pos < zipSearchedFrom_ || pos > zipSearchedTo_) {
+        zipEnds_.clear();
+        zipSearchedFrom_ = zipSearchedTo_ = pos;
+    }
+    while (!zipEnds_.empty() && zipEnds_.front().eocd < pos) {
+        zipEnds_.erase(zipEnds_.begin());
+    }
+    zipSearchedFrom_ = pos;
+    for (const auto& known : zipEnds_) {
+        if (known.archiveStart == start) {
+            return result(start, known.end, CarveStatus::Complete);
+        }
+    }
+
+    uint64_t eocd;
+    while (find("PK\x05\x06", 4, zipSearchedTo_, limit, eocd)) {
+        zipSearchedTo_ = eocd + 1;
+        ZipEnd found = {eocd, 0, 0};
+        if (!zipStartFor(eocd, found.archiveStart, found.end)) continue;
+        zipEnds_.push_back(found);
+        if (found.archiveStart == start) {
+            return result(start, found.end, CarveStatus::Complete);
+        }
+    }
+    // A record starting in the last three bytes was not seen whole
+    uint64_t searched = std::min(limit, sourceSize_);
+    zipSearchedTo_ = std::max(zipSearchedTo_, searched >= 3 ? searched - 3 : 0);
+
+    // Without an end record, at least the first entry is known to be there
+    uint64_t firstEntryEnd = start + 30 + nameLength + extraLength + compressedSize;
+    return result(start, std::min(firstEntryEnd, sourceSize_), CarveStatus::Truncated);
+}
+
+bool FormatWalker::zipStartFor(uint64_t eocd, uint64_t& archiveStart, uint64_t& end) {
+    const uint8_t* record = at(eocd, 22);
+    if (!record) return false;
+    uint64_t directorySize = readLe32(record + 12);
+    uint64_t directoryOffset = readLe32(record + 16);
+    end = std::min(eocd + 22 + readLe16(record + 20), sourceSize_);
+    uint64_t directoryEnd = eocd;
+
+    // ZIP64 archives saturate the fields and put the real ones in a record
+    // found through the locator just before this one
+    if (directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) {
+        const uint8_t* locator = eocd >= 20 ? at(eocd - 20, 20) : nullptr;
+        if (!locator || readLe32(locator) != 0x07064B50) return false;
+        uint64_t recordOffset = readLe64(locator + 8);
+        // Only records without extensible data, which is how writers make them
+        if (eocd < 20 + 56) return false;
+        directoryEnd = eocd - 20 - 56;
+        const uint8_t* zip64 = at(directoryEnd, 56);
+        if (!zip64 || readLe32(zip64) != 0x06064B50 || readLe64(zip64 + 4) != 44) return false;
+        directorySize = readLe64(zip64 + 40);
+        directoryOffset = readLe64(zip64 + 48);
+        if (recordOffset != directoryOffset + directorySize) return false;
+    }
+
+    if (directoryOffset + directorySize > directoryEnd) return false;
+    archiveStart = directoryEnd - directoryOffset - directorySize;
+    return true;
+}
+
+CarvedExtent FormatWalker::walkPdf(uint64_t start, uint64_t limit) {
+    const uint8_t* header = at(start, 5);
+    if (!header || memcmp(header, "%PDF-", 5) != 0) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    uint64_t end = start;
+    bool complete = false;
+    uint64_t pos = start + 5;
+    uint64_t marker;
+    while (find("%%EOF", 5, pos, limit, marker)) {
+        // A real trailer has startxref just before %%EOF
+        uint64_t lookback = std::max(start, marker >= 1024 ? marker - 1024 : 0);
+        uint64_t startxref;
+        if (!find("startxref", 9, lookback, marker, startxref)) {
+            pos = marker + 5;
+            continue;
+        }
+
+        end = marker + 5;
+        complete = true;
+        const uint8_t* eol = at(end, 2);
+        if (eol && eol[0] == '\r' && eol[1] == '\n') end += 2;
+        else if (eol && (eol[0] == '\n' || eol[0] == '\r')) end += 1;
+
+        // Incremental updates append objects or an xref table after %%EOF
+        const uint8_t* next = at(end, 4);
+        if (!next || !((next[0] >= '0' && next[0] <= '9') || memcmp(next, "xref", 4) == 0)) {
+            break;
+        }
+        pos = end;
+    }
+
+    return result(start, end, complete ? CarveStatus::Complete : CarveStatus::Truncated);
+}
+
+bool FormatWalker::skipSubBlocks(uint64_t& pos, uint64_t limit) {
+    while (pos < limit) {
+        const uint8_t* size = at(pos, 1);
+        if (!size) return false;
+        pos += 1 + size[0];
+        if (size[0] == 0) return true;
+    }
+    return false;
+}
+
+CarvedExtent FormatWalker::walkGif(uint64_t start, uint64_t limit) {
+    const uint8_t* header = at(start, 13);
+    if (!header || (memcmp(header, "GIF87a", 6) != 0 && memcmp(header, "GIF89a", 6) != 0)) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    uint64_t pos = start + 13;
+    if (header[10] & 0x80) { // Global colour table
+        pos += 3u << ((header[10] & 7) + 1);
+    }
+
+    int images = 0;
+    while (pos < limit) {
+        const uint8_t* block = at(pos, 1);
+        if (!block) break;
+
+        if (block[0] == 0x3B) { // Trailer
+            return result(start, pos + 1, images > 0 ? CarveStatus::Complete : CarveStatus::Invalid);
+        }
+        if (block[0] == 0x21) { // Extension: introducer, label, sub-blocks
+            pos += 2;
+            if (!skipSubBlocks(pos, limit)) break;
+        } else if (block[0] == 0x2C) { // Image descriptor, optional local colour table, LZW data
+            const uint8_t* descriptor = at(pos, 10);
+            if (!descriptor) break;
+            pos += 10;
+            if (descriptor[9] & 0x80) {
+                pos += 3u << ((descriptor[9] & 7) + 1);
+            }
+            pos += 1; // LZW minimum code size
+            if (!skipSubBlocks(pos, limit)) break;
+            images++;
+        } else {
+            return result(start, pos, images > 0 ? CarveStatus::Truncated : CarveStatus::Invalid);
+        }
+    }
+
+    return result(start, std::min(pos, sourceSize_), images > 0 ? CarveStatus::Truncated : CarveStatus::Invalid);
+}
+
+CarvedExtent FormatWalker::walkMp3(uint64_t start, uint64_t limit) {
+    const uint8_t* first = at(start, 4);
+    if (!first || mp3FrameLength(first) == 0) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    // Every frame in a stream shares version, layer and sample rate
+    const uint8_t streamBits = first[1];
+    const uint8_t rateBits = first[2] & 0x0C;
+    uint64_t pos = start;
+    int frames = 0;
+    while (pos < limit) {
+        const uint8_t* header = at(pos, 4);
+        if (!header || header[1] != streamBits || (header[2] & 0x0C) != rateBits) break;
+        uint32_t length = mp3FrameLength(header);
+        if (length == 0 || pos + length > sourceSize_) break;
+        pos += length;
+        frames++;
+    }
+
+    if (frames < kMinMp3Frames) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    // Trailing ID3v1 tag
+    const uint8_t* tag = at(pos, 3);
+    if (tag && memcmp(tag, "TAG", 3) == 0 && pos + 128 <= sourceSize_) {
+        pos += 128;
+    }
+    return result(start, pos, CarveStatus::Complete);
+}
+
+CarvedExtent FormatWalker::walkMp4(uint64_t start, uint64_t limit) {
+    const uint8_t* ftyp = at(start, 8);
+    if (!ftyp || memcmp(ftyp + 4, "ftyp", 4) != 0 || readBe32(ftyp) < 8) {
+        return result(start, start, CarveStatus::Invalid);
+    }
+
+    uint64_t pos = start;
+    bool sawMoov = false;
+    bool sawMdat = false;
+    for (int boxes = 0; boxes < kMaxMp4Boxes && pos < limit; ++boxes) {
+        const uint8_t* header = at(pos, 8);
+        if (!header || !isMp4TopLevelBox(header + 4)) break;
+
+        uint64_t size = readBe32(header);
+        if (size == 1) { // 64-bit size follows the type
+            const uint8_t* large = at(pos + 8, 8);
+            if (!large) break;
+            size = readBe64(large);
+        } else if (size == 0) { // Box runs to the end of the file
+            size = sourceSize_ - pos;
+        }
+        if (size < 8) break;
+
+        sawMoov = sawMoov || memcmp(header + 4, "moov", 4) == 0;
+        sawMdat = sawMdat || memcmp(header + 4, "mdat", 4) == 0;
+        // Compared as what is left, since a corrupt 64-bit size would overflow pos + size
+        uint64_t end = std::min(limit, sourceSize_);
+        if (size > end - pos) {
+            return result(start, end, CarveStatus::Truncated);
+        }
+        pos += size;
+    }
+
+    CarveStatus status = sawMoov && sawMdat ? CarveStatus::Complete : CarveStatus::Truncated;
+    return result(start, std::min(pos, sourceSize_), status);
+}
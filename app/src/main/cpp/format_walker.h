@@ -0,0 +1,82 @@
+#ifndef FORMAT_WALKER_H
+#define FORMAT_WALKER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+enum class CarveStatus {
+    Invalid,    // Header bytes matched but the structure behind them does not hold up
+    Truncated,  // Structure is sound as far as it goes, the end was not found
+    Complete    // End marker reached and every checked field was consistent
+};
+
+struct CarvedExtent {
+    uint64_t start;
+    uint64_t end;  // Exclusive; equals start when nothing beyond the header is known
+    CarveStatus status;
+};
+
+// Follows a file's own structure from a carved header to find where it ends:
+// JPEG segments to EOI, PNG chunks (CRC-checked) to IEND, ZIP to a matching
+// end-of-central-directory record, PDF to its last %%EOF, GIF blocks to the
+// trailer, MP3 frame headers and MP4 top-level boxes until the chain breaks.
+// Reads through its own small window, so walking never holds a whole file.
+class FormatWalker {
+public:
+    explicit FormatWalker(const char* path);
+    ~FormatWalker();
+
+    FormatWalker(const FormatWalker&) = delete;
+    FormatWalker& operator=(const FormatWalker&) = delete;
+
+    bool isOpen() const { return fd_ >= 0; }
+    uint64_t sourceSize() const { return sourceSize_; }
+
+    // fileType is one of the FileType ids from file_recovery_engine.h
+    CarvedExtent walk(uint64_t start, int fileType);
+    // identifySignature over the first block at start, which tells a carved
+    // ZIP apart from a Word or Excel file
+    int identify(uint64_t start);
+
+private:
+    CarvedExtent walkJpeg(uint64_t start, uint64_t limit);
+    CarvedExtent walkPng(uint64_t start, uint64_t limit);
+    CarvedExtent walkZip(uint64_t start, uint64_t limit);
+    CarvedExtent walkPdf(uint64_t start, uint64_t limit);
+    CarvedExtent walkGif(uint64_t start, uint64_t limit);
+    CarvedExtent walkMp3(uint64_t start, uint64_t limit);
+    CarvedExtent walkMp4(uint64_t start, uint64_t limit);
+
+    // Pointer to length bytes at offset, or null past the end of the source
+    const uint8_t* at(uint64_t offset, size_t length);
+    bool findByte(uint8_t value, uint64_t from, uint64_t limit, uint64_t& found);
+    // findByte over compressed data, which never holds a whole blank block: the
+    // search gives up at the first one. On false, found is where it gave up.
+    bool findByteInData(uint8_t value, uint64_t from, uint64_t limit, uint64_t& found);
+    bool find(const char* pattern, size_t length, uint64_t from, uint64_t limit, uint64_t& found);
+    bool skipSubBlocks(uint64_t& pos, uint64_t limit);
+    // Archive start an end record at eocd implies, from where its central
+    // directory ends; false if it is not a usable end record
+    bool zipStartFor(uint64_t eocd, uint64_t& archiveStart, uint64_t& end);
+
+    struct ZipEnd {
+        uint64_t eocd;
+        uint64_t archiveStart;
+        uint64_t end;
+    };
+
+    int fd_;
+    uint64_t sourceSize_;
+    std::vector<uint8_t> window_;
+    uint64_t windowOffset_;
+    size_t windowLength_;
+    // End records walkZip has seen, in offset order, and the stretch it has
+    // searched for them. Every member of an archive without a matching end
+    // record is also a ZIP header, and each would otherwise search it again.
+    std::vector<ZipEnd> zipEnds_;
+    uint64_t zipSearchedFrom_;
+    uint64_t zipSearchedTo_;
+};
+
+#endif // FORMAT_WALKER_H
@@ -0,0 +1,1100 @@
+#include "fragment_reassembler.h"
+#include "file_types.h"
+#include "byte_order.h"
+#include "block_classifier.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#define LOG_TAG "FragmentReassembler"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const size_t kReadChunk = 1024 * 1024;
+const size_t kWindowSize = 256 * 1024;
+const uint64_t kMaxImageBytes = 64ULL * 1024 * 1024;
+const uint64_t kMaxMoovBytes = 64ULL * 1024 * 1024;
+const size_t kMaxMp4Boxes = 4096;
+const size_t kMaxMp4Samples = 1 << 20;
+
+// Huffman errors surface a little after the data actually goes wrong, so
+// this many block boundaries before the error are tried as the break
+const uint64_t kBreakCandidates = 8;
+// Entropy-coded data uses nearly every byte value; zero fill and text do not
+const size_t kMinDistinctBytes = 96;
+// Blocks decoded past a candidate continuation, so that the middle of
+// another image with the same tables is caught at its EOI
+const uint64_t kLookaheadBlocks = 16;
+// NAL headers that must line up before an MP4 continuation is accepted
+const int kMp4ProbeHeaders = 4;
+const size_t kMp4SpotChecks = 8;
+
+const int kFastBits = 9;
+
+struct HuffmanTable {
+    bool present = false;
+    int32_t maxCode[17];                 // Largest code of each length, -1 if none
+    int32_t valueOffset[17];             // values[] index of a code = code + valueOffset
+    uint16_t fast[1 << kFastBits];       // (length << 8) | value for codes up to kFastBits long
+    uint8_t values[256];
+
+    bool build(const uint8_t* counts, const uint8_t* symbols, size_t symbolCount) {
+        size_t total = 0;
+        for (int i = 0; i < 16; ++i) total += counts[i];
+        if (total > sizeof(values) || total > symbolCount) return false;
+        memcpy(values, symbols, total);
+        memset(fast, 0, sizeof(fast));
+
+        int32_t code = 0;
+        size_t k = 0;
+        for (int length = 1; length <= 16; ++length) {
+            valueOffset[length] = static_cast<int32_t>(k) - code;
+            for (int i = 0; i < counts[length - 1]; ++i, ++code, ++k) {
+                if (length <= kFastBits) {
+                    int shift = kFastBits - length;
+                    for (int j = 0; j < (1 << shift); ++j) {
+                        fast[(code << shift) + j] = static_cast<uint16_t>((length << 8) | values[k]);
+                    }
+                }
+            }
+            maxCode[length] = counts[length - 1] ? code - 1 : -1;
+            if (code > (1 << length)) return false; // Over-subscribed
+            code <<= 1;
+        }
+        present = true;
+        return true;
+    }
+};
+
+struct ScanComponent {
+    int blocks;  // Blocks per MCU
+    int dcTable;
+    int acTable;
+};
+
+// What a baseline scan needs to be decoded for validity (no pixels)
+struct JpegScan {
+    HuffmanTable dc[4];
+    HuffmanTable ac[4];
+    std::vector<ScanComponent> components;
+    uint32_t restartInterval = 0;
+    uint32_t totalMcus = 0; // 0 when the height is only given by a DNL marker
+    int maxDcBits = 11;
+    int maxAcBits = 10;
+};
+
+// Parses SOI through SOS. False for progressive, lossless and arithmetic
+// coding, which this validator does not decode.
+bool parseJpegHeader(const uint8_t* data, size_t size, JpegScan& scan, size_t& entropyStart) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+
+    struct FrameComponent {
+        uint8_t id, h, v;
+    };
+    std::vector<FrameComponent> frame;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return false;
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xD8) return false;
+
+        uint16_t length = readBe16(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size) return false;
+        const uint8_t* seg = data + pos + 4;
+        size_t segLength = length - 2u;
+
+        if (marker == 0xC0 || marker == 0xC1) {
+            if (segLength < 6) return false;
+            uint8_t precision = seg[0];
+            height = readBe16(seg + 1);
+            width = readBe16(seg + 3);
+            size_t count = seg[5];
+            if (segLength < 6 + 3 * count || count == 0 || width == 0) return false;
+            for (size_t i = 0; i < count; ++i) {
+                const uint8_t* c = seg + 6 + 3 * i;
+                uint8_t h = c[1] >> 4;
+                uint8_t v = c[1] & 15;
+                if (h < 1 || h > 4 || v < 1 || v > 4) return false;
+                frame.push_back({c[0], h, v});
+            }
+            scan.maxDcBits = precision + 3;
+            scan.maxAcBits = precision + 2;
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false;
+        } else if (marker == 0xC4) {
+            size_t p = 0;
+            while (p + 17 <= segLength) {
+                int tableClass = seg[p] >> 4;
+                int tableId = seg[p] & 15;
+                if (tableClass > 1 || tableId > 3) return false;
+                HuffmanTable& table = tableClass ? scan.ac[tableId] : scan.dc[tableId];
+                if (!table.build(seg + p + 1, seg + p + 17, segLength - p - 17)) return false;
+                size_t total = 0;
+                for (int i = 0; i < 16; ++i) total += seg[p + 1 + i];
+                p += 17 + total;
+            }
+        } else if (marker == 0xDD) {
+            if (segLength < 2) return false;
+            scan.restartInterval = readBe16(seg);
+        } else if (marker == 0xDA) {
+            if (frame.empty() || segLength < 1) return false;
+            size_t count = seg[0];
+            if (count == 0 || segLength < 1 + 2 * count + 3) return false;
+            const uint8_t* spectral = seg + 1 + 2 * count;
+            if (spectral[0] != 0 || spectral[1] != 63) return false;
+
+            int hMax = 1;
+            int vMax = 1;
+            for (const auto& c : frame) {
+                hMax = std::max<int>(hMax, c.h);
+                vMax = std::max<int>(vMax, c.v);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                uint8_t id = seg[1 + 2 * i];
+                uint8_t tables = seg[2 + 2 * i];
+                auto c = std::find_if(frame.begin(), frame.end(), [id](const FrameComponent& f) { return f.id == id; });
+                int dcTable = tables >> 4;
+                int acTable = tables & 15;
+                if (c == frame.end() || dcTable > 3 || acTable > 3 ||
+                    !scan.dc[dcTable].present || !scan.ac[acTable].present) {
+                    return false;
+                }
+                scan.components.push_back({count == 1 ? 1 : c->h * c->v, dcTable, acTable});
+
+                if (count == 1 && height) {
+                    // A single-component scan is not interleaved: one block per MCU
+                    uint32_t cw = (width * c->h + hMax - 1) / hMax;
+                    uint32_t ch = (height * c->v + vMax - 1) / vMax;
+                    scan.totalMcus = ((cw + 7) / 8) * ((ch + 7) / 8);
+                }
+            }
+            if (count > 1 && height) {
+                scan.totalMcus = ((width + 8 * hMax - 1) / (8 * hMax)) * ((height + 8 * vMax - 1) / (8 * vMax));
+            }
+            entropyStart = pos + 2 + length;
+            return true;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// Decoder position, saved at MCU boundaries so decoding can resume from one
+struct JpegCursor {
+    size_t pos = 0;         // Next unread byte
+    uint64_t bits = 0;      // Unconsumed bits, the oldest highest
+    int bitCount = 0;
+    uint32_t mcu = 0;
+    uint32_t restarts = 0;
+    bool atMarker = false;  // Entropy data ended at the marker at markerPos
+    size_t markerPos = 0;
+};
+
+void rebase(JpegCursor& cursor, size_t shift) {
+    cursor.pos -= shift;
+    if (cursor.atMarker) cursor.markerPos -= shift;
+}
+
+enum class JpegStop {
+    EndOfImage,   // stopPos is just past EOI
+    EndOfData,    // Ran out of bytes; the cursor is at the start of the unfinished MCU
+    Invalid,      // stopPos is where the stream stopped decoding
+    EarlyEnd,     // EOI before the last MCU: the data belongs to another image
+    Unsupported   // Another scan or a DNL marker follows
+};
+
+// Huffman-decodes a baseline scan without reconstructing pixels: a code
+// that is not in the table, a coefficient run past 63, an oversized
+// magnitude or a restart marker out of sequence means the data is not (or no
+// longer) this image's.
+class JpegDecoder {
+public:
+    explicit JpegDecoder(const JpegScan& scan) : scan_(scan), data_(nullptr), size_(0) {}
+
+    template <typename OnMcu>
+    JpegStop run(const uint8_t* data, size_t size, JpegCursor& cursor, size_t& stopPos, OnMcu onMcu) {
+        data_ = data;
+        size_ = size;
+        c_ = cursor;
+
+        while (true) {
+            uint32_t interval = scan_.restartInterval;
+            bool last = scan_.totalMcus && c_.mcu >= scan_.totalMcus;
+            if (interval && !last && c_.mcu > 0 && c_.mcu % interval == 0 && c_.restarts < c_.mcu / interval) {
+                // Restart: the bit buffer is dropped and RSTn must follow
+                size_t at = markerStart();
+                if (at + 2 > size_) {
+                    return JpegStop::EndOfData;
+                }
+                if (data_[at] != 0xFF || data_[at + 1] != 0xD0 + (c_.restarts & 7)) {
+                    stopPos = at;
+                    return JpegStop::Invalid;
+                }
+                c_.bits = 0;
+                c_.bitCount = 0;
+                c_.pos = at + 2;
+                c_.atMarker = false;
+                c_.restarts++;
+            }
+
+            if (last) {
+                size_t at = markerStart();
+                if (at + 2 > size_) {
+                    return JpegStop::EndOfData;
+                }
+                stopPos = at;
+                if (data_[at] == 0xFF && data_[at + 1] == 0xD9) {
+                    stopPos = at + 2;
+                    return JpegStop::EndOfImage;
+                }
+                return data_[at] == 0xFF ? JpegStop::Unsupported : JpegStop::Invalid;
+            }
+
+            if (c_.atMarker) {
+                stopPos = c_.markerPos;
+                if (data_[c_.markerPos + 1] != 0xD9) {
+                    return JpegStop::Invalid;
+                }
+                if (scan_.totalMcus) {
+                    return JpegStop::EarlyEnd;
+                }
+                stopPos = c_.markerPos + 2;
+                return JpegStop::EndOfImage;
+            }
+
+            cursor = c_;
+            onMcu(cursor);
+            for (const auto& component : scan_.components) {
+                for (int b = 0; b < component.blocks; ++b) {
+                    Step step = decodeBlock(scan_.dc[component.dcTable], scan_.ac[component.acTable]);
+                    if (step == Step::Exhausted) {
+                        return JpegStop::EndOfData;
+                    }
+                    if (step == Step::Invalid) {
+                        stopPos = c_.pos;
+                        return JpegStop::Invalid;
+                    }
+                }
+            }
+            c_.mcu++;
+            cursor = c_;
+        }
+    }
+
+private:
+    enum class Step { Ok, Invalid, Exhausted };
+
+    // Where the next marker starts once the bit buffer is dropped, past fill bytes
+    size_t markerStart() const {
+        size_t at = c_.atMarker ? c_.markerPos : c_.pos;
+        while (at + 1 < size_ && data_[at] == 0xFF && data_[at + 1] == 0xFF) at++;
+        return at;
+    }
+
+    Step fill(int wanted) {
+        while (c_.bitCount < wanted) {
+            uint8_t byte = 0; // Zeros past a marker, as decoders do
+            if (!c_.atMarker) {
+                if (c_.pos >= size_) return Step::Exhausted;
+                byte = data_[c_.pos];
+                if (byte == 0xFF) {
+                    if (c_.pos + 1 >= size_) return Step::Exhausted;
+                    uint8_t next = data_[c_.pos + 1];
+                    if (next == 0x00) {
+                        c_.pos += 2;
+                    } else if (next == 0xFF) {
+                        c_.pos++;
+                        continue;
+                    } else {
+                        c_.atMarker = true;
+                        c_.markerPos = c_.pos;
+                        byte = 0;
+                    }
+                } else {
+                    c_.pos++;
+                }
+            }
+            c_.bits = (c_.bits << 8) | byte;
+            c_.bitCount += 8;
+        }
+        return Step::Ok;
+    }
+
+    void consume(int count) {
+        c_.bitCount -= count;
+        c_.bits &= (1ULL << c_.bitCount) - 1;
+    }
+
+    Step skipBits(int count) {
+        if (count == 0) return Step::Ok;
+        Step step = fill(count);
+        if (step != Step::Ok) return step;
+        consume(count);
+        return Step::Ok;
+    }
+
+    Step decodeSymbol(const HuffmanTable& table, int& symbol) {
+        if (fill(kFastBits) == Step::Ok) {
+            uint16_t entry = table.fast[(c_.bits >> (c_.bitCount - kFastBits)) & ((1 << kFastBits) - 1)];
+            if (entry) {
+                consume(entry >> 8);
+                symbol = entry & 0xFF;
+                return Step::Ok;
+            }
+        }
+        for (int length = 1; length <= 16; ++length) {
+            Step step = fill(length);
+            if (step != Step::Ok) return step;
+            int32_t code = static_cast<int32_t>((c_.bits >> (c_.bitCount - length)) & ((1u << length) - 1));
+            if (code <= table.maxCode[length]) {
+                consume(length);
+                symbol = table.values[table.valueOffset[length] + code];
+                return Step::Ok;
+            }
+        }
+        return Step::Invalid;
+    }
+
+    Step decodeBlock(const HuffmanTable& dc, const HuffmanTable& ac) {
+        int symbol;
+        Step step = decodeSymbol(dc, symbol);
+        if (step != Step::Ok) return step;
+        if (symbol > scan_.maxDcBits) return Step::Invalid;
+        step = skipBits(symbol);
+        if (step != Step::Ok) return step;
+
+        for (int k = 1; k < 64;) {
+            step = decodeSymbol(ac, symbol);
+            if (step != Step::Ok) return step;
+            int run = symbol >> 4;
+            int magnitude = symbol & 15;
+            if (magnitude == 0) {
+                if (run != 15) break; // End of block
+                k += 16;              // Zero run
+                if (k > 63) return Step::Invalid;
+                continue;
+            }
+            if (magnitude > scan_.maxAcBits) return Step::Invalid;
+            k += run;
+            if (k > 63) return Step::Invalid;
+            step = skipBits(magnitude);
+            if (step != Step::Ok) return step;
+            k++;
+        }
+        return Step::Ok;
+    }
+
+    const JpegScan& scan_;
+    const uint8_t* data_;
+    size_t size_;
+    JpegCursor c_;
+};
+
+// Cheap filter run on every candidate block before any decoding: only
+// stuffed zeros, restart markers and EOI may follow 0xFF, and the bytes must
+// be varied enough to be compressed data
+bool looksLikeEntropyData(const uint8_t* data, size_t size) {
+    size_t limit = size;
+    for (size_t i = 0; i + 1 < size; ++i) {
+        if (data[i] != 0xFF) continue;
+        uint8_t next = data[i + 1];
+        if (next == 0xD9) {
+            limit = i;
+            break;
+        }
+        if (next != 0x00 && next != 0xFF && (next < 0xD0 || next > 0xD7)) return false;
+    }
+
+    bool seen[256] = {};
+    size_t distinct = 0;
+    for (size_t i = 0; i < limit; ++i) {
+        if (!seen[data[i]]) {
+            seen[data[i]] = true;
+            distinct++;
+        }
+    }
+    return distinct >= std::min(kMinDistinctBytes, limit / 4);
+}
+
+// Blank space or text: never the inside of a compressed image or video stream
+bool isFiller(const BlockClass& block) {
+    return block.blank() || block.kind == BlockKind::Text;
+}
+
+bool startsWithFileHeader(const uint8_t* data, size_t size) {
+    static const uint8_t kPng[4] = {0x89, 'P', 'N', 'G'};
+    if (size < 8) return false;
+    return (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) ||
+           memcmp(data, kPng, 4) == 0 || memcmp(data, "GIF8", 4) == 0 || memcmp(data, "%PDF", 4) == 0 ||
+           memcmp(data, "PK\x03\x04", 4) == 0 || memcmp(data + 4, "ftyp", 4) == 0;
+}
+
+// A length-prefixed NAL unit: nonzero length, forbidden bit clear and a
+// type in use (AVC 1-23; HEVC 0-40 with a nonzero temporal id)
+bool nalUnitHolds(const uint8_t* h, uint8_t nalLength, bool hevc, uint32_t& length) {
+    length = 0;
+    for (int i = 0; i < nalLength; ++i) length = (length << 8) | h[i];
+    const uint8_t* nal = h + nalLength;
+    bool header = hevc
+                  ? (nal[0] & 0x80) == 0 && ((nal[0] >> 1) & 0x3F) <= 40 && (nal[1] & 7) != 0
+                  : (nal[0] & 0x80) == 0 && (nal[0] & 0x1F) >= 1 && (nal[0] & 0x1F) <= 23;
+    return header && length != 0;
+}
+
+bool isMp4TopLevelBox(const uint8_t* type) {
+    static const char* const kTypes[] = {
+            "ftyp", "moov", "mdat", "free", "skip", "wide", "uuid", "meta",
+            "moof", "mfra", "pdin", "styp", "sidx", "udta", "pnot"
+    };
+    for (const char* known : kTypes) {
+        if (memcmp(type, known, 4) == 0) return true;
+    }
+    return false;
+}
+
+bool isMoovChild(const uint8_t* type) {
+    static const char* const kTypes[] = {"mvhd", "trak", "udta", "meta", "iods", "mvex"};
+    for (const char* known : kTypes) {
+        if (memcmp(type, known, 4) == 0) return true;
+    }
+    return false;
+}
+
+// Calls visit(type, payload, payloadSize) for each box in data[0, size);
+// false if the boxes do not tile the range exactly
+template <typename Visit>
+bool forEachBox(const uint8_t* data, size_t size, Visit visit) {
+    size_t pos = 0;
+    while (pos + 8 <= size) {
+        uint64_t boxSize = readBe32(data + pos);
+        size_t header = 8;
+        if (boxSize == 1) {
+            if (pos + 16 > size) return false;
+            boxSize = readBe64(data + pos + 8);
+            header = 16;
+        } else if (boxSize == 0) {
+            boxSize = size - pos;
+        }
+        if (boxSize < header || boxSize > size - pos) return false;
+        visit(data + pos + 4, data + pos + header, static_cast<size_t>(boxSize - header));
+        pos += static_cast<size_t>(boxSize);
+    }
+    return pos == size;
+}
+
+// Windowed reads for probes scattered over a large range
+class SourceWindow {
+public:
+    SourceWindow(int fd, uint64_t sourceSize) : fd_(fd), sourceSize_(sourceSize), window_(kWindowSize),
+                                                  windowOffset_(0), windowLength_(0) {}
+
+    const uint8_t* at(uint64_t offset, size_t length) {
+        if (length > window_.size() || offset + length > sourceSize_) {
+            return nullptr;
+        }
+        if (offset >= windowOffset_ && offset + length <= windowOffset_ + windowLength_) {
+            return window_.data() + (offset - windowOffset_);
+        }
+        windowOffset_ = offset;
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(window_.size(), sourceSize_ - offset));
+        windowLength_ = BlockReader::readFully(fd_, window_.data(), wanted, offset);
+        if (length > windowLength_) {
+            windowLength_ = 0;
+            return nullptr;
+        }
+        return window_.data();
+    }
+
+private:
+    int fd_;
+    uint64_t sourceSize_;
+    std::vector<uint8_t> window_;
+    uint64_t windowOffset_;
+    size_t windowLength_;
+};
+
+} // namespace
+
+struct FragmentReassembler::Mp4Sample {
+    uint64_t offset;     // In the file, as stco/co64 and stsz place it
+    uint32_t size;
+    uint8_t nalLength;   // Bytes in each NAL unit's length prefix
+    bool hevc;
+};
+
+FragmentReassembler::FragmentReassembler(const char* path, const ReassemblyOptions& options)
+        : fd_(-1), sourceSize_(0), options_(options), allowed_(nullptr), claimed_(nullptr) {
+    fd_ = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        LOGE("Cannot open source: %s", path);
+        return;
+    }
+    sourceSize_ = BlockReader::querySize(fd_);
+    options_.blockSize = std::max<uint64_t>(options_.blockSize, 512);
+}
+
+FragmentReassembler::~FragmentReassembler() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+ReassembledFile FragmentReassembler::reassemble(uint64_t start, int fileType, const std::vector<ByteRange>& allowed,
+                                                const std::vector<ByteRange>& claimed) {
+    // Files start on a block; a header anywhere else was not written there as a file
+    if (fd_ < 0 || start >= sourceSize_ || start % options_.blockSize != 0) {
+        return {{}, CarveStatus::Invalid};
+    }
+
+    allowed_ = &allowed;
+    claimed_ = &claimed;
+    ReassembledFile file = {{}, CarveStatus::Invalid};
+    switch (fileType) {
+        case JPEG: file = reassembleJpeg(start); break;
+        case MP4:  file = reassembleMp4(start); break;
+        default: break;
+    }
+    allowed_ = nullptr;
+    claimed_ = nullptr;
+
+    if (file.fragments.size() > 1) {
+        LOGI("Reassembled type %d at %llu from %zu fragments%s", fileType,
+             static_cast<unsigned long long>(start), file.fragments.size(),
+             file.status == CarveStatus::Complete ? "" : " (truncated)");
+    }
+    return file;
+}
+
+ReassembledFile FragmentReassembler::reassembleJpeg(uint64_t start) {
+    ReassembledFile file = {{}, CarveStatus::Invalid};
+    const uint64_t blockSize = options_.blockSize;
+
+    std::vector<uint8_t> stream;
+    read(start, kReadChunk, stream);
+    JpegScan scan;
+    size_t entropyStart = 0;
+    if (!parseJpegHeader(stream.data(), stream.size(), scan, entropyStart)) {
+        return file;
+    }
+
+    JpegDecoder decoder(scan);
+    JpegCursor cursor;
+    cursor.pos = entropyStart;
+    std::deque<JpegCursor> history; // Recent MCU starts, for backing up to a break
+
+    // stream[i] for i >= mapBase sits at mapPhys + (i - mapBase); anything
+    // before mapBase is the tail of the previous fragment
+    size_t mapBase = 0;
+    uint64_t mapPhys = start;
+    uint64_t fragmentStart = start;
+    uint64_t nextRead = start + stream.size();
+    uint64_t closedBytes = 0;
+    auto physOf = [&](size_t i) { return mapPhys + (i - mapBase); };
+    const uint64_t lagBytes = blockSize * (kBreakCandidates + 1);
+
+    std::vector<uint8_t> chunk;
+    std::vector<uint8_t> test;
+    while (true) {
+        size_t stopPos = 0;
+        JpegStop stop = decoder.run(stream.data(), stream.size(), cursor, stopPos, [&](const JpegCursor& c) {
+            history.push_back(c);
+            while (history.size() > 1 && history.front().pos + lagBytes < c.pos) history.pop_front();
+        });
+
+        if (stop == JpegStop::Unsupported) {
+            return {{}, CarveStatus::Invalid};
+        }
+        if (stop == JpegStop::EndOfImage) {
+            file.fragments.push_back({fragmentStart, physOf(stopPos) - fragmentStart});
+            file.status = CarveStatus::Complete;
+            return file;
+        }
+
+        if (stop == JpegStop::EndOfData) {
+            uint64_t streamEnd = physOf(stream.size());
+            if (nextRead >= sourceSize_ || closedBytes + (streamEnd - fragmentStart) >= kMaxImageBytes ||
+                read(nextRead, kReadChunk, chunk) == 0) {
+                file.fragments.push_back({fragmentStart, streamEnd - fragmentStart});
+                file.status = CarveStatus::Truncated;
+                return file;
+            }
+
+            // Keep only what backing up to a break may still need
+            size_t keep = history.empty() ? cursor.pos : std::min(cursor.pos, history.front().pos);
+            stream.erase(stream.begin(), stream.begin() + static_cast<std::ptrdiff_t>(keep));
+            rebase(cursor, keep);
+            for (auto& c : history) rebase(c, keep);
+            if (keep >= mapBase) {
+                mapPhys += keep - mapBase;
+                mapBase = 0;
+            } else {
+                mapBase -= keep;
+            }
+
+            stream.insert(stream.end(), chunk.begin(), chunk.end());
+            nextRead += chunk.size();
+            continue;
+        }
+
+        // Invalid: the break is at one of the block boundaries just before stopPos
+        uint64_t stopPhys = stopPos >= mapBase ? physOf(stopPos) : fragmentStart;
+        std::vector<uint64_t> breaks;
+        if (file.fragments.size() + 1 < options_.maxFragments && !history.empty()) {
+            uint64_t earliest = history.front().pos >= mapBase ? physOf(history.front().pos) : fragmentStart;
+            for (uint64_t b = stopPhys / blockSize * blockSize;
+                 breaks.size() < kBreakCandidates && b > fragmentStart && b > earliest; b -= blockSize) {
+                breaks.push_back(b);
+            }
+        }
+
+        bool continued = false;
+        if (!breaks.empty()) {
+            // One read covers the continuations of every candidate break
+            uint64_t windowStart = breaks.back() + blockSize;
+            uint64_t windowEnd = std::min(sourceSize_, breaks.front() + options_.maxGap + blockSize);
+            BudgetLease lease(windowStart < windowEnd ? static_cast<size_t>(windowEnd - windowStart) : 0);
+            std::vector<uint8_t> window;
+            if (windowStart < windowEnd) {
+                read(windowStart, static_cast<size_t>(windowEnd - windowStart), window);
+            }
+            size_t blockCount = static_cast<size_t>((window.size() + blockSize - 1) / blockSize);
+            std::vector<bool> plausible(blockCount);
+            for (size_t j = 0; j < blockCount; ++j) {
+                size_t offset = j * blockSize;
+                size_t length = static_cast<size_t>(std::min<uint64_t>(blockSize, window.size() - offset));
+                plausible[j] = candidateBlock(windowStart + offset) &&
+                               !isFiller(BlockClassifier::classify(window.data() + offset, length)) &&
+                               looksLikeEntropyData(window.data() + offset, length);
+            }
+
+            for (uint64_t b : breaks) {
+                size_t breakPos = mapBase + static_cast<size_t>(b - mapPhys);
+                auto resume = std::find_if(history.rbegin(), history.rend(), [breakPos](const JpegCursor& c) {
+                    return c.pos < breakPos && (!c.atMarker || c.markerPos < breakPos);
+                });
+                if (resume == history.rend()) continue;
+
+                size_t prefix = breakPos - resume->pos;
+                for (size_t j = 0; j < blockCount; ++j) {
+                    uint64_t candidate = windowStart + j * blockSize;
+                    if (candidate <= b || candidate - b > options_.maxGap) continue;
+                    if (!plausible[j]) continue;
+
+                    size_t length = static_cast<size_t>(std::min<uint64_t>(blockSize, window.size() - j * blockSize));
+                    size_t lookahead = static_cast<size_t>(
+                            std::min<uint64_t>(blockSize * (kLookaheadBlocks + 1), window.size() - j * blockSize));
+                    test.assign(stream.begin() + static_cast<std::ptrdiff_t>(resume->pos),
+                                stream.begin() + static_cast<std::ptrdiff_t>(breakPos));
+                    test.insert(test.end(), window.begin() + static_cast<std::ptrdiff_t>(j * blockSize),
+                                window.begin() + static_cast<std::ptrdiff_t>(j * blockSize + lookahead));
+
+                    JpegCursor trial = *resume;
+                    rebase(trial, resume->pos);
+                    size_t trialStop = 0;
+                    JpegStop result = decoder.run(test.data(), test.size(), trial, trialStop, [](const JpegCursor&) {});
+                    // The block itself must decode; a later error may be the next break
+                    bool holds = result == JpegStop::EndOfData ||
+                                 (result == JpegStop::EndOfImage && trialStop > prefix) ||
+                                 (result == JpegStop::Invalid && trialStop >= prefix + length);
+                    if (!holds) continue;
+
+                    // Continue decoding from the checkpoint over the new fragment
+                    file.fragments.push_back({fragmentStart, b - fragmentStart});
+                    closedBytes += b - fragmentStart;
+                    test.resize(prefix);
+                    test.insert(test.end(), window.begin() + static_cast<std::ptrdiff_t>(j * blockSize), window.end());
+                    stream.swap(test);
+                    cursor = *resume;
+                    rebase(cursor, resume->pos);
+                    history.clear();
+                    mapBase = prefix;
+                    mapPhys = candidate;
+                    fragmentStart = candidate;
+                    nextRead = windowStart + window.size();
+                    continued = true;
+                    break;
+                }
+                if (continued) break;
+            }
+        }
+
+        if (!continued) {
+            // Keep what decoded, up to the block the data went wrong in
+            uint64_t end = stopPhys / blockSize * blockSize;
+            if (end <= fragmentStart) end = std::max(stopPhys, fragmentStart + 1);
+            file.fragments.push_back({fragmentStart, end - fragmentStart});
+            file.status = CarveStatus::Truncated;
+            return file;
+        }
+    }
+}
+
+bool FragmentReassembler::readMp4Samples(const std::vector<uint8_t>& moov, std::vector<Mp4Sample>& samples) const {
+    auto readTrak = [&](const uint8_t* type, const uint8_t* trak, size_t trakSize) {
+        if (memcmp(type, "trak", 4) != 0) return;
+
+        // Only H.264/HEVC tracks have sample contents that can be checked
+        uint8_t nalLength = 0;
+        bool hevc = false;
+        std::vector<uint64_t> chunkOffsets;
+        std::vector<uint32_t> stscFirst, stscCount;
+        uint32_t uniformSize = 0;
+        uint32_t sampleCount = 0;
+        const uint8_t* sizes = nullptr;
+
+        std::function<void(const uint8_t*, const uint8_t*, size_t)> visit =
+                [&](const uint8_t* t, const uint8_t* p, size_t n) {
+            if (memcmp(t, "mdia", 4) == 0 || memcmp(t, "minf", 4) == 0 || memcmp(t, "stbl", 4) == 0) {
+                forEachBox(p, n, visit);
+            } else if (memcmp(t, "stsd", 4) == 0 && n >= 16) {
+                const uint8_t* entry = p + 8;
+                size_t entrySize = std::min<size_t>(readBe32(entry), n - 8);
+                bool avc = memcmp(entry + 4, "avc1", 4) == 0 || memcmp(entry + 4, "avc3", 4) == 0;
+                hevc = memcmp(entry + 4, "hvc1", 4) == 0 || memcmp(entry + 4, "hev1", 4) == 0;
+                const size_t kVisualEntryHeader = 8 + 78;
+                if ((avc || hevc) && entrySize > kVisualEntryHeader) {
+                    forEachBox(entry + kVisualEntryHeader, entrySize - kVisualEntryHeader,
+                               [&](const uint8_t* ct, const uint8_t* cp, size_t cn) {
+                        if (avc && memcmp(ct, "avcC", 4) == 0 && cn >= 5) nalLength = (cp[4] & 3) + 1;
+                        if (hevc && memcmp(ct, "hvcC", 4) == 0 && cn >= 22) nalLength = (cp[21] & 3) + 1;
+                    });
+                }
+            } else if ((memcmp(t, "stco", 4) == 0 || memcmp(t, "co64", 4) == 0) && n >= 8) {
+                bool wide = t[0] == 'c';
+                uint32_t count = readBe32(p + 4);
+                if (count > (n - 8) / (wide ? 8 : 4)) return;
+                for (uint32_t i = 0; i < count; ++i) {
+                    chunkOffsets.push_back(wide ? readBe64(p + 8 + 8 * i) : readBe32(p + 8 + 4 * i));
+                }
+            } else if (memcmp(t, "stsc", 4) == 0 && n >= 8) {
+                uint32_t count = readBe32(p + 4);
+                if (count > (n - 8) / 12) return;
+                for (uint32_t i = 0; i < count; ++i) {
+                    stscFirst.push_back(readBe32(p + 8 + 12 * i));
+                    stscCount.push_back(readBe32(p + 12 + 12 * i));
+                }
+            } else if (memcmp(t, "stsz", 4) == 0 && n >= 12) {
+                uniformSize = readBe32(p + 4);
+                sampleCount = readBe32(p + 8);
+                if (uniformSize == 0) {
+                    if (sampleCount > (n - 12) / 4) sampleCount = static_cast<uint32_t>((n - 12) / 4);
+                    sizes = p + 12;
+                }
+            }
+        };
+        forEachBox(trak, trakSize, visit);
+
+        if (nalLength == 0 || chunkOffsets.empty() || stscFirst.empty()) return;
+
+        // stsc runs: chunks from first_chunk on hold samples_per_chunk samples each
+        uint32_t sample = 0;
+        size_t run = 0;
+        for (uint32_t chunk = 1; chunk <= chunkOffsets.size() && sample < sampleCount; ++chunk) {
+            while (run + 1 < stscFirst.size() && stscFirst[run + 1] <= chunk) run++;
+            uint64_t offset = chunkOffsets[chunk - 1];
+            for (uint32_t s = 0; s < stscCount[run] && sample < sampleCount; ++s, ++sample) {
+                uint32_t size = uniformSize ? uniformSize : readBe32(sizes + 4 * sample);
+                if (samples.size() >= kMaxMp4Samples) return;
+                samples.push_back({offset, size, nalLength, hevc});
+                offset += size;
+            }
+        }
+    };
+    bool ok = false;
+    forEachBox(moov.data(), moov.size(), [&](const uint8_t* type, const uint8_t* payload, size_t size) {
+        if (memcmp(type, "moov", 4) == 0) ok = forEachBox(payload, size, readTrak);
+    });
+
+    std::sort(samples.begin(), samples.end(), [](const Mp4Sample& a, const Mp4Sample& b) {
+        return a.offset < b.offset;
+    });
+    for (size_t i = 1; i < samples.size(); ++i) {
+        if (samples[i].offset < samples[i - 1].offset + samples[i - 1].size) return false;
+    }
+    return ok && !samples.empty();
+}
+
+ReassembledFile FragmentReassembler::reassembleMp4(uint64_t start) {
+    ReassembledFile file = {{}, CarveStatus::Invalid};
+    const uint64_t blockSize = options_.blockSize;
+
+    // Top-level boxes, assuming they are contiguous until the chain breaks
+    struct Box {
+        char type[4];
+        uint64_t offset;
+        uint64_t size;
+    };
+    std::vector<Box> boxes;
+    std::vector<uint8_t> buffer;
+    uint64_t chainEnd = 0;
+    bool chainBroken = false;
+    while (boxes.size() < kMaxMp4Boxes && start + chainEnd < sourceSize_) {
+        if (read(start + chainEnd, 16, buffer) < 16 || !isMp4TopLevelBox(buffer.data() + 4)) {
+            chainBroken = true;
+            break;
+        }
+        uint64_t size = readBe32(buffer.data());
+        if (size == 1) size = readBe64(buffer.data() + 8);
+        else if (size == 0) size = sourceSize_ - (start + chainEnd);
+        if (size < 8) {
+            chainBroken = true;
+            break;
+        }
+        Box box;
+        memcpy(box.type, buffer.data() + 4, 4);
+        box.offset = chainEnd;
+        box.size = size;
+        boxes.push_back(box);
+        chainEnd += size;
+    }
+
+    auto findBox = [&boxes](const char* type) -> const Box* {
+        for (const auto& box : boxes) {
+            if (memcmp(box.type, type, 4) == 0) return &box;
+        }
+        return nullptr;
+    };
+    const Box* mdat = findBox("mdat");
+    const Box* moovBox = findBox("moov");
+    if (!mdat || (!moovBox && !chainBroken)) {
+        return file;
+    }
+
+    std::vector<uint8_t> moov;
+    std::unique_ptr<BudgetLease> moovLease; // moov is held until the samples are checked
+    uint64_t moovLogical;
+    uint64_t moovDelta = 0; // Physical minus logical offset of a moov found past the break
+    if (moovBox) {
+        if (moovBox->size > kMaxMoovBytes) {
+            return file;
+        }
+        moovLease.reset(new BudgetLease(static_cast<size_t>(moovBox->size)));
+        if (read(start + moovBox->offset, moovBox->size, moov) != moovBox->size) {
+            return file;
+        }
+        moovLogical = moovBox->offset;
+    } else {
+        // moov after mdat: look for it past the break, where the last fragment ends
+        if (chainEnd != mdat->offset + mdat->size) return file;
+        moovLogical = chainEnd;
+        BudgetLease windowLease(static_cast<size_t>(std::min<uint64_t>(options_.maxGap, sourceSize_)));
+        std::vector<uint8_t> window;
+        read(start + chainEnd, static_cast<size_t>(std::min<uint64_t>(options_.maxGap, sourceSize_)), window);
+        std::vector<Mp4Sample> trial;
+        for (size_t p = 4; p + 12 <= window.size(); ++p) {
+            const uint8_t* hit = static_cast<const uint8_t*>(memmem(window.data() + p, window.size() - p, "moov", 4));
+            if (!hit) break;
+            p = static_cast<size_t>(hit - window.data());
+            if (p < 4 || p + 8 > window.size()) continue;
+
+            uint64_t moovPhys = start + chainEnd + p - 4;
+            uint32_t size = readBe32(hit - 4);
+            if ((moovPhys - start - moovLogical) % blockSize != 0 || size < 16 || size > kMaxMoovBytes ||
+                !isMoovChild(hit + 8)) {
+                continue;
+            }
+            trial.clear();
+            moovLease.reset();
+            moovLease.reset(new BudgetLease(size));
+            if (read(moovPhys, size, moov) == size && readMp4Samples(moov, trial)) {
+                moovDelta = moovPhys - moovLogical;
+                break;
+            }
+        }
+        if (moovDelta == 0) return file;
+    }
+
+    std::vector<Mp4Sample> samples;
+    if (!readMp4Samples(moov, samples)) {
+        return file;
+    }
+    uint64_t mdatPayload = mdat->offset + 8;
+    uint64_t mdatEnd = mdat->offset + mdat->size;
+    if (samples.front().offset < mdatPayload || samples.back().offset + samples.back().size > mdatEnd) {
+        return file;
+    }
+    uint64_t moovSize = moov.size();
+    uint64_t fileEnd = moovBox ? chainEnd : moovLogical + moovSize;
+
+    // Most files are contiguous: when a few samples spread over the file
+    // start where moov says, a handful of small reads settle it
+    if (moovBox && start + fileEnd <= sourceSize_) {
+        bool holds = true;
+        for (size_t i = 0; i < kMp4SpotChecks && holds; ++i) {
+            const Mp4Sample& sample = samples[(samples.size() - 1) * i / (kMp4SpotChecks - 1)];
+            uint32_t length = 0;
+            holds = read(start + sample.offset, sample.nalLength + 2u, buffer) == sample.nalLength + 2u &&
+                    nalUnitHolds(buffer.data(), sample.nalLength, sample.hevc, length) &&
+                    sample.nalLength + length <= sample.size;
+        }
+        if (holds) {
+            file.fragments.push_back({start, fileEnd});
+            file.status = CarveStatus::Complete;
+            return file;
+        }
+    }
+
+    // Probes walk the NAL units of every sample in file order, then the moov header
+    struct Probe {
+        size_t sample;
+        uint64_t offset;
+    };
+    enum class Check { Holds, Fails, Done };
+    auto check = [&](Probe& probe, uint64_t delta, SourceWindow& source, uint64_t& headerEnd) {
+        if (probe.sample == samples.size()) {
+            if (moovBox) return Check::Done;
+            const uint8_t* h = source.at(moovLogical + delta, 8);
+            headerEnd = moovLogical + 8;
+            if (!h || readBe32(h) != moovSize || memcmp(h + 4, "moov", 4) != 0) return Check::Fails;
+            probe.sample++;
+            return Check::Holds;
+        }
+        if (probe.sample > samples.size()) return Check::Done;
+
+        const Mp4Sample& sample = samples[probe.sample];
+        uint64_t sampleEnd = sample.offset + sample.size;
+        const uint8_t* h = source.at(probe.offset + delta, sample.nalLength + 2u);
+        headerEnd = probe.offset + sample.nalLength + 2;
+        if (!h || headerEnd > sampleEnd) return Check::Fails;
+
+        uint32_t length = 0;
+        if (!nalUnitHolds(h, sample.nalLength, sample.hevc, length) ||
+            probe.offset + sample.nalLength + length > sampleEnd) {
+            return Check::Fails;
+        }
+
+        probe.offset += sample.nalLength + length;
+        if (probe.offset == sampleEnd) {
+            probe.sample++;
+            if (probe.sample < samples.size()) probe.offset = samples[probe.sample].offset;
+        }
+        return Check::Holds;
+    };
+
+    struct Piece {
+        uint64_t logical;
+        uint64_t delta;
+    };
+    std::vector<Piece> pieces = {{0, start}};
+    SourceWindow scanSource(fd_, sourceSize_);
+    SourceWindow checkSource(fd_, sourceSize_);
+    Probe probe = {0, samples.front().offset};
+    uint64_t goodUpTo = mdatPayload;
+    bool complete = false;
+
+    while (true) {
+        uint64_t delta = pieces.back().delta;
+        Probe before = probe;
+        uint64_t headerEnd = 0;
+        Check result = check(probe, delta, checkSource, headerEnd);
+        if (result == Check::Done) {
+            complete = true;
+            break;
+        }
+        if (result == Check::Holds) {
+            goodUpTo = headerEnd;
+            continue;
+        }
+
+        uint64_t failAt = before.sample < samples.size() ? before.offset : moovLogical;
+        if (pieces.size() >= options_.maxFragments) break;
+
+        // New offset for the rest of the file: the moov found past the break
+        // first, then every block-aligned shift within maxGap
+        auto holdsFrom = [&](uint64_t newDelta) {
+            Probe trial = before;
+            uint64_t unused = 0;
+            for (int i = 0; i < kMp4ProbeHeaders; ++i) {
+                Check c = check(trial, newDelta, i == 0 ? scanSource : checkSource, unused);
+                if (c == Check::Fails) return false;
+                if (c == Check::Done) return i > 0;
+            }
+            return true;
+        };
+        uint64_t newDelta = 0;
+        if (moovDelta > delta && (moovDelta - delta) % blockSize == 0 &&
+            candidateBlock((failAt + moovDelta) / blockSize * blockSize) && holdsFrom(moovDelta)) {
+            newDelta = moovDelta;
+        }
+        for (uint64_t shift = blockSize; newDelta == 0 && shift <= options_.maxGap; shift += blockSize) {
+            uint64_t candidate = (failAt + delta + shift) / blockSize * blockSize;
+            if (candidate >= sourceSize_) break;
+            if (candidateBlock(candidate) && holdsFrom(delta + shift)) {
+                newDelta = delta + shift;
+            }
+        }
+        if (newDelta == 0) break;
+
+        // The break is a block boundary between the last header that held and
+        // the one that failed; prefer the first whose old block is foreign
+        uint64_t firstBoundary = ((goodUpTo + delta + blockSize - 1) / blockSize) * blockSize - delta;
+        uint64_t lastBoundary = ((failAt + delta) / blockSize) * blockSize - delta;
+        if (firstBoundary > lastBoundary || firstBoundary <= pieces.back().logical) break;
+        uint64_t breakAt = lastBoundary;
+        for (uint64_t b = firstBoundary; b < lastBoundary; b += blockSize) {
+            if (looksForeign(b + delta)) {
+                breakAt = b;
+                break;
+            }
+        }
+        pieces.push_back({breakAt, newDelta});
+        probe = before;
+    }
+
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        uint64_t logicalEnd = i + 1 < pieces.size() ? pieces[i + 1].logical : (complete ? fileEnd : goodUpTo);
+        uint64_t physStart = pieces[i].logical + pieces[i].delta;
+        uint64_t length = std::min(logicalEnd - pieces[i].logical, sourceSize_ - physStart);
+        file.fragments.push_back({physStart, length});
+    }
+    file.status = complete ? CarveStatus::Complete : CarveStatus::Truncated;
+    return file;
+}
+
+bool FragmentReassembler::candidateBlock(uint64_t offset) const {
+    if (allowed_ && !allowed_->empty()) {
+        auto next = std::upper_bound(allowed_->begin(), allowed_->end(), offset,
+                                     [](uint64_t value, const ByteRange& range) { return value < range.offset; });
+        if (next == allowed_->begin() || offset >= (next - 1)->offset + (next - 1)->length) return false;
+    }
+    if (claimed_ && !claimed_->empty()) {
+        auto next = std::upper_bound(claimed_->begin(), claimed_->end(), offset,
+                                     [](uint64_t value, const ByteRange& range) { return value < range.offset; });
+        if (next != claimed_->begin() && offset < (next - 1)->offset + (next - 1)->length) return false;
+    }
+    return true;
+}
+
+bool FragmentReassembler::looksForeign(uint64_t offset) {
+    if (!candidateBlock(offset)) return true;
+
+    std::vector<uint8_t> block;
+    size_t length = read(offset, static_cast<size_t>(options_.blockSize), block);
+    if (length == 0) return true;
+    return isFiller(BlockClassifier::classify(block.data(), length)) || startsWithFileHeader(block.data(), length);
+}
+
+size_t FragmentReassembler::read(uint64_t offset, size_t length, std::vector<uint8_t>& out) const {
+    if (offset >= sourceSize_) {
+        out.clear();
+        return 0;
+    }
+    out.resize(static_cast<size_t>(std::min<uint64_t>(length, sourceSize_ - offset)));
+    out.resize(BlockReader::readFully(fd_, out.data(), out.size(), offset));
+    return out.size();
+}
@@ -0,0 +1,67 @@
+#ifndef FRAGMENT_REASSEMBLER_H
+#define FRAGMENT_REASSEMBLER_H
+
+#include "block_reader.h"
+#include "format_walker.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct ReassemblyOptions {
+    uint64_t blockSize = 4096;          // Allocation unit; every fragment starts on one
+    uint64_t maxGap = 8 * 1024 * 1024;  // How far past a break the continuation may start
+    size_t maxFragments = 8;
+};
+
+struct ReassembledFile {
+    std::vector<ByteRange> fragments; // Physical extents in file order
+    CarveStatus status;               // Invalid when the format is not supported or the start is unusable
+};
+
+// Rebuilds JPEG and MP4 files whose blocks are not contiguous. Decoding runs
+// along the file until the data stops making sense, then the blocks after
+// the break are tested as continuations:
+//  - JPEG: the baseline Huffman stream must keep decoding, restart markers
+//    must arrive in sequence, and the block must look like entropy-coded data
+//  - MP4: the sample table in moov fixes where every sample starts; a
+//    continuation is accepted when the length-prefixed NAL units of the next
+//    samples line up at the offsets it implies
+// Candidates are only block-aligned positions within maxGap of the break,
+// forward of it, inside `allowed` and outside `claimed`, and each break reads
+// that window once, so the work per file stays close to linear in its size.
+class FragmentReassembler {
+public:
+    FragmentReassembler(const char* path, const ReassemblyOptions& options);
+    ~FragmentReassembler();
+
+    FragmentReassembler(const FragmentReassembler&) = delete;
+    FragmentReassembler& operator=(const FragmentReassembler&) = delete;
+
+    // allowed: where continuation blocks may lie, e.g. the free extents; empty means anywhere.
+    // claimed: ranges already carved as other files, sorted by offset.
+    ReassembledFile reassemble(uint64_t start, int fileType, const std::vector<ByteRange>& allowed,
+                               const std::vector<ByteRange>& claimed);
+
+private:
+    struct Mp4Sample;
+
+    ReassembledFile reassembleJpeg(uint64_t start);
+    ReassembledFile reassembleMp4(uint64_t start);
+
+    // True when a continuation may start in the block at offset
+    bool candidateBlock(uint64_t offset) const;
+    // Zero-filled, inside another file or starting with a file header
+    bool looksForeign(uint64_t offset);
+    bool readMp4Samples(const std::vector<uint8_t>& moov, std::vector<Mp4Sample>& samples) const;
+
+    // Fills out with up to length bytes at offset; returns the count read
+    size_t read(uint64_t offset, size_t length, std::vector<uint8_t>& out) const;
+
+    int fd_;
+    uint64_t sourceSize_;
+    ReassemblyOptions options_;
+    const std::vector<ByteRange>* allowed_;
+    const std::vector<ByteRange>* claimed_;
+};
+
+#endif // FRAGMENT_REASSEMBLER_H
@@ -0,0 +1,153 @@
+#include "hit_arena.h"
+#include "memory_budget.h"
+#include <stdexcept>
+
+namespace {
+
+const size_t kChunkBytes = HitArena::kChunkSize * sizeof(CarveHit);
+
+// On the heap while the memory budget has room, then in spill files, where
+// hits stay addressable in place and the kernel can write them out
+CarveHit* allocateChunk(bool& spilled) {
+    spilled = false;
+    if (MemoryBudget::tryReserve(kChunkBytes)) {
+        return new CarveHit[HitArena::kChunkSize];
+    }
+    if (void* mapped = MemoryBudget::mapSpill(kChunkBytes)) {
+        spilled = true;
+        return static_cast<CarveHit*>(mapped);
+    }
+    MemoryBudget::reserve(kChunkBytes);
+    return new CarveHit[HitArena::kChunkSize];
+}
+
+void freeChunk(CarveHit* chunk, bool spilled) {
+    if (!chunk) return;
+    if (spilled) {
+        MemoryBudget::unmapSpill(chunk, kChunkBytes);
+    } else {
+        delete[] chunk;
+        MemoryBudget::unreserve(kChunkBytes);
+    }
+}
+
+} // namespace
+
+HitArena::HitArena() : size_(0) {
+    for (size_t i = 0; i < kMaxChunks; ++i) {
+        chunks_[i].store(nullptr, std::memory_order_relaxed);
+        spilled_[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+HitArena::~HitArena() {
+    for (size_t i = 0; i < kMaxChunks; ++i) {
+        freeChunk(chunks_[i].load(std::memory_order_relaxed), spilled_[i].load(std::memory_order_relaxed));
+    }
+}
+
+CarveHit* HitArena::chunkFor(size_t chunk) {
+    CarveHit* existing = chunks_[chunk].load(std::memory_order_acquire);
+    if (existing) return existing;
+
+    // Several threads may cross into a new chunk together; one allocation wins
+    bool spilled;
+    CarveHit* fresh = allocateChunk(spilled);
+    if (chunks_[chunk].compare_exchange_strong(existing, fresh, std::memory_order_acq_rel)) {
+        spilled_[chunk].store(spilled, std::memory_order_relaxed);
+        return fresh;
+    }
+    freeChunk(fresh, spilled);
+    return existing;
+}
+
+size_t HitArena::append(const CarveHit& hit) {
+    size_t index = size_.fetch_add(1, std::memory_order_relaxed);
+    size_t chunk = index >> kChunkShift;
+    if (chunk >= kMaxChunks) {
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        throw std::length_error("HitArena is full");
+    }
+
+    chunkFor(chunk)[index & (kChunkSize - 1)] = hit;
+    return index;
+}
+
+uint32_t HitArena::addSource(const std::string& name) {
+    std::lock_guard<std::mutex> lock(sourcesMutex_);
+    // Sources are few (one per device or directory), so a linear lookup is fine
+    for (size_t i = 0; i < sources_.size(); ++i) {
+        if (sources_[i] == name) return static_cast<uint32_t>(i);
+    }
+    sources_.push_back(name);
+    return static_cast<uint32_t>(sources_.size() - 1);
+}
+
+std::string HitArena::sourceName(uint32_t source) const {
+    std::lock_guard<std::mutex> lock(sourcesMutex_);
+    return source < sources_.size() ? sources_[source] : std::string();
+}
+
+void HitArena::setFragments(size_t index, const std::vector<ByteRange>& fragments) {
+    std::lock_guard<std::mutex> lock(fragmentsMutex_);
+    fragments_[index] = fragments;
+}
+
+std::vector<ByteRange> HitArena::fragments(size_t index) const {
+    std::lock_guard<std::mutex> lock(fragmentsMutex_);
+    auto found = fragments_.find(index);
+    return found != fragments_.end() ? found->second : std::vector<ByteRange>();
+}
+
+void HitArena::setLocation(size_t index, const std::string& location) {
+    std::lock_guard<std::mutex> lock(locationsMutex_);
+    locations_[index] = location;
+}
+
+std::string HitArena::location(size_t index) const {
+    std::lock_guard<std::mutex> lock(locationsMutex_);
+    auto found = locations_.find(index);
+    return found != locations_.end() ? found->second : std::string();
+}
+
+void HitArena::addDuplicate(size_t index, const std::string& location) {
+    std::lock_guard<std::mutex> lock(duplicatesMutex_);
+    duplicates_.emplace_back(index, location);
+}
+
+size_t HitArena::duplicateCount() const {
+    std::lock_guard<std::mutex> lock(duplicatesMutex_);
+    return duplicates_.size();
+}
+
+std::vector<std::pair<size_t, std::string>> HitArena::duplicatesFrom(size_t from) const {
+    std::lock_guard<std::mutex> lock(duplicatesMutex_);
+    if (from >= duplicates_.size()) return {};
+    return std::vector<std::pair<size_t, std::string>>(duplicates_.begin() + from, duplicates_.end());
+}
+
+std::vector<std::string> HitArena::duplicates(size_t index) const {
+    std::lock_guard<std::mutex> lock(duplicatesMutex_);
+    // Duplicates are rare enough that a scan of the log is fine
+    std::vector<std::string> locations;
+    for (const auto& duplicate : duplicates_) {
+        if (duplicate.first == index) locations.push_back(duplicate.second);
+    }
+    return locations;
+}
+
+size_t HitArena::memoryBytes() const {
+    size_t chunks = 0;
+    for (size_t i = 0; i < kMaxChunks; ++i) {
+        if (chunks_[i].load(std::memory_order_relaxed) && !spilled_[i].load(std::memory_order_relaxed)) chunks++;
+    }
+    return chunks * kChunkBytes;
+}
+
+size_t HitArena::spilledBytes() const {
+    size_t chunks = 0;
+    for (const auto& spilled : spilled_) {
+        if (spilled.load(std::memory_order_relaxed)) chunks++;
+    }
+    return chunks * kChunkBytes;
+}
@@ -0,0 +1,259 @@
+#ifndef HIT_ARENA_H
+#define HIT_ARENA_H
+
+#include "block_reader.h"
+#include "memory_budget.h"
+#include "scan_stats.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+enum HitFlags : uint8_t {
+    kHitComplete = 0x1,        // Carved file whose end marker was found
+    kHitDirectoryEntry = 0x2,  // Empty or damaged entry found by a directory scan
+    kHitSystemArea = 0x4,      // Found under a root-only system path
+    kHitFreeExtent = 0x8,      // Run of unallocated blocks
+    kHitFragmented = 0x10,     // Reassembled from several extents, see HitArena::fragments
+    kHitJournal = 0x20,        // Deleted file mapped exactly by a journaled inode copy
+    kHitFatEntry = 0x40,       // Deleted file mapped exactly by its FAT32 or exFAT directory entry
+    kHitInode = 0x80           // Deleted file mapped exactly by an inode it left on disk: an ext4
+                               // inode table entry or an F2FS node block
+};
+
+// One scan result. Fixed-size and trivially copyable so the arena can hand
+// whole chunks to Java without per-hit conversion; the layout is part of the
+// JNI contract (see NativeHitListener.kt).
+struct CarveHit {
+    uint64_t offset;     // Byte offset in the source; 0 for directory entries
+    uint64_t length;     // Bytes; 0 when unknown
+    uint32_t source;     // Index into HitArena::sourceName
+    uint16_t fileType;   // FileType id
+    uint8_t confidence;  // 0-100
+    uint8_t flags;       // HitFlags
+};
+static_assert(sizeof(CarveHit) == 24, "CarveHit layout is shared with Kotlin");
+
+// Append-only store for scan results. Hits live in fixed chunks that are
+// never moved, so appending is a single atomic increment plus, once per
+// chunk, a compare-and-swap to install a new one; any number of scanner
+// threads may append at once. A million hits take 24 MB. Chunks that do not
+// fit the memory budget go to spill files (memory_budget.h).
+class HitArena {
+public:
+    static constexpr size_t kChunkShift = 16;
+    static constexpr size_t kChunkSize = size_t(1) << kChunkShift; // Hits per chunk
+    static constexpr size_t kMaxChunks = 4096;
+
+    HitArena();
+    ~HitArena();
+
+    HitArena(const HitArena&) = delete;
+    HitArena& operator=(const HitArena&) = delete;
+
+    // Returns the hit's index. Throws std::length_error once the arena is full.
+    size_t append(const CarveHit& hit);
+
+    // Hits below size() are readable once the threads that appended them
+    // have been joined or have otherwise synchronised with the reader
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+    const CarveHit& operator[](size_t index) const {
+        return chunks_[index >> kChunkShift].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
+    }
+
+    // Calls visitor with contiguous runs covering [from, to), at most one per chunk
+    template <typename Visitor>
+    void forEachRun(size_t from, size_t to, Visitor visitor) const {
+        while (from < to) {
+            size_t inChunk = std::min(to - from, kChunkSize - (from & (kChunkSize - 1)));
+            visitor(&(*this)[from], inChunk);
+            from += inChunk;
+        }
+    }
+
+    uint32_t addSource(const std::string& name);
+    std::string sourceName(uint32_t source) const;
+
+    // Extents of a kHitFragmented hit in file order; the hit itself only
+    // holds the first offset and the total length. Fragmented hits are rare,
+    // so they live in a side table rather than widening every record.
+    void setFragments(size_t index, const std::vector<ByteRange>& fragments);
+    std::vector<ByteRange> fragments(size_t index) const;
+
+    // Path of a kHitDirectoryEntry hit, which has no extent to recover from;
+    // empty for every other hit
+    void setLocation(size_t index, const std::string& location);
+    std::string location(size_t index) const;
+
+    // Other places a hit's content was found. Those copies are not hits of
+    // their own: each is logged as (index of the first hit, location) in an
+    // append-only log that consumers read from their own position on.
+    void addDuplicate(size_t index, const std::string& location);
+    size_t duplicateCount() const;
+    std::vector<std::pair<size_t, std::string>> duplicatesFrom(size_t from) const;
+    std::vector<std::string> duplicates(size_t index) const;
+
+    // Chunk bytes held on the heap, and in spill files
+    size_t memoryBytes() const;
+    size_t spilledBytes() const;
+
+private:
+    CarveHit* chunkFor(size_t chunk);
+
+    std::atomic<CarveHit*> chunks_[kMaxChunks];
+    std::atomic<bool> spilled_[kMaxChunks]; // Set once its chunk is installed from a spill file
+    std::atomic<size_t> size_;
+
+    mutable std::mutex sourcesMutex_;
+    std::vector<std::string> sources_;
+
+    mutable std::mutex fragmentsMutex_;
+    std::map<size_t, std::vector<ByteRange>> fragments_;
+
+    mutable std::mutex locationsMutex_;
+    std::map<size_t, std::string> locations_;
+
+    mutable std::mutex duplicatesMutex_;
+    std::vector<std::pair<size_t, std::string>> duplicates_;
+};
+
+// Receives [from, to) whenever a batch of new hits is ready, or an empty
+// range when only new duplicates were logged; return false to stop
+using HitSink = std::function<bool(const HitArena&, size_t from, size_t to)>;
+
+// Appends to an arena on one thread and passes each full batch to a sink
+class HitBatcher {
+public:
+    // Full content hash of a hit that is not yet, or already, in the arena;
+    // path is the file of a kHitDirectoryEntry hit. 0 if it cannot be read.
+    using FullHash = std::function<uint64_t(const CarveHit& hit, const std::string& path,
+                                            const std::vector<ByteRange>& fragments)>;
+
+    HitBatcher(HitArena& arena, const HitSink& sink, size_t batchSize)
+            : arena_(arena), sink_(sink), batchSize_(batchSize), flushed_(arena.size()),
+              duplicatesFlushed_(arena.duplicateCount()), limit_(0), added_(0), exactUpTo_(0),
+              budgetedEntries_(0) {}
+    ~HitBatcher() { MemoryBudget::unreserve(budgetedEntries_ * kEntryBytes); }
+
+    HitBatcher(const HitBatcher&) = delete;
+    HitBatcher& operator=(const HitBatcher&) = delete;
+
+    HitArena& arena() { return arena_; }
+
+    // Content hashes passed to add are sampled keys: hits longer than
+    // exactUpTo whose keys match are only merged once fullHash agrees.
+    // Without one, matching keys are taken as the same content.
+    void setFullHash(const FullHash& fullHash, uint64_t exactUpTo) {
+        fullHash_ = fullHash;
+        exactUpTo_ = exactUpTo;
+    }
+
+    // Stops the scan, as a sink returning false would, once maxHits hits are
+    // added; duplicates do not count. 0 removes the limit.
+    void setLimit(size_t maxHits) { limit_ = maxHits; }
+    bool limitReached() const { return limit_ > 0 && added_ >= limit_; }
+
+    bool add(const CarveHit& hit) {
+        arena_.append(hit);
+        return added();
+    }
+
+    bool add(const CarveHit& hit, const std::vector<ByteRange>& fragments) {
+        arena_.setFragments(arena_.append(hit), fragments);
+        return added();
+    }
+
+    // Adds the hit unless an earlier one had the same length and content;
+    // then location is only noted as a duplicate of that one. A hash of 0
+    // (not hashed) is never merged. A directory entry keeps location as its own.
+    bool add(const CarveHit& hit, uint64_t contentHash, const std::string& location,
+             const std::vector<ByteRange>& fragments = {}) {
+        if (contentHash != 0 && hit.length > 0) {
+            uint64_t key = contentHash ^ (hit.length * 0x9E3779B97F4A7C15ULL);
+            auto first = firstByContent_.find(key);
+            if (first != firstByContent_.end()) {
+                if (arena_[first->second].length == hit.length &&
+                    sameContent(first->second, hit, location, fragments)) {
+                    arena_.addDuplicate(first->second, location);
+                    ScanStats::add(kStatDuplicates, 1);
+                    return true;
+                }
+            } else if (budgetEntry()) {
+                firstByContent_.emplace(key, arena_.size());
+            }
+        }
+        if (hit.flags & kHitDirectoryEntry) {
+            arena_.setLocation(arena_.size(), location);
+        }
+        return fragments.empty() ? add(hit) : add(hit, fragments);
+    }
+
+    bool flush() {
+        size_t end = arena_.size();
+        size_t duplicates = arena_.duplicateCount();
+        if (end == flushed_ && duplicates == duplicatesFlushed_) return true;
+        size_t from = flushed_;
+        flushed_ = end;
+        duplicatesFlushed_ = duplicates;
+        return sink_(arena_, from, end);
+    }
+
+private:
+    // Rough heap cost of one hash table entry: node, bucket and allocator overhead
+    static constexpr size_t kEntryBytes = 64;
+    static constexpr size_t kEntriesPerReserve = 4096;
+
+    bool added() {
+        ++added_;
+        if (limitReached()) return false;
+        return arena_.size() - flushed_ < batchSize_ || flush();
+    }
+
+    // Counts one more table entry against the memory budget, in blocks. Past
+    // the budget nothing new is remembered, so later copies are not merged.
+    bool budgetEntry() {
+        if (firstByContent_.size() + fullHashes_.size() < budgetedEntries_) return true;
+        if (!MemoryBudget::tryReserve(kEntriesPerReserve * kEntryBytes)) return false;
+        budgetedEntries_ += kEntriesPerReserve;
+        return true;
+    }
+
+    bool sameContent(size_t first, const CarveHit& hit, const std::string& location,
+                     const std::vector<ByteRange>& fragments) {
+        if (!fullHash_ || hit.length <= exactUpTo_) return true;
+        uint64_t firstHash;
+        auto cached = fullHashes_.find(first);
+        if (cached != fullHashes_.end()) {
+            firstHash = cached->second;
+        } else {
+            const CarveHit& earlier = arena_[first];
+            firstHash = fullHash_(earlier, arena_.location(first),
+                                  (earlier.flags & kHitFragmented) ? arena_.fragments(first) : std::vector<ByteRange>());
+            if (budgetEntry()) fullHashes_.emplace(first, firstHash);
+        }
+        uint64_t hash = fullHash_(hit, location, fragments);
+        return hash != 0 && hash == firstHash;
+    }
+
+    HitArena& arena_;
+    const HitSink& sink_;
+    size_t batchSize_;
+    size_t flushed_;
+    size_t duplicatesFlushed_;
+    size_t limit_;
+    size_t added_;
+    FullHash fullHash_;
+    uint64_t exactUpTo_;
+    std::unordered_map<uint64_t, size_t> firstByContent_; // Mixed hash and length -> first hit
+    std::unordered_map<size_t, uint64_t> fullHashes_;     // First hit -> its full hash, once a key matched it
+    size_t budgetedEntries_;
+};
+
+#endif // HIT_ARENA_H
@@ -0,0 +1,389 @@
+#include "jbd2_journal.h"
+#include "byte_order.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <algorithm>
+#include <cstring>
+
+#define LOG_TAG "Jbd2Journal"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+// Every jbd2 structure is big-endian and starts with this header
+const uint32_t kJournalMagic = 0xC03B3998;
+const uint32_t kBlockDescriptor = 1;
+const uint32_t kBlockCommit = 2;
+const uint32_t kBlockSuperblockV1 = 3;
+const uint32_t kBlockSuperblockV2 = 4;
+const uint32_t kBlockRevoke = 5;
+const size_t kHeaderBytes = 12;
+
+const uint32_t kIncompat64Bit = 0x2;
+const uint32_t kIncompatCsumV2 = 0x8;
+const uint32_t kIncompatCsumV3 = 0x10;
+
+const uint32_t kTagEscaped = 0x1;
+const uint32_t kTagSameUuid = 0x2;
+const uint32_t kTagLast = 0x8;
+const size_t kUuidBytes = 16;
+
+// Journal blocks read per request while walking the log
+const uint32_t kWalkBatch = 256;
+
+// Sequence numbers wrap; this is jbd2's tid_gt
+bool newer(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+}
+
+bool validNameByte(uint8_t c) {
+    return c != 0 && c != '/';
+}
+
+} // namespace
+
+Jbd2Journal::Jbd2Journal(const Ext4Reader& fs)
+        : fs_(fs), blockSize_(0), maxLength_(0), firstBlock_(0), incompat_(0), tagBytes_(0) {
+}
+
+bool Jbd2Journal::load(const StopCheck& stop) {
+    if (!fs_.isOpen() || fs_.journalInode() == 0) {
+        LOGE("Filesystem has no journal");
+        return false;
+    }
+
+    std::vector<uint8_t> raw(fs_.inodeSize());
+    if (!fs_.readInode(fs_.journalInode(), raw.data())) {
+        LOGE("Cannot read journal inode %u", fs_.journalInode());
+        return false;
+    }
+    Ext4Inode inode = Ext4Inode::parse(raw.data());
+    auto fromDevice = [this](uint64_t block, uint8_t* buffer) { return fs_.readBlocks(block, 1, buffer); };
+    if (!fs_.mapExtents(inode, fromDevice, journalExtents_) || journalExtents_.empty()) {
+        LOGE("Cannot map journal inode %u", fs_.journalInode());
+        return false;
+    }
+
+    if (!readSuperblock()) {
+        return false;
+    }
+    if (!walkLog(stop)) {
+        LOGI("Journal walk stopped");
+        return false;
+    }
+    indexCopies();
+
+    size_t revoked = std::count_if(logged_.begin(), logged_.end(), [](const LoggedBlock& copy) { return copy.revoked; });
+    LOGI("Journal: %zu committed transactions, %zu logged blocks (%zu revoked), %zu inodes with older copies",
+         committed_.size(), logged_.size(), revoked, inodeCopies_.size());
+    return true;
+}
+
+bool Jbd2Journal::readJournalBlocks(uint64_t journalBlock, uint32_t count, uint8_t* buffer) const {
+    while (count > 0) {
+        auto extent = std::find_if(journalExtents_.begin(), journalExtents_.end(), [&](const Ext4Extent& e) {
+            return journalBlock >= e.logical && journalBlock < e.logical + e.length;
+        });
+        if (extent == journalExtents_.end()) {
+            return false;
+        }
+        uint32_t run = static_cast<uint32_t>(std::min<uint64_t>(count, extent->logical + extent->length - journalBlock));
+        if (!fs_.readBlocks(extent->physical + (journalBlock - extent->logical), run, buffer)) {
+            return false;
+        }
+        journalBlock += run;
+        count -= run;
+        buffer += static_cast<size_t>(run) * blockSize_;
+    }
+    return true;
+}
+
+bool Jbd2Journal::readCopy(const LoggedBlock& copy, uint8_t* buffer) const {
+    if (!readJournalBlocks(copy.journalBlock, 1, buffer)) {
+        return false;
+    }
+    if (copy.escaped) {
+        buffer[0] = 0xC0;
+        buffer[1] = 0x3B;
+        buffer[2] = 0x39;
+        buffer[3] = 0x98;
+    }
+    return true;
+}
+
+bool Jbd2Journal::readSuperblock() {
+    blockSize_ = fs_.blockSize();
+    std::vector<uint8_t> sb(blockSize_);
+    if (!readJournalBlocks(0, 1, sb.data())) {
+        LOGE("Cannot read journal superblock");
+        return false;
+    }
+
+    uint32_t type = readBe32(sb.data() + 4);
+    if (readBe32(sb.data()) != kJournalMagic || (type != kBlockSuperblockV1 && type != kBlockSuperblockV2)) {
+        LOGE("Bad journal superblock");
+        return false;
+    }
+    // An ext4 journal shares the filesystem block size
+    if (readBe32(sb.data() + 0x0C) != blockSize_) {
+        LOGE("Journal block size %u differs from the filesystem's", readBe32(sb.data() + 0x0C));
+        return false;
+    }
+
+    uint64_t inodeBlocks = journalExtents_.back().logical + journalExtents_.back().length;
+    maxLength_ = readBe32(sb.data() + 0x10);
+    firstBlock_ = readBe32(sb.data() + 0x14);
+    if (maxLength_ > inodeBlocks || firstBlock_ == 0 || firstBlock_ >= maxLength_) {
+        LOGE("Corrupt journal geometry");
+        return false;
+    }
+
+    incompat_ = type == kBlockSuperblockV2 ? readBe32(sb.data() + 0x28) : 0;
+    // Mirrors jbd2's journal_tag_bytes
+    if (incompat_ & kIncompatCsumV3) {
+        tagBytes_ = 16;
+    } else {
+        tagBytes_ = 12 + ((incompat_ & kIncompatCsumV2) ? 2 : 0) - ((incompat_ & kIncompat64Bit) ? 0 : 4);
+    }
+    return true;
+}
+
+bool Jbd2Journal::walkLog(const StopCheck& stop) {
+    // The log is a ring; a block belongs to the newest transaction that wrote
+    // it. Copies whose journal block a later transaction reused are stale.
+    std::vector<uint32_t> owner(maxLength_, 0);
+    std::vector<bool> owned(maxLength_, false);
+    auto claim = [&](uint64_t journalBlock, uint32_t sequence) {
+        if (!owned[journalBlock] || newer(sequence, owner[journalBlock])) {
+            owner[journalBlock] = sequence;
+            owned[journalBlock] = true;
+        }
+    };
+    auto nextBlock = [this](uint64_t journalBlock) {
+        return journalBlock + 1 < maxLength_ ? journalBlock + 1 : firstBlock_;
+    };
+
+    const bool csum = (incompat_ & (kIncompatCsumV2 | kIncompatCsumV3)) != 0;
+    const bool wide = (incompat_ & kIncompat64Bit) != 0;
+    std::vector<LoggedBlock> candidates;
+    std::unordered_map<uint64_t, uint32_t> revokedAt; // Filesystem block -> newest revoking transaction
+
+    // Data blocks never begin with the magic (those are logged escaped), so
+    // checking every block finds all headers still in the ring
+    BudgetLease lease(static_cast<size_t>(kWalkBatch) * blockSize_);
+    std::vector<uint8_t> batch(static_cast<size_t>(kWalkBatch) * blockSize_);
+    for (uint64_t start = firstBlock_; start < maxLength_; start += kWalkBatch) {
+        if (stop && stop()) return false;
+        uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(kWalkBatch, maxLength_ - start));
+        if (!readJournalBlocks(start, count, batch.data())) {
+            LOGE("Cannot read journal blocks from %llu", static_cast<unsigned long long>(start));
+            continue;
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint8_t* block = batch.data() + static_cast<size_t>(i) * blockSize_;
+            if (readBe32(block) != kJournalMagic) continue;
+            uint64_t journalBlock = start + i;
+            uint32_t type = readBe32(block + 4);
+            uint32_t sequence = readBe32(block + 8);
+
+            if (type == kBlockDescriptor) {
+                claim(journalBlock, sequence);
+                size_t limit = blockSize_ - (csum ? 4 : 0); // Checksum tail
+                uint64_t dataBlock = journalBlock;
+                for (size_t offset = kHeaderBytes; offset + tagBytes_ <= limit;) {
+                    const uint8_t* tag = block + offset;
+                    uint32_t flags = (incompat_ & kIncompatCsumV3) ? readBe32(tag + 4) : readBe16(tag + 6);
+                    uint64_t fsBlock = readBe32(tag);
+                    if (wide) fsBlock |= static_cast<uint64_t>(readBe32(tag + 8)) << 32;
+
+                    dataBlock = nextBlock(dataBlock);
+                    claim(dataBlock, sequence);
+                    if (fsBlock < fs_.blockCount()) {
+                        candidates.push_back({fsBlock, dataBlock, sequence, (flags & kTagEscaped) != 0, false});
+                    }
+
+                    offset += tagBytes_ + ((flags & kTagSameUuid) ? 0 : kUuidBytes);
+                    if (flags & kTagLast) break;
+                }
+            } else if (type == kBlockCommit) {
+                claim(journalBlock, sequence);
+                committed_.insert(sequence);
+            } else if (type == kBlockRevoke) {
+                claim(journalBlock, sequence);
+                size_t used = std::min<size_t>(readBe32(block + kHeaderBytes), blockSize_);
+                size_t recordBytes = wide ? 8 : 4;
+                for (size_t offset = kHeaderBytes + 4; offset + recordBytes <= used; offset += recordBytes) {
+                    uint64_t fsBlock = wide ? readBe64(block + offset) : readBe32(block + offset);
+                    auto found = revokedAt.find(fsBlock);
+                    if (found == revokedAt.end() || newer(sequence, found->second)) {
+                        revokedAt[fsBlock] = sequence;
+                    }
+                }
+            }
+        }
+    }
+
+    // Only what a committed transaction logged and nothing has overwritten since
+    for (auto& copy : candidates) {
+        if (!committed_.count(copy.sequence) || owner[copy.journalBlock] != copy.sequence) continue;
+        auto revoke = revokedAt.find(copy.fsBlock);
+        copy.revoked = revoke != revokedAt.end() && !newer(copy.sequence, revoke->second);
+        logged_.push_back(copy);
+    }
+    std::sort(logged_.begin(), logged_.end(), [](const LoggedBlock& a, const LoggedBlock& b) {
+        return a.fsBlock != b.fsBlock ? a.fsBlock < b.fsBlock : newer(b.sequence, a.sequence);
+    });
+    return true;
+}
+
+uint32_t Jbd2Journal::firstInodeIn(uint64_t fsBlock) const {
+    auto next = std::upper_bound(inodeTables_.begin(), inodeTables_.end(), fsBlock,
+                                 [](uint64_t block, const std::pair<uint64_t, uint32_t>& table) {
+                                     return block < table.first;
+                                 });
+    if (next == inodeTables_.begin()) {
+        return 0;
+    }
+    const auto& table = *(next - 1);
+    uint64_t within = fsBlock - table.first;
+    if (within >= fs_.inodeTableBlocks()) {
+        return 0;
+    }
+    uint32_t perBlock = blockSize_ / fs_.inodeSize();
+    return table.second * fs_.inodesPerGroup() + static_cast<uint32_t>(within) * perBlock + 1;
+}
+
+void Jbd2Journal::indexCopies() {
+    const auto& groups = fs_.groups();
+    for (uint32_t group = 0; group < groups.size(); ++group) {
+        inodeTables_.push_back({groups[group].inodeTable, group});
+    }
+    std::sort(inodeTables_.begin(), inodeTables_.end());
+
+    std::vector<uint8_t> data(blockSize_);
+    for (size_t i = 0; i < logged_.size(); ++i) {
+        if (!readCopy(logged_[i], data.data())) continue;
+        uint32_t firstInode = firstInodeIn(logged_[i].fsBlock);
+        if (firstInode) {
+            indexInodeTableBlock(i, firstInode, data.data());
+        } else {
+            indexDirectoryBlock(logged_[i].sequence, data.data());
+        }
+    }
+}
+
+void Jbd2Journal::indexInodeTableBlock(size_t block, uint32_t firstInode, const uint8_t* data) {
+    uint32_t inodeSize = fs_.inodeSize();
+    for (uint32_t offset = 0; offset + inodeSize <= blockSize_; offset += inodeSize) {
+        Ext4Inode inode = Ext4Inode::parse(data + offset);
+        // Only copies that still map data are worth keeping
+        if (!inode.isRegular() || inode.size == 0 || !(inode.flags & Ext4Inode::kFlagExtents) ||
+            readLe16(inode.blockMap + 2) == 0) {
+            continue;
+        }
+        uint32_t number = firstInode + offset / inodeSize;
+        inodeCopies_[number].push_back({logged_[block].sequence, block, offset});
+    }
+}
+
+void Jbd2Journal::indexDirectoryBlock(uint32_t sequence, const uint8_t* data) {
+    // A directory block is a chain of records that exactly fills it. A
+    // deleted entry is folded into the record before it, so its bytes
+    // survive in that record's slack and are read back from there too.
+    std::vector<std::pair<uint32_t, std::string>> entries;
+    auto entryAt = [&](uint32_t offset, uint32_t room, uint32_t& recordLength) {
+        uint32_t inode = readLe32(data + offset);
+        recordLength = readLe16(data + offset + 4);
+        uint8_t nameLength = data[offset + 6];
+        uint8_t fileType = data[offset + 7];
+        if (recordLength < 12 || recordLength % 4 || recordLength > room) return false;
+        if (inode == 0) return true; // Unused record, or the checksum tail
+        if (nameLength == 0 || 8u + nameLength > recordLength || fileType == 0 || fileType > 7) return false;
+        if (!std::all_of(data + offset + 8, data + offset + 8 + nameLength, validNameByte)) return false;
+        entries.push_back({inode, std::string(reinterpret_cast<const char*>(data + offset + 8), nameLength)});
+        return true;
+    };
+
+    uint32_t offset = 0;
+    while (offset < blockSize_) {
+        uint32_t recordLength = 0;
+        size_t before = entries.size();
+        if (offset + 12 > blockSize_ || !entryAt(offset, blockSize_ - offset, recordLength)) {
+            return;
+        }
+        uint32_t used = entries.size() > before ? (8 + data[offset + 6] + 3) & ~3u : 8;
+        for (uint32_t slack = offset + used; slack + 12 <= offset + recordLength;) {
+            uint32_t deletedLength = 0;
+            size_t count = entries.size();
+            if (!entryAt(slack, offset + recordLength - slack, deletedLength) || entries.size() == count) break;
+            slack += deletedLength;
+        }
+        offset += recordLength;
+    }
+
+    for (auto& entry : entries) {
+        if (entry.second == "." || entry.second == "..") continue;
+        auto found = names_.find(entry.first);
+        if (found == names_.end() || !newer(found->second.sequence, sequence)) {
+            names_[entry.first] = {std::move(entry.second), sequence};
+        }
+    }
+}
+
+bool Jbd2Journal::readLoggedBlock(uint64_t fsBlock, uint32_t maxSequence, uint8_t* buffer) const {
+    auto range = std::equal_range(logged_.begin(), logged_.end(), LoggedBlock{fsBlock, 0, 0, false, false},
+                                  [](const LoggedBlock& a, const LoggedBlock& b) { return a.fsBlock < b.fsBlock; });
+    for (auto copy = range.second; copy != range.first;) {
+        --copy;
+        if (!newer(copy->sequence, maxSequence)) {
+            return readCopy(*copy, buffer);
+        }
+    }
+    return false;
+}
+
+std::vector<JournalFile> Jbd2Journal::deletedFiles(const StopCheck& stop) const {
+    std::vector<JournalFile> files;
+    std::vector<uint8_t> live(fs_.inodeSize());
+    std::vector<uint8_t> block(blockSize_);
+    std::vector<Ext4Extent> extents;
+
+    for (const auto& entry : inodeCopies_) {
+        if (stop && stop()) break;
+        uint32_t number = entry.first;
+        if (!fs_.readInode(number, live.data()) || !Ext4Inode::parse(live.data()).isDeleted()) {
+            continue;
+        }
+
+        // Newest copy first; the extent tree below the inode is read as it
+        // stood in that transaction where the log still has it
+        std::vector<InodeCopy> copies = entry.second;
+        std::sort(copies.begin(), copies.end(), [](const InodeCopy& a, const InodeCopy& b) {
+            return newer(a.sequence, b.sequence);
+        });
+        for (const auto& copy : copies) {
+            if (!readCopy(logged_[copy.block], block.data())) continue;
+            Ext4Inode inode = Ext4Inode::parse(block.data() + copy.offset);
+            auto asLogged = [&](uint64_t fsBlock, uint8_t* buffer) {
+                return readLoggedBlock(fsBlock, copy.sequence, buffer) || fs_.readBlocks(fsBlock, 1, buffer);
+            };
+            if (!fs_.mapExtents(inode, asLogged, extents)) continue;
+
+            // Holes cannot be expressed as byte ranges; such files are left to carving
+            JournalFile file = {number, copy.sequence, inode.size, {}, {}};
+            if (!fs_.fileRanges(extents, inode.size, file.extents)) continue;
+
+            auto name = names_.find(number);
+            if (name != names_.end()) file.name = name->second.name;
+            files.push_back(std::move(file));
+            break;
+        }
+    }
+
+    std::sort(files.begin(), files.end(), [](const JournalFile& a, const JournalFile& b) {
+        return a.inode < b.inode;
+    });
+    return files;
+}
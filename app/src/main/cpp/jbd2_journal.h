@@ -0,0 +1,87 @@
+#ifndef JBD2_JOURNAL_H
+#define JBD2_JOURNAL_H
+
+#include "ext4_reader.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <cstddef>
+
+// A deleted file whose extent map survives in a journaled copy of its inode
+struct JournalFile {
+    uint32_t inode;
+    uint32_t sequence;              // Transaction that logged the copy used
+    uint64_t size;
+    std::string name;               // From a journaled directory block; empty if none was logged
+    std::vector<ByteRange> extents; // Byte ranges on the device in file order, clipped to size
+};
+
+// Older copies of ext4 metadata kept in the jbd2 journal. Every committed
+// transaction still in the log is walked, not only the ones a mount would
+// replay: an inode-table block logged before a delete still holds the
+// file's extent tree after the live inode has been wiped.
+class Jbd2Journal {
+public:
+    explicit Jbd2Journal(const Ext4Reader& fs);
+
+    // Locates the journal inode and indexes the log; false if there is none,
+    // it is damaged or stop cut the walk short
+    bool load(const StopCheck& stop = nullptr);
+
+    size_t transactionCount() const { return committed_.size(); }
+    size_t loggedBlockCount() const { return logged_.size(); }
+
+    // Newest logged copy of a filesystem block from a transaction no later than maxSequence
+    bool readLoggedBlock(uint64_t fsBlock, uint32_t maxSequence, uint8_t* buffer) const;
+
+    // Files whose live inode is freed while a journaled copy still maps all of
+    // their data. A stop ends the search with what it found so far.
+    std::vector<JournalFile> deletedFiles(const StopCheck& stop = nullptr) const;
+
+private:
+    struct LoggedBlock {
+        uint64_t fsBlock;
+        uint64_t journalBlock;
+        uint32_t sequence;
+        bool escaped; // Began with the jbd2 magic, which the log stores zeroed
+        bool revoked; // Freed by a later transaction; the copy is what the block held before
+    };
+
+    // Where one older copy of an inode sits in the log
+    struct InodeCopy {
+        uint32_t sequence;
+        size_t block;    // Index into logged_
+        uint32_t offset; // Of the inode within that block
+    };
+
+    struct NamedInode {
+        std::string name;
+        uint32_t sequence;
+    };
+
+    bool readJournalBlocks(uint64_t journalBlock, uint32_t count, uint8_t* buffer) const;
+    bool readCopy(const LoggedBlock& copy, uint8_t* buffer) const;
+    bool readSuperblock();
+    bool walkLog(const StopCheck& stop);
+    void indexCopies();
+    void indexInodeTableBlock(size_t block, uint32_t firstInode, const uint8_t* data);
+    void indexDirectoryBlock(uint32_t sequence, const uint8_t* data);
+    uint32_t firstInodeIn(uint64_t fsBlock) const; // 0 unless fsBlock is part of an inode table
+
+    const Ext4Reader& fs_;
+    std::vector<Ext4Extent> journalExtents_;
+    uint32_t blockSize_;
+    uint32_t maxLength_;  // Journal blocks, superblock included
+    uint32_t firstBlock_; // First block of the log proper
+    uint32_t incompat_;
+    size_t tagBytes_;
+    std::vector<LoggedBlock> logged_; // By filesystem block, then sequence
+    std::unordered_set<uint32_t> committed_;
+    std::vector<std::pair<uint64_t, uint32_t>> inodeTables_; // First block, group; by block
+    std::unordered_map<uint32_t, std::vector<InodeCopy>> inodeCopies_;
+    std::unordered_map<uint32_t, NamedInode> names_;
+};
+
+#endif // JBD2_JOURNAL_H
@@ -0,0 +1,211 @@
+#include "memory_budget.h"
+#include "scan_stats.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <utility>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#define LOG_TAG "MemoryBudget"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+std::mutex gMutex;
+std::condition_variable gReleased;
+size_t gLimit = 0;
+size_t gUsed = 0;
+size_t gTransient = 0; // Part of gUsed held through acquire
+size_t gPeak = 0;
+std::string gSpillDirectory;
+// Transient bytes this thread holds. A thread that holds some never waits for
+// more: the others could be waiting on it in turn.
+thread_local size_t tTransient = 0;
+
+bool fits(size_t bytes) {
+    return gLimit == 0 || (gUsed <= gLimit && bytes <= gLimit - gUsed);
+}
+
+// Caller holds gMutex
+void count(size_t bytes) {
+    gUsed += bytes;
+    if (gUsed > gPeak) {
+        // Summed per thread like every counter, so the stat grows by the new peak's excess
+        ScanStats::add(kStatPeakBytes, gUsed - gPeak);
+        gPeak = gUsed;
+    }
+}
+
+void uncount(size_t bytes) {
+    gUsed -= std::min(bytes, gUsed);
+}
+
+} // namespace
+
+void MemoryBudget::configure(size_t limitBytes, const std::string& spillDirectory) {
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        gLimit = limitBytes;
+        gSpillDirectory = spillDirectory;
+    }
+    gReleased.notify_all();
+    LOGI("Memory budget %zu bytes, spilling to %s", limitBytes,
+         spillDirectory.empty() ? "nowhere" : spillDirectory.c_str());
+}
+
+size_t MemoryBudget::limit() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gLimit;
+}
+
+void MemoryBudget::acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(gMutex);
+    if (!fits(bytes) && gTransient > 0 && tTransient == 0) {
+        uint64_t start = ScanStats::nowNanos();
+        gReleased.wait(lock, [bytes] { return fits(bytes) || gTransient == 0; });
+        ScanStats::add(kStatBudgetStallNanos, ScanStats::nowNanos() - start);
+    }
+    gTransient += bytes;
+    tTransient += bytes;
+    count(bytes);
+}
+
+void MemoryBudget::release(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        gTransient -= std::min(bytes, gTransient);
+        tTransient -= std::min(bytes, tTransient);
+        uncount(bytes);
+    }
+    gReleased.notify_all();
+}
+
+bool MemoryBudget::tryReserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    if (!fits(bytes)) return false;
+    count(bytes);
+    return true;
+}
+
+void MemoryBudget::reserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    count(bytes);
+}
+
+void MemoryBudget::unreserve(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        uncount(bytes);
+    }
+    gReleased.notify_all();
+}
+
+void* MemoryBudget::mapSpill(size_t bytes) {
+    std::string pattern;
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        if (gSpillDirectory.empty()) return nullptr;
+        pattern = gSpillDirectory + "/spill.XXXXXX";
+    }
+
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        LOGE("Cannot create a spill file in %s: %s", pattern.c_str(), strerror(errno));
+        return nullptr;
+    }
+    // Only the mapping keeps the file alive, so nothing is left behind after a crash
+    unlink(path.data());
+
+    void* data = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+        data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        LOGE("Cannot map a %zu byte spill file: %s", bytes, strerror(errno));
+        data = nullptr;
+    }
+    close(fd);
+    return data;
+}
+
+void MemoryBudget::unmapSpill(void* data, size_t bytes) {
+    if (data) munmap(data, bytes);
+}
+
+size_t MemoryBudget::used() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gUsed;
+}
+
+size_t MemoryBudget::peak() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    return gPeak;
+}
+
+void MemoryBudget::resetPeak() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    gPeak = gUsed;
+    ScanStats::add(kStatPeakBytes, gUsed);
+}
+
+BudgetBuffer::BudgetBuffer(BudgetBuffer&& other) noexcept
+        : data_(other.data_), size_(other.size_), spilled_(other.spilled_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.spilled_ = false;
+}
+
+BudgetBuffer& BudgetBuffer::operator=(BudgetBuffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(spilled_, other.spilled_);
+    }
+    return *this;
+}
+
+bool BudgetBuffer::allocate(size_t size) {
+    reset();
+    if (size == 0) return true;
+
+    if (MemoryBudget::tryReserve(size)) {
+        data_ = new (std::nothrow) uint8_t[size];
+        if (!data_) {
+            MemoryBudget::unreserve(size);
+            return false;
+        }
+    } else if ((data_ = static_cast<uint8_t*>(MemoryBudget::mapSpill(size)))) {
+        spilled_ = true;
+    } else {
+        data_ = new (std::nothrow) uint8_t[size];
+        if (!data_) return false;
+        MemoryBudget::reserve(size);
+    }
+    size_ = size;
+    return true;
+}
+
+void BudgetBuffer::reset() {
+    if (!data_) return;
+    if (spilled_) {
+        MemoryBudget::unmapSpill(data_, size_);
+    } else {
+        delete[] data_;
+        MemoryBudget::unreserve(size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    spilled_ = false;
+}
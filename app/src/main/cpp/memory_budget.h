@@ -0,0 +1,87 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Process-wide account of the large native buffers scans and recoveries hold:
+// read rings, carve windows, hit arena chunks, cached previews and staged
+// files. Without a limit (the default) they are only counted. With one,
+// long-lived buffers shrink or spill to disk when they do not fit, and
+// transient ones wait for another transient buffer to come back, so a scan
+// slows down instead of growing past the limit.
+//
+// Peak use and time spent waiting go to kStatPeakBytes and
+// kStatBudgetStallNanos.
+class MemoryBudget {
+public:
+    // limitBytes 0 removes the limit. Spilled buffers are unlinked files in
+    // spillDirectory; with none they stay in memory and are counted over the limit.
+    static void configure(size_t limitBytes, const std::string& spillDirectory);
+    static size_t limit();
+
+    // Transient buffers, released within one read or carve step on the thread
+    // that took them. A request waits only while other transient buffers are
+    // out: those always come back, where long-lived ones may be held for the
+    // whole scan. One from a thread already holding some never waits.
+    static void acquire(size_t bytes);
+    static void release(size_t bytes);
+
+    // Long-lived buffers. tryReserve counts the bytes only if they fit now;
+    // reserve counts them regardless, for buffers that can neither shrink nor spill.
+    static bool tryReserve(size_t bytes);
+    static void reserve(size_t bytes);
+    static void unreserve(size_t bytes);
+
+    // Zero-filled bytes in an unlinked spill file, mapped shared so the kernel
+    // can write them back and drop the pages. Null without a spill directory.
+    static void* mapSpill(size_t bytes);
+    static void unmapSpill(void* data, size_t bytes);
+
+    static size_t used();
+    static size_t peak();
+    // Restarts the peak from what is held now; call after ScanStats::reset
+    static void resetPeak();
+};
+
+// Holds transient budget for its lifetime
+class BudgetLease {
+public:
+    explicit BudgetLease(size_t bytes) : bytes_(bytes) { MemoryBudget::acquire(bytes_); }
+    ~BudgetLease() { MemoryBudget::release(bytes_); }
+
+    BudgetLease(const BudgetLease&) = delete;
+    BudgetLease& operator=(const BudgetLease&) = delete;
+
+private:
+    size_t bytes_;
+};
+
+// Byte buffer counted as long-lived: on the heap when it fits the budget,
+// otherwise spilled to a mapped file
+class BudgetBuffer {
+public:
+    BudgetBuffer() : data_(nullptr), size_(0), spilled_(false) {}
+    ~BudgetBuffer() { reset(); }
+
+    BudgetBuffer(BudgetBuffer&& other) noexcept;
+    BudgetBuffer& operator=(BudgetBuffer&& other) noexcept;
+    BudgetBuffer(const BudgetBuffer&) = delete;
+    BudgetBuffer& operator=(const BudgetBuffer&) = delete;
+
+    // False if neither memory nor a spill file could be had
+    bool allocate(size_t size);
+    void reset();
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool spilled() const { return spilled_; }
+
+private:
+    uint8_t* data_;
+    size_t size_;
+    bool spilled_;
+};
+
+#endif // MEMORY_BUDGET_H
@@ -7,12 +7,27 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <mutex>
+#include <algorithm>
 #include "file_recovery_engine.h"
+#include "scan_stats.h"
+#include "scan_session.h"
+#include "preview_extractor.h"
+#include "memory_budget.h"
 
 #define LOG_TAG "DataRescuePro"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
+// Scan tuning shared by every engine created from Kotlin
+static std::mutex gScanOptionsMutex;
+static ScanOptions gScanOptions;
+
+static ScanOptions currentScanOptions() {
+    std::lock_guard<std::mutex> lock(gScanOptionsMutex);
+    return gScanOptions;
+}
+
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeGetVersion(
         JNIEnv *env,
@@ -21,6 +36,84 @@ Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeGetVersion(
     return env->NewStringUTF(version.c_str());
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeConfigureScan(
+        JNIEnv *env,
+        jobject /* this */,
+        jint threads,
+        jlong stripeBytes,
+        jint queueDepth) {
+
+    std::lock_guard<std::mutex> lock(gScanOptionsMutex);
+    gScanOptions.threads = threads > 0 ? static_cast<size_t>(threads) : 0;
+    if (stripeBytes > 0) {
+        gScanOptions.stripeBytes = static_cast<uint64_t>(stripeBytes);
+    }
+    if (queueDepth > 0) {
+        gScanOptions.queueDepth = static_cast<size_t>(queueDepth);
+    }
+    LOGI("Scan configured: threads=%d, stripeBytes=%lld, queueDepth=%zu", threads,
+         static_cast<long long>(stripeBytes), gScanOptions.queueDepth);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeSetScanIndexPath(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring indexPath) {
+
+    std::string path;
+    if (indexPath) {
+        const char* pathStr = env->GetStringUTFChars(indexPath, nullptr);
+        path = pathStr;
+        env->ReleaseStringUTFChars(indexPath, pathStr);
+    }
+
+    std::lock_guard<std::mutex> lock(gScanOptionsMutex);
+    gScanOptions.indexPath = path;
+    LOGI("Scan index: %s", path.empty() ? "disabled" : path.c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeConfigureMemoryBudget(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong limitBytes,
+        jstring spillDirectory) {
+
+    std::string directory;
+    if (spillDirectory) {
+        const char* directoryStr = env->GetStringUTFChars(spillDirectory, nullptr);
+        directory = directoryStr;
+        env->ReleaseStringUTFChars(spillDirectory, directoryStr);
+    }
+    MemoryBudget::configure(limitBytes > 0 ? static_cast<size_t>(limitBytes) : 0, directory);
+}
+
+// Cheap enough to poll while a scan runs: sums the per-thread counters
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeGetScanStats(
+        JNIEnv *env,
+        jobject /* this */) {
+
+    std::vector<uint64_t> totals = ScanStats::snapshot();
+    std::vector<jlong> values(totals.begin(), totals.end());
+
+    jlongArray result = env->NewLongArray(static_cast<jsize>(values.size()));
+    if (result) {
+        env->SetLongArrayRegion(result, 0, static_cast<jsize>(values.size()), values.data());
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeResetScanStats(
+        JNIEnv * /* env */,
+        jobject /* this */) {
+    ScanStats::reset();
+    MemoryBudget::resetPeak();
+}
+
 extern "C" JNIEXPORT jintArray JNICALL
 Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeDeepScan(
         JNIEnv *env,
@@ -32,6 +125,7 @@ Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeDeepScan(
     LOGI("Starting enhanced deep scan on path: %s, rooted: %d", pathStr, isRooted);
     
     FileRecoveryEngine engine;
+    engine.setScanOptions(currentScanOptions());
     std::vector<int> results = engine.performEnhancedScan(pathStr, isRooted);
     
     env->ReleaseStringUTFChars(path, pathStr);
@@ -96,6 +190,47 @@ Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeRecoverDeletedFile(
     return result;
 }
 
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeRecoverToFd(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring filePath,
+        jint outFd) {
+
+    const char* pathStr = env->GetStringUTFChars(filePath, nullptr);
+    LOGI("Recovering %s to fd %d", pathStr, outFd);
+
+    FileRecoveryEngine engine;
+    bool recovered = engine.recoverToFd(pathStr, outFd);
+
+    env->ReleaseStringUTFChars(filePath, pathStr);
+    return recovered ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeExtractPreview(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring location) {
+
+    const char* locationStr = env->GetStringUTFChars(location, nullptr);
+
+    FileRecoveryEngine engine;
+    std::vector<uint8_t> preview = engine.extractPreview(locationStr);
+
+    env->ReleaseStringUTFChars(location, locationStr);
+
+    if (preview.empty()) {
+        return nullptr;
+    }
+
+    jbyteArray result = env->NewByteArray(preview.size());
+    if (result) {
+        env->SetByteArrayRegion(result, 0, preview.size(), reinterpret_cast<const jbyte*>(preview.data()));
+    }
+    return result;
+}
+
 extern "C" JNIEXPORT jobjectArray JNICALL
 Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeScanFreeClusters(
         JNIEnv *env,
@@ -120,3 +255,424 @@ Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeScanFreeClusters(
     
     return result;
 }
+
+// Passes arena hits to NativeHitListener.onHits as packed CarveHit records:
+// one bulk copy per arena chunk into a byte array reused across batches
+class HitListenerBridge {
+public:
+    HitListenerBridge(JNIEnv* env, jobject listener)
+            : env_(env), listener_(listener), onHits_(nullptr), onFragments_(nullptr), onDuplicate_(nullptr),
+              onLocation_(nullptr), records_(nullptr), capacity_(0), duplicatesSent_(0) {
+        jclass listenerClass = env->GetObjectClass(listener);
+        onHits_ = env->GetMethodID(listenerClass, "onHits", "([BII)Z");
+        onFragments_ = env->GetMethodID(listenerClass, "onFragments", "(I[J)V");
+        if (!onFragments_) {
+            env->ExceptionClear(); // Optional; fragmented hits then only carry their first extent
+        }
+        onDuplicate_ = env->GetMethodID(listenerClass, "onDuplicate", "(ILjava/lang/String;)V");
+        if (!onDuplicate_) {
+            env->ExceptionClear(); // Optional; merged copies are then simply not reported
+        }
+        onLocation_ = env->GetMethodID(listenerClass, "onLocation", "(ILjava/lang/String;)V");
+        if (!onLocation_) {
+            env->ExceptionClear(); // Optional; directory entries then carry no recoverable path
+        }
+        env->DeleteLocalRef(listenerClass);
+        if (!onHits_) {
+            LOGE("NativeHitListener.onHits not found");
+        }
+    }
+
+    ~HitListenerBridge() {
+        if (records_) {
+            env_->DeleteLocalRef(records_);
+        }
+    }
+
+    bool isValid() const { return onHits_ != nullptr; }
+
+    bool deliver(const HitArena& arena, size_t from, size_t to) {
+        jsize count = static_cast<jsize>(to - from);
+        jsize bytes = count * static_cast<jsize>(sizeof(CarveHit));
+        if (bytes > capacity_) {
+            if (records_) env_->DeleteLocalRef(records_);
+            capacity_ = std::max(bytes, static_cast<jsize>(FileRecoveryEngine::kResultBatchSize * sizeof(CarveHit)));
+            records_ = env_->NewByteArray(capacity_);
+            if (!records_) return false;
+        }
+
+        // Extents of fragmented hits go first so the batch can be resolved in one pass
+        for (size_t i = from; i < to && onFragments_; ++i) {
+            if (!(arena[i].flags & kHitFragmented)) continue;
+            std::vector<ByteRange> fragments = arena.fragments(i);
+            std::vector<jlong> extents;
+            for (const auto& fragment : fragments) {
+                extents.push_back(static_cast<jlong>(fragment.offset));
+                extents.push_back(static_cast<jlong>(fragment.length));
+            }
+            jlongArray array = env_->NewLongArray(static_cast<jsize>(extents.size()));
+            if (!array) return false;
+            env_->SetLongArrayRegion(array, 0, static_cast<jsize>(extents.size()), extents.data());
+            env_->CallVoidMethod(listener_, onFragments_, static_cast<jint>(i), array);
+            env_->DeleteLocalRef(array);
+            if (env_->ExceptionCheck()) {
+                return false;
+            }
+        }
+
+        // Likewise the paths of directory entries, which have no extent of their own
+        for (size_t i = from; i < to && onLocation_; ++i) {
+            if (!(arena[i].flags & kHitDirectoryEntry)) continue;
+            std::string path = arena.location(i);
+            if (path.empty()) continue;
+            jstring location = env_->NewStringUTF(path.c_str());
+            if (!location) return false;
+            env_->CallVoidMethod(listener_, onLocation_, static_cast<jint>(i), location);
+            env_->DeleteLocalRef(location);
+            if (env_->ExceptionCheck()) {
+                return false;
+            }
+        }
+
+        jboolean keepGoing = JNI_TRUE;
+        if (count > 0) {
+            jsize written = 0;
+            arena.forEachRun(from, to, [&](const CarveHit* hits, size_t run) {
+                jsize runBytes = static_cast<jsize>(run * sizeof(CarveHit));
+                env_->SetByteArrayRegion(records_, written, runBytes, reinterpret_cast<const jbyte*>(hits));
+                written += runBytes;
+            });
+
+            keepGoing = env_->CallBooleanMethod(listener_, onHits_, records_, static_cast<jint>(from), count);
+            if (env_->ExceptionCheck()) {
+                return false;
+            }
+        }
+
+        // Copies merged into a hit go after it, which may have been delivered in an earlier batch
+        std::vector<std::pair<size_t, std::string>> duplicates = arena.duplicatesFrom(duplicatesSent_);
+        duplicatesSent_ += duplicates.size();
+        for (size_t i = 0; i < duplicates.size() && onDuplicate_; ++i) {
+            jstring location = env_->NewStringUTF(duplicates[i].second.c_str());
+            if (!location) return false;
+            env_->CallVoidMethod(listener_, onDuplicate_, static_cast<jint>(duplicates[i].first), location);
+            env_->DeleteLocalRef(location);
+            if (env_->ExceptionCheck()) {
+                return false;
+            }
+        }
+        return keepGoing == JNI_TRUE;
+    }
+
+private:
+    JNIEnv* env_;
+    jobject listener_;
+    jmethodID onHits_;
+    jmethodID onFragments_;
+    jmethodID onDuplicate_;
+    jmethodID onLocation_;
+    jbyteArray records_;
+    jsize capacity_;
+    size_t duplicatesSent_;
+};
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeDeepScanStreaming(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring path,
+        jboolean isRooted,
+        jobject listener) {
+
+    HitListenerBridge bridge(env, listener);
+    if (!bridge.isValid()) {
+        return JNI_FALSE;
+    }
+
+    const char* pathStr = env->GetStringUTFChars(path, nullptr);
+    LOGI("Starting streaming deep scan on path: %s, rooted: %d", pathStr, isRooted);
+
+    FileRecoveryEngine engine;
+    engine.setScanOptions(currentScanOptions());
+    HitArena arena;
+    bool completed = engine.performEnhancedScan(pathStr, isRooted, arena,
+                                                [&bridge](const HitArena& hits, size_t from, size_t to) {
+                                                    return bridge.deliver(hits, from, to);
+                                                });
+
+    LOGI("Deep scan kept %zu hits in %zu bytes, %zu more spilled", arena.size(), arena.memoryBytes(),
+         arena.spilledBytes());
+    env->ReleaseStringUTFChars(path, pathStr);
+
+    return static_cast<jboolean>(completed);
+}
+
+// Deep scan narrowed to a ScanQuery: ranges are (offset, length) pairs, and
+// zero or null leaves a field open
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeQueryScanStreaming(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring path,
+        jboolean isRooted,
+        jintArray fileTypes,
+        jlongArray ranges,
+        jobjectArray directories,
+        jlong minSize,
+        jlong maxSize,
+        jint maxResults,
+        jlong timeBudgetMillis,
+        jobject listener) {
+
+    HitListenerBridge bridge(env, listener);
+    if (!bridge.isValid()) {
+        return JNI_FALSE;
+    }
+
+    ScanQuery query;
+    if (fileTypes) {
+        std::vector<jint> types(env->GetArrayLength(fileTypes));
+        env->GetIntArrayRegion(fileTypes, 0, static_cast<jsize>(types.size()), types.data());
+        query.fileTypes.assign(types.begin(), types.end());
+    }
+    if (ranges) {
+        std::vector<jlong> values(env->GetArrayLength(ranges));
+        env->GetLongArrayRegion(ranges, 0, static_cast<jsize>(values.size()), values.data());
+        for (size_t i = 0; i + 1 < values.size(); i += 2) {
+            if (values[i] < 0 || values[i + 1] <= 0) continue;
+            query.ranges.push_back({static_cast<uint64_t>(values[i]), static_cast<uint64_t>(values[i + 1])});
+        }
+        std::sort(query.ranges.begin(), query.ranges.end(), [](const ByteRange& a, const ByteRange& b) {
+            return a.offset < b.offset;
+        });
+    }
+    if (directories) {
+        jsize count = env->GetArrayLength(directories);
+        for (jsize i = 0; i < count; ++i) {
+            jstring directory = static_cast<jstring>(env->GetObjectArrayElement(directories, i));
+            if (!directory) continue;
+            const char* directoryStr = env->GetStringUTFChars(directory, nullptr);
+            query.directories.push_back(directoryStr);
+            env->ReleaseStringUTFChars(directory, directoryStr);
+            env->DeleteLocalRef(directory);
+        }
+    }
+    query.minSize = minSize > 0 ? static_cast<uint64_t>(minSize) : 0;
+    query.maxSize = maxSize > 0 ? static_cast<uint64_t>(maxSize) : 0;
+    query.maxResults = maxResults > 0 ? static_cast<size_t>(maxResults) : 0;
+    query.timeBudgetNanos = timeBudgetMillis > 0 ? static_cast<uint64_t>(timeBudgetMillis) * 1000000ULL : 0;
+
+    const char* pathStr = env->GetStringUTFChars(path, nullptr);
+    LOGI("Starting query scan on path: %s, %zu types, %zu ranges, %zu directories, at most %zu hits",
+         pathStr, query.fileTypes.size(), query.ranges.size(), query.directories.size(), query.maxResults);
+
+    FileRecoveryEngine engine;
+    engine.setScanOptions(currentScanOptions());
+    engine.setScanQuery(query);
+    HitArena arena;
+    bool completed = engine.performEnhancedScan(pathStr, isRooted, arena,
+                                                [&bridge](const HitArena& hits, size_t from, size_t to) {
+                                                    return bridge.deliver(hits, from, to);
+                                                });
+
+    env->ReleaseStringUTFChars(path, pathStr);
+    return static_cast<jboolean>(completed);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_coderx_datarescuepro_core_FileRecoveryEngine_nativeScanFreeClustersStreaming(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring devicePath,
+        jobject listener) {
+
+    HitListenerBridge bridge(env, listener);
+    if (!bridge.isValid()) {
+        return JNI_FALSE;
+    }
+
+    const char* pathStr = env->GetStringUTFChars(devicePath, nullptr);
+    LOGI("Streaming free clusters on device: %s", pathStr);
+
+    FileRecoveryEngine engine;
+    HitArena arena;
+    bool completed = engine.scanFreeClusters(pathStr, arena,
+                                             [&bridge](const HitArena& hits, size_t from, size_t to) {
+                                                 return bridge.deliver(hits, from, to);
+                                             });
+
+    env->ReleaseStringUTFChars(devicePath, pathStr);
+
+    return static_cast<jboolean>(completed);
+}
+
+// ScanSession.kt holds the session as an opaque handle from nativeCreate until nativeDestroy
+static ScanSession* sessionFrom(jlong handle) {
+    return reinterpret_cast<ScanSession*>(static_cast<intptr_t>(handle));
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativeCreate(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring sourcePath,
+        jstring checkpointPath) {
+
+    const char* sourceStr = env->GetStringUTFChars(sourcePath, nullptr);
+    std::string checkpoint;
+    if (checkpointPath) {
+        const char* checkpointStr = env->GetStringUTFChars(checkpointPath, nullptr);
+        checkpoint = checkpointStr;
+        env->ReleaseStringUTFChars(checkpointPath, checkpointStr);
+    }
+
+    ScanSession* session = new ScanSession(sourceStr, checkpoint, currentScanOptions());
+    env->ReleaseStringUTFChars(sourcePath, sourceStr);
+
+    return static_cast<jlong>(reinterpret_cast<intptr_t>(session));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativeRun(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong handle,
+        jobject listener) {
+
+    HitListenerBridge bridge(env, listener);
+    if (!handle || !bridge.isValid()) {
+        return JNI_FALSE;
+    }
+
+    HitArena arena;
+    bool completed = sessionFrom(handle)->run(arena, [&bridge](const HitArena& hits, size_t from, size_t to) {
+        return bridge.deliver(hits, from, to);
+    });
+
+    return static_cast<jboolean>(completed);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativePause(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong handle) {
+    if (handle) sessionFrom(handle)->pause();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativeResume(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong handle) {
+    if (handle) sessionFrom(handle)->resume();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativeCancel(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong handle) {
+    if (handle) sessionFrom(handle)->cancel();
+}
+
+// [state, scannedTo, bytesDone, bytesTotal, hits]
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativeProgress(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong handle) {
+
+    if (!handle) {
+        return nullptr;
+    }
+
+    SessionProgress progress = sessionFrom(handle)->progress();
+    jlong values[] = {
+            static_cast<jlong>(progress.state),
+            static_cast<jlong>(progress.scannedTo),
+            static_cast<jlong>(progress.bytesDone),
+            static_cast<jlong>(progress.bytesTotal),
+            static_cast<jlong>(progress.hits)
+    };
+    jlongArray result = env->NewLongArray(5);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, 5, values);
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_ScanSession_nativeDestroy(
+        JNIEnv *env,
+        jobject /* this */,
+        jlong handle) {
+    delete sessionFrom(handle);
+}
+
+// PreviewSource.kt holds the extractor as an opaque handle from nativeOpen until nativeClose
+static PreviewExtractor* extractorFrom(jlong handle) {
+    return reinterpret_cast<PreviewExtractor*>(static_cast<intptr_t>(handle));
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_coderx_datarescuepro_core_PreviewSource_nativeOpen(
+        JNIEnv *env,
+        jclass /* PreviewSource */,
+        jstring location) {
+
+    const char* locationStr = env->GetStringUTFChars(location, nullptr);
+
+    FileRecoveryEngine engine;
+    auto* extractor = new PreviewExtractor();
+    if (!engine.openPreviewSource(locationStr, *extractor)) {
+        LOGE("Cannot open preview source: %s", locationStr);
+        delete extractor;
+        extractor = nullptr;
+    }
+
+    env->ReleaseStringUTFChars(location, locationStr);
+    return static_cast<jlong>(reinterpret_cast<intptr_t>(extractor));
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_coderx_datarescuepro_core_PreviewSource_nativeSize(
+        JNIEnv *env,
+        jclass /* PreviewSource */,
+        jlong handle) {
+    return handle ? static_cast<jlong>(extractorFrom(handle)->size()) : -1;
+}
+
+// Bytes copied into buffer, -1 once position is at or past the end
+extern "C" JNIEXPORT jint JNICALL
+Java_com_coderx_datarescuepro_core_PreviewSource_nativeReadAt(
+        JNIEnv *env,
+        jclass /* PreviewSource */,
+        jlong handle,
+        jlong position,
+        jbyteArray buffer,
+        jint offset,
+        jint size) {
+
+    if (!handle || position < 0 || offset < 0 || size < 0) {
+        return -1;
+    }
+    PreviewExtractor* extractor = extractorFrom(handle);
+    if (static_cast<uint64_t>(position) >= extractor->size()) {
+        return -1;
+    }
+
+    // Not read into the Java array directly: the read may block on the device
+    std::vector<uint8_t> data(static_cast<size_t>(size));
+    size_t n = extractor->readAt(static_cast<uint64_t>(position), data.data(), data.size());
+    env->SetByteArrayRegion(buffer, offset, static_cast<jsize>(n), reinterpret_cast<const jbyte*>(data.data()));
+    return static_cast<jint>(n);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_coderx_datarescuepro_core_PreviewSource_nativeClose(
+        JNIEnv *env,
+        jclass /* PreviewSource */,
+        jlong handle) {
+    delete extractorFrom(handle);
+}
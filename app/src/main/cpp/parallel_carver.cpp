@@ -0,0 +1,347 @@
+#include "parallel_carver.h"
+#include "thread_pool.h"
+#include "async_reader.h"
+#include "scan_stats.h"
+#include "block_classifier.h"
+#include "memory_budget.h"
+#include <android/log.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+#define LOG_TAG "ParallelCarver"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+ParallelCarver::ParallelCarver(const SignatureMatcher& matcher, const CarveOptions& options)
+        : matcher_(matcher), options_(options), bytesScanned_(0), stopped_(false) {
+    // A header owned by one stripe may have its pattern end this far past the stripe
+    overlap_ = matcher_.maxHeaderReach() > 0 ? matcher_.maxHeaderReach() - 1 : 0;
+    if (options_.threads == 0) {
+        options_.threads = ThreadPool::defaultThreadCount();
+    }
+    options_.stripeBytes = std::max<uint64_t>(options_.stripeBytes, 1024 * 1024);
+    // A pattern of one repeated byte could match inside blank space
+    options_.skipBlank = options_.skipBlank && !matcher_.hasUniformPattern();
+}
+
+std::vector<SignatureMatch> ParallelCarver::carve(const char* path, const std::vector<ByteRange>& ranges) {
+    std::vector<SignatureMatch> results;
+    carve(path, ranges, [&results](const std::vector<SignatureMatch>& batch) {
+        results.insert(results.end(), batch.begin(), batch.end());
+        return true;
+    });
+    return results;
+}
+
+bool ParallelCarver::carve(const char* path, const std::vector<ByteRange>& ranges, const BatchSink& sink) {
+    if (!path) {
+        LOGE("Null path provided");
+        return false;
+    }
+
+    bytesScanned_ = 0;
+    stopped_ = false;
+    return options_.threads > 1 ? carveParallel(path, ranges, sink) : carveSequential(path, ranges, sink);
+}
+
+bool ParallelCarver::carveSequential(const char* path, const std::vector<ByteRange>& ranges,
+                                     const BatchSink& sink) {
+    std::vector<ByteRange> normalized = ranges.empty() ? ranges : normalizeRanges(ranges, UINT64_MAX);
+
+    BlockReader reader;
+    BlockReader::Options readOptions = BlockReader::optionsFor(path);
+    readOptions.queueDepth = options_.queueDepth;
+    if (!reader.open(path, readOptions, normalized)) {
+        return false;
+    }
+
+    uint64_t bytesTotal = 0;
+    for (const auto& range : normalized) bytesTotal += range.length;
+    if (normalized.empty()) bytesTotal = reader.sourceSize();
+
+    SignatureMatcher::State state;
+    uint64_t rangeStart = 0;
+    bool started = false;
+    std::vector<SignatureMatch> matches;
+    std::vector<SignatureMatch> pending;
+    std::vector<SignatureMatch> batch;
+
+    auto flush = [&](uint64_t limit) {
+        // Headers below limit can no longer be preceded by a later report
+        sortMatches(pending);
+        auto split = std::lower_bound(pending.begin(), pending.end(), limit,
+                                      [](const SignatureMatch& m, uint64_t offset) { return m.offset < offset; });
+        batch.assign(pending.begin(), split);
+        pending.erase(pending.begin(), split);
+        if (!batch.empty() && !stopped_ && !sink(batch)) {
+            stopped_ = true;
+        }
+        if (progressSink_ && !stopped_ && !progressSink_({limit, bytesScanned_, bytesTotal})) {
+            stopped_ = true;
+        }
+    };
+
+    ReadBlock block;
+    while (reader.next(block)) {
+        if (!started || block.offset != state.position) {
+            // Start of a new range: matches cannot continue across the gap
+            flush(block.offset);
+            state = SignatureMatcher::State();
+            state.position = block.offset;
+            rangeStart = block.offset;
+            started = true;
+        }
+
+        matches.clear();
+        scan(state, block.data, block.size, matches);
+        for (const auto& match : matches) {
+            if (match.offset >= rangeStart) {
+                pending.push_back(match);
+            }
+        }
+        bytesScanned_ += block.size;
+
+        if (state.position > overlap_) {
+            flush(state.position - overlap_);
+        }
+        if (stopped_) break;
+    }
+    if (!stopped_) {
+        // After a read error only what came before the failed block was scanned
+        flush(reader.failed() ? state.position : reader.sourceSize());
+    }
+
+    reader.close();
+    reader.logThroughput("Sequential carve");
+    return !reader.failed();
+}
+
+bool ParallelCarver::carveParallel(const char* path, const std::vector<ByteRange>& ranges,
+                                   const BatchSink& sink) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0 || S_ISDIR(statbuf.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    std::vector<ByteRange> normalized = normalizeRanges(ranges, BlockReader::querySize(fd));
+    std::vector<Stripe> stripes;
+    for (const auto& range : normalized) {
+        uint64_t rangeEnd = range.offset + range.length;
+        for (uint64_t start = range.offset; start < rangeEnd; start += options_.stripeBytes) {
+            uint64_t end = std::min(rangeEnd, start + options_.stripeBytes);
+            stripes.push_back({start, end, std::min(rangeEnd, end + overlap_)});
+        }
+        bytesScanned_ += range.length;
+    }
+
+    if (stripes.empty()) {
+        close(fd);
+        return true;
+    }
+
+    LOGI("Carving %zu stripes of %llu bytes on %zu threads", stripes.size(),
+         static_cast<unsigned long long>(options_.stripeBytes), options_.threads);
+
+    uint64_t bytesDone = 0;
+    uint64_t scannedTo = 0;
+    bool readFailed = false;
+    bool unreadBefore = false; // Only touched by the delivering thread
+    std::mutex mutex;
+    std::condition_variable stripeDone;
+    std::vector<std::vector<SignatureMatch>> results(stripes.size());
+    std::vector<bool> done(stripes.size(), false);
+    std::vector<bool> failed(stripes.size(), false);
+
+    {
+        ThreadPool pool(std::min<size_t>(options_.threads, stripes.size()));
+        auto submitStripe = [&](size_t i) {
+            pool.submit([&, i] {
+                std::vector<SignatureMatch> local;
+                bool ok = false;
+                try {
+                    ok = carveStripe(fd, stripes[i], local);
+                } catch (const std::exception& e) {
+                    LOGE("Error carving stripe %zu: %s", i, e.what());
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                readFailed = readFailed || !ok;
+                failed[i] = !ok;
+                results[i] = std::move(local);
+                done[i] = true;
+                stripeDone.notify_all();
+            });
+        };
+
+        // Only a window of stripes is in flight, which bounds the results held
+        // for stripes that finish ahead of the one being delivered
+        size_t window = options_.threads * 2;
+        size_t submitted = 0;
+        for (; submitted < std::min(window, stripes.size()); ++submitted) {
+            submitStripe(submitted);
+        }
+
+        // Hand stripes to the sink in offset order as soon as each one is complete
+        for (size_t i = 0; i < stripes.size() && !stopped_; ++i) {
+            std::vector<SignatureMatch> batch;
+            bool stripeFailed;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                stripeDone.wait(lock, [&] { return done[i]; });
+                batch.swap(results[i]);
+                stripeFailed = failed[i];
+            }
+            if (submitted < stripes.size()) {
+                submitStripe(submitted++);
+            }
+            if (!batch.empty() && !sink(batch)) {
+                stopped_ = true;
+            }
+            bytesDone += stripes[i].end - stripes[i].start;
+            // Nothing past a stripe with unread blocks counts as scanned
+            unreadBefore = unreadBefore || stripeFailed;
+            if (!unreadBefore) {
+                scannedTo = stripes[i].end;
+            }
+            if (progressSink_ && !stopped_ && !progressSink_({scannedTo, bytesDone, bytesScanned_})) {
+                stopped_ = true;
+            }
+        }
+
+        pool.wait();
+    }
+
+    close(fd);
+    return !readFailed;
+}
+
+bool ParallelCarver::carveStripe(int fd, const Stripe& stripe, std::vector<SignatureMatch>& matches) const {
+    const size_t chunkSize = 1024 * 1024;
+    // Waits while other stripes hold the memory budget, so fewer carve at once
+    BudgetLease lease(chunkSize);
+    std::vector<uint8_t> buffer(chunkSize);
+
+    // Workers already keep threads reads in flight; each adds its share of the rest
+    AsyncReader async;
+    size_t depth = (options_.queueDepth + options_.threads - 1) / options_.threads;
+    if (depth > 1) {
+        AsyncReader::Options asyncOptions;
+        asyncOptions.queueDepth = depth;
+        asyncOptions.requestBytes = std::max<size_t>(chunkSize / depth, 64 * 1024);
+        async.open(fd, asyncOptions, {{buffer.data(), buffer.size()}});
+    }
+
+    SignatureMatcher::State state;
+    state.position = stripe.start;
+
+    uint64_t pos = stripe.start;
+    while (pos < stripe.readEnd && !stopped_) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(chunkSize, stripe.readEnd - pos));
+        size_t n;
+        {
+            ScopedStatTimer timer(kStatIoWaitNanos);
+            n = async.isOpen() ? async.read(buffer.data(), length, pos)
+                               : BlockReader::readFully(fd, buffer.data(), length, pos);
+        }
+        if (n > 0) {
+            scan(state, buffer.data(), n, matches);
+            pos += n;
+        }
+        if (n < length) {
+            // Ranges are clipped to the source, so a short read is an I/O error
+            LOGE("Read failed at offset %llu of stripe %llu-%llu", static_cast<unsigned long long>(pos),
+                 static_cast<unsigned long long>(stripe.start), static_cast<unsigned long long>(stripe.readEnd));
+            break;
+        }
+    }
+
+    // Keep only headers owned by this stripe; the overlap belongs to the next one
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [&stripe](const SignatureMatch& m) {
+        return m.offset < stripe.start || m.offset >= stripe.end;
+    }), matches.end());
+    sortMatches(matches);
+    return pos >= stripe.readEnd || stopped_;
+}
+
+// Blank runs are whole blocks aligned on the source, all of one fill byte. No
+// pattern fits inside one, so a match touching a run either starts before it
+// and ends in its first maxPatternLength - 1 bytes or starts in its last
+// maxPatternLength - 1 bytes; the matcher sees those edges and nothing between.
+void ParallelCarver::scan(SignatureMatcher::State& state, const uint8_t* data, size_t size,
+                          std::vector<SignatureMatch>& matches) const {
+    ScopedStatTimer timer(kStatMatchNanos);
+    if (!options_.skipBlank) {
+        matcher_.scan(state, data, size, matches);
+        return;
+    }
+
+    const size_t kBlock = BlockClassifier::kBlockSize;
+    const size_t edge = matcher_.maxPatternLength() > 0 ? matcher_.maxPatternLength() - 1 : 0;
+    uint64_t skipped = 0;
+    size_t scanned = 0; // data[0, scanned) has been through the matcher
+    size_t pos = static_cast<size_t>((kBlock - state.position % kBlock) % kBlock);
+    while (pos + kBlock <= size) {
+        if (!BlockClassifier::isUniform(data + pos, kBlock)) {
+            pos += kBlock;
+            continue;
+        }
+        size_t runEnd = pos + kBlock;
+        while (runEnd + kBlock <= size && data[runEnd] == data[pos] &&
+               BlockClassifier::isUniform(data + runEnd, kBlock)) {
+            runEnd += kBlock;
+        }
+        if (runEnd - pos > 2 * edge) {
+            size_t headEnd = pos + edge;
+            size_t resume = runEnd - edge;
+            matcher_.scan(state, data + scanned, headEnd - scanned, matches);
+            state.node = 0;
+            state.position += resume - headEnd;
+            skipped += resume - headEnd;
+            scanned = resume;
+        }
+        pos = runEnd;
+    }
+    matcher_.scan(state, data + scanned, size - scanned, matches);
+    if (skipped > 0) ScanStats::add(kStatBlankBytes, skipped);
+}
+
+std::vector<ByteRange> ParallelCarver::normalizeRanges(std::vector<ByteRange> ranges, uint64_t sourceSize) {
+    if (ranges.empty()) {
+        ranges.push_back({0, sourceSize});
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) {
+        return a.offset < b.offset;
+    });
+
+    std::vector<ByteRange> merged;
+    for (const auto& range : ranges) {
+        if (range.offset >= sourceSize || range.length == 0) continue;
+        uint64_t end = range.offset + std::min(range.length, sourceSize - range.offset);
+        if (!merged.empty() && range.offset <= merged.back().offset + merged.back().length) {
+            uint64_t mergedEnd = std::max(merged.back().offset + merged.back().length, end);
+            merged.back().length = mergedEnd - merged.back().offset;
+        } else {
+            merged.push_back({range.offset, end - range.offset});
+        }
+    }
+    return merged;
+}
+
+void ParallelCarver::sortMatches(std::vector<SignatureMatch>& matches) {
+    std::sort(matches.begin(), matches.end(), [](const SignatureMatch& a, const SignatureMatch& b) {
+        return a.offset != b.offset ? a.offset < b.offset : a.fileType < b.fileType;
+    });
+    matches.erase(std::unique(matches.begin(), matches.end(), [](const SignatureMatch& a, const SignatureMatch& b) {
+        return a.offset == b.offset && a.fileType == b.fileType;
+    }), matches.end());
+}
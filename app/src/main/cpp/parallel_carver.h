@@ -0,0 +1,77 @@
+#ifndef PARALLEL_CARVER_H
+#define PARALLEL_CARVER_H
+
+#include "block_reader.h"
+#include "signature_matcher.h"
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+struct CarveOptions {
+    size_t threads = 0;                      // 0 = one per online core, 1 = sequential
+    uint64_t stripeBytes = 64 * 1024 * 1024; // Work unit handed to one worker
+    size_t queueDepth = 16;                  // Reads in flight across all workers, 1 = plain pread
+    bool skipBlank = true;                   // Step over runs of blank blocks (block_classifier.h)
+};
+
+// How far a carve has got; every header below scannedTo has been passed to the sink
+struct CarveProgress {
+    uint64_t scannedTo;
+    uint64_t bytesDone;
+    uint64_t bytesTotal;
+};
+
+// Runs the signature matcher over a device or image. In parallel mode the
+// source is cut into stripes that are carved independently; each stripe also
+// reads a short overlap past its end so headers crossing the boundary are
+// seen, but only reports headers that start inside the stripe, so nothing is
+// lost or reported twice. Results come back in offset order either way.
+class ParallelCarver {
+public:
+    // Receives consecutive, offset-ordered batches on the calling thread;
+    // returning false stops the carve
+    using BatchSink = std::function<bool(const std::vector<SignatureMatch>&)>;
+    // Called on the calling thread after each delivered stretch; returning false stops the carve
+    using ProgressSink = std::function<bool(const CarveProgress&)>;
+
+    ParallelCarver(const SignatureMatcher& matcher, const CarveOptions& options);
+
+    // Empty ranges means the whole source. False if the source could not be
+    // opened or some of it could not be read; whatever was read is still delivered.
+    bool carve(const char* path, const std::vector<ByteRange>& ranges, const BatchSink& sink);
+    std::vector<SignatureMatch> carve(const char* path, const std::vector<ByteRange>& ranges = {});
+
+    void setProgressSink(const ProgressSink& sink) { progressSink_ = sink; }
+
+    uint64_t bytesScanned() const { return bytesScanned_; }
+    bool stopped() const { return stopped_; }
+
+private:
+    struct Stripe {
+        uint64_t start;
+        uint64_t end;      // Headers in [start, end) belong to this stripe
+        uint64_t readEnd;  // end plus overlap, clipped to the owning range
+    };
+
+    bool carveSequential(const char* path, const std::vector<ByteRange>& ranges, const BatchSink& sink);
+    bool carveParallel(const char* path, const std::vector<ByteRange>& ranges, const BatchSink& sink);
+    // False if the stripe could not be read to its end
+    bool carveStripe(int fd, const Stripe& stripe, std::vector<SignatureMatch>& matches) const;
+    // Matcher pass over one buffer, skipping the inside of blank runs when enabled
+    void scan(SignatureMatcher::State& state, const uint8_t* data, size_t size,
+              std::vector<SignatureMatch>& matches) const;
+
+    static std::vector<ByteRange> normalizeRanges(std::vector<ByteRange> ranges, uint64_t sourceSize);
+    static void sortMatches(std::vector<SignatureMatch>& matches);
+
+    const SignatureMatcher& matcher_;
+    CarveOptions options_;
+    uint64_t overlap_;
+    uint64_t bytesScanned_;
+    std::atomic<bool> stopped_;
+    ProgressSink progressSink_;
+};
+
+#endif // PARALLEL_CARVER_H
@@ -0,0 +1,303 @@
+#include "preview_extractor.h"
+#include "byte_order.h"
+#include "memory_budget.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+const size_t kMaxJpegSegments = 32;  // Markers walked before giving up on finding APP1
+const size_t kMaxBoxesPerLevel = 4096;
+
+bool isImage(const uint8_t* data, size_t size) {
+    static const uint8_t kPng[] = {0x89, 'P', 'N', 'G'};
+    return size >= 4 && ((data[0] == 0xFF && data[1] == 0xD8) || memcmp(data, kPng, 4) == 0);
+}
+
+// EXIF thumbnail within one APP1 payload, "Exif\0\0" then a TIFF structure
+// whose second IFD points at a JPEG kept in the same segment
+std::vector<uint8_t> exifThumbnail(const std::vector<uint8_t>& segment) {
+    static const size_t kTiff = 6;
+    if (segment.size() < kTiff + 8 || memcmp(segment.data(), "Exif\0\0", 6) != 0) {
+        return {};
+    }
+
+    const uint8_t* tiff = segment.data() + kTiff;
+    const size_t tiffSize = segment.size() - kTiff;
+    bool little = tiff[0] == 'I' && tiff[1] == 'I';
+    if (!little && !(tiff[0] == 'M' && tiff[1] == 'M')) {
+        return {};
+    }
+    auto u16 = [&](size_t at) { return little ? readLe16(tiff + at) : readBe16(tiff + at); };
+    auto u32 = [&](size_t at) { return little ? readLe32(tiff + at) : readBe32(tiff + at); };
+
+    // IFD0 only matters for where IFD1 starts
+    uint64_t ifd0 = u32(4);
+    if (ifd0 + 2 > tiffSize) return {};
+    uint64_t next = ifd0 + 2 + static_cast<uint64_t>(u16(ifd0)) * 12;
+    if (next + 4 > tiffSize) return {};
+    uint64_t ifd1 = u32(next);
+    if (ifd1 == 0 || ifd1 + 2 > tiffSize) return {};
+
+    uint64_t thumbOffset = 0;
+    uint64_t thumbLength = 0;
+    size_t entries = u16(ifd1);
+    for (size_t i = 0; i < entries; ++i) {
+        uint64_t entry = ifd1 + 2 + i * 12;
+        if (entry + 12 > tiffSize) break;
+        uint16_t tag = u16(entry);
+        if (tag == 0x0201) {        // JPEGInterchangeFormat
+            thumbOffset = u32(entry + 8);
+        } else if (tag == 0x0202) { // JPEGInterchangeFormatLength
+            thumbLength = u32(entry + 8);
+        }
+    }
+
+    if (thumbOffset == 0 || thumbLength < 4 || thumbOffset + thumbLength > tiffSize ||
+        !isImage(tiff + thumbOffset, thumbLength)) {
+        return {};
+    }
+    return std::vector<uint8_t>(tiff + thumbOffset, tiff + thumbOffset + thumbLength);
+}
+
+} // namespace
+
+PreviewExtractor::PreviewExtractor() : fd_(-1), size_(0) {
+}
+
+PreviewExtractor::~PreviewExtractor() {
+    close();
+}
+
+bool PreviewExtractor::open(const char* sourcePath, const std::vector<ByteRange>& extents) {
+    close();
+    if (!sourcePath || extents.empty()) {
+        return false;
+    }
+
+    fd_ = ::open(sourcePath, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    extents_ = extents;
+    for (size_t i = 0; i < extents_.size(); ++i) {
+        ByteRange& extent = extents_[i];
+        if (extent.length == 0) {
+            uint64_t sourceSize = BlockReader::querySize(fd_);
+            if (i + 1 != extents_.size() || sourceSize <= extent.offset) {
+                close();
+                return false;
+            }
+            extent.length = sourceSize - extent.offset;
+        }
+        size_ += extent.length;
+    }
+    return true;
+}
+
+void PreviewExtractor::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    extents_.clear();
+    size_ = 0;
+}
+
+size_t PreviewExtractor::readAt(uint64_t position, uint8_t* buffer, size_t length) {
+    size_t done = 0;
+    uint64_t extentStart = 0;
+    for (const auto& extent : extents_) {
+        if (done == length) break;
+        uint64_t extentEnd = extentStart + extent.length;
+        if (position + done < extentEnd) {
+            uint64_t within = position + done - extentStart;
+            size_t wanted = static_cast<size_t>(std::min<uint64_t>(length - done, extent.length - within));
+            size_t n = BlockReader::readFully(fd_, buffer + done, wanted, extent.offset + within);
+            done += n;
+            if (n != wanted) break;
+        }
+        extentStart = extentEnd;
+    }
+    return done;
+}
+
+std::vector<uint8_t> PreviewExtractor::extractEmbedded() {
+    uint8_t head[12];
+    if (!isOpen() || readAt(0, head, sizeof(head)) != sizeof(head)) {
+        return {};
+    }
+
+    if (head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) {
+        return jpegThumbnail();
+    }
+    if (memcmp(head + 4, "ftyp", 4) == 0) {
+        return mp4CoverArt();
+    }
+    return {};
+}
+
+std::vector<uint8_t> PreviewExtractor::jpegThumbnail() {
+    // APP segments come first; the thumbnail is in the Exif APP1 if anywhere
+    uint64_t position = 2;
+    for (size_t i = 0; i < kMaxJpegSegments; ++i) {
+        uint8_t marker[4];
+        if (readAt(position, marker, sizeof(marker)) != sizeof(marker) || marker[0] != 0xFF) {
+            break;
+        }
+        if (marker[1] == 0xFF) {
+            ++position; // Fill byte
+            continue;
+        }
+        // Image data starts at the first frame or scan header
+        if (marker[1] == 0xDA || marker[1] == 0xD9 ||
+            (marker[1] >= 0xC0 && marker[1] <= 0xCF && marker[1] != 0xC4 && marker[1] != 0xC8 && marker[1] != 0xCC)) {
+            break;
+        }
+
+        uint16_t length = readBe16(marker + 2);
+        if (length < 2) break;
+        if (marker[1] == 0xE1) {
+            std::vector<uint8_t> segment(length - 2);
+            if (readAt(position + 4, segment.data(), segment.size()) != segment.size()) {
+                break;
+            }
+            std::vector<uint8_t> thumbnail = exifThumbnail(segment);
+            if (!thumbnail.empty()) {
+                return thumbnail;
+            }
+        }
+        position += 2 + static_cast<uint64_t>(length);
+    }
+    return {};
+}
+
+std::vector<uint8_t> PreviewExtractor::mp4CoverArt() {
+    // moov/udta/meta/ilst/covr/data, only box headers read on the way down
+    uint64_t start = 0;
+    uint64_t stop = size_;
+    if (!findBox(start, stop, "moov", start, stop) || !findBox(start, stop, "udta", start, stop) ||
+        !findBox(start, stop, "meta", start, stop)) {
+        return {};
+    }
+
+    // meta is a full box in ISO files but a plain one in QuickTime files
+    uint8_t probe[8];
+    if (readAt(start, probe, sizeof(probe)) != sizeof(probe)) return {};
+    if (memcmp(probe + 4, "hdlr", 4) != 0) {
+        start += 4;
+    }
+
+    if (!findBox(start, stop, "ilst", start, stop) || !findBox(start, stop, "covr", start, stop) ||
+        !findBox(start, stop, "data", start, stop) || stop - start <= 8) {
+        return {};
+    }
+    // data payload: type indicator and locale, then the image itself
+    return readImage(start + 8, stop - start - 8);
+}
+
+bool PreviewExtractor::findBox(uint64_t begin, uint64_t end, const char* type, uint64_t& start, uint64_t& stop) {
+    uint64_t position = begin;
+    for (size_t i = 0; i < kMaxBoxesPerLevel && position + 8 <= end; ++i) {
+        uint8_t header[16];
+        size_t headerRead = readAt(position, header, static_cast<size_t>(std::min<uint64_t>(sizeof(header), end - position)));
+        if (headerRead < 8) return false;
+
+        uint64_t boxSize = readBe32(header);
+        uint64_t headerSize = 8;
+        if (boxSize == 1) {
+            if (headerRead < 16) return false;
+            boxSize = readBe64(header + 8);
+            headerSize = 16;
+        } else if (boxSize == 0) {
+            boxSize = end - position; // Runs to the end of its parent
+        }
+        if (boxSize < headerSize || boxSize > end - position) {
+            return false;
+        }
+
+        if (memcmp(header + 4, type, 4) == 0) {
+            start = position + headerSize;
+            stop = position + boxSize;
+            return true;
+        }
+        position += boxSize;
+    }
+    return false;
+}
+
+std::vector<uint8_t> PreviewExtractor::readImage(uint64_t position, uint64_t length) {
+    if (length < 4 || length > kMaxEmbeddedBytes) {
+        return {};
+    }
+    std::vector<uint8_t> image(static_cast<size_t>(length));
+    if (readAt(position, image.data(), image.size()) != image.size() || !isImage(image.data(), image.size())) {
+        return {};
+    }
+    return image;
+}
+
+PreviewCache::PreviewCache(size_t budgetBytes) : budget_(budgetBytes), bytes_(0) {
+}
+
+bool PreviewCache::get(const std::string& location, std::vector<uint8_t>& preview) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = byLocation_.find(location);
+    if (found == byLocation_.end()) {
+        return false;
+    }
+    entries_.splice(entries_.begin(), entries_, found->second);
+    preview = found->second->second;
+    return true;
+}
+
+void PreviewCache::put(const std::string& location, const std::vector<uint8_t>& preview) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = byLocation_.find(location);
+    if (found != byLocation_.end()) {
+        drop(found->second);
+    }
+
+    Entry entry(location, preview);
+    size_t entryCost = cost(entry);
+    if (entryCost > budget_) {
+        return;
+    }
+    // Older previews make room, first under the cache's own budget and then
+    // under the process-wide one; a preview that still does not fit is not kept
+    while (!entries_.empty() && bytes_ + entryCost > budget_) {
+        drop(std::prev(entries_.end()));
+    }
+    while (!MemoryBudget::tryReserve(entryCost)) {
+        if (entries_.empty()) return;
+        drop(std::prev(entries_.end()));
+    }
+    bytes_ += entryCost;
+    entries_.push_front(std::move(entry));
+    byLocation_[location] = entries_.begin();
+}
+
+void PreviewCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    byLocation_.clear();
+    MemoryBudget::unreserve(bytes_);
+    bytes_ = 0;
+}
+
+void PreviewCache::drop(std::list<Entry>::iterator entry) {
+    size_t entryCost = cost(*entry);
+    bytes_ -= entryCost;
+    MemoryBudget::unreserve(entryCost);
+    byLocation_.erase(entry->first);
+    entries_.erase(entry);
+}
+
+PreviewCache& PreviewCache::shared() {
+    static PreviewCache cache;
+    return cache;
+}
@@ -0,0 +1,83 @@
+#ifndef PREVIEW_EXTRACTOR_H
+#define PREVIEW_EXTRACTOR_H
+
+#include "block_reader.h"
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Reads a recovered file in place, on the device or image it was found on,
+// for previews. extractEmbedded reads only the few KB behind the preview a
+// file carries itself: the EXIF thumbnail of a JPEG, the cover art of an MP4.
+// Decoders that need more pull it through readAt.
+class PreviewExtractor {
+public:
+    static const size_t kMaxEmbeddedBytes = 4 * 1024 * 1024; // Larger embedded images are not previews
+
+    PreviewExtractor();
+    ~PreviewExtractor();
+
+    PreviewExtractor(const PreviewExtractor&) = delete;
+    PreviewExtractor& operator=(const PreviewExtractor&) = delete;
+
+    // extents in file order; a last extent of length 0 runs to the end of the source
+    bool open(const char* sourcePath, const std::vector<ByteRange>& extents);
+    void close();
+
+    bool isOpen() const { return fd_ >= 0; }
+    uint64_t size() const { return size_; }
+
+    // Bytes of the file from position on, short only at its end or on error
+    size_t readAt(uint64_t position, uint8_t* buffer, size_t length);
+
+    // Embedded JPEG or PNG ready to decode, empty if the file has none
+    std::vector<uint8_t> extractEmbedded();
+
+private:
+    std::vector<uint8_t> jpegThumbnail();
+    std::vector<uint8_t> mp4CoverArt();
+    // Payload [start, end) of the first child box of the given type within [begin, end)
+    bool findBox(uint64_t begin, uint64_t end, const char* type, uint64_t& start, uint64_t& stop);
+    std::vector<uint8_t> readImage(uint64_t position, uint64_t length);
+
+    int fd_;
+    std::vector<ByteRange> extents_;
+    uint64_t size_;
+};
+
+// Recently extracted previews by location, least recently used dropped
+// first once the total passes the budget. Files without an embedded preview
+// are remembered too, as an empty entry, so they are not probed again.
+// Entries also count against the memory budget, which evicts them early.
+class PreviewCache {
+public:
+    static const size_t kDefaultBudget = 8 * 1024 * 1024;
+
+    explicit PreviewCache(size_t budgetBytes = kDefaultBudget);
+    ~PreviewCache() { clear(); }
+
+    bool get(const std::string& location, std::vector<uint8_t>& preview);
+    void put(const std::string& location, const std::vector<uint8_t>& preview);
+    void clear();
+
+    // The one cache previews share across engines
+    static PreviewCache& shared();
+
+private:
+    using Entry = std::pair<std::string, std::vector<uint8_t>>;
+
+    static size_t cost(const Entry& entry) { return entry.first.size() + entry.second.size(); }
+    void drop(std::list<Entry>::iterator entry);
+
+    std::mutex mutex_;
+    std::list<Entry> entries_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> byLocation_;
+    size_t budget_;
+    size_t bytes_;
+};
+
+#endif // PREVIEW_EXTRACTOR_H
@@ -0,0 +1,266 @@
+#include "scan_index.h"
+#include "byte_order.h"
+#include <android/log.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#define LOG_TAG "ScanIndex"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const uint32_t kIndexMagic = 0x58495352; // "RSIX"
+// 2: hits carry their carved length, 3: and their fragments, 4: and their content hash,
+// 5: directories keep their entries rather than a count, 6: content hashes are sampled keys
+const uint32_t kIndexVersion = 6;
+
+// Bounds-checked little-endian reader; any overrun marks the whole index bad
+class IndexReader {
+public:
+    IndexReader(const uint8_t* data, size_t size) : data_(data), left_(size), ok_(true) {}
+
+    bool ok() const { return ok_; }
+
+    uint32_t u32() {
+        if (!take(4)) return 0;
+        return readLe32(data_ - 4);
+    }
+
+    uint64_t u64() {
+        if (!take(8)) return 0;
+        return readLe64(data_ - 8);
+    }
+
+    std::string str() {
+        uint32_t length = u32();
+        if (!take(length)) return std::string();
+        return std::string(reinterpret_cast<const char*>(data_ - length), length);
+    }
+
+private:
+    bool take(size_t count) {
+        if (!ok_ || count > left_) {
+            ok_ = false;
+            return false;
+        }
+        data_ += count;
+        left_ -= count;
+        return true;
+    }
+
+    const uint8_t* data_;
+    size_t left_;
+    bool ok_;
+};
+
+void putU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void putU64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void putStr(std::vector<uint8_t>& out, const std::string& value) {
+    putU32(out, static_cast<uint32_t>(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+} // namespace
+
+ScanIndex::ScanIndex(const std::string& indexPath) : indexPath_(indexPath), dirty_(false) {
+}
+
+bool ScanIndex::load() {
+    sources_.clear();
+    directories_.clear();
+    dirty_ = false;
+
+    std::ifstream file(indexPath_, std::ios::binary);
+    if (!file.is_open()) {
+        return false; // First scan
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    IndexReader in(data.data(), data.size());
+    if (in.u32() != kIndexMagic || in.u32() != kIndexVersion) {
+        LOGE("Ignoring index with unknown format: %s", indexPath_.c_str());
+        return false;
+    }
+
+    uint32_t sourceCount = in.u32();
+    for (uint32_t s = 0; s < sourceCount && in.ok(); ++s) {
+        std::string source = in.str();
+        SourceEntry& entry = sources_[source];
+        entry.size = in.u64();
+
+        uint32_t segmentCount = in.u32();
+        for (uint32_t i = 0; i < segmentCount && in.ok(); ++i) {
+            IndexedSegment segment;
+            segment.start = in.u64();
+            segment.end = in.u64();
+            segment.generation = in.u64();
+            uint32_t hitCount = in.u32();
+            for (uint32_t h = 0; h < hitCount && in.ok(); ++h) {
+                IndexedHit hit;
+                hit.offset = in.u64();
+                hit.length = in.u64();
+                uint32_t typeAndFlags = in.u32();
+                hit.fileType = static_cast<int>(typeAndFlags & 0xFFFF);
+                hit.complete = (typeAndFlags >> 16) & 1;
+                hit.contentHash = in.u64();
+                uint32_t fragmentCount = in.u32();
+                for (uint32_t f = 0; f < fragmentCount && in.ok(); ++f) {
+                    uint64_t offset = in.u64();
+                    hit.fragments.push_back({offset, in.u64()});
+                }
+                segment.hits.push_back(hit);
+            }
+            entry.segments[segment.start] = std::move(segment);
+        }
+    }
+
+    uint32_t directoryCount = in.u32();
+    for (uint32_t d = 0; d < directoryCount && in.ok(); ++d) {
+        std::string path = in.str();
+        IndexedDirectory directory;
+        directory.mtimeNs = static_cast<int64_t>(in.u64());
+        directory.ctimeNs = static_cast<int64_t>(in.u64());
+        uint32_t entryCount = in.u32();
+        for (uint32_t e = 0; e < entryCount && in.ok(); ++e) {
+            IndexedEntry entry;
+            entry.name = in.str();
+            entry.length = in.u64();
+            entry.fileType = static_cast<int>(in.u32());
+            entry.contentHash = in.u64();
+            directory.entries.push_back(std::move(entry));
+        }
+        directories_[path] = std::move(directory);
+    }
+
+    if (!in.ok()) {
+        LOGE("Index is truncated, starting over: %s", indexPath_.c_str());
+        sources_.clear();
+        directories_.clear();
+        return false;
+    }
+
+    LOGI("Loaded scan index: %zu sources, %zu directories", sources_.size(), directories_.size());
+    return true;
+}
+
+bool ScanIndex::save() {
+    if (!dirty_) return true;
+
+    std::vector<uint8_t> out;
+    putU32(out, kIndexMagic);
+    putU32(out, kIndexVersion);
+
+    putU32(out, static_cast<uint32_t>(sources_.size()));
+    for (const auto& source : sources_) {
+        putStr(out, source.first);
+        putU64(out, source.second.size);
+        putU32(out, static_cast<uint32_t>(source.second.segments.size()));
+        for (const auto& item : source.second.segments) {
+            const IndexedSegment& segment = item.second;
+            putU64(out, segment.start);
+            putU64(out, segment.end);
+            putU64(out, segment.generation);
+            putU32(out, static_cast<uint32_t>(segment.hits.size()));
+            for (const auto& hit : segment.hits) {
+                putU64(out, hit.offset);
+                putU64(out, hit.length);
+                putU32(out, (static_cast<uint32_t>(hit.fileType) & 0xFFFF) | (hit.complete ? 1u << 16 : 0));
+                putU64(out, hit.contentHash);
+                putU32(out, static_cast<uint32_t>(hit.fragments.size()));
+                for (const auto& fragment : hit.fragments) {
+                    putU64(out, fragment.offset);
+                    putU64(out, fragment.length);
+                }
+            }
+        }
+    }
+
+    putU32(out, static_cast<uint32_t>(directories_.size()));
+    for (const auto& directory : directories_) {
+        putStr(out, directory.first);
+        putU64(out, static_cast<uint64_t>(directory.second.mtimeNs));
+        putU64(out, static_cast<uint64_t>(directory.second.ctimeNs));
+        putU32(out, static_cast<uint32_t>(directory.second.entries.size()));
+        for (const auto& entry : directory.second.entries) {
+            putStr(out, entry.name);
+            putU64(out, entry.length);
+            putU32(out, static_cast<uint32_t>(entry.fileType));
+            putU64(out, entry.contentHash);
+        }
+    }
+
+    std::string tempPath = indexPath_ + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()))) {
+            LOGE("Cannot write scan index: %s", tempPath.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tempPath.c_str(), indexPath_.c_str()) != 0) {
+        LOGE("Cannot replace scan index: %s", indexPath_.c_str());
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    dirty_ = false;
+    LOGI("Saved scan index: %zu bytes", out.size());
+    return true;
+}
+
+const IndexedSegment* ScanIndex::findSegment(const std::string& source, uint64_t sourceSize,
+                                             uint64_t start, uint64_t end, uint64_t generation) const {
+    auto entry = sources_.find(source);
+    if (entry == sources_.end() || entry->second.size != sourceSize) {
+        return nullptr;
+    }
+
+    auto segment = entry->second.segments.find(start);
+    if (segment == entry->second.segments.end() || segment->second.end != end ||
+        segment->second.generation != generation) {
+        return nullptr;
+    }
+    return &segment->second;
+}
+
+const IndexedSegment* ScanIndex::segmentAt(const std::string& source, uint64_t sourceSize, uint64_t start) const {
+    auto entry = sources_.find(source);
+    if (entry == sources_.end() || entry->second.size != sourceSize) {
+        return nullptr;
+    }
+    auto segment = entry->second.segments.find(start);
+    return segment != entry->second.segments.end() ? &segment->second : nullptr;
+}
+
+void ScanIndex::storeSegment(const std::string& source, uint64_t sourceSize, IndexedSegment segment) {
+    SourceEntry& entry = sources_[source];
+    if (entry.size != sourceSize) {
+        // Resized or reformatted: nothing recorded for it still applies
+        entry.segments.clear();
+        entry.size = sourceSize;
+    }
+    uint64_t start = segment.start;
+    entry.segments[start] = std::move(segment);
+    dirty_ = true;
+}
+
+const IndexedDirectory* ScanIndex::findDirectory(const std::string& path, int64_t mtimeNs, int64_t ctimeNs) const {
+    auto entry = directories_.find(path);
+    if (entry == directories_.end() || entry->second.mtimeNs != mtimeNs || entry->second.ctimeNs != ctimeNs) {
+        return nullptr;
+    }
+    return &entry->second;
+}
+
+void ScanIndex::storeDirectory(const std::string& path, const IndexedDirectory& directory) {
+    directories_[path] = directory;
+    dirty_ = true;
+}
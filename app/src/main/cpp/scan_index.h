@@ -0,0 +1,80 @@
+#ifndef SCAN_INDEX_H
+#define SCAN_INDEX_H
+
+#include "block_reader.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// A carved file found in a segment, with the extent its format walker found
+struct IndexedHit {
+    uint64_t offset;
+    uint64_t length;
+    int fileType;
+    bool complete;
+    std::vector<ByteRange> fragments; // Empty unless reassembled from several extents
+    uint64_t contentHash = 0;         // ContentHasher::sample key of the carved bytes, 0 if not hashed
+};
+
+// A scanned slice of a source: an ext4 block group or a whole image file.
+// The generation is whatever cheaply proves the slice is unchanged (a
+// bitmap checksum, or size and timestamps for a file).
+struct IndexedSegment {
+    uint64_t start;
+    uint64_t end;
+    uint64_t generation;
+    std::vector<IndexedHit> hits;
+};
+
+// A deleted or damaged file a directory scan reported, replayed as it was
+// while the directory is unchanged
+struct IndexedEntry {
+    std::string name;
+    uint64_t length;
+    int fileType;
+    uint64_t contentHash; // ContentHasher::sampleFile key, 0 if not a regular file
+};
+
+struct IndexedDirectory {
+    int64_t mtimeNs;
+    int64_t ctimeNs;
+    std::vector<IndexedEntry> entries;
+};
+
+// On-disk record of earlier scans so a re-scan only revisits what changed.
+// Loaded and saved as a whole; writes go to a temporary file that is renamed
+// over the old one, so a crash mid-save leaves the previous index intact.
+class ScanIndex {
+public:
+    explicit ScanIndex(const std::string& indexPath);
+
+    bool load();
+    bool save();
+
+    // Null unless a segment with the same bounds and generation was stored
+    // for this source at the same size
+    const IndexedSegment* findSegment(const std::string& source, uint64_t sourceSize,
+                                      uint64_t start, uint64_t end, uint64_t generation) const;
+    // Null unless a segment starting at start was stored for this source at this size
+    const IndexedSegment* segmentAt(const std::string& source, uint64_t sourceSize, uint64_t start) const;
+    void storeSegment(const std::string& source, uint64_t sourceSize, IndexedSegment segment);
+
+    const IndexedDirectory* findDirectory(const std::string& path, int64_t mtimeNs, int64_t ctimeNs) const;
+    void storeDirectory(const std::string& path, const IndexedDirectory& directory);
+
+    const std::string& path() const { return indexPath_; }
+
+private:
+    struct SourceEntry {
+        uint64_t size = 0;
+        std::map<uint64_t, IndexedSegment> segments; // Keyed by start offset
+    };
+
+    std::string indexPath_;
+    std::map<std::string, SourceEntry> sources_;
+    std::map<std::string, IndexedDirectory> directories_;
+    bool dirty_;
+};
+
+#endif // SCAN_INDEX_H
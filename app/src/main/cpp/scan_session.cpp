@@ -0,0 +1,179 @@
+#include "scan_session.h"
+#include "parallel_carver.h"
+#include <android/log.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+
+#define LOG_TAG "ScanSession"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+ScanSession::ScanSession(const std::string& sourcePath, const std::string& checkpointPath,
+                         const ScanOptions& options)
+        : sourcePath_(sourcePath),
+          checkpointPath_(checkpointPath),
+          sourceSize_(0),
+          progress_{SessionState::Idle, 0, 0, 0, 0},
+          pauseRequested_(false),
+          cancelRequested_(false) {
+    // The checkpoint takes the place of the scan index for session carves
+    ScanOptions sessionOptions = options;
+    sessionOptions.indexPath.clear();
+    engine_.setScanOptions(sessionOptions);
+}
+
+bool ScanSession::run(HitArena& arena, const HitSink& sink) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (progress_.state != SessionState::Idle) {
+            LOGE("Session for %s has already run", sourcePath_.c_str());
+            return false;
+        }
+        if (cancelRequested_) {
+            progress_.state = SessionState::Cancelled;
+            return false;
+        }
+        progress_.state = SessionState::Running;
+    }
+
+    int fd = open(sourcePath_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        sourceSize_ = BlockReader::querySize(fd);
+        close(fd);
+    }
+
+    // A checkpoint only applies to the same source at the same size
+    uint64_t resumeOffset = 0;
+    std::vector<IndexedHit> resumeHits;
+    if (!checkpointPath_.empty()) {
+        ScanIndex checkpoint(checkpointPath_);
+        const IndexedSegment* done = checkpoint.load() ? checkpoint.segmentAt(sourcePath_, sourceSize_, 0) : nullptr;
+        if (done) {
+            resumeOffset = done->end;
+            resumeHits = done->hits;
+            LOGI("Resuming %s at %llu with %zu hits", sourcePath_.c_str(),
+                 static_cast<unsigned long long>(resumeOffset), resumeHits.size());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.scannedTo = resumeOffset;
+    }
+    lastCheckpoint_ = std::chrono::steady_clock::now();
+
+    auto countingSink = [&](const HitArena& hits, size_t from, size_t to) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            progress_.hits += to - from;
+        }
+        return sink(hits, from, to);
+    };
+
+    // The engine keeps a copy of every reported hit, with its content key, for the checkpoint
+    bool completed = engine_.carveSignatures(sourcePath_.c_str(), arena, countingSink,
+                                             [this](const CarveProgress& progress) {
+                                                 return onProgress(progress);
+                                             },
+                                             resumeOffset, resumeHits, &hits_);
+
+    uint64_t scannedTo;
+    bool cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        scannedTo = progress_.scannedTo;
+        cancelled = cancelRequested_;
+    }
+
+    SessionState state = SessionState::Finished;
+    if (completed) {
+        if (!checkpointPath_.empty()) {
+            std::remove(checkpointPath_.c_str());
+        }
+    } else {
+        // Whatever was carved before the stop still counts next time
+        saveCheckpoint(scannedTo);
+        state = cancelled ? SessionState::Cancelled : SessionState::Failed;
+    }
+
+    LOGI("Session on %s ended in state %d at %llu with %zu hits", sourcePath_.c_str(), static_cast<int>(state),
+         static_cast<unsigned long long>(scannedTo), hits_.size());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_.state = state;
+    return completed;
+}
+
+void ScanSession::pause() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pauseRequested_ = true;
+}
+
+void ScanSession::resume() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pauseRequested_ = false;
+    resumed_.notify_all();
+}
+
+void ScanSession::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelRequested_ = true;
+    resumed_.notify_all();
+}
+
+SessionProgress ScanSession::progress() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return progress_;
+}
+
+bool ScanSession::onProgress(const CarveProgress& progress) {
+    bool pausing;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.scannedTo = progress.scannedTo;
+        progress_.bytesDone = progress.bytesDone;
+        progress_.bytesTotal = progress.bytesTotal;
+        if (cancelRequested_) {
+            return false;
+        }
+        pausing = pauseRequested_;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (pausing || now - lastCheckpoint_ >= kCheckpointInterval) {
+        // A paused app may well be killed before it resumes
+        saveCheckpoint(progress.scannedTo);
+        lastCheckpoint_ = now;
+    }
+    if (!pausing) {
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    progress_.state = SessionState::Paused;
+    LOGI("Paused at %llu", static_cast<unsigned long long>(progress.scannedTo));
+    resumed_.wait(lock, [this] { return !pauseRequested_ || cancelRequested_; });
+    if (cancelRequested_) {
+        return false;
+    }
+    progress_.state = SessionState::Running;
+    return true;
+}
+
+void ScanSession::saveCheckpoint(uint64_t scannedTo) {
+    if (checkpointPath_.empty() || scannedTo == 0) {
+        return;
+    }
+
+    // A stop can land between a delivered batch and its progress report
+    IndexedSegment segment = {0, scannedTo, 0, {}};
+    for (const auto& hit : hits_) {
+        if (hit.offset < scannedTo) segment.hits.push_back(hit);
+    }
+
+    ScanIndex checkpoint(checkpointPath_);
+    checkpoint.storeSegment(sourcePath_, sourceSize_, std::move(segment));
+    if (!checkpoint.save()) {
+        LOGE("Could not write checkpoint %s", checkpointPath_.c_str());
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef SCAN_SESSION_H
+#define SCAN_SESSION_H
+
+#include "file_recovery_engine.h"
+#include "scan_index.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+// Values are shared with Kotlin (ScanSession.State)
+enum class SessionState : int {
+    Idle = 0,
+    Running = 1,
+    Paused = 2,
+    Cancelled = 3,
+    Finished = 4,
+    Failed = 5
+};
+
+struct SessionProgress {
+    SessionState state;
+    uint64_t scannedTo;  // Every header below this offset has been reported
+    uint64_t bytesDone;  // Of the bytes this run carves; a resumed run skips what came before
+    uint64_t bytesTotal;
+    uint64_t hits;
+};
+
+// A signature carve of one device or image that outlives a single JNI call.
+// run() blocks on the caller's thread while pause(), resume(), cancel() and
+// progress() may be called from any other. The carve stops between batches
+// to honour them, and every few seconds writes a checkpoint of how far it
+// got and what it found, so a new session on the same source and checkpoint
+// path picks up where a cancelled or killed one left off.
+class ScanSession {
+public:
+    static constexpr std::chrono::seconds kCheckpointInterval{5};
+
+    ScanSession(const std::string& sourcePath, const std::string& checkpointPath, const ScanOptions& options);
+
+    ScanSession(const ScanSession&) = delete;
+    ScanSession& operator=(const ScanSession&) = delete;
+
+    // Runs once; true if the whole source was carved. The checkpoint is
+    // removed only then; a run that stops, throws or skips unreadable blocks
+    // keeps it so the next one carves what is missing.
+    bool run(HitArena& arena, const HitSink& sink);
+
+    void pause();
+    void resume();
+    void cancel();
+
+    SessionProgress progress() const;
+
+private:
+    bool onProgress(const CarveProgress& progress);
+    void saveCheckpoint(uint64_t scannedTo);
+
+    std::string sourcePath_;
+    std::string checkpointPath_;
+    FileRecoveryEngine engine_;
+    uint64_t sourceSize_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable resumed_;
+    SessionProgress progress_;
+    bool pauseRequested_;
+    bool cancelRequested_;
+
+    // Only touched by the thread inside run()
+    std::vector<IndexedHit> hits_;
+    std::chrono::steady_clock::time_point lastCheckpoint_;
+};
+
+#endif // SCAN_SESSION_H
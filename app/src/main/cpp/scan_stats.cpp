@@ -0,0 +1,83 @@
+#include "scan_stats.h"
+#include <atomic>
+#include <chrono>
+
+namespace {
+
+const size_t kMaxSlots = 64;
+
+struct alignas(64) StatSlot {
+    std::atomic<bool> leased{false};
+    std::atomic<uint64_t> counters[kStatCount] = {};
+};
+
+// The last slot is never leased: threads beyond kMaxSlots share it, which
+// fetch_add keeps correct
+StatSlot gSlots[kMaxSlots];
+
+// Holds a slot for the lifetime of its thread
+class SlotLease {
+public:
+    SlotLease() : slot_(&gSlots[kMaxSlots - 1]), owned_(false) {
+        for (size_t i = 0; i + 1 < kMaxSlots; ++i) {
+            bool expected = false;
+            if (gSlots[i].leased.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                slot_ = &gSlots[i];
+                owned_ = true;
+                break;
+            }
+        }
+    }
+
+    ~SlotLease() {
+        if (owned_) slot_->leased.store(false, std::memory_order_release);
+    }
+
+    StatSlot& slot() { return *slot_; }
+
+private:
+    StatSlot* slot_;
+    bool owned_;
+};
+
+StatSlot& threadSlot() {
+    thread_local SlotLease lease;
+    return lease.slot();
+}
+
+} // namespace
+
+void ScanStats::add(ScanStat stat, uint64_t value) {
+    threadSlot().counters[stat].fetch_add(value, std::memory_order_relaxed);
+}
+
+void ScanStats::addHit(int fileType) {
+    StatSlot& slot = threadSlot();
+    size_t type = fileType >= 0 && static_cast<size_t>(fileType) < kStatTypeSlots ? static_cast<size_t>(fileType) : 0;
+    slot.counters[kStatHits].fetch_add(1, std::memory_order_relaxed);
+    slot.counters[kStatHitsByType + type].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> ScanStats::snapshot() {
+    std::vector<uint64_t> totals(kStatCount, 0);
+    for (const auto& slot : gSlots) {
+        for (size_t i = 0; i < kStatCount; ++i) {
+            totals[i] += slot.counters[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+void ScanStats::reset() {
+    // Counts added by a scan still running while this runs may survive it
+    for (auto& slot : gSlots) {
+        for (auto& counter : slot.counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t ScanStats::nowNanos() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
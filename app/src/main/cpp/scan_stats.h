@@ -0,0 +1,61 @@
+#ifndef SCAN_STATS_H
+#define SCAN_STATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Counter ids; also the layout of the array returned by nativeGetScanStats
+// (see ScanStats.kt)
+enum ScanStat : size_t {
+    kStatBytesRead = 0,
+    kStatReadCalls,      // pread and mmap syscalls
+    kStatIoWaitNanos,    // Scan threads blocked on reads
+    kStatMatchNanos,     // Signature matching
+    kStatValidateNanos,  // Format walkers checking candidate headers
+    kStatHits,
+    kStatRejects,        // Headers the format walker found invalid
+    kStatTruncated,      // Hits whose end marker was not found
+    kStatFragmented,     // Hits reassembled from more than one extent
+    kStatDuplicates,     // Hits merged into an earlier one with the same content
+    kStatHashNanos,      // Hashing hit contents
+    kStatBlankBytes,     // Blank blocks the matcher stepped over (block_classifier.h)
+    kStatPeakBytes,      // Most native buffer memory held at once (memory_budget.h)
+    kStatBudgetStallNanos, // Threads waiting for the memory budget
+    kStatHitsByType,     // kStatTypeSlots counters indexed by FileType id
+};
+
+const size_t kStatTypeSlots = 16;
+const size_t kStatCount = kStatHitsByType + kStatTypeSlots;
+
+// Process-wide scan counters. Every thread adds to its own cache-line
+// aligned slot with relaxed atomics, so the hot path takes no lock and
+// shares no line with other scanners; reading sums the slots. Slots are
+// released when their thread exits and keep their totals for the next owner.
+class ScanStats {
+public:
+    static void add(ScanStat stat, uint64_t value);
+    static void addHit(int fileType);
+
+    // Totals across all threads, kStatCount values in ScanStat order
+    static std::vector<uint64_t> snapshot();
+    static void reset();
+
+    static uint64_t nowNanos();
+};
+
+// Adds the time until the end of the scope to a phase timer
+class ScopedStatTimer {
+public:
+    explicit ScopedStatTimer(ScanStat stat) : stat_(stat), start_(ScanStats::nowNanos()) {}
+    ~ScopedStatTimer() { ScanStats::add(stat_, ScanStats::nowNanos() - start_); }
+
+    ScopedStatTimer(const ScopedStatTimer&) = delete;
+    ScopedStatTimer& operator=(const ScopedStatTimer&) = delete;
+
+private:
+    ScanStat stat_;
+    uint64_t start_;
+};
+
+#endif // SCAN_STATS_H
@@ -0,0 +1,106 @@
+#include "signature_matcher.h"
+#include <algorithm>
+#include <array>
+#include <queue>
+
+SignatureMatcher::SignatureMatcher(const std::vector<SignaturePattern>& patterns)
+        : patterns_(patterns), maxPatternLength_(0), maxHeaderReach_(0), uniformPattern_(false) {
+    // Build the trie
+    std::vector<std::array<int32_t, 256>> trie(1);
+    trie[0].fill(-1);
+    std::vector<std::vector<uint32_t>> nodeOutputs(1);
+
+    for (uint32_t p = 0; p < patterns_.size(); ++p) {
+        const auto& bytes = patterns_[p].bytes;
+        if (bytes.empty()) continue;
+        maxPatternLength_ = std::max(maxPatternLength_, bytes.size());
+        maxHeaderReach_ = std::max(maxHeaderReach_, patterns_[p].headerOffset + bytes.size());
+        uniformPattern_ = uniformPattern_ ||
+                          std::all_of(bytes.begin(), bytes.end(), [&bytes](uint8_t b) { return b == bytes[0]; });
+
+        int32_t node = 0;
+        for (uint8_t b : bytes) {
+            if (trie[node][b] < 0) {
+                trie[node][b] = static_cast<int32_t>(trie.size());
+                trie.emplace_back();
+                trie.back().fill(-1);
+                nodeOutputs.emplace_back();
+            }
+            node = trie[node][b];
+        }
+        nodeOutputs[node].push_back(p);
+    }
+
+    // Breadth-first pass computing failure links and completing the DFA
+    const size_t nodeCount = trie.size();
+    std::vector<int32_t> fail(nodeCount, 0);
+    transitions_.assign(nodeCount * 256, 0);
+    std::queue<int32_t> pending;
+
+    for (int b = 0; b < 256; ++b) {
+        int32_t child = trie[0][b];
+        if (child >= 0) {
+            fail[child] = 0;
+            transitions_[b] = static_cast<uint32_t>(child);
+            pending.push(child);
+        }
+    }
+
+    while (!pending.empty()) {
+        int32_t node = pending.front();
+        pending.pop();
+
+        // Inherit outputs from the failure chain (already final, BFS order)
+        const auto& inherited = nodeOutputs[fail[node]];
+        nodeOutputs[node].insert(nodeOutputs[node].end(), inherited.begin(), inherited.end());
+
+        for (int b = 0; b < 256; ++b) {
+            int32_t child = trie[node][b];
+            if (child >= 0) {
+                fail[child] = static_cast<int32_t>(transitions_[fail[node] * 256 + b]);
+                transitions_[node * 256 + b] = static_cast<uint32_t>(child);
+                pending.push(child);
+            } else {
+                transitions_[node * 256 + b] = transitions_[fail[node] * 256 + b];
+            }
+        }
+    }
+
+    // Flatten outputs and tag transitions that land on reporting nodes
+    outputStart_.resize(nodeCount + 1);
+    for (size_t n = 0; n < nodeCount; ++n) {
+        outputStart_[n] = static_cast<uint32_t>(outputs_.size());
+        outputs_.insert(outputs_.end(), nodeOutputs[n].begin(), nodeOutputs[n].end());
+    }
+    outputStart_[nodeCount] = static_cast<uint32_t>(outputs_.size());
+
+    for (auto& target : transitions_) {
+        if (!nodeOutputs[target].empty()) {
+            target |= kOutputFlag;
+        }
+    }
+}
+
+void SignatureMatcher::scan(State& state, const uint8_t* data, size_t size,
+                            std::vector<SignatureMatch>& matches) const {
+    const uint32_t* delta = transitions_.data();
+    uint32_t node = state.node;
+
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t next = delta[node * 256 + data[i]];
+        node = next & kStateMask;
+        if (next & kOutputFlag) {
+            // Absolute offset of the byte that completed the match
+            uint64_t endPos = state.position + i;
+            for (uint32_t k = outputStart_[node]; k < outputStart_[node + 1]; ++k) {
+                const SignaturePattern& pattern = patterns_[outputs_[k]];
+                uint64_t patternStart = endPos + 1 - pattern.bytes.size();
+                if (patternStart < pattern.headerOffset) continue;
+                matches.push_back({patternStart - pattern.headerOffset, pattern.fileType});
+            }
+        }
+    }
+
+    state.node = node;
+    state.position += size;
+}
@@ -0,0 +1,57 @@
+#ifndef SIGNATURE_MATCHER_H
+#define SIGNATURE_MATCHER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct SignaturePattern {
+    std::vector<uint8_t> bytes;
+    int fileType;
+    size_t headerOffset; // Distance from the start of the file to the pattern (e.g. 4 for "ftyp")
+};
+
+struct SignatureMatch {
+    uint64_t offset; // Offset of the file header in the scanned stream
+    int fileType;
+};
+
+// Aho-Corasick automaton compiled to a dense DFA so that every signature is
+// matched in a single pass with one table lookup per input byte.
+class SignatureMatcher {
+public:
+    // Streaming state, carried between buffers so matches that straddle a
+    // buffer boundary are still reported
+    struct State {
+        uint32_t node = 0;
+        uint64_t position = 0;
+    };
+
+    explicit SignatureMatcher(const std::vector<SignaturePattern>& patterns);
+
+    void scan(State& state, const uint8_t* data, size_t size,
+              std::vector<SignatureMatch>& matches) const;
+
+    size_t maxPatternLength() const { return maxPatternLength_; }
+    // Bytes from a header offset to the end of its pattern, over all patterns
+    size_t maxHeaderReach() const { return maxHeaderReach_; }
+    size_t patternCount() const { return patterns_.size(); }
+    // Some pattern is one byte repeated, so it could match inside blank space
+    bool hasUniformPattern() const { return uniformPattern_; }
+
+private:
+    static constexpr uint32_t kOutputFlag = 0x80000000u;
+    static constexpr uint32_t kStateMask = 0x7FFFFFFFu;
+
+    std::vector<SignaturePattern> patterns_;
+    // transitions_[node * 256 + byte]; high bit set when the target node has outputs
+    std::vector<uint32_t> transitions_;
+    // Patterns reported at each node, flattened: outputs_[outputStart_[n] .. outputStart_[n + 1])
+    std::vector<uint32_t> outputStart_;
+    std::vector<uint32_t> outputs_;
+    size_t maxPatternLength_;
+    size_t maxHeaderReach_;
+    bool uniformPattern_;
+};
+
+#endif // SIGNATURE_MATCHER_H
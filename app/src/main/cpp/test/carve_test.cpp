@@ -0,0 +1,604 @@
+// Host checks for the signature carving path.
+//
+//   matcher   a pattern fed to SignatureMatcher in two scan() calls, split at
+//             every point, or ending in a last buffer shorter than the rest,
+//             is reported as it is from a single call
+//   parallel  headers planted on and around stripe boundaries and their
+//             overlaps come back from ParallelCarver identically, offset for
+//             offset, with one thread and with several
+//   reassembly a baseline JPEG and an MP4, each split across blocks that are
+//             not adjacent with foreign blocks between, come back from
+//             FragmentReassembler as exactly the fragments they were written to
+//
+//   carve_test matcher|parallel|reassembly [--tmp DIR]
+//
+// Images are files in a work directory that is removed afterwards.
+
+#include "parallel_carver.h"
+#include "signature_matcher.h"
+#include "fragment_reassembler.h"
+#include "file_types.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+int gFailures = 0;
+
+void expect(bool ok, const char* condition, int line) {
+    if (!ok) {
+        fprintf(stderr, "carve_test.cpp:%d: expected %s\n", line, condition);
+        gFailures++;
+    }
+}
+
+#define EXPECT(condition) expect((condition), #condition, __LINE__)
+
+using Bytes = std::vector<uint8_t>;
+
+Bytes bytesOf(const char* text) {
+    return Bytes(text, text + strlen(text));
+}
+
+// Lower-case letters, which start no signature below
+Bytes background(size_t size) {
+    Bytes data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>('a' + (i * 7 + i / 13) % 26);
+    return data;
+}
+
+// Patterns of several lengths, one found a few bytes into its file like MP4's "ftyp"
+std::vector<SignaturePattern> testPatterns() {
+    return {
+        {{0xFF, 0xD8, 0xFF}, JPEG, 0},
+        {{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'}, PNG, 0},
+        {bytesOf("%PDF-1."), PDF, 0},
+        {bytesOf("ftypisom"), MP4, 4},
+    };
+}
+
+bool sameMatches(const std::vector<SignatureMatch>& actual, const std::vector<SignatureMatch>& expected) {
+    return actual.size() == expected.size() &&
+           std::equal(actual.begin(), actual.end(), expected.begin(), [](const SignatureMatch& a, const SignatureMatch& b) {
+               return a.offset == b.offset && a.fileType == b.fileType;
+           });
+}
+
+bool sameRanges(const std::vector<ByteRange>& actual, const std::vector<ByteRange>& expected) {
+    return actual.size() == expected.size() &&
+           std::equal(actual.begin(), actual.end(), expected.begin(), [](const ByteRange& a, const ByteRange& b) {
+               return a.offset == b.offset && a.length == b.length;
+           });
+}
+
+bool writeFile(const std::string& path, const Bytes& data) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && pwrite(fd, data.data(), data.size(), 0) == static_cast<ssize_t>(data.size());
+    if (fd >= 0) close(fd);
+    return written;
+}
+
+void printMatches(const char* label, const std::vector<SignatureMatch>& matches) {
+    fprintf(stderr, "%s:", label);
+    for (const auto& match : matches) {
+        fprintf(stderr, " %llu/%d", static_cast<unsigned long long>(match.offset), match.fileType);
+    }
+    fprintf(stderr, "\n");
+}
+
+void testMatcher(const std::string&) {
+    const auto patterns = testPatterns();
+    const SignatureMatcher matcher(patterns);
+
+    for (const auto& pattern : patterns) {
+        const uint64_t header = 100;
+        Bytes data = background(200);
+        std::copy(pattern.bytes.begin(), pattern.bytes.end(), data.begin() + header + pattern.headerOffset);
+        const std::vector<SignatureMatch> expected = {{header, pattern.fileType}};
+
+        std::vector<SignatureMatch> whole;
+        SignatureMatcher::State state;
+        matcher.scan(state, data.data(), data.size(), whole);
+        EXPECT(sameMatches(whole, expected));
+
+        // Split before, inside and after the pattern
+        const size_t patternStart = header + pattern.headerOffset;
+        for (size_t split = patternStart - 1; split <= patternStart + pattern.bytes.size() + 1; ++split) {
+            std::vector<SignatureMatch> matches;
+            SignatureMatcher::State splitState;
+            matcher.scan(splitState, data.data(), split, matches);
+            matcher.scan(splitState, data.data() + split, data.size() - split, matches);
+            if (!sameMatches(matches, expected)) {
+                fprintf(stderr, "pattern of type %d split at %zu:\n", pattern.fileType, split);
+                printMatches("  found", matches);
+            }
+            EXPECT(sameMatches(matches, expected));
+        }
+
+        // Fixed-size buffers with a short one last, the pattern ending on its final byte
+        Bytes tail = background(3 * 64 + 21);
+        const uint64_t tailHeader = tail.size() - pattern.bytes.size() - pattern.headerOffset;
+        std::copy(pattern.bytes.begin(), pattern.bytes.end(), tail.end() - pattern.bytes.size());
+        std::vector<SignatureMatch> matches;
+        SignatureMatcher::State tailState;
+        for (size_t at = 0; at < tail.size(); at += 64) {
+            matcher.scan(tailState, tail.data() + at, std::min<size_t>(64, tail.size() - at), matches);
+        }
+        EXPECT(sameMatches(matches, {{tailHeader, pattern.fileType}}));
+        EXPECT(tailState.position == tail.size());
+    }
+}
+
+namespace parallel {
+
+// Stripes never shrink below 1 MiB, so the image spans a few of them
+const uint64_t kStripe = 1024 * 1024;
+const uint64_t kStripes = 6;
+const uint64_t kImageSize = kStripes * kStripe;
+// Zeros around the fourth boundary, so blank runs are stepped over right next to it
+const uint64_t kBlankStart = 3 * kStripe - 64 * 1024;
+const uint64_t kBlankEnd = 3 * kStripe + 64 * 1024;
+
+// Every boundary gets one pattern, its header shift bytes into the span
+// from where the pattern would end just before the boundary. Across shifts
+// each pattern crosses each boundary at every point, and the MP4 header
+// also sits in one stripe with its whole pattern in the next, which only the
+// overlap sees.
+std::vector<std::pair<uint64_t, SignaturePattern>> plants(size_t shift) {
+    const auto patterns = testPatterns();
+    std::vector<std::pair<uint64_t, SignaturePattern>> planted = {{0, patterns[0]}, {kImageSize - 8, patterns[1]}};
+    for (uint64_t boundary = kStripe; boundary < kImageSize; boundary += kStripe) {
+        const SignaturePattern& pattern = patterns[(boundary / kStripe + shift) % patterns.size()];
+        uint64_t reach = pattern.headerOffset + pattern.bytes.size();
+        planted.push_back({boundary - reach + std::min<uint64_t>(shift, reach), pattern});
+    }
+    return planted;
+}
+
+void build(const std::string& path, size_t shift, std::vector<SignatureMatch>& expected) {
+    Bytes image = background(static_cast<size_t>(kImageSize));
+    std::fill(image.begin() + kBlankStart, image.begin() + kBlankEnd, 0);
+
+    expected.clear();
+    for (const auto& plant : plants(shift)) {
+        const SignaturePattern& pattern = plant.second;
+        std::copy(pattern.bytes.begin(), pattern.bytes.end(), image.begin() + plant.first + pattern.headerOffset);
+        expected.push_back({plant.first, pattern.fileType});
+    }
+    std::sort(expected.begin(), expected.end(), [](const SignatureMatch& a, const SignatureMatch& b) {
+        return a.offset < b.offset;
+    });
+
+    EXPECT(writeFile(path, image));
+}
+
+std::vector<SignatureMatch> carve(const SignatureMatcher& matcher, const std::string& path, size_t threads,
+                                  size_t queueDepth, const std::vector<ByteRange>& ranges) {
+    CarveOptions options;
+    options.threads = threads;
+    options.stripeBytes = kStripe;
+    options.queueDepth = queueDepth;
+    ParallelCarver carver(matcher, options);
+    std::vector<SignatureMatch> matches;
+    EXPECT(carver.carve(path.c_str(), ranges, [&matches](const std::vector<SignatureMatch>& batch) {
+        matches.insert(matches.end(), batch.begin(), batch.end());
+        return true;
+    }));
+    return matches;
+}
+
+} // namespace parallel
+
+void testParallel(const std::string& workDir) {
+    const std::string path = workDir + "/parallel.img";
+    const SignatureMatcher matcher(testPatterns());
+    // The whole image, then ranges that start and end mid-stripe
+    const std::vector<std::vector<ByteRange>> rangeSets = {
+        {},
+        {{parallel::kStripe / 2, 2 * parallel::kStripe}, {3 * parallel::kStripe - 100, parallel::kStripe + 200}},
+    };
+
+    size_t maxReach = 0;
+    for (const auto& pattern : testPatterns()) {
+        maxReach = std::max(maxReach, pattern.headerOffset + pattern.bytes.size());
+    }
+    for (size_t shift = 0; shift <= maxReach; ++shift) {
+        std::vector<SignatureMatch> expected;
+        parallel::build(path, shift, expected);
+        for (const auto& ranges : rangeSets) {
+            std::vector<SignatureMatch> serial = parallel::carve(matcher, path, 1, 16, ranges);
+            if (ranges.empty()) {
+                EXPECT(sameMatches(serial, expected));
+            } else {
+                EXPECT(!serial.empty());
+            }
+            for (size_t threads : {2, 8}) {
+                for (size_t queueDepth : {1, 16}) {
+                    std::vector<SignatureMatch> striped = parallel::carve(matcher, path, threads, queueDepth, ranges);
+                    if (!sameMatches(striped, serial)) {
+                        fprintf(stderr, "shift %zu, %zu threads, queue depth %zu:\n", shift, threads, queueDepth);
+                        printMatches("  one thread", serial);
+                        printMatches("  striped", striped);
+                    }
+                    EXPECT(sameMatches(striped, serial));
+                }
+            }
+        }
+    }
+    unlink(path.c_str());
+}
+
+// Deterministic stand-ins for real photos and videos
+namespace media {
+
+// xorshift64*, so the files are the same on every run
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next() {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545F4914F6CDD1DULL;
+    }
+    int range(int low, int high) { return low + static_cast<int>(next() % static_cast<uint64_t>(high - low + 1)); }
+    bool chance(int percent) { return static_cast<int>(next() % 100) < percent; }
+    Bytes bytes(size_t size) {
+        Bytes data(size);
+        for (auto& byte : data) byte = static_cast<uint8_t>(next() >> 56);
+        return data;
+    }
+
+private:
+    uint64_t state_;
+};
+
+void appendBe16(Bytes& b, uint16_t v) {
+    b.push_back(static_cast<uint8_t>(v >> 8));
+    b.push_back(static_cast<uint8_t>(v));
+}
+
+void appendBe32(Bytes& b, uint32_t v) {
+    appendBe16(b, static_cast<uint16_t>(v >> 16));
+    appendBe16(b, static_cast<uint16_t>(v));
+}
+
+void append(Bytes& b, const Bytes& more) {
+    b.insert(b.end(), more.begin(), more.end());
+}
+
+// The standard luminance Huffman tables of ITU T.81 Annex K
+const uint8_t kDcBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t kAcBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+const uint8_t kAcValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+struct HuffmanCode {
+    uint16_t code;
+    int length;
+};
+
+// Canonical codes indexed by symbol
+std::vector<HuffmanCode> huffmanCodes(const uint8_t bits[16], const uint8_t* values) {
+    std::vector<HuffmanCode> codes(256, {0, 0});
+    uint16_t code = 0;
+    size_t k = 0;
+    for (int length = 1; length <= 16; ++length) {
+        for (int i = 0; i < bits[length - 1]; ++i) codes[values[k++]] = {code++, length};
+        code <<= 1;
+    }
+    return codes;
+}
+
+class BitWriter {
+public:
+    void put(uint32_t value, int length) {
+        for (int i = length - 1; i >= 0; --i) {
+            acc_ = (acc_ << 1) | ((value >> i) & 1);
+            if (++count_ == 8) {
+                out.push_back(static_cast<uint8_t>(acc_));
+                if (acc_ == 0xFF) out.push_back(0); // Stuffed
+                acc_ = 0;
+                count_ = 0;
+            }
+        }
+    }
+    void put(const HuffmanCode& code) { put(code.code, code.length); }
+    // Pads the last byte with one bits
+    void align() {
+        if (count_ > 0) put((1u << (8 - count_)) - 1, 8 - count_);
+    }
+
+    Bytes out;
+
+private:
+    uint32_t acc_ = 0;
+    int count_ = 0;
+};
+
+// Magnitude category and the bits that follow it
+void putCoefficient(BitWriter& bits, const std::vector<HuffmanCode>& codes, int run, int value) {
+    int magnitude = value < 0 ? -value : value;
+    int size = 0;
+    while (magnitude >> size) ++size;
+    bits.put(codes[(run << 4) | size]);
+    bits.put(static_cast<uint32_t>(value >= 0 ? value : value + (1 << size) - 1), size);
+}
+
+// Baseline 4:2:0 JPEG of random quantised coefficients, one DC and one AC table for all components
+Bytes baselineJpeg(uint16_t width, uint16_t height, uint64_t seed) {
+    Random random(seed);
+    uint8_t dcValues[12];
+    for (uint8_t i = 0; i < 12; ++i) dcValues[i] = i;
+    const auto dc = huffmanCodes(kDcBits, dcValues);
+    const auto ac = huffmanCodes(kAcBits, kAcValues);
+
+    Bytes jpeg = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    jpeg.insert(jpeg.end(), {0xFF, 0xDB, 0x00, 67, 0x00});
+    for (int i = 0; i < 64; ++i) jpeg.push_back(static_cast<uint8_t>(random.range(1, 50)));
+    jpeg.insert(jpeg.end(), {0xFF, 0xC0, 0x00, 17, 8});
+    appendBe16(jpeg, height);
+    appendBe16(jpeg, width);
+    jpeg.insert(jpeg.end(), {3, 1, 0x22, 0, 2, 0x11, 0, 3, 0x11, 0});
+    jpeg.insert(jpeg.end(), {0xFF, 0xC4, 0x00, 2 + 17 + 12, 0x00});
+    jpeg.insert(jpeg.end(), kDcBits, kDcBits + 16);
+    jpeg.insert(jpeg.end(), dcValues, dcValues + 12);
+    jpeg.insert(jpeg.end(), {0xFF, 0xC4, 0x00, 2 + 17 + 162, 0x10});
+    jpeg.insert(jpeg.end(), kAcBits, kAcBits + 16);
+    jpeg.insert(jpeg.end(), kAcValues, kAcValues + 162);
+    jpeg.insert(jpeg.end(), {0xFF, 0xDA, 0x00, 12, 3, 1, 0, 2, 0, 3, 0, 0, 63, 0});
+
+    BitWriter bits;
+    const int mcus = ((width + 15) / 16) * ((height + 15) / 16);
+    for (int mcu = 0; mcu < mcus; ++mcu) {
+        for (int block = 0; block < 6; ++block) {
+            int value = random.range(-60, 60);
+            int magnitude = value < 0 ? -value : value;
+            int size = 0;
+            while (magnitude >> size) ++size;
+            bits.put(dc[size]);
+            bits.put(static_cast<uint32_t>(value >= 0 ? value : value + (1 << size) - 1), size);
+            for (int k = 1; k < 64;) {
+                if (random.chance(12)) {
+                    bits.put(ac[0x00]); // End of block
+                    break;
+                }
+                int run = std::min(std::max(random.range(-3, 3), 0), 63 - k);
+                int coefficient = random.range(-30, 30);
+                putCoefficient(bits, ac, run, coefficient != 0 ? coefficient : 1);
+                k += run + 1;
+            }
+        }
+    }
+    bits.align();
+    append(jpeg, bits.out);
+    jpeg.insert(jpeg.end(), {0xFF, 0xD9});
+    return jpeg;
+}
+
+Bytes box(const char* type, const Bytes& payload) {
+    Bytes b;
+    appendBe32(b, static_cast<uint32_t>(8 + payload.size()));
+    b.insert(b.end(), type, type + 4);
+    append(b, payload);
+    return b;
+}
+
+Bytes fullBox(const char* type, const Bytes& payload, uint32_t flags = 0) {
+    Bytes b;
+    appendBe32(b, flags);
+    append(b, payload);
+    return box(type, b);
+}
+
+// ftyp, mdat, then moov: one AVC track whose samples are runs of
+// length-prefixed NAL units, five samples to a chunk
+Bytes avcMp4(int sampleCount, uint64_t seed) {
+    Random random(seed);
+    const uint8_t nalHeaders[] = {0x65, 0x41, 0x06, 0x67, 0x68};
+    std::vector<Bytes> samples;
+    Bytes mdatPayload;
+    for (int i = 0; i < sampleCount; ++i) {
+        Bytes sample;
+        for (int nals = random.range(1, 3); nals > 0; --nals) {
+            int length = random.range(200, 6000);
+            appendBe32(sample, static_cast<uint32_t>(length));
+            sample.push_back(nalHeaders[random.range(0, 4)]);
+            append(sample, random.bytes(static_cast<size_t>(length - 1)));
+        }
+        append(mdatPayload, sample);
+        samples.push_back(std::move(sample));
+    }
+
+    Bytes ftyp = box("ftyp", {'i', 's', 'o', 'm', 0, 0, 2, 0, 'i', 's', 'o', 'm', 'a', 'v', 'c', '1'});
+    Bytes mdat = box("mdat", mdatPayload);
+
+    Bytes stsc, stsz, stco, stts;
+    appendBe32(stsc, 1);
+    for (uint32_t v : {1u, 5u, 1u}) appendBe32(stsc, v);
+    appendBe32(stsz, 0);
+    appendBe32(stsz, static_cast<uint32_t>(sampleCount));
+    Bytes chunkOffsets;
+    uint32_t chunks = 0;
+    uint64_t pos = ftyp.size() + 8;
+    for (int i = 0; i < sampleCount; ++i) {
+        appendBe32(stsz, static_cast<uint32_t>(samples[i].size()));
+        if (i % 5 == 0) {
+            appendBe32(chunkOffsets, static_cast<uint32_t>(pos));
+            chunks++;
+        }
+        pos += samples[i].size();
+    }
+    appendBe32(stco, chunks);
+    append(stco, chunkOffsets);
+    for (uint32_t v : {1u, static_cast<uint32_t>(sampleCount), 1000u}) appendBe32(stts, v);
+
+    Bytes entry(6, 0);
+    appendBe16(entry, 1);
+    entry.resize(entry.size() + 16, 0);
+    appendBe16(entry, 320);
+    appendBe16(entry, 240);
+    for (uint32_t v : {0x480000u, 0x480000u, 0u}) appendBe32(entry, v);
+    appendBe16(entry, 1);
+    entry.resize(entry.size() + 32, 0);
+    appendBe16(entry, 24);
+    appendBe16(entry, 0xFFFF);
+    append(entry, box("avcC", {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE0, 0x00}));
+    Bytes stsd;
+    appendBe32(stsd, 1);
+    append(stsd, box("avc1", entry));
+
+    Bytes stbl = fullBox("stsd", stsd);
+    append(stbl, fullBox("stts", stts));
+    append(stbl, fullBox("stsc", stsc));
+    append(stbl, fullBox("stsz", stsz));
+    append(stbl, fullBox("stco", stco));
+    Bytes minf = fullBox("vmhd", Bytes(8, 0), 1);
+    append(minf, box("stbl", stbl));
+    Bytes hdlr(4, 0);
+    hdlr.insert(hdlr.end(), {'v', 'i', 'd', 'e'});
+    hdlr.resize(hdlr.size() + 12, 0);
+    hdlr.insert(hdlr.end(), {'v', 0});
+    Bytes mdia = fullBox("mdhd", Bytes(20, 0));
+    append(mdia, fullBox("hdlr", hdlr));
+    append(mdia, box("minf", minf));
+    Bytes trak = fullBox("tkhd", Bytes(80, 0));
+    append(trak, box("mdia", mdia));
+    Bytes moov = fullBox("mvhd", Bytes(96, 0));
+    append(moov, box("trak", trak));
+
+    Bytes mp4 = ftyp;
+    append(mp4, mdat);
+    append(mp4, box("moov", moov));
+    return mp4;
+}
+
+} // namespace media
+
+namespace reassembly {
+
+const uint64_t kBlock = 4096;
+const uint64_t kBlocks = 512;
+
+// Writes data over the image in pieces of whole blocks, the last piece
+// taking the rest, and returns the ranges it was written to
+std::vector<ByteRange> place(Bytes& image, const Bytes& data, const std::vector<std::pair<uint64_t, uint64_t>>& pieces) {
+    std::vector<ByteRange> written;
+    uint64_t done = 0;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        uint64_t length = i + 1 < pieces.size() ? pieces[i].second * kBlock : data.size() - done;
+        std::copy(data.begin() + done, data.begin() + done + length, image.begin() + pieces[i].first * kBlock);
+        written.push_back({pieces[i].first * kBlock, length});
+        done += length;
+    }
+    return written;
+}
+
+} // namespace reassembly
+
+void testReassembly(const std::string& workDir) {
+    using reassembly::kBlock;
+    const std::string path = workDir + "/reassembly.img";
+
+    // Random blocks, with blank ones and one that starts another file among them
+    media::Random random(3);
+    Bytes image = random.bytes(reassembly::kBlocks * kBlock);
+    for (uint64_t block = 0; block < reassembly::kBlocks; block += 3) {
+        std::fill(image.begin() + block * kBlock, image.begin() + (block + 1) * kBlock, 0);
+    }
+
+    const Bytes jpeg = media::baselineJpeg(320, 240, 1);
+    const Bytes mp4 = media::avcMp4(40, 2);
+    const auto jpegFragments = reassembly::place(image, jpeg, {{8, 5}, {20, 0}});
+    const auto mp4Fragments = reassembly::place(image, mp4, {{120, 20}, {150, 10}, {190, 0}});
+    EXPECT(jpegFragments.back().offset + jpegFragments.back().length < 120 * kBlock);
+    // Random bytes in place of MP4 payload pass for payload until the next
+    // NAL header, so the block after each MP4 piece is blank or starts
+    // another file; the JPEG's entropy stream shows the break by itself
+    const Bytes png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    std::copy(png.begin(), png.end(), image.begin() + 15 * kBlock);
+    std::fill(image.begin() + 140 * kBlock, image.begin() + 141 * kBlock, 0);
+    std::copy(png.begin(), png.end(), image.begin() + 140 * kBlock);
+    std::fill(image.begin() + 160 * kBlock, image.begin() + 161 * kBlock, 0);
+    EXPECT(writeFile(path, image));
+
+    FragmentReassembler reassembler(path.c_str(), ReassemblyOptions());
+    ReassembledFile photo = reassembler.reassemble(jpegFragments.front().offset, JPEG, {}, {});
+    EXPECT(photo.status == CarveStatus::Complete);
+    EXPECT(sameRanges(photo.fragments, jpegFragments));
+
+    ReassembledFile video = reassembler.reassemble(mp4Fragments.front().offset, MP4, {}, {});
+    EXPECT(video.status == CarveStatus::Complete);
+    EXPECT(sameRanges(video.fragments, mp4Fragments));
+
+    unlink(path.c_str());
+}
+
+struct TestCase {
+    const char* name;
+    std::function<void(const std::string&)> run;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const TestCase cases[] = {
+        {"matcher", testMatcher},
+        {"parallel", testParallel},
+        {"reassembly", testReassembly},
+    };
+
+    std::string caseName;
+    std::string tmpRoot = "/tmp";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--tmp" && i + 1 < argc) {
+            tmpRoot = argv[++i];
+        } else if (caseName.empty() && arg[0] != '-') {
+            caseName = arg;
+        } else {
+            caseName.clear();
+            break;
+        }
+    }
+    const TestCase* selected = std::find_if(std::begin(cases), std::end(cases), [&](const TestCase& c) {
+        return caseName == c.name;
+    });
+    if (selected == std::end(cases)) {
+        fprintf(stderr, "usage: %s matcher|parallel|reassembly [--tmp DIR]\n", argv[0]);
+        return 2;
+    }
+
+    std::string pattern = tmpRoot + "/carve_test.XXXXXX";
+    std::vector<char> workDir(pattern.begin(), pattern.end());
+    workDir.push_back('\0');
+    if (!mkdtemp(workDir.data())) {
+        fprintf(stderr, "Cannot create a work directory under %s\n", tmpRoot.c_str());
+        return 1;
+    }
+    selected->run(workDir.data());
+    rmdir(workDir.data());
+
+    printf("%s: %s\n", selected->name, gFailures == 0 ? "ok" : "FAILED");
+    return gFailures == 0 ? 0 : 1;
+}
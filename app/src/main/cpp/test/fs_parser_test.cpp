@@ -0,0 +1,855 @@
+// Host checks for the filesystem parsers that map deleted files exactly.
+//
+// Each case writes a small synthetic image holding deleted files with known
+// contents, next to live files and deleted files whose blocks were handed to
+// another file since, then checks the reader returns the exact size and byte
+// ranges of the intact ones, that those ranges read back the file, and that
+// the others are left out:
+//
+//   fs_parser_test ext4|jbd2|fat32|exfat|f2fs [--tmp DIR]
+//
+// Images are sparse files in a work directory that is removed afterwards.
+
+#include "ext4_reader.h"
+#include "jbd2_journal.h"
+#include "fat_reader.h"
+#include "f2fs_reader.h"
+#include "file_recovery_engine.h"
+#include "hit_arena.h"
+#include "scan_index.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+int gFailures = 0;
+
+void expect(bool ok, const char* condition, int line) {
+    if (!ok) {
+        fprintf(stderr, "fs_parser_test.cpp:%d: expected %s\n", line, condition);
+        gFailures++;
+    }
+}
+
+#define EXPECT(condition) expect((condition), #condition, __LINE__)
+
+using Bytes = std::vector<uint8_t>;
+
+void putLe16(Bytes& b, size_t at, uint16_t v) {
+    b[at] = static_cast<uint8_t>(v);
+    b[at + 1] = static_cast<uint8_t>(v >> 8);
+}
+
+void putLe32(Bytes& b, size_t at, uint32_t v) {
+    putLe16(b, at, static_cast<uint16_t>(v));
+    putLe16(b, at + 2, static_cast<uint16_t>(v >> 16));
+}
+
+void putLe64(Bytes& b, size_t at, uint64_t v) {
+    putLe32(b, at, static_cast<uint32_t>(v));
+    putLe32(b, at + 4, static_cast<uint32_t>(v >> 32));
+}
+
+void putBe16(Bytes& b, size_t at, uint16_t v) {
+    b[at] = static_cast<uint8_t>(v >> 8);
+    b[at + 1] = static_cast<uint8_t>(v);
+}
+
+void putBe32(Bytes& b, size_t at, uint32_t v) {
+    putBe16(b, at, static_cast<uint16_t>(v >> 16));
+    putBe16(b, at + 2, static_cast<uint16_t>(v));
+}
+
+void putBits(Bytes& b, size_t at, uint32_t first, uint32_t count) {
+    for (uint32_t bit = first; bit < first + count; ++bit) b[at + bit / 8] |= static_cast<uint8_t>(1u << (bit & 7));
+}
+
+// Lower-case letters, which start no signature the carver knows
+Bytes fileContent(size_t size, unsigned seed) {
+    Bytes data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>('a' + (i * 7 + seed) % 26);
+    return data;
+}
+
+// Image file written at scattered offsets and left sparse everywhere else
+class SparseImage {
+public:
+    SparseImage(const std::string& path, uint64_t size) : path_(path) {
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ok_ = fd_ >= 0 && ftruncate(fd_, static_cast<off_t>(size)) == 0;
+    }
+    ~SparseImage() {
+        if (fd_ >= 0) close(fd_);
+        unlink(path_.c_str());
+    }
+
+    SparseImage(const SparseImage&) = delete;
+    SparseImage& operator=(const SparseImage&) = delete;
+
+    void write(uint64_t offset, const Bytes& data) {
+        ok_ = ok_ && pwrite(fd_, data.data(), data.size(), static_cast<off_t>(offset)) ==
+                     static_cast<ssize_t>(data.size());
+    }
+
+    // Bytes at the ranges a reader returned, in order
+    Bytes gather(const std::vector<ByteRange>& ranges) const {
+        Bytes data;
+        for (const auto& range : ranges) {
+            Bytes part(static_cast<size_t>(range.length));
+            if (pread(fd_, part.data(), part.size(), static_cast<off_t>(range.offset)) !=
+                static_cast<ssize_t>(part.size())) {
+                return {};
+            }
+            data.insert(data.end(), part.begin(), part.end());
+        }
+        return data;
+    }
+
+    bool ok() const { return ok_; }
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    int fd_;
+    bool ok_;
+};
+
+bool sameRanges(const std::vector<ByteRange>& actual, const std::vector<ByteRange>& expected) {
+    return actual.size() == expected.size() &&
+           std::equal(actual.begin(), actual.end(), expected.begin(), [](const ByteRange& a, const ByteRange& b) {
+               return a.offset == b.offset && a.length == b.length;
+           });
+}
+
+// ext4 with 4 KiB blocks, one group, 256-byte inodes and a 64-block journal
+namespace ext4 {
+
+const uint32_t kBlockSize = 4096;
+const uint32_t kBlocks = 2048;
+const uint32_t kInodeSize = 256;
+const uint32_t kInodes = 32;
+const uint64_t kBlockBitmap = 2;
+const uint64_t kInodeBitmap = 3;
+const uint64_t kInodeTable = 4;
+const uint32_t kJournalInode = 8;
+const uint64_t kJournalStart = 100;
+const uint32_t kJournalBlocks = 64;
+const uint64_t kRootDirectory = 250;
+const uint32_t kDeletedTime = 1700000000;
+
+struct Extent {
+    uint32_t logical;
+    uint64_t physical;
+    uint16_t length;
+};
+
+uint64_t at(uint64_t block) {
+    return block * kBlockSize;
+}
+
+Bytes inode(uint16_t mode, uint16_t links, uint32_t dtime, uint64_t size) {
+    Bytes raw(kInodeSize);
+    putLe16(raw, 0x00, mode);
+    putLe32(raw, 0x04, static_cast<uint32_t>(size));
+    putLe32(raw, 0x14, dtime);
+    putLe16(raw, 0x1A, links);
+    putLe32(raw, 0x6C, static_cast<uint32_t>(size >> 32));
+    return raw;
+}
+
+Bytes extentInode(uint16_t mode, uint16_t links, uint32_t dtime, uint64_t size, const std::vector<Extent>& extents) {
+    Bytes raw = inode(mode, links, dtime, size);
+    putLe32(raw, 0x20, Ext4Inode::kFlagExtents);
+    putLe16(raw, 0x28, 0xF30A);
+    putLe16(raw, 0x2A, static_cast<uint16_t>(extents.size()));
+    putLe16(raw, 0x2C, 4);
+    for (size_t i = 0; i < extents.size(); ++i) {
+        size_t entry = 0x28 + 12 + i * 12;
+        putLe32(raw, entry, extents[i].logical);
+        putLe16(raw, entry + 4, extents[i].length);
+        putLe16(raw, entry + 6, static_cast<uint16_t>(extents[i].physical >> 32));
+        putLe32(raw, entry + 8, static_cast<uint32_t>(extents[i].physical));
+    }
+    return raw;
+}
+
+void placeInode(Bytes& table, uint32_t number, const Bytes& raw) {
+    std::copy(raw.begin(), raw.end(), table.begin() + (number - 1) * kInodeSize);
+}
+
+// A directory block of ".", ".." and the named entries, the last record filling the block
+Bytes directoryBlock(uint32_t self, const std::vector<std::pair<uint32_t, std::string>>& names) {
+    Bytes block(kBlockSize);
+    std::vector<std::pair<uint32_t, std::string>> entries = {{self, "."}, {2, ".."}};
+    entries.insert(entries.end(), names.begin(), names.end());
+    size_t offset = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const std::string& name = entries[i].second;
+        uint16_t length = i + 1 < entries.size() ? static_cast<uint16_t>((8 + name.size() + 3) & ~3u)
+                                                 : static_cast<uint16_t>(kBlockSize - offset);
+        putLe32(block, offset, entries[i].first);
+        putLe16(block, offset + 4, length);
+        block[offset + 6] = static_cast<uint8_t>(name.size());
+        block[offset + 7] = name == "." || name == ".." ? 2 : 1;
+        memcpy(block.data() + offset + 8, name.data(), name.size());
+        offset += length;
+    }
+    return block;
+}
+
+Bytes journalHeader(uint32_t type, uint32_t sequence) {
+    Bytes block(kBlockSize);
+    putBe32(block, 0, 0xC03B3998);
+    putBe32(block, 4, type);
+    putBe32(block, 8, sequence);
+    return block;
+}
+
+// Descriptor logging fsBlocks in order; 32-bit tags without checksums
+Bytes journalDescriptor(uint32_t sequence, const std::vector<uint64_t>& fsBlocks) {
+    Bytes block = journalHeader(1, sequence);
+    size_t offset = 12;
+    for (size_t i = 0; i < fsBlocks.size(); ++i) {
+        uint16_t flags = (i > 0 ? 0x2 : 0) | (i + 1 == fsBlocks.size() ? 0x8 : 0);
+        putBe32(block, offset, static_cast<uint32_t>(fsBlocks[i]));
+        putBe16(block, offset + 6, flags);
+        offset += 8 + (i > 0 ? 0 : 16); // The first tag carries the UUID
+    }
+    return block;
+}
+
+// Deleted files with sizes and extents set out below, and a journal that
+// committed transaction 5, logging the inode table from before inodes 15 and
+// 16 were deleted, and began transaction 6 without committing it
+void build(SparseImage& image) {
+    Bytes sb(1024);
+    putLe32(sb, 0x00, kInodes);
+    putLe32(sb, 0x04, kBlocks);
+    putLe32(sb, 0x14, 0);
+    putLe32(sb, 0x18, 2);
+    putLe32(sb, 0x20, 32768);
+    putLe32(sb, 0x28, kInodes);
+    putLe16(sb, 0x38, 0xEF53);
+    putLe32(sb, 0x4C, 1);
+    putLe16(sb, 0x58, kInodeSize);
+    putLe32(sb, 0x5C, 0x4);  // has_journal
+    putLe32(sb, 0x60, 0x40); // extents
+    putLe32(sb, 0xE0, kJournalInode);
+    image.write(1024, sb);
+
+    Bytes descriptors(kBlockSize);
+    putLe32(descriptors, 0x00, static_cast<uint32_t>(kBlockBitmap));
+    putLe32(descriptors, 0x04, static_cast<uint32_t>(kInodeBitmap));
+    putLe32(descriptors, 0x08, static_cast<uint32_t>(kInodeTable));
+    image.write(at(1), descriptors);
+
+    // Metadata, journal, root directory and live file; block 500 was reused
+    // after inodes 13 and 16 let it go
+    Bytes bitmap(kBlockSize);
+    putBits(bitmap, 0, 0, 6);
+    putBits(bitmap, 0, kJournalStart, kJournalBlocks);
+    putBits(bitmap, 0, 200, 1);
+    putBits(bitmap, 0, static_cast<uint32_t>(kRootDirectory), 1);
+    putBits(bitmap, 0, 500, 1);
+    putBits(bitmap, 0, kBlocks, kBlockSize * 8 - kBlocks);
+    image.write(at(kBlockBitmap), bitmap);
+
+    const Bytes wiped = extentInode(0x81A4, 0, kDeletedTime, 0, {});
+    Bytes table(2 * kBlockSize);
+    placeInode(table, 2, extentInode(0x41ED, 3, 0, kBlockSize, {{0, kRootDirectory, 1}}));
+    placeInode(table, kJournalInode, extentInode(0x8180, 1, 0, static_cast<uint64_t>(kJournalBlocks) * kBlockSize,
+                                                 {{0, kJournalStart, kJournalBlocks}}));
+    placeInode(table, 11, extentInode(0x81A4, 1, 0, 100, {{0, 200, 1}}));
+    placeInode(table, 12, extentInode(0x81A4, 0, kDeletedTime, 9000, {{0, 300, 2}, {2, 400, 1}}));
+    placeInode(table, 13, extentInode(0x81A4, 0, kDeletedTime, 4096, {{0, 500, 1}}));
+    Bytes blockMapped = inode(0x81A4, 0, kDeletedTime, 5000);
+    putLe32(blockMapped, 0x28, 600);
+    putLe32(blockMapped, 0x2C, 601);
+    placeInode(table, 14, blockMapped);
+    placeInode(table, 15, wiped);
+    placeInode(table, 16, wiped);
+    placeInode(table, 17, wiped);
+    image.write(at(kInodeTable), table);
+    image.write(at(kRootDirectory), directoryBlock(2, {}));
+
+    image.write(at(200), fileContent(100, 11));
+    Bytes swept = fileContent(9000, 12);
+    image.write(at(300), Bytes(swept.begin(), swept.begin() + 8192));
+    image.write(at(400), Bytes(swept.begin() + 8192, swept.end()));
+    image.write(at(500), fileContent(4096, 99));
+    image.write(at(600), fileContent(5000, 14));
+    image.write(at(700), fileContent(10000, 15));
+    image.write(at(800), fileContent(4096, 17));
+
+    Bytes journalSb = journalHeader(4, 0);
+    putBe32(journalSb, 0x0C, kBlockSize);
+    putBe32(journalSb, 0x10, kJournalBlocks);
+    putBe32(journalSb, 0x14, 1);
+    putBe32(journalSb, 0x18, 5);
+    image.write(at(kJournalStart), journalSb);
+
+    Bytes before(kBlockSize);
+    placeInode(before, 2, extentInode(0x41ED, 3, 0, kBlockSize, {{0, kRootDirectory, 1}}));
+    placeInode(before, kJournalInode, extentInode(0x8180, 1, 0, static_cast<uint64_t>(kJournalBlocks) * kBlockSize,
+                                                  {{0, kJournalStart, kJournalBlocks}}));
+    placeInode(before, 15, extentInode(0x81A4, 1, 0, 10000, {{0, 700, 3}}));
+    placeInode(before, 16, extentInode(0x81A4, 1, 0, 4096, {{0, 500, 1}}));
+    image.write(at(kJournalStart + 1), journalDescriptor(5, {kInodeTable, kRootDirectory}));
+    image.write(at(kJournalStart + 2), before);
+    image.write(at(kJournalStart + 3), directoryBlock(2, {{15, "holiday.jpg"}}));
+    image.write(at(kJournalStart + 4), journalHeader(2, 5));
+
+    Bytes uncommitted(kBlockSize);
+    placeInode(uncommitted, 17 - kBlockSize / kInodeSize, extentInode(0x81A4, 1, 0, 4096, {{0, 800, 1}}));
+    image.write(at(kJournalStart + 5), journalDescriptor(6, {kInodeTable + 1}));
+    image.write(at(kJournalStart + 6), uncommitted);
+}
+
+} // namespace ext4
+
+void testExt4(SparseImage& image) {
+    ext4::build(image);
+    EXPECT(image.ok());
+
+    Ext4Reader reader;
+    EXPECT(reader.open(image.path()));
+    EXPECT(reader.blockSize() == ext4::kBlockSize);
+    EXPECT(reader.groups().size() == 1);
+
+    // 13 lost block 500 to another file, 15 to 17 were truncated when freed
+    std::vector<Ext4DeletedFile> files = reader.deletedInodes();
+    EXPECT(files.size() == 2);
+    if (files.size() != 2) return;
+
+    EXPECT(files[0].inode == 12);
+    EXPECT(files[0].dtime == ext4::kDeletedTime);
+    EXPECT(files[0].size == 9000);
+    EXPECT(sameRanges(files[0].extents, {{ext4::at(300), 8192}, {ext4::at(400), 808}}));
+    EXPECT(image.gather(files[0].extents) == fileContent(9000, 12));
+
+    // ext2-style block map
+    EXPECT(files[1].inode == 14);
+    EXPECT(files[1].size == 5000);
+    EXPECT(sameRanges(files[1].extents, {{ext4::at(600), 5000}}));
+    EXPECT(image.gather(files[1].extents) == fileContent(5000, 14));
+
+    // Returning false from the stop check leaves the sweep whole; true ends it before any group
+    EXPECT(reader.deletedInodes([] { return false; }).size() == 2);
+    EXPECT(reader.deletedInodes([] { return true; }).empty());
+}
+
+void testJbd2(SparseImage& image) {
+    ext4::build(image);
+    EXPECT(image.ok());
+
+    Ext4Reader reader;
+    EXPECT(reader.open(image.path()));
+    Jbd2Journal journal(reader);
+    EXPECT(journal.load());
+    EXPECT(journal.transactionCount() == 1);
+    EXPECT(journal.loggedBlockCount() == 2);
+
+    // Transaction 6 never committed, so inode 17's copy does not count
+    std::vector<JournalFile> files = journal.deletedFiles();
+    EXPECT(files.size() == 2);
+    if (files.size() != 2) return;
+
+    EXPECT(files[0].inode == 15);
+    EXPECT(files[0].sequence == 5);
+    EXPECT(files[0].size == 10000);
+    EXPECT(files[0].name == "holiday.jpg");
+    EXPECT(sameRanges(files[0].extents, {{ext4::at(700), 10000}}));
+    EXPECT(image.gather(files[0].extents) == fileContent(10000, 15));
+
+    // The journal still maps 16, but block 500 belongs to another file now
+    EXPECT(files[1].inode == 16);
+    EXPECT(files[1].name.empty());
+    EXPECT(sameRanges(files[1].extents, {{ext4::at(500), 4096}}));
+
+    // The engine keeps journaled files only where every block is still free,
+    // and reports the inode sweep's files alongside
+    FileRecoveryEngine engine;
+    HitArena arena;
+    EXPECT(engine.carveSignatures(image.path().c_str(), arena, [](const HitArena&, size_t, size_t) { return true; },
+                                  nullptr, 0, {}));
+    std::vector<std::pair<uint64_t, uint64_t>> journaled;
+    std::vector<std::pair<uint64_t, uint64_t>> swept;
+    for (size_t i = 0; i < arena.size(); ++i) {
+        if (arena[i].flags & kHitJournal) journaled.push_back({arena[i].offset, arena[i].length});
+        if (arena[i].flags & kHitInode) swept.push_back({arena[i].offset, arena[i].length});
+    }
+    std::sort(swept.begin(), swept.end());
+    EXPECT(journaled == (std::vector<std::pair<uint64_t, uint64_t>>{{ext4::at(700), 10000}}));
+    EXPECT(swept == (std::vector<std::pair<uint64_t, uint64_t>>{{ext4::at(300), 9000}, {ext4::at(600), 5000}}));
+
+    EXPECT(!journal.load([] { return true; }));
+}
+
+// FAT32 with 512-byte clusters, the fewest FAT32 allows
+namespace fat32 {
+
+const uint32_t kSector = 512;
+const uint32_t kClusters = 66000;
+const uint32_t kReserved = 32;
+const uint32_t kFatSectors = ((kClusters + 2) * 4 + kSector - 1) / kSector;
+const uint32_t kDataStart = kReserved + 2 * kFatSectors;
+
+uint64_t at(uint32_t cluster) {
+    return static_cast<uint64_t>(kDataStart + cluster - 2) * kSector;
+}
+
+uint8_t shortNameChecksum(const char* name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; ++i) sum = static_cast<uint8_t>(((sum & 1) << 7) + (sum >> 1) + static_cast<uint8_t>(name[i]));
+    return sum;
+}
+
+Bytes shortEntry(const char* name, uint8_t attributes, uint32_t cluster, uint32_t size) {
+    Bytes e(32);
+    memcpy(e.data(), name, 11);
+    e[11] = attributes;
+    putLe16(e, 20, static_cast<uint16_t>(cluster >> 16));
+    putLe16(e, 26, static_cast<uint16_t>(cluster));
+    putLe32(e, 28, size);
+    return e;
+}
+
+// Long-name entries, last part first, then the 8.3 entry
+Bytes namedEntry(const std::string& longName, const char* name, uint32_t cluster, uint32_t size) {
+    std::vector<uint16_t> units(longName.begin(), longName.end());
+    units.push_back(0);
+    while (units.size() % 13) units.push_back(0xFFFF);
+    const size_t offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    size_t parts = units.size() / 13;
+    Bytes entries;
+    for (size_t part = parts; part-- > 0;) {
+        Bytes e(32);
+        e[0] = static_cast<uint8_t>((part + 1) | (part + 1 == parts ? 0x40 : 0));
+        for (size_t c = 0; c < 13; ++c) putLe16(e, offsets[c], units[part * 13 + c]);
+        e[11] = 0x0F;
+        e[13] = shortNameChecksum(name);
+        entries.insert(entries.end(), e.begin(), e.end());
+    }
+    Bytes last = shortEntry(name, 0x20, cluster, size);
+    entries.insert(entries.end(), last.begin(), last.end());
+    return entries;
+}
+
+Bytes deleted(Bytes entries) {
+    for (size_t i = 0; i < entries.size(); i += 32) entries[i] = 0xE5;
+    return entries;
+}
+
+void build(SparseImage& image) {
+    Bytes boot(kSector);
+    boot[0] = 0xEB;
+    boot[1] = 0x58;
+    boot[2] = 0x90;
+    memcpy(boot.data() + 3, "MSWIN4.1", 8);
+    putLe16(boot, 0x0B, kSector);
+    boot[0x0D] = 1;
+    putLe16(boot, 0x0E, kReserved);
+    boot[0x10] = 2;
+    boot[0x15] = 0xF8;
+    putLe32(boot, 0x20, kDataStart + kClusters);
+    putLe32(boot, 0x24, kFatSectors);
+    putLe32(boot, 0x2C, 2);
+    memcpy(boot.data() + 82, "FAT32   ", 8);
+    boot[510] = 0x55;
+    boot[511] = 0xAA;
+    image.write(0, boot);
+
+    // Root at 2, KEEP.TXT at 40, and NEW.BIN at 20 and 21 where GONE.TXT was
+    Bytes fat(8 + 4 * 64);
+    putLe32(fat, 0, 0x0FFFFFF8);
+    putLe32(fat, 4, 0x0FFFFFFF);
+    putLe32(fat, 2 * 4, 0x0FFFFFFF);
+    putLe32(fat, 20 * 4, 21);
+    putLe32(fat, 21 * 4, 0x0FFFFFFF);
+    putLe32(fat, 40 * 4, 0x0FFFFFFF);
+    for (uint32_t copy = 0; copy < 2; ++copy) {
+        image.write(static_cast<uint64_t>(kReserved + copy * kFatSectors) * kSector, fat);
+    }
+
+    Bytes root;
+    auto add = [&root](const Bytes& entries) { root.insert(root.end(), entries.begin(), entries.end()); };
+    add(deleted(namedEntry("Holiday photo.jpg", "HOLIDA~1JPG", 10, 1300)));
+    add(deleted(shortEntry("GONE    TXT", 0x20, 20, 900)));
+    add(shortEntry("NEW     BIN", 0x20, 20, 1000));
+    add(deleted(shortEntry("NOTES   TXT", 0x20, 30, 600)));
+    add(namedEntry("keep.txt", "KEEP    TXT", 40, 100));
+    add(deleted(shortEntry("OLDDIR     ", 0x10, 50, 0)));
+    image.write(at(2), root);
+
+    Bytes old;
+    old.insert(old.end(), 64, 0);
+    Bytes dot = shortEntry(".          ", 0x10, 50, 0);
+    Bytes dotDot = shortEntry("..         ", 0x10, 0, 0);
+    std::copy(dot.begin(), dot.end(), old.begin());
+    std::copy(dotDot.begin(), dotDot.end(), old.begin() + 32);
+    Bytes inner = deleted(shortEntry("INNER   TXT", 0x20, 51, 200));
+    old.insert(old.end(), inner.begin(), inner.end());
+    image.write(at(50), old);
+
+    image.write(at(10), fileContent(1300, 1));
+    image.write(at(20), fileContent(1000, 2));
+    image.write(at(30), fileContent(600, 3));
+    image.write(at(40), fileContent(100, 4));
+    image.write(at(51), fileContent(200, 5));
+}
+
+} // namespace fat32
+
+void testFat32(SparseImage& image) {
+    fat32::build(image);
+    EXPECT(image.ok());
+
+    FatReader reader;
+    EXPECT(reader.open(image.path()));
+    EXPECT(reader.kind() == FatReader::Kind::Fat32);
+    EXPECT(reader.clusterCount() == fat32::kClusters);
+
+    // GONE.TXT's clusters now belong to NEW.BIN
+    std::vector<FatFile> files = reader.deletedFiles();
+    EXPECT(files.size() == 3);
+    if (files.size() != 3) return;
+
+    EXPECT(files[0].path == "/Holiday photo.jpg");
+    EXPECT(files[0].size == 1300);
+    EXPECT(sameRanges(files[0].extents, {{fat32::at(10), 1300}}));
+    EXPECT(image.gather(files[0].extents) == fileContent(1300, 1));
+
+    // Without a long name the deleted marker hides the first character
+    EXPECT(files[1].path == "/_OTES.TXT");
+    EXPECT(sameRanges(files[1].extents, {{fat32::at(30), 600}}));
+    EXPECT(image.gather(files[1].extents) == fileContent(600, 3));
+
+    EXPECT(files[2].path == "/_LDDIR/_NNER.TXT");
+    EXPECT(sameRanges(files[2].extents, {{fat32::at(51), 200}}));
+    EXPECT(image.gather(files[2].extents) == fileContent(200, 5));
+}
+
+// exFAT with 4 KiB clusters
+namespace exfat {
+
+const uint32_t kSector = 512;
+const uint32_t kClusterSize = 4096;
+const uint32_t kClusters = 4000;
+const uint32_t kFatOffset = 128;
+const uint32_t kFatLength = ((kClusters + 2) * 4 + kSector - 1) / kSector;
+const uint32_t kHeapOffset = kFatOffset + kFatLength + 64;
+
+uint64_t at(uint32_t cluster) {
+    return static_cast<uint64_t>(kHeapOffset) * kSector + static_cast<uint64_t>(cluster - 2) * kClusterSize;
+}
+
+// File, stream extension and name entries with their set checksum
+Bytes entrySet(const std::string& name, uint32_t cluster, uint64_t size, bool noFatChain, bool inUse,
+               bool badChecksum = false) {
+    size_t nameEntries = (name.size() + 14) / 15;
+    Bytes set((2 + nameEntries) * 32);
+    set[0] = 0x85;
+    set[1] = static_cast<uint8_t>(1 + nameEntries);
+    putLe16(set, 4, 0x20);
+    set[32] = 0xC0;
+    set[33] = noFatChain ? 0x03 : 0x01;
+    set[35] = static_cast<uint8_t>(name.size());
+    putLe64(set, 40, size);
+    putLe32(set, 52, cluster);
+    putLe64(set, 56, size);
+    for (size_t i = 0; i < name.size(); ++i) {
+        size_t entry = 64 + i / 15 * 32;
+        set[entry] = 0xC1;
+        putLe16(set, entry + 2 + i % 15 * 2, static_cast<uint8_t>(name[i]));
+    }
+
+    uint16_t sum = 0;
+    for (size_t i = 0; i < set.size(); ++i) {
+        if (i == 2 || i == 3) continue;
+        sum = static_cast<uint16_t>(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + set[i]);
+    }
+    putLe16(set, 2, badChecksum ? sum ^ 1 : sum);
+    if (!inUse) {
+        for (size_t i = 0; i < set.size(); i += 32) set[i] &= 0x7F;
+    }
+    return set;
+}
+
+void build(SparseImage& image) {
+    Bytes boot(kSector);
+    boot[0] = 0xEB;
+    boot[1] = 0x76;
+    boot[2] = 0x90;
+    memcpy(boot.data() + 3, "EXFAT   ", 8);
+    putLe64(boot, 72, kHeapOffset + static_cast<uint64_t>(kClusters) * (kClusterSize / kSector));
+    putLe32(boot, 80, kFatOffset);
+    putLe32(boot, 84, kFatLength);
+    putLe32(boot, 88, kHeapOffset);
+    putLe32(boot, 92, kClusters);
+    putLe32(boot, 96, 4);
+    boot[108] = 9;
+    boot[109] = 3;
+    boot[110] = 1;
+    boot[510] = 0x55;
+    boot[511] = 0xAA;
+    image.write(0, boot);
+
+    // Bitmap, up-case table and root, then the fragmented file's chain 20, 21, 30
+    Bytes fat(4 * 64);
+    putLe32(fat, 0, 0xFFFFFFF8);
+    putLe32(fat, 4, 0xFFFFFFFF);
+    for (uint32_t cluster : {2u, 3u, 4u, 30u}) putLe32(fat, cluster * 4, 0xFFFFFFFF);
+    putLe32(fat, 20 * 4, 21);
+    putLe32(fat, 21 * 4, 30);
+    image.write(static_cast<uint64_t>(kFatOffset) * kSector, fat);
+
+    // Clusters 22 to 29 went to a file since deleted from the directory, 50 was reused
+    Bytes bitmap((kClusters + 7) / 8);
+    putBits(bitmap, 0, 0, 3);
+    putBits(bitmap, 0, 20, 8);
+    putBits(bitmap, 0, 48, 1);
+    putBits(bitmap, 0, 58, 1);
+    image.write(at(2), bitmap);
+
+    Bytes root(32);
+    root[0] = 0x81;
+    putLe32(root, 20, 2);
+    putLe64(root, 24, bitmap.size());
+    auto add = [&root](const Bytes& set) { root.insert(root.end(), set.begin(), set.end()); };
+    add(entrySet("video clip.mp4", 10, 10000, true, false));
+    add(entrySet("fragmented.jpg", 20, 2 * kClusterSize + 100, false, false));
+    add(entrySet("bad.txt", 40, 500, true, false, true));
+    add(entrySet("reused.txt", 50, 500, true, false));
+    add(entrySet("live.txt", 60, 700, true, true));
+    image.write(at(4), root);
+
+    Bytes video = fileContent(10000, 1);
+    Bytes fragmented = fileContent(2 * kClusterSize + 100, 2);
+    image.write(at(10), video);
+    image.write(at(20), Bytes(fragmented.begin(), fragmented.begin() + 2 * kClusterSize));
+    image.write(at(30), Bytes(fragmented.begin() + 2 * kClusterSize, fragmented.end()));
+    image.write(at(40), fileContent(500, 3));
+    image.write(at(50), fileContent(500, 4));
+    image.write(at(60), fileContent(700, 5));
+}
+
+} // namespace exfat
+
+void testExFat(SparseImage& image) {
+    exfat::build(image);
+    EXPECT(image.ok());
+
+    FatReader reader;
+    EXPECT(reader.open(image.path()));
+    EXPECT(reader.kind() == FatReader::Kind::ExFat);
+    EXPECT(reader.clusterSize() == exfat::kClusterSize);
+
+    // bad.txt fails its set checksum and reused.txt lost its cluster
+    std::vector<FatFile> files = reader.deletedFiles();
+    EXPECT(files.size() == 2);
+    if (files.size() != 2) return;
+
+    EXPECT(files[0].path == "/video clip.mp4");
+    EXPECT(files[0].size == 10000);
+    EXPECT(sameRanges(files[0].extents, {{exfat::at(10), 10000}}));
+    EXPECT(image.gather(files[0].extents) == fileContent(10000, 1));
+
+    // Deleting leaves the chain in the FAT
+    EXPECT(files[1].path == "/fragmented.jpg");
+    EXPECT(files[1].size == 2 * exfat::kClusterSize + 100);
+    EXPECT(sameRanges(files[1].extents, {{exfat::at(20), 2 * exfat::kClusterSize}, {exfat::at(30), 100}}));
+    EXPECT(image.gather(files[1].extents) == fileContent(2 * exfat::kClusterSize + 100, 2));
+}
+
+// F2FS with the checkpoint, SIT, NAT and SSA areas at their usual places and four main segments
+namespace f2fs {
+
+const uint32_t kBlockSize = 4096;
+const uint32_t kSegment = 512;
+const uint32_t kCheckpoint = 512;
+const uint32_t kSit = 1536;
+const uint32_t kNat = 2560;
+const uint32_t kMain = 4096;
+const uint32_t kMainSegments = 4;
+const uint32_t kVersion = 4;
+
+uint64_t at(uint32_t block) {
+    return static_cast<uint64_t>(block) * kBlockSize;
+}
+
+uint32_t mainBlock(uint32_t segment, uint32_t index) {
+    return kMain + segment * kSegment + index;
+}
+
+uint32_t checksum(const Bytes& data, size_t length) {
+    uint32_t crc = 0xF2F52010;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+    }
+    return crc;
+}
+
+Bytes inode(uint32_t ino, const std::string& name, uint64_t size, const std::vector<uint32_t>& addresses,
+            uint32_t version) {
+    Bytes node(kBlockSize);
+    putLe16(node, 0, 0x81A4);
+    putLe64(node, 16, size);
+    putLe32(node, 68, 1);
+    putLe32(node, 88, static_cast<uint32_t>(name.size()));
+    memcpy(node.data() + 92, name.data(), name.size());
+    for (size_t i = 0; i < addresses.size(); ++i) putLe32(node, 360 + i * 4, addresses[i]);
+    putLe32(node, 4072, ino);
+    putLe32(node, 4076, ino);
+    putLe64(node, 4084, version);
+    return node;
+}
+
+void sitEntry(Bytes& sit, uint32_t segment, uint32_t type, const std::vector<uint32_t>& validBlocks) {
+    size_t entry = segment * 74;
+    putLe16(sit, entry, static_cast<uint16_t>((type << 10) | validBlocks.size()));
+    for (uint32_t block : validBlocks) sit[entry + 2 + block / 8] |= static_cast<uint8_t>(0x80 >> (block & 7));
+}
+
+// Segment 0 holds node blocks and segment 1 data. Inode 4 is live; 5 was
+// deleted after being written twice; 6 was deleted and one of its blocks reused.
+void build(SparseImage& image) {
+    Bytes sb(3072);
+    putLe32(sb, 0, 0xF2F52010);
+    putLe32(sb, 16, 12);
+    putLe32(sb, 20, 9);
+    putLe64(sb, 36, kMain + kMainSegments * kSegment);
+    putLe32(sb, 56, 2);
+    putLe32(sb, 60, 2);
+    putLe32(sb, 64, 1);
+    putLe32(sb, 68, kMainSegments);
+    putLe32(sb, 76, kCheckpoint);
+    putLe32(sb, 80, kSit);
+    putLe32(sb, 84, kNat);
+    putLe32(sb, 88, 3584);
+    putLe32(sb, 92, kMain);
+    image.write(1024, sb);
+    image.write(kBlockSize + 1024, sb);
+
+    // Compact summaries with empty SIT and NAT journals; the second pack stays blank
+    Bytes checkpoint(kBlockSize);
+    putLe64(checkpoint, 0, kVersion);
+    putLe32(checkpoint, 132, 0x4 | 0x1);
+    putLe32(checkpoint, 136, 8);
+    putLe32(checkpoint, 140, 1);
+    putLe32(checkpoint, 156, 64);
+    putLe32(checkpoint, 160, 64);
+    putLe32(checkpoint, 164, 4092);
+    putLe32(checkpoint, 4092, checksum(checkpoint, 4092));
+    image.write(at(kCheckpoint), checkpoint);
+    image.write(at(kCheckpoint + 7), checkpoint);
+
+    Bytes sit(kBlockSize);
+    sitEntry(sit, 0, 4, {0});
+    sitEntry(sit, 1, 1, {19, 28});
+    image.write(at(kSit), sit);
+
+    Bytes nat(kBlockSize);
+    putLe32(nat, 4 * 9 + 1, 4);
+    putLe32(nat, 4 * 9 + 5, mainBlock(0, 0));
+    image.write(at(kNat), nat);
+
+    image.write(at(mainBlock(0, 0)), inode(4, "live.txt", 100, {mainBlock(1, 28)}, 4));
+    image.write(at(mainBlock(0, 1)), inode(5, "photo.jpg", 10000,
+                                           {mainBlock(1, 0), mainBlock(1, 1), mainBlock(1, 2)}, 4));
+    image.write(at(mainBlock(0, 2)), inode(5, "photo.jpg", 3000, {mainBlock(1, 8)}, 2));
+    image.write(at(mainBlock(0, 3)), inode(6, "reused.bin", 8000, {mainBlock(1, 18), mainBlock(1, 19)}, 4));
+    image.write(at(mainBlock(0, 4)), inode(4, "live.txt", 50, {mainBlock(1, 27)}, 3));
+
+    image.write(at(mainBlock(1, 0)), fileContent(10000, 5));
+    image.write(at(mainBlock(1, 8)), fileContent(3000, 50));
+    image.write(at(mainBlock(1, 18)), fileContent(8000, 6));
+    image.write(at(mainBlock(1, 28)), fileContent(100, 4));
+}
+
+} // namespace f2fs
+
+void testF2fs(SparseImage& image) {
+    f2fs::build(image);
+    EXPECT(image.ok());
+
+    F2fsReader reader;
+    EXPECT(reader.open(image.path()));
+    EXPECT(!reader.isBlockValid(f2fs::mainBlock(1, 0)));
+    EXPECT(reader.isBlockValid(f2fs::mainBlock(1, 19)));
+
+    // Only the newest version of 5; 6 lost a block, and 4 is still in the NAT
+    std::vector<F2fsFile> files = reader.deletedFiles();
+    EXPECT(files.size() == 1);
+    if (files.size() != 1) return;
+
+    EXPECT(files[0].ino == 5);
+    EXPECT(files[0].name == "photo.jpg");
+    EXPECT(files[0].size == 10000);
+    EXPECT(sameRanges(files[0].extents, {{f2fs::at(f2fs::mainBlock(1, 0)), 10000}}));
+    EXPECT(image.gather(files[0].extents) == fileContent(10000, 5));
+
+    EXPECT(reader.deletedFiles([] { return true; }).empty());
+}
+
+struct TestCase {
+    const char* name;
+    uint64_t imageSize;
+    std::function<void(SparseImage&)> run;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const TestCase cases[] = {
+        {"ext4", static_cast<uint64_t>(ext4::kBlocks) * ext4::kBlockSize, testExt4},
+        {"jbd2", static_cast<uint64_t>(ext4::kBlocks) * ext4::kBlockSize, testJbd2},
+        {"fat32", static_cast<uint64_t>(fat32::kDataStart + fat32::kClusters) * fat32::kSector, testFat32},
+        {"exfat", exfat::at(exfat::kClusters + 2), testExFat},
+        {"f2fs", f2fs::at(f2fs::kMain + f2fs::kMainSegments * f2fs::kSegment), testF2fs},
+    };
+
+    std::string caseName;
+    std::string tmpRoot = "/tmp";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--tmp" && i + 1 < argc) {
+            tmpRoot = argv[++i];
+        } else if (caseName.empty() && arg[0] != '-') {
+            caseName = arg;
+        } else {
+            caseName.clear();
+            break;
+        }
+    }
+    const TestCase* selected = std::find_if(std::begin(cases), std::end(cases), [&](const TestCase& c) {
+        return caseName == c.name;
+    });
+    if (selected == std::end(cases)) {
+        fprintf(stderr, "usage: %s ext4|jbd2|fat32|exfat|f2fs [--tmp DIR]\n", argv[0]);
+        return 2;
+    }
+
+    std::string pattern = tmpRoot + "/fs_parser_test.XXXXXX";
+    std::vector<char> workDir(pattern.begin(), pattern.end());
+    workDir.push_back('\0');
+    if (!mkdtemp(workDir.data())) {
+        fprintf(stderr, "Cannot create a work directory under %s\n", tmpRoot.c_str());
+        return 1;
+    }
+    {
+        SparseImage image(std::string(workDir.data()) + "/" + selected->name + ".img", selected->imageSize);
+        selected->run(image);
+    }
+    rmdir(workDir.data());
+
+    printf("%s: %s\n", selected->name, gFailures == 0 ? "ok" : "FAILED");
+    return gFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include "thread_pool.h"
+#include <unistd.h>
+
+ThreadPool::ThreadPool(size_t threadCount)
+        : nextQueue_(0), pending_(0), stopping_(false) {
+    if (threadCount == 0) {
+        threadCount = defaultThreadCount();
+    }
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        queues_.emplace_back(new WorkQueue());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    workAvailable_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::defaultThreadCount() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = static_cast<long>(std::thread::hardware_concurrency());
+    }
+    return cores > 0 ? static_cast<size_t>(cores) : 1;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    // Count the task before it becomes visible: a running task may submit
+    // more work, and wait() must not see zero between the two steps. The push
+    // also happens under mutex_, or a worker that has just found every queue
+    // empty could miss the notify before it starts waiting.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+        std::lock_guard<std::mutex> queueLock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    workAvailable_.notify_all();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return pending_ == 0; });
+}
+
+bool ThreadPool::popTask(size_t index, std::function<void()>& task) {
+    // Own queue first, oldest task first so work roughly follows submission order
+    {
+        WorkQueue& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of the other queues
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        WorkQueue& victim = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    while (true) {
+        std::function<void()> task;
+        if (popTask(index, task)) {
+            task();
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) {
+                idle_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopping_) return;
+        // Re-check under the lock: tasks submitted since the failed pop bump pending_
+        size_t queued = 0;
+        for (auto& queue : queues_) {
+            std::lock_guard<std::mutex> queueLock(queue->mutex);
+            queued += queue->tasks.size();
+        }
+        if (queued == 0) {
+            workAvailable_.wait(lock);
+        }
+    }
+}
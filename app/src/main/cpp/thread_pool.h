@@ -0,0 +1,52 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// Fixed-size pool with one task deque per worker. Workers take their own
+// tasks oldest-first and steal from the back of other queues when idle.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadCount = 0); // 0 = one per online core
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Safe to call from inside a running task
+    void submit(std::function<void()> task);
+    // Blocks until every submitted task has finished, including ones they submitted
+    void wait();
+
+    size_t threadCount() const { return workers_.size(); }
+    static size_t defaultThreadCount();
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(size_t index);
+    bool popTask(size_t index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> nextQueue_;
+
+    std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable idle_;
+    size_t pending_;
+    bool stopping_;
+};
+
+#endif // THREAD_POOL_H
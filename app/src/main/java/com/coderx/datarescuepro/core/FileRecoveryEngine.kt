@@ -6,23 +6,31 @@ import android.database.Cursor
 import android.graphics.Bitmap
 import android.graphics.BitmapFactory
 import android.media.MediaMetadataRetriever
+import android.os.Build
 import android.os.Environment
+import android.os.ParcelFileDescriptor
 import android.provider.MediaStore
 import android.util.Log
 import com.coderx.datarescuepro.data.model.FileType
 import com.coderx.datarescuepro.data.model.RecoverableFile
 import com.coderx.datarescuepro.data.model.RecoveryCategory
+import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.awaitCancellation
+import kotlinx.coroutines.isActive
+import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
 import java.io.File
 import java.io.FileInputStream
-import java.io.FileOutputStream
+import java.io.InputStream
 import java.text.SimpleDateFormat
 import java.util.*
 
 class FileRecoveryEngine {
     companion object {
         private const val TAG = "FileRecoveryEngine"
+        private const val SCAN_INDEX_FILE = "scan_index.bin"
+        private const val PREVIEW_MAX_DIMENSION = 256
 
         init {
             System.loadLibrary("datarescuepro")
@@ -30,20 +38,146 @@ class FileRecoveryEngine {
     }
 
     private external fun nativeGetVersion(): String
+    private external fun nativeConfigureScan(threads: Int, stripeBytes: Long, queueDepth: Int)
+    private external fun nativeSetScanIndexPath(indexPath: String?)
+    private external fun nativeConfigureMemoryBudget(limitBytes: Long, spillDirectory: String?)
     private external fun nativeDeepScan(path: String, isRooted: Boolean): IntArray
     private external fun nativeDetectRoot(): Boolean
     private external fun nativeIdentifyFileType(signature: ByteArray): Int
     private external fun nativeRecoverDeletedFile(path: String): ByteArray?
+    private external fun nativeRecoverToFd(path: String, fd: Int): Boolean
+    private external fun nativeExtractPreview(location: String): ByteArray?
     private external fun nativeScanFreeClusters(devicePath: String): Array<String>
+    private external fun nativeDeepScanStreaming(path: String, isRooted: Boolean, listener: NativeHitListener): Boolean
+    private external fun nativeQueryScanStreaming(
+        path: String,
+        isRooted: Boolean,
+        fileTypes: IntArray?,
+        ranges: LongArray?,
+        directories: Array<String>?,
+        minSize: Long,
+        maxSize: Long,
+        maxResults: Int,
+        timeBudgetMillis: Long,
+        listener: NativeHitListener
+    ): Boolean
+    private external fun nativeScanFreeClustersStreaming(devicePath: String, listener: NativeHitListener): Boolean
+    private external fun nativeGetScanStats(): LongArray
+    private external fun nativeResetScanStats()
 
     fun getVersion(): String = nativeGetVersion()
 
     fun detectRootAccess(): Boolean = nativeDetectRoot()
 
-    suspend fun performFullScan(context: Context, isRooted: Boolean = false): List<RecoverableFile> = withContext(Dispatchers.IO) {
+    // threads = 0 uses one thread per core, 1 forces the sequential path;
+    // stripeBytes = 0 keeps the current stripe size; queueDepth is the number of
+    // device reads kept in flight (io_uring where allowed), 0 keeps the current one
+    fun configureScan(threads: Int = 0, stripeBytes: Long = 0L, queueDepth: Int = 0) =
+        nativeConfigureScan(threads, stripeBytes, queueDepth)
+
+    // Caps the native buffers scans and recoveries hold at limitBytes (0 removes the cap).
+    // Over it, scans read in smaller blocks, carve fewer stripes at once and spill hits to
+    // the cache directory; whole-file recovery into a ByteArray is refused past the cap.
+    // ScanStats.peakBytes and budgetStallNanos show how a budget fits a device class.
+    fun configureMemoryBudget(context: Context, limitBytes: Long) =
+        nativeConfigureMemoryBudget(limitBytes, context.cacheDir.absolutePath)
+
+    private var scanIndexConfigured = false
+
+    // Re-scans only revisit ranges and directories that changed since the last scan.
+    // On by default; the first native scan enables it unless this was called before.
+    fun enableScanIndex(context: Context, enabled: Boolean = true) {
+        nativeSetScanIndexPath(if (enabled) File(context.noBackupFilesDir, SCAN_INDEX_FILE).absolutePath else null)
+        scanIndexConfigured = true
+    }
+
+    // Forget earlier scans so the next one starts from scratch
+    fun clearScanIndex(context: Context) {
+        File(context.noBackupFilesDir, SCAN_INDEX_FILE).delete()
+    }
+
+    // Native scan counters since the current full scan started; cheap enough to poll from the UI
+    fun getScanStats(): ScanStats = ScanStats.fromArray(nativeGetScanStats())
+
+    // Signature carve of one device or image that can be paused and polled while
+    // carveWithSession runs; each source keeps its own checkpoint between sessions
+    fun openScanSession(context: Context, sourcePath: String): ScanSession {
+        val checkpoint = File(context.noBackupFilesDir, "session_${Integer.toHexString(sourcePath.hashCode())}.bin")
+        return ScanSession(sourcePath, checkpoint.absolutePath)
+    }
+
+    // Runs the session to its end; cancelling the coroutine cancels the carve and
+    // keeps its checkpoint, so the next session on the source resumes there
+    suspend fun carveWithSession(
+        session: ScanSession,
+        onPartialResults: ((List<RecoverableFile>) -> Unit)? = null
+    ): List<RecoverableFile> = withContext(Dispatchers.IO) {
+        val files = mutableListOf<RecoverableFile>()
+        val path = session.sourcePath
+        // The carve may go a long time between hits, so cancellation cannot wait for onHits
+        val canceller = launch {
+            try {
+                awaitCancellation()
+            } finally {
+                session.cancel()
+            }
+        }
+
+        try {
+            session.run(object : NativeHitListener {
+                private val fragmentLocations = HashMap<Int, String>()
+
+                override fun onFragments(index: Int, extents: LongArray) {
+                    fragmentLocations[index] = "$path@" +
+                        (extents.indices step 2).joinToString(",") { "${extents[it]}+${extents[it + 1]}" }
+                }
+
+                // Hit indices count from 0 in this session, as do the entries of files
+                override fun onDuplicate(index: Int, location: String) {
+                    val file = files.getOrNull(index) ?: return
+                    files[index] = file.copy(duplicateLocations = file.duplicateLocations + location)
+                }
+
+                override fun onHits(records: ByteArray, firstIndex: Int, count: Int): Boolean {
+                    val batch = NativeHit.decode(records, firstIndex, count).map { hit ->
+                        val location = fragmentLocations.remove(hit.index) ?: "$path@${hit.offset}+${hit.length}"
+                        RecoverableFile(
+                            name = "carved_${hit.offset}",
+                            path = location,
+                            size = hit.length,
+                            type = nativeTypeToFileType(hit.fileType),
+                            lastModified = System.currentTimeMillis(),
+                            isRecoverable = true,
+                            recoveryLocation = location,
+                            recoveryConfidence = hit.confidence / 100f,
+                            recoveryCategory = RecoveryCategory.DEEP_SCAN
+                        )
+                    }
+                    files.addAll(batch)
+                    onPartialResults?.invoke(batch)
+                    return true
+                }
+            })
+        } catch (e: Exception) {
+            Log.e(TAG, "Error in session carve of $path", e)
+        } finally {
+            canceller.cancel()
+        }
+
+        files
+    }
+
+    // onPartialResults receives native hits as soon as they are found, before the full scan completes
+    suspend fun performFullScan(
+        context: Context,
+        isRooted: Boolean = false,
+        onPartialResults: ((List<RecoverableFile>) -> Unit)? = null
+    ): List<RecoverableFile> = withContext(Dispatchers.IO) {
         val allFiles = mutableListOf<RecoverableFile>()
 
         try {
+            nativeResetScanStats()
+
             // Scan media files using MediaStore
             allFiles.addAll(scanMediaFiles(context))
 
@@ -57,11 +191,12 @@ class FileRecoveryEngine {
             allFiles.addAll(scanTemporaryFiles(context))
 
             // Enhanced native scan for both rooted and unrooted devices
-            allFiles.addAll(performNativeScan(context, isRooted))
+            allFiles.addAll(performNativeScan(context, isRooted, onPartialResults))
+            Log.i(TAG, "Native scan: ${getScanStats()}")
 
             // Scan for recoverable data in free space clusters
             if (isRooted) {
-                allFiles.addAll(scanFreeClusters(context))
+                allFiles.addAll(scanFreeClusters(context, onPartialResults))
             }
 
         } catch (e: Exception) {
@@ -71,6 +206,29 @@ class FileRecoveryEngine {
         allFiles.distinctBy { it.path }.sortedByDescending { it.recoveryConfidence }
     }
 
+    // Native deep scan of one directory, device or image narrowed to query; far quicker
+    // than a full pass when the query names a few types or stops after a few results
+    suspend fun performTargetedScan(
+        path: String,
+        query: ScanQuery,
+        isRooted: Boolean = false,
+        onPartialResults: ((List<RecoverableFile>) -> Unit)? = null
+    ): List<RecoverableFile> = withContext(Dispatchers.IO) {
+        val files = mutableListOf<RecoverableFile>()
+
+        try {
+            nativeQueryScanStreaming(
+                path, isRooted, query.nativeTypes(), query.nativeRanges(), query.directories.toTypedArray(),
+                query.minSize, query.maxSize, query.maxResults, query.timeBudgetMillis,
+                deepScanListener(path, isRooted, files, onPartialResults)
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Error in targeted scan", e)
+        }
+
+        files
+    }
+
     private suspend fun scanMediaFiles(context: Context): List<RecoverableFile> = withContext(Dispatchers.IO) {
         val files = mutableListOf<RecoverableFile>()
         
@@ -226,10 +384,18 @@ class FileRecoveryEngine {
         files
     }
 
-    private suspend fun performNativeScan(context: Context, isRooted: Boolean): List<RecoverableFile> = withContext(Dispatchers.IO) {
+    private suspend fun performNativeScan(
+        context: Context,
+        isRooted: Boolean,
+        onPartialResults: ((List<RecoverableFile>) -> Unit)?
+    ): List<RecoverableFile> = withContext(Dispatchers.IO) {
         val files = mutableListOf<RecoverableFile>()
         
         try {
+            if (!scanIndexConfigured) {
+                enableScanIndex(context)
+            }
+
             val scanPaths = if (isRooted) {
                 arrayOf("/data", "/system", "/sdcard", "/storage")
             } else {
@@ -237,23 +403,7 @@ class FileRecoveryEngine {
             }
 
             scanPaths.forEach { path ->
-                val results = nativeDeepScan(path, isRooted)
-                results.forEach { fileId ->
-                    // Convert native scan results to RecoverableFile objects
-                    files.add(
-                        RecoverableFile(
-                            name = "recovered_file_$fileId",
-                            path = "$path/recovered_$fileId",
-                            size = 0L, // Will be determined during recovery
-                            type = FileType.UNKNOWN,
-                            lastModified = System.currentTimeMillis(),
-                            isRecoverable = true,
-                            recoveryLocation = "$path/recovered_$fileId",
-                            recoveryConfidence = if (isRooted) 0.7f else 0.5f,
-                            recoveryCategory = if (isRooted) RecoveryCategory.ROOT_SCAN else RecoveryCategory.DEEP_SCAN
-                        )
-                    )
-                }
+                nativeDeepScanStreaming(path, isRooted, deepScanListener(path, isRooted, files, onPartialResults))
             }
         } catch (e: Exception) {
             Log.e(TAG, "Error in native scan", e)
@@ -262,29 +412,97 @@ class FileRecoveryEngine {
         files
     }
 
-    private suspend fun scanFreeClusters(context: Context): List<RecoverableFile> = withContext(Dispatchers.IO) {
+    // Appends the hits of one path to files as RecoverableFiles; the scan stops once the scope is cancelled
+    private fun CoroutineScope.deepScanListener(
+        path: String,
+        isRooted: Boolean,
+        files: MutableList<RecoverableFile>,
+        onPartialResults: ((List<RecoverableFile>) -> Unit)?
+    ): NativeHitListener = object : NativeHitListener {
+        // Reassembled files and directory entries, by hit index, until their record arrives
+        private val fragmentLocations = HashMap<Int, String>()
+        private val entryLocations = HashMap<Int, String>()
+        // Where each hit of this path landed in files, for merging later copies into it
+        private val positions = HashMap<Int, Int>()
+
+        override fun onFragments(index: Int, extents: LongArray) {
+            fragmentLocations[index] = "$path@" +
+                (extents.indices step 2).joinToString(",") { "${extents[it]}+${extents[it + 1]}" }
+        }
+
+        override fun onLocation(index: Int, location: String) {
+            entryLocations[index] = location
+        }
+
+        override fun onDuplicate(index: Int, location: String) {
+            val position = positions[index] ?: return
+            val file = files[position]
+            files[position] = file.copy(duplicateLocations = file.duplicateLocations + location)
+        }
+
+        override fun onHits(records: ByteArray, firstIndex: Int, count: Int): Boolean {
+            // Convert native scan results to RecoverableFile objects
+            val batch = NativeHit.decode(records, firstIndex, count).map { hit ->
+                val fileId = hit.index
+                // Carved hits carry their extent so recovery copies exactly those bytes
+                val location = entryLocations.remove(hit.index) ?: when {
+                    hit.isFragmented -> fragmentLocations.remove(hit.index) ?: "$path@${hit.offset}"
+                    hit.offset > 0 && hit.length > 0 -> "$path@${hit.offset}+${hit.length}"
+                    hit.offset > 0 -> "$path@${hit.offset}"
+                    else -> "$path/recovered_$fileId"
+                }
+                RecoverableFile(
+                    name = "recovered_file_$fileId",
+                    path = location,
+                    size = hit.length,
+                    type = nativeTypeToFileType(hit.fileType),
+                    lastModified = System.currentTimeMillis(),
+                    isRecoverable = true,
+                    recoveryLocation = location,
+                    recoveryConfidence = hit.confidence / 100f,
+                    recoveryCategory = if (isRooted) RecoveryCategory.ROOT_SCAN else RecoveryCategory.DEEP_SCAN
+                )
+            }
+            for (i in 0 until count) {
+                positions[firstIndex + i] = files.size + i
+            }
+            files.addAll(batch)
+            onPartialResults?.invoke(batch)
+            return isActive
+        }
+    }
+
+    private suspend fun scanFreeClusters(
+        context: Context,
+        onPartialResults: ((List<RecoverableFile>) -> Unit)?
+    ): List<RecoverableFile> = withContext(Dispatchers.IO) {
         val files = mutableListOf<RecoverableFile>()
         
         try {
             val devicePaths = arrayOf("/dev/block/mmcblk0", "/dev/block/sda1")
             
             devicePaths.forEach { devicePath ->
-                val clusters = nativeScanFreeClusters(devicePath)
-                clusters.forEach { cluster ->
-                    files.add(
-                        RecoverableFile(
-                            name = "cluster_recovery_${cluster.hashCode()}",
-                            path = cluster,
-                            size = 0L,
-                            type = FileType.UNKNOWN,
-                            lastModified = System.currentTimeMillis(),
-                            isRecoverable = true,
-                            recoveryLocation = cluster,
-                            recoveryConfidence = 0.6f,
-                            recoveryCategory = RecoveryCategory.DEEP_SCAN
-                        )
-                    )
-                }
+                nativeScanFreeClustersStreaming(devicePath, object : NativeHitListener {
+                    override fun onHits(records: ByteArray, firstIndex: Int, count: Int): Boolean {
+                        val batch = NativeHit.decode(records, firstIndex, count).map { hit ->
+                            val cluster = "$devicePath@${hit.offset}+${hit.length}"
+                            RecoverableFile(
+                                name = "cluster_recovery_${cluster.hashCode()}",
+                                path = cluster,
+                                size = hit.length,
+                                type = FileType.UNKNOWN,
+                                lastModified = System.currentTimeMillis(),
+                                isRecoverable = true,
+                                recoveryLocation = cluster,
+                                recoveryConfidence = hit.confidence / 100f,
+                                recoveryCategory = RecoveryCategory.DEEP_SCAN
+                            )
+                        }
+                        files.addAll(batch)
+                        onPartialResults?.invoke(batch)
+                        return isActive
+                    }
+                })
             }
         } catch (e: Exception) {
             Log.e(TAG, "Error scanning free clusters", e)
@@ -311,14 +529,19 @@ class FileRecoveryEngine {
                     }
                 }
                 RecoveryCategory.DEEP_SCAN, RecoveryCategory.ROOT_SCAN -> {
-                    // Use native recovery
-                    val recoveredData = nativeRecoverDeletedFile(file.path)
-                    if (recoveredData != null && recoveredData.isNotEmpty()) {
-                        FileOutputStream(outputFile).use { fos ->
-                            fos.write(recoveredData)
-                        }
+                    // Native side writes straight into the output file
+                    val recovered = ParcelFileDescriptor.open(
+                        outputFile,
+                        ParcelFileDescriptor.MODE_WRITE_ONLY or
+                            ParcelFileDescriptor.MODE_CREATE or
+                            ParcelFileDescriptor.MODE_TRUNCATE
+                    ).use { pfd ->
+                        nativeRecoverToFd(file.path, pfd.fd)
+                    }
+                    if (recovered) {
                         return@withContext true
                     }
+                    outputFile.delete()
                 }
                 RecoveryCategory.CACHE_FILES -> {
                     // Cache file recovery
@@ -336,31 +559,19 @@ class FileRecoveryEngine {
         false
     }
 
-    fun generatePreview(file: RecoverableFile): Bitmap? {
+    // Previews read the file where the scan found it, never the whole of it up
+    // front: the thumbnail or cover art the file embeds if it has one, else a
+    // decode subsampled down to about maxDimension pixels
+    fun generatePreview(file: RecoverableFile, maxDimension: Int = PREVIEW_MAX_DIMENSION): Bitmap? {
         return try {
             when (file.type) {
                 FileType.JPEG, FileType.PNG, FileType.GIF -> {
-                    val sourceFile = File(file.path)
-                    if (sourceFile.exists()) {
-                        BitmapFactory.decodeFile(file.path)
-                    } else {
-                        // Try to recover preview from native scan
-                        val recoveredData = nativeRecoverDeletedFile(file.path)
-                        if (recoveredData != null) {
-                            BitmapFactory.decodeByteArray(recoveredData, 0, recoveredData.size)
-                        } else null
-                    }
+                    nativeExtractPreview(file.path)?.let { decodeSampled(it, maxDimension) }
+                        ?: PreviewSource.open(file.path)?.use { source -> decodeSampled({ source.inputStream() }, maxDimension) }
                 }
                 FileType.MP4, FileType.MP3 -> {
-                    val retriever = MediaMetadataRetriever()
-                    try {
-                        retriever.setDataSource(file.path)
-                        retriever.getFrameAtTime(0)
-                    } catch (e: Exception) {
-                        null
-                    } finally {
-                        retriever.release()
-                    }
+                    nativeExtractPreview(file.path)?.let { decodeSampled(it, maxDimension) }
+                        ?: PreviewSource.open(file.path)?.use { source -> retrieveFrame(source, maxDimension) }
                 }
                 else -> null
             }
@@ -370,6 +581,58 @@ class FileRecoveryEngine {
         }
     }
 
+    // The retriever reads through source only what it needs: the index and the first keyframe
+    private fun retrieveFrame(source: PreviewSource, maxDimension: Int): Bitmap? {
+        val retriever = MediaMetadataRetriever()
+        return try {
+            retriever.setDataSource(source)
+            val frame = if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.O_MR1) {
+                retriever.getScaledFrameAtTime(0, MediaMetadataRetriever.OPTION_CLOSEST_SYNC, maxDimension, maxDimension)
+            } else {
+                retriever.getFrameAtTime(0, MediaMetadataRetriever.OPTION_CLOSEST_SYNC)
+            }
+            frame ?: retriever.embeddedPicture?.let { decodeSampled(it, maxDimension) }
+        } catch (e: Exception) {
+            null
+        } finally {
+            retriever.release()
+        }
+    }
+
+    private fun decodeSampled(data: ByteArray, maxDimension: Int): Bitmap? {
+        return decodeSampled({ data.inputStream() }, maxDimension)
+    }
+
+    // Bounds first, then the decode at the largest power of two that keeps both sides >= maxDimension
+    private fun decodeSampled(open: () -> InputStream, maxDimension: Int): Bitmap? {
+        val bounds = BitmapFactory.Options().apply { inJustDecodeBounds = true }
+        open().use { BitmapFactory.decodeStream(it, null, bounds) }
+        if (bounds.outWidth <= 0 || bounds.outHeight <= 0) return null
+
+        var sampleSize = 1
+        while (bounds.outWidth / (sampleSize * 2) >= maxDimension && bounds.outHeight / (sampleSize * 2) >= maxDimension) {
+            sampleSize *= 2
+        }
+        val options = BitmapFactory.Options().apply { inSampleSize = sampleSize }
+        return open().use { BitmapFactory.decodeStream(it, null, options) }
+    }
+
+    // Native type ids from file_recovery_engine.h
+    private fun nativeTypeToFileType(nativeType: Int): FileType {
+        return when (nativeType) {
+            1 -> FileType.JPEG
+            2 -> FileType.PNG
+            3 -> FileType.GIF
+            4 -> FileType.PDF
+            5 -> FileType.ZIP
+            6 -> FileType.MP3
+            7 -> FileType.MP4
+            8 -> FileType.DOC
+            9 -> FileType.XLS
+            else -> FileType.UNKNOWN
+        }
+    }
+
     private fun getFileTypeFromMime(mimeType: String): FileType {
         return when {
             mimeType.startsWith("image/jpeg") -> FileType.JPEG
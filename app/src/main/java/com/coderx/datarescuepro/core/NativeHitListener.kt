@@ -0,0 +1,72 @@
+package com.coderx.datarescuepro.core
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+// Called from native code on the scanning thread while a scan runs. `records`
+// holds `count` packed CarveHit structs (hit_arena.h) for the hits numbered
+// firstIndex until firstIndex + count. The array is reused between calls, so
+// decode it before returning. Return false to stop the scan.
+interface NativeHitListener {
+    fun onHits(records: ByteArray, firstIndex: Int, count: Int): Boolean
+
+    // Extents of a FLAG_FRAGMENTED hit as offset/length pairs in file order,
+    // delivered just before the onHits call that contains the hit
+    fun onFragments(index: Int, extents: LongArray) {}
+
+    // Path of a FLAG_DIRECTORY_ENTRY hit, which has no extent to recover from,
+    // delivered just before the onHits call that contains the hit
+    fun onLocation(index: Int, location: String) {}
+
+    // Another place the content of hit `index` was found, as a recovery location.
+    // Such copies never get a hit of their own; this arrives after the onHits
+    // call that delivered the hit, possibly several batches later.
+    fun onDuplicate(index: Int, location: String) {}
+}
+
+// Kotlin view of one native CarveHit record
+data class NativeHit(
+    val index: Int,
+    val offset: Long,
+    val length: Long,
+    val source: Int,
+    val fileType: Int,
+    val confidence: Int,
+    val flags: Int
+) {
+    val isComplete: Boolean get() = (flags and FLAG_COMPLETE) != 0
+    val isFragmented: Boolean get() = (flags and FLAG_FRAGMENTED) != 0
+    val isJournaled: Boolean get() = (flags and FLAG_JOURNAL) != 0
+    val isFromFatEntry: Boolean get() = (flags and FLAG_FAT_ENTRY) != 0
+    val isFromInode: Boolean get() = (flags and FLAG_INODE) != 0
+
+    companion object {
+        // Must match sizeof(CarveHit) and the field order in hit_arena.h
+        const val RECORD_SIZE = 24
+
+        const val FLAG_COMPLETE = 0x1
+        const val FLAG_DIRECTORY_ENTRY = 0x2
+        const val FLAG_SYSTEM_AREA = 0x4
+        const val FLAG_FREE_EXTENT = 0x8
+        const val FLAG_FRAGMENTED = 0x10
+        const val FLAG_JOURNAL = 0x20
+        const val FLAG_FAT_ENTRY = 0x40
+        const val FLAG_INODE = 0x80
+
+        fun decode(records: ByteArray, firstIndex: Int, count: Int): List<NativeHit> {
+            val buffer = ByteBuffer.wrap(records).order(ByteOrder.nativeOrder())
+            return List(count) { i ->
+                val base = i * RECORD_SIZE
+                NativeHit(
+                    index = firstIndex + i,
+                    offset = buffer.getLong(base),
+                    length = buffer.getLong(base + 8),
+                    source = buffer.getInt(base + 16),
+                    fileType = buffer.getShort(base + 20).toInt() and 0xFFFF,
+                    confidence = buffer.get(base + 22).toInt() and 0xFF,
+                    flags = buffer.get(base + 23).toInt() and 0xFF
+                )
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+package com.coderx.datarescuepro.core
+
+import android.media.MediaDataSource
+import java.io.IOException
+import java.io.InputStream
+
+// A recovered file read in place, where the scan found it (preview_extractor.h),
+// so decoders fetch only the bytes they need instead of the whole file.
+// Location is a file path or an extent location as scan results carry them.
+class PreviewSource private constructor(private var handle: Long) : MediaDataSource() {
+
+    @Synchronized
+    override fun readAt(position: Long, buffer: ByteArray, offset: Int, size: Int): Int {
+        if (handle == 0L) throw IOException("PreviewSource is closed")
+        return nativeReadAt(handle, position, buffer, offset, size)
+    }
+
+    @Synchronized
+    override fun getSize(): Long = if (handle != 0L) nativeSize(handle) else -1L
+
+    // Sequential view for BitmapFactory; each call starts again at the first byte
+    fun inputStream(): InputStream = object : InputStream() {
+        private var position = 0L
+
+        override fun read(): Int {
+            val single = ByteArray(1)
+            return if (read(single, 0, 1) == 1) single[0].toInt() and 0xFF else -1
+        }
+
+        override fun read(buffer: ByteArray, offset: Int, length: Int): Int {
+            if (length == 0) return 0
+            val n = readAt(position, buffer, offset, length)
+            if (n <= 0) return -1
+            position += n
+            return n
+        }
+
+        override fun skip(n: Long): Long {
+            val skipped = n.coerceIn(0L, (size - position).coerceAtLeast(0L))
+            position += skipped
+            return skipped
+        }
+    }
+
+    @Synchronized
+    override fun close() {
+        if (handle != 0L) {
+            nativeClose(handle)
+            handle = 0L
+        }
+    }
+
+    companion object {
+        init {
+            System.loadLibrary("datarescuepro")
+        }
+
+        // Null if the location cannot be opened
+        fun open(location: String): PreviewSource? {
+            val handle = nativeOpen(location)
+            return if (handle != 0L) PreviewSource(handle) else null
+        }
+
+        @JvmStatic private external fun nativeOpen(location: String): Long
+        @JvmStatic private external fun nativeSize(handle: Long): Long
+        @JvmStatic private external fun nativeReadAt(handle: Long, position: Long, buffer: ByteArray, offset: Int, size: Int): Int
+        @JvmStatic private external fun nativeClose(handle: Long)
+    }
+}
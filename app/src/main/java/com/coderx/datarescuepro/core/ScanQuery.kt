@@ -0,0 +1,46 @@
+package com.coderx.datarescuepro.core
+
+import com.coderx.datarescuepro.data.model.FileType
+
+// Narrows a native deep scan to what the user is after, such as "photos in this
+// region" or "the first 200 JPEGs" (ScanQuery in file_recovery_engine.h). Empty
+// or zero fields leave that dimension open; the scan ends early once maxResults
+// files are found or timeBudgetMillis has passed.
+data class ScanQuery(
+    val fileTypes: Set<FileType> = emptySet(),
+    val byteRanges: List<LongRange> = emptyList(), // Device or image offsets to carve
+    val directories: List<String> = emptyList(),   // Checked for deleted entries instead of the scan path
+    val minSize: Long = 0L,
+    val maxSize: Long = 0L,
+    val maxResults: Int = 0,
+    val timeBudgetMillis: Long = 0L
+) {
+    // Native type ids; a broad category asks for every native type in it
+    internal fun nativeTypes(): IntArray? =
+        if (fileTypes.isEmpty()) null else fileTypes.flatMap(::nativeTypesOf).distinct().toIntArray()
+
+    // (offset, length) pairs in the layout nativeQueryScanStreaming takes
+    internal fun nativeRanges(): LongArray? =
+        if (byteRanges.isEmpty()) null
+        else byteRanges.filter { !it.isEmpty() }.flatMap { listOf(it.first, it.last - it.first + 1) }.toLongArray()
+
+    private fun nativeTypesOf(type: FileType): List<Int> = when (type) {
+        FileType.JPEG -> listOf(1)
+        FileType.PNG -> listOf(2)
+        FileType.GIF -> listOf(3)
+        FileType.PDF -> listOf(4)
+        FileType.ZIP -> listOf(5)
+        FileType.MP3 -> listOf(6)
+        FileType.MP4 -> listOf(7)
+        // Native 8 and 9 are Word and Excel archives; ZIP keeps those it could not tell apart
+        FileType.DOC -> listOf(8)
+        FileType.XLS -> listOf(9)
+        FileType.DOCX -> listOf(5, 8)
+        FileType.XLSX -> listOf(5, 9)
+        FileType.IMAGE -> listOf(1, 2, 3)
+        FileType.VIDEO -> listOf(7)
+        FileType.AUDIO -> listOf(6)
+        FileType.DOCUMENT -> listOf(4, 8, 9)
+        FileType.UNKNOWN -> listOf(0)
+    }
+}
@@ -0,0 +1,73 @@
+package com.coderx.datarescuepro.core
+
+import java.io.Closeable
+
+// Native signature carve of one device or image (scan_session.h). run() blocks
+// the calling thread; pause, resume, cancel and progress may be called from any
+// other. With a checkpoint path, a cancelled or killed session leaves a
+// checkpoint behind and the next session for the same source resumes from it.
+class ScanSession(val sourcePath: String, checkpointPath: String?) : Closeable {
+    // Values must match SessionState in scan_session.h
+    enum class State { IDLE, RUNNING, PAUSED, CANCELLED, FINISHED, FAILED }
+
+    data class Progress(
+        val state: State,
+        val scannedTo: Long,  // Every header below this offset has been reported
+        val bytesDone: Long,  // Of this run only; a resumed run skips what came before
+        val bytesTotal: Long,
+        val hits: Long
+    ) {
+        val fraction: Float get() = if (bytesTotal > 0) bytesDone.toFloat() / bytesTotal else 0f
+    }
+
+    private var handle: Long = nativeCreate(sourcePath, checkpointPath)
+
+    // True once the whole source was carved; hits found before a resume are replayed first
+    fun run(listener: NativeHitListener): Boolean = nativeRun(checkedHandle(), listener)
+
+    fun pause() = nativePause(checkedHandle())
+
+    fun resume() = nativeResume(checkedHandle())
+
+    fun cancel() = nativeCancel(checkedHandle())
+
+    fun progress(): Progress {
+        val values = nativeProgress(checkedHandle())
+        return Progress(
+            state = State.values().getOrElse(values[0].toInt()) { State.FAILED },
+            scannedTo = values[1],
+            bytesDone = values[2],
+            bytesTotal = values[3],
+            hits = values[4]
+        )
+    }
+
+    // Only once run has returned
+    @Synchronized
+    override fun close() {
+        if (handle != 0L) {
+            nativeDestroy(handle)
+            handle = 0L
+        }
+    }
+
+    @Synchronized
+    private fun checkedHandle(): Long {
+        check(handle != 0L) { "ScanSession is closed" }
+        return handle
+    }
+
+    private external fun nativeCreate(sourcePath: String, checkpointPath: String?): Long
+    private external fun nativeRun(handle: Long, listener: NativeHitListener): Boolean
+    private external fun nativePause(handle: Long)
+    private external fun nativeResume(handle: Long)
+    private external fun nativeCancel(handle: Long)
+    private external fun nativeProgress(handle: Long): LongArray
+    private external fun nativeDestroy(handle: Long)
+
+    companion object {
+        init {
+            System.loadLibrary("datarescuepro")
+        }
+    }
+}
@@ -0,0 +1,66 @@
+package com.coderx.datarescuepro.core
+
+// Snapshot of the native scan counters (scan_stats.h). Times are in nanoseconds;
+// ioWait and match are summed over all scan threads, so they can exceed wall time.
+data class ScanStats(
+    val bytesRead: Long,
+    val readCalls: Long,
+    val ioWaitNanos: Long,
+    val matchNanos: Long,
+    val validateNanos: Long,
+    val hits: Long,
+    val rejects: Long,
+    val truncated: Long,
+    val fragmented: Long,
+    val duplicates: Long,
+    val hashNanos: Long,
+    val blankBytes: Long,
+    val peakBytes: Long,        // Most native buffer memory held at once since the last reset
+    val budgetStallNanos: Long, // Threads waiting for the memory budget
+    val hitsByType: LongArray // Indexed by native file type id
+) {
+    override fun equals(other: Any?): Boolean =
+        other is ScanStats && toArray().contentEquals(other.toArray())
+
+    override fun hashCode(): Int = toArray().contentHashCode()
+
+    override fun toString(): String =
+        "ScanStats(read=${bytesRead / (1024 * 1024)}MB in $readCalls calls, " +
+            "ioWait=${ioWaitNanos / 1_000_000}ms, match=${matchNanos / 1_000_000}ms, " +
+            "validate=${validateNanos / 1_000_000}ms, hits=$hits, rejects=$rejects, truncated=$truncated, " +
+            "fragmented=$fragmented, duplicates=$duplicates, hash=${hashNanos / 1_000_000}ms, " +
+            "blank=${blankBytes / (1024 * 1024)}MB, peak=${peakBytes / (1024 * 1024)}MB, " +
+            "budgetStall=${budgetStallNanos / 1_000_000}ms)"
+
+    private fun toArray(): LongArray =
+        longArrayOf(
+            bytesRead, readCalls, ioWaitNanos, matchNanos, validateNanos, hits, rejects, truncated, fragmented,
+            duplicates, hashNanos, blankBytes, peakBytes, budgetStallNanos
+        ) + hitsByType
+
+    companion object {
+        // Index of the first per-type counter; must match kStatHitsByType
+        private const val HITS_BY_TYPE = 14
+
+        fun fromArray(values: LongArray): ScanStats {
+            fun at(i: Int) = values.getOrElse(i) { 0L }
+            return ScanStats(
+                bytesRead = at(0),
+                readCalls = at(1),
+                ioWaitNanos = at(2),
+                matchNanos = at(3),
+                validateNanos = at(4),
+                hits = at(5),
+                rejects = at(6),
+                truncated = at(7),
+                fragmented = at(8),
+                duplicates = at(9),
+                hashNanos = at(10),
+                blankBytes = at(11),
+                peakBytes = at(12),
+                budgetStallNanos = at(13),
+                hitsByType = if (values.size > HITS_BY_TYPE) values.copyOfRange(HITS_BY_TYPE, values.size) else LongArray(0)
+            )
+        }
+    }
+}
@@ -22,8 +22,12 @@ data class RecoverableFile(
     val isRecoverable: Boolean = true,
     val recoveryLocation: String,
     val recoveryConfidence: Float,
-    val recoveryCategory: RecoveryCategory
+    val recoveryCategory: RecoveryCategory,
+    // Other locations holding the same content, found by the native scan
+    val duplicateLocations: List<String> = emptyList()
 ) {
+    val copies: Int get() = 1 + duplicateLocations.size
+
     val formattedSize: String
         get() {
             val bytes = size
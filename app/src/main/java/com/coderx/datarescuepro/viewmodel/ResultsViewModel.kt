@@ -2,6 +2,7 @@ package com.coderx.datarescuepro.viewmodel
 
 import android.content.Context
 import android.os.Environment
+import android.os.SystemClock
 import android.widget.Toast
 import androidx.lifecycle.ViewModel
 import androidx.lifecycle.viewModelScope
@@ -20,6 +21,13 @@ class ResultsViewModel : ViewModel() {
     private val _recoveredFiles = MutableStateFlow<List<RecoverableFile>>(emptyList())
     val recoveredFiles: StateFlow<List<RecoverableFile>> = _recoveredFiles
 
+    // Hits streamed in by the running scan. Batches are appended in place and
+    // a copy is published at most every PUBLISH_INTERVAL_MS, so a scan with
+    // many batches does not copy the whole list for each one.
+    private val streamedFiles = ArrayList<RecoverableFile>()
+    private var streaming = false
+    private var lastPublishMs = 0L
+
     private val _selectedFilter = MutableStateFlow("all")
     val selectedFilter: StateFlow<String> = _selectedFilter
 
@@ -46,16 +54,46 @@ class ResultsViewModel : ViewModel() {
             _isLoading.value = true
             try {
                 val isRooted = fileRecoveryEngine.detectRootAccess()
-                val files = fileRecoveryEngine.performFullScan(context, isRooted)
-                _recoveredFiles.value = files
+                // Show native hits as they stream in, then replace with the merged, sorted list
+                synchronized(streamedFiles) {
+                    streamedFiles.clear()
+                    streaming = true
+                    lastPublishMs = 0L
+                }
+                val files = fileRecoveryEngine.performFullScan(context, isRooted, ::addStreamedFiles)
+                synchronized(streamedFiles) {
+                    streaming = false
+                    _recoveredFiles.value = files
+                }
             } catch (e: Exception) {
                 Toast.makeText(context, "Error loading files: ${e.message}", Toast.LENGTH_SHORT).show()
             } finally {
+                // A failed scan keeps what it streamed
+                synchronized(streamedFiles) {
+                    if (streaming) {
+                        streaming = false
+                        _recoveredFiles.value = ArrayList(streamedFiles)
+                    }
+                    streamedFiles.clear()
+                }
                 _isLoading.value = false
             }
         }
     }
 
+    // Called from the scan's worker threads
+    private fun addStreamedFiles(batch: List<RecoverableFile>) {
+        synchronized(streamedFiles) {
+            if (!streaming) return
+            streamedFiles.addAll(batch)
+            val now = SystemClock.elapsedRealtime()
+            if (now - lastPublishMs >= PUBLISH_INTERVAL_MS) {
+                lastPublishMs = now
+                _recoveredFiles.value = ArrayList(streamedFiles)
+            }
+        }
+    }
+
     fun setFilter(filter: String) {
         _selectedFilter.value = filter
     }
@@ -80,4 +118,8 @@ class ResultsViewModel : ViewModel() {
             }
         }
     }
+
+    companion object {
+        private const val PUBLISH_INTERVAL_MS = 250L
+    }
 }